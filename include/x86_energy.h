@@ -48,8 +48,15 @@ enum x86_energy_counter
     X86_ENERGY_COUNTER_GPU = 3,      /**< gpu of one package / X86_ENERGY_GRANULARITY_SOCKET */
     X86_ENERGY_COUNTER_PLATFORM = 4, /**< whole platform  / X86_ENERGY_GRANULARITY_SYSTEM */
     X86_ENERGY_COUNTER_SINGLE_CORE = 5, /**< a single core / X86_ENERGY_GRANULARITY_CORE */
+    /** time in s the package was throttled by its RAPL power limits /
+        X86_ENERGY_GRANULARITY_SOCKET */
+    X86_ENERGY_COUNTER_PCKG_THROTTLE = 6,
+    /** time in s the cores of a package were throttled / X86_ENERGY_GRANULARITY_SOCKET */
+    X86_ENERGY_COUNTER_CORES_THROTTLE = 7,
+    /** time in s the dram of a package was throttled / X86_ENERGY_GRANULARITY_SOCKET */
+    X86_ENERGY_COUNTER_DRAM_THROTTLE = 8,
 
-    /* Non ABI */
+    /* Non ABI, x86_energy_mechanisms_t grows with it, so new counters change the SOVERSION */
     X86_ENERGY_COUNTER_SIZE
 };
 
@@ -70,6 +77,8 @@ struct x86_energy_architecture_node
 
 /**
  * Create a tree representation of the current hardware
+ * All nodes are stored in a single array in breadth-first order, starting with the root, so the
+ * children of each node are contiguous.
  * @return the hardware tree, NULL if error occured
  */
 x86_energy_architecture_node_t* x86_energy_init_architecture_nodes(void);
@@ -135,11 +144,34 @@ typedef struct x86_energy_mechanism_struct
  */
 x86_energy_mechanisms_t* x86_energy_get_avail_mechanism(void);
 
+/**
+ * Frees a mechanism that was returned by x86_energy_get_avail_mechanism
+ */
+void x86_energy_free_mechanism(x86_energy_mechanisms_t* mechanism);
+
+/**
+ * Returns a short name for a counter (e.g., "PCKG"), NULL for invalid counters
+ */
+const char* x86_energy_counter_name(enum x86_energy_counter counter);
+
+/**
+ * Returns 1 if a counter measures energy in J, 0 if it measures something else (e.g., the
+ * throttling time in s of X86_ENERGY_COUNTER_PCKG_THROTTLE) or is invalid
+ */
+int x86_energy_counter_is_energy(enum x86_energy_counter counter);
+
+/**
+ * Returns a short name for a granularity (e.g., "SOCKET"), NULL for invalid granularities
+ */
+const char* x86_energy_granularity_name(enum x86_energy_granularity granularity);
+
 char * x86_energy_error_string( void );
 
 /**
  * Hardware energy measurement might have in overflows.
- * Internal threads will take care of this. If you know what you do, you can override their update
+ * Internal threads will take care of this. They only read a counter if it has not been read for
+ * the update rate, so counters that are read frequently by the application cause no wakeups.
+ * If you know what you do, you can override their update
  * rate with this function. You can also disable threads by setting it to 0.
  * This will not influence existing threads, so you should call this before calling any
  * x86_energy_access_source_t.setup(...) and not afterwards!
@@ -147,6 +179,83 @@ char * x86_energy_error_string( void );
  */
 void x86_energy_set_internal_update_thread_rate(long long int time_in_us);
 
+/**
+ * Scheduling policies for internal threads
+ */
+enum x86_energy_thread_policy
+{
+    /** keep the policy and nice value of the thread that creates them (default) */
+    X86_ENERGY_THREAD_POLICY_INHERIT,
+    /** SCHED_IDLE, only runs if nothing else wants the CPU, overflows might be missed */
+    X86_ENERGY_THREAD_POLICY_IDLE,
+    /** SCHED_OTHER with the given nice value (-20..19) */
+    X86_ENERGY_THREAD_POLICY_OTHER,
+    /** SCHED_FIFO with the given real-time priority, requires CAP_SYS_NICE */
+    X86_ENERGY_THREAD_POLICY_FIFO
+};
+
+/**
+ * Sets the CPUs that internal threads (overflow, sampling and trace writer threads) run on.
+ * The default are the housekeeping CPUs, i.e., online CPUs that are not listed in
+ * /sys/devices/system/cpu/isolated or nohz_full, or the CPUs in X86_ENERGY_THREAD_CPUS.
+ * Like x86_energy_set_internal_update_thread_rate, this only influences threads created afterwards.
+ * @param cpu_list a list like "0-3,8", NULL restores the housekeeping CPUs
+ * @return 0 on success, 1 if the list is invalid
+ */
+int x86_energy_set_internal_thread_cpus(const char* cpu_list);
+
+/**
+ * Sets the scheduling policy of internal threads that are created afterwards. The default is
+ * taken from X86_ENERGY_THREAD_POLICY ("idle", "other[:nice]" or "fifo[:priority]").
+ * Failing to apply the policy (e.g. missing permissions for SCHED_FIFO) is ignored.
+ * @param priority the nice value for X86_ENERGY_THREAD_POLICY_OTHER, the real-time priority for
+ * X86_ENERGY_THREAD_POLICY_FIFO, ignored otherwise
+ * @return 0 on success, 1 if the priority is invalid for the policy
+ */
+int x86_energy_set_internal_thread_policy(enum x86_energy_thread_policy policy, int priority);
+
+/**
+ * Anomalies seen while extending a wrapping energy counter of a source, see x86_energy_glitch_stats
+ */
+typedef struct
+{
+    uint64_t wraps;       /**< counter wraps */
+    uint64_t false_wraps; /**< readings below the last one that were rejected, since a wrap would
+                               imply a power above the bound */
+    uint64_t spikes;      /**< readings above the last one that were rejected, since they imply a
+                               power above the bound */
+    uint64_t resyncs;     /**< rejected readings that were confirmed by the next one, the counter
+                               is followed and the energy of the jump is estimated */
+} x86_energy_glitch_stats_t;
+
+/**
+ * The constraints of a RAPL domain, see x86_energy_get_power_limit
+ */
+enum x86_energy_power_limit_constraint
+{
+    X86_ENERGY_POWER_LIMIT_LONG_TERM,  /**< PL1, all domains */
+    X86_ENERGY_POWER_LIMIT_SHORT_TERM, /**< PL2, only package and platform */
+    /** Non-ABI, always compare to >= X86_ENERGY_POWER_LIMIT_SIZE */
+    X86_ENERGY_POWER_LIMIT_SIZE
+};
+
+/**
+ * A power limit of a domain
+ */
+typedef struct
+{
+    double power;       /**< the limit in W */
+    double time_window; /**< the averaging window in s, <= 0.0 keeps the current one when set */
+    int enabled;        /**< != 0 if the limit is enforced */
+    int locked;         /**< != 0 if the limit cannot be changed until reset, ignored when set */
+} x86_energy_power_limit_t;
+
+/**
+ * Flag for x86_energy_set_power_limit: only validate the limit and round it to the units of the
+ * hardware, do not write it
+ */
+#define X86_ENERGY_POWER_LIMIT_DRY_RUN 1
+
 /**
  * Will be used by access sources
  */
@@ -166,6 +275,337 @@ typedef struct x86_energy_access_source
                                                       will return < 0.0 on error */
     void (*close)(x86_energy_single_counter_t t);  /**< Close a single counter */
     void (*fini)(void);                            /**< Finalize a source */
+    int (*read_batch)(size_t nr, x86_energy_single_counter_t* counters,
+                      double* values); /**< Optional (might be NULL), read nr counters of this
+                                          source at once, see x86_energy_read_batch */
+    double (*error_bound)(x86_energy_single_counter_t t); /**< Optional (might be NULL), see
+                                                             x86_energy_error_bound */
+    void (*glitch_stats)(x86_energy_single_counter_t t,
+                         x86_energy_glitch_stats_t* stats); /**< Optional (might be NULL), see
+                                                               x86_energy_glitch_stats */
+    int (*get_power_limit)(enum x86_energy_counter counter, size_t index,
+                           enum x86_energy_power_limit_constraint constraint,
+                           x86_energy_power_limit_t* limit); /**< Optional (might be NULL), see
+                                                                x86_energy_get_power_limit */
+    int (*set_power_limit)(enum x86_energy_counter counter, size_t index,
+                           enum x86_energy_power_limit_constraint constraint,
+                           x86_energy_power_limit_t* limit,
+                           int flags); /**< Optional (might be NULL), see
+                                          x86_energy_set_power_limit */
 } x86_energy_access_source_t;
 
+/**
+ * Read several counters of one source at once. Uses the read_batch function of the source if
+ * there is one, otherwise read is called for each counter.
+ *
+ * @param source the source all counters have been set up with
+ * @param nr number of counters
+ * @param counters the counters, as returned by source->setup
+ * @param values will hold nr values in Joules, a value < 0.0 marks a counter that could not be read
+ * @return the number of counters that could not be read
+ */
+int x86_energy_read_batch(x86_energy_access_source_t* source, size_t nr,
+                          x86_energy_single_counter_t* counters, double* values);
+
+/**
+ * Sources that do not read energy counters but integrate power readings (e.g. sysfs-Fam15h)
+ * provide a bound of the absolute error of the energy they return.
+ *
+ * @param source the source the counter has been set up with
+ * @param counter the counter, as returned by source->setup
+ * @return the bound of the absolute error in Joules accumulated since setup, 0.0 for sources that
+ * read energy counters
+ */
+double x86_energy_error_bound(x86_energy_access_source_t* source,
+                              x86_energy_single_counter_t counter);
+
+/**
+ * Sets a bound for the power of a domain, which validates the readings of counters that are set up
+ * afterwards. Sources that extend wrapping counters (msr, sysfs, likwid, x86_adapt) reject
+ * readings that imply a higher power since the last one, e.g. a transient low reading that would
+ * be taken for a wrap, and count them in x86_energy_glitch_stats. The default is taken from
+ * X86_ENERGY_MAX_POWER (e.g. "400" for all domains or "PCKG=400,DRAM=100,SINGLE_CORE=30").
+ *
+ * @param counter_type the domain
+ * @param watts the maximal power, 0.0 disables validation (default)
+ * @return 0 on success
+ */
+int x86_energy_set_max_power(enum x86_energy_counter counter_type, double watts);
+
+/**
+ * Gets the anomalies seen by a counter since setup. Sources that do not extend wrapping counters
+ * report zeros.
+ *
+ * @param source the source the counter has been set up with
+ * @param counter the counter, as returned by source->setup
+ * @param stats will hold the statistics
+ */
+void x86_energy_glitch_stats(x86_energy_access_source_t* source,
+                             x86_energy_single_counter_t counter, x86_energy_glitch_stats_t* stats);
+
+/**
+ * Reads a power limit of a domain. The source has to be initialized, but no counter of the domain
+ * has to be set up. Supported by msr-rapl (MSR_*_POWER_LIMIT) and sysfs (powercap constraints).
+ *
+ * @param source the source, e.g. from x86_energy_session_init_source
+ * @param counter the domain
+ * @param index the index of the domain, as used for setup
+ * @param constraint the long or short term limit
+ * @param limit will hold the limit
+ * @return 0 on success, != 0 if the source or domain does not support power limits
+ */
+int x86_energy_get_power_limit(x86_energy_access_source_t* source, enum x86_energy_counter counter,
+                               size_t index, enum x86_energy_power_limit_constraint constraint,
+                               x86_energy_power_limit_t* limit);
+
+/**
+ * Sets a power limit of a domain. The current settings are read, modified and written under a
+ * lock, so concurrent calls in this process do not overwrite each other. Power and time window are
+ * rounded to the units of the hardware (MSR_RAPL_POWER_UNIT for msr-rapl, by the kernel for
+ * sysfs). sysfs can only enable or disable a whole zone, so it refuses an enabled flag that
+ * differs from the zone's.
+ *
+ * @param limit the new limit, will hold the limit as rounded by the hardware units (for sysfs, a
+ * dry run returns the limit unrounded)
+ * @param flags 0 or X86_ENERGY_POWER_LIMIT_DRY_RUN
+ * @return 0 on success, != 0 if the limit is invalid, locked or could not be written
+ */
+int x86_energy_set_power_limit(x86_energy_access_source_t* source, enum x86_energy_counter counter,
+                               size_t index, enum x86_energy_power_limit_constraint constraint,
+                               x86_energy_power_limit_t* limit, int flags);
+
+/**
+ * A session owns a topology, a mechanism, the sources it initialized, their counters and a
+ * sampling thread. Several sessions can coexist in one process (e.g., a monitoring library and the
+ * application). Sources and their overflow threads are shared between sessions, a source is
+ * initialized by the first session that uses it and finalized when the last one is destroyed.
+ * All session functions are thread-safe.
+ */
+typedef struct x86_energy_session x86_energy_session_t;
+
+/**
+ * Called by the sampling thread of a session
+ * @param time_ns time of the sample (CLOCK_MONOTONIC) in ns
+ * @param nr number of values
+ * @param values the values of all counters in the order they were added, < 0.0 on error
+ * @param arg the argument passed to x86_energy_session_start_sampling
+ */
+typedef void (*x86_energy_sample_callback_t)(uint64_t time_ns, size_t nr, const double* values,
+                                             void* arg);
+
+/**
+ * Creates a new session, detecting the architecture and the mechanism
+ * @return the session, NULL on error
+ */
+x86_energy_session_t* x86_energy_session_create(void);
+
+/**
+ * Stops sampling, closes all counters, finalizes sources no other session uses and frees the
+ * session
+ */
+void x86_energy_session_destroy(x86_energy_session_t* session);
+
+/**
+ * The architecture of the session, it is freed with the session. CPUs that came online since the
+ * last call are added to a new tree, earlier trees stay valid until the session is destroyed.
+ */
+x86_energy_architecture_node_t* x86_energy_session_get_architecture(x86_energy_session_t* session);
+
+/**
+ * The mechanism of the session, it is freed with the session
+ */
+x86_energy_mechanisms_t* x86_energy_session_get_mechanism(x86_energy_session_t* session);
+
+/**
+ * Like x86_energy_set_internal_update_thread_rate, but only for counters that are added to this
+ * session afterwards. Overflow threads keep a deadline per counter, so counters of sessions with
+ * different rates can share a thread.
+ * @param time_in_us the update rate in us, if 0, no overflow threads are used for this session
+ */
+void x86_energy_session_set_update_rate(x86_energy_session_t* session, long long int time_in_us);
+
+/**
+ * Initializes a source of the mechanism of the session
+ * @param name the name of the source, NULL for the first available source that can be initialized
+ * @return the source (valid until the session is destroyed), NULL on error
+ */
+x86_energy_access_source_t* x86_energy_session_init_source(x86_energy_session_t* session,
+                                                          const char* name);
+
+/**
+ * Adds a counter of a source initialized with x86_energy_session_init_source.
+ * Counters cannot be added while the session is sampling.
+ * @return the index of the counter in the values that are read, < 0 on error
+ */
+int x86_energy_session_add_counter(x86_energy_session_t* session,
+                                   x86_energy_access_source_t* source,
+                                   enum x86_energy_counter counter, size_t index);
+
+/**
+ * The number of counters that have been added to the session
+ */
+size_t x86_energy_session_nr_counters(x86_energy_session_t* session);
+
+/**
+ * Reads all counters of the session, counters of the same source are read with
+ * x86_energy_read_batch
+ * @param values will hold x86_energy_session_nr_counters values, < 0.0 on error
+ * @return the number of counters that could not be read
+ */
+int x86_energy_session_read(x86_energy_session_t* session, double* values);
+
+/**
+ * Starts a thread that reads all counters of the session periodically, evaluates the triggers of
+ * the session and passes the values to callback
+ * @param callback might be NULL if only triggers are used
+ * @return 0 on success
+ */
+int x86_energy_session_start_sampling(x86_energy_session_t* session, long long int period_us,
+                                      x86_energy_sample_callback_t callback, void* arg);
+
+/**
+ * Stops the sampling thread of the session, the callback will not be called afterwards. It can be
+ * called from a sample or trigger callback; the thread then exits once the callback returns, so
+ * the session must not be destroyed from the callback.
+ * @return 0 on success, != 0 if the session was not sampling
+ */
+int x86_energy_session_stop_sampling(x86_energy_session_t* session);
+
+/**
+ * Sets a power limit of the domain of a counter through the source of the counter, see
+ * x86_energy_set_power_limit. The counter is read when the limit is written, so the effect of the
+ * change can be measured with x86_energy_session_power_since_limit, also while sampling.
+ * @param counter the index of the counter, as returned by x86_energy_session_add_counter
+ * @return 0 on success
+ */
+int x86_energy_session_set_power_limit(x86_energy_session_t* session, size_t counter,
+                                       enum x86_energy_power_limit_constraint constraint,
+                                       x86_energy_power_limit_t* limit, int flags);
+
+/**
+ * Gets the average power of a counter since its last limit change with
+ * x86_energy_session_set_power_limit
+ * @param power will hold the power in W
+ * @return 0 on success, != 0 if the limit has not been changed or the counter could not be read
+ */
+int x86_energy_session_power_since_limit(x86_energy_session_t* session, size_t counter,
+                                         double* power);
+
+/**
+ * Conditions that are evaluated by the sampling thread of a session after each sample, see
+ * x86_energy_session_add_trigger
+ */
+enum x86_energy_trigger_type
+{
+    X86_ENERGY_TRIGGER_POWER_ABOVE,   /**< the power over the window rises above threshold (W) */
+    X86_ENERGY_TRIGGER_POWER_BELOW,   /**< the power over the window falls below threshold (W) */
+    X86_ENERGY_TRIGGER_ENERGY_BUDGET, /**< the energy since the first sample after adding the
+                                           trigger reaches threshold (J), fires once */
+    X86_ENERGY_TRIGGER_POWER_SLOPE,   /**< the power over the window changes faster than threshold
+                                           (W/s) compared to the window before */
+    /** Non-ABI, always compare to >= X86_ENERGY_TRIGGER_SIZE */
+    X86_ENERGY_TRIGGER_SIZE
+};
+
+/**
+ * A trigger that fired
+ */
+typedef struct
+{
+    int id;                            /**< as returned by x86_energy_session_add_trigger */
+    enum x86_energy_trigger_type type; /**< the type of the trigger */
+    size_t counter;                    /**< the index of the counter in the session */
+    uint64_t time_ns;                  /**< time of the sample (CLOCK_MONOTONIC) in ns */
+    double value; /**< the power (W), energy (J) or slope (W/s) that fulfilled the condition */
+} x86_energy_trigger_event_t;
+
+/**
+ * Called by the sampling thread of a session when a trigger fires. It must not add or remove
+ * triggers.
+ */
+typedef void (*x86_energy_trigger_callback_t)(const x86_energy_trigger_event_t* event, void* arg);
+
+/**
+ * Adds a trigger that is evaluated incrementally on each sample of the sampling thread, see
+ * x86_energy_session_start_sampling. Triggers are edge-triggered: they fire when their condition
+ * becomes true and fire again only after it was false. Power conditions are evaluated once the
+ * samples span the window (two windows for slopes).
+ * @param type the condition
+ * @param counter the index of the counter, as returned by x86_energy_session_add_counter
+ * @param threshold in W, J or W/s, depending on type
+ * @param window_us the window of power conditions, ignored for X86_ENERGY_TRIGGER_ENERGY_BUDGET
+ * @param callback called from the sampling thread, if NULL, events are queued instead and can be
+ * fetched with x86_energy_session_poll_triggers
+ * @param arg passed to callback
+ * @return the id of the trigger, < 0 on error
+ */
+int x86_energy_session_add_trigger(x86_energy_session_t* session,
+                                   enum x86_energy_trigger_type type, size_t counter,
+                                   double threshold, long long int window_us,
+                                   x86_energy_trigger_callback_t callback, void* arg);
+
+/**
+ * Removes a trigger. Callbacks run with the triggers of the session locked, so if the callback of
+ * the trigger is running, this waits until it returns. The callback is not called afterwards.
+ * @return 0 on success, != 0 if there is no trigger with this id
+ */
+int x86_energy_session_remove_trigger(x86_energy_session_t* session, int id);
+
+/**
+ * An eventfd that becomes readable when events of triggers without callback are queued, e.g. for
+ * poll() or epoll. It is closed with the session.
+ * @return the file descriptor, < 0 on error
+ */
+int x86_energy_session_trigger_fd(x86_energy_session_t* session);
+
+/**
+ * Fetches queued events of triggers without callback and resets the eventfd. The queue is
+ * lock-free for a single consumer, so only one thread may call this function at a time. If the
+ * queue is full, new events are dropped, see x86_energy_session_dropped_trigger_events.
+ * @param events will hold up to max events, oldest first
+ * @return the number of events
+ */
+size_t x86_energy_session_poll_triggers(x86_energy_session_t* session,
+                                        x86_energy_trigger_event_t* events, size_t max);
+
+/**
+ * The number of events of triggers without callback that were dropped since the queue was full
+ */
+size_t x86_energy_session_dropped_trigger_events(x86_energy_session_t* session);
+
+/**
+ * The result of reading one domain through one source, see x86_energy_compare_sources. Offset and
+ * drift are the intercept and slope of a linear fit of the difference between the energy this
+ * source and the reference source (the first one that could be read) report since the start.
+ */
+typedef struct
+{
+    const char* source;       /**< the name of the source */
+    int status;               /**< 0 on success, != 0 if the source could not be initialized, the
+                                   counter not be set up or read */
+    size_t nr_reads;          /**< number of successful reads */
+    double energy;            /**< energy between the first and the last read in Joules */
+    double power;             /**< average power in Watts */
+    double offset;            /**< offset to the reference in Joules */
+    double drift;             /**< drift to the reference in Watts */
+    double mean_read_latency; /**< average duration of a read in seconds */
+    double max_read_latency;  /**< longest read in seconds */
+    double update_period;     /**< average time between changes of the value in seconds, 0.0 if
+                                   it changed less than twice */
+} x86_energy_source_comparison_t;
+
+/**
+ * Opens the same domain through every available source of the mechanism and reads them
+ * interleaved in a tight loop (the order is rotated every round) for duration_us, e.g. to qualify
+ * a new processor or kernel. Uses an own session.
+ * @param counter the domain
+ * @param index the index of the domain, as used by x86_energy_session_add_counter
+ * @param duration_us the duration of the comparison
+ * @param results will hold the results in the order of the sources of the mechanism, free with
+ * free()
+ * @return the number of results, < 0 on error
+ */
+int x86_energy_compare_sources(enum x86_energy_counter counter, size_t index,
+                               long long int duration_us, x86_energy_source_comparison_t** results);
+
 #endif /* INCLUDE_X86_ENERGY_H_ */
@@ -8,14 +8,29 @@
 #ifndef INCLUDE_X86_ENERGY_HPP_
 #define INCLUDE_X86_ENERGY_HPP_
 
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <future>
 #include <iostream>
+#include <iterator>
 #include <memory>
+#include <mutex>
 #include <stdexcept>
 #include <string>
 #include <system_error>
+#include <thread>
+#include <utility>
 #include <vector>
+#include <cstddef>
 #include <cstdint>
 
+#if __cplusplus >= 201703L
+#include <string_view>
+#endif
+
 extern "C"
 {
 #include <x86_energy.h>
@@ -79,6 +94,9 @@ enum class Counter
     GPU = X86_ENERGY_COUNTER_GPU,
     PLATFORM = X86_ENERGY_COUNTER_PLATFORM,
     SINGLE_CORE = X86_ENERGY_COUNTER_SINGLE_CORE,
+    PCKG_THROTTLE = X86_ENERGY_COUNTER_PCKG_THROTTLE,
+    CORES_THROTTLE = X86_ENERGY_COUNTER_CORES_THROTTLE,
+    DRAM_THROTTLE = X86_ENERGY_COUNTER_DRAM_THROTTLE,
     SIZE = X86_ENERGY_COUNTER_SIZE
 };
 
@@ -104,6 +122,15 @@ inline std::ostream& operator<<(std::ostream& s, Counter c)
     case Counter::SINGLE_CORE:
         s << "SINGLE_CORE";
         break;
+    case Counter::PCKG_THROTTLE:
+        s << "PCKG_THROTTLE";
+        break;
+    case Counter::CORES_THROTTLE:
+        s << "CORES_THROTTLE";
+        break;
+    case Counter::DRAM_THROTTLE:
+        s << "DRAM_THROTTLE";
+        break;
     default:
         s << "INVALID";
         break;
@@ -112,27 +139,166 @@ inline std::ostream& operator<<(std::ostream& s, Counter c)
     return s;
 }
 
+#if __cplusplus >= 201703L
+using NameView = std::string_view;
+#else
+using NameView = const char*;
+#endif
+
 class Architecture;
 
+/**
+ * A non-owning view of a node of an Architecture. It is only valid as long as the Architecture
+ * exists and can be copied cheaply.
+ */
 class ArchitectureNode
 {
-private:
-    ArchitectureNode() = default;
-
-    ArchitectureNode(x86_energy_architecture_node_t* node) : node_(node)
+public:
+    /**
+     * Iterates over the children of a node, which are stored contiguously
+     */
+    class ChildIterator
     {
-        initialize_children();
-    }
+    public:
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type = ArchitectureNode;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = ArchitectureNode;
+
+        ChildIterator(x86_energy_architecture_node_t* node, x86_energy_architecture_node_t* root,
+                      const std::size_t* parents)
+        : node_(node), root_(root), parents_(parents)
+        {
+        }
+
+        ArchitectureNode operator*() const
+        {
+            return { node_, root_, parents_ };
+        }
+
+        ArchitectureNode operator[](difference_type n) const
+        {
+            return *(*this + n);
+        }
+
+        ChildIterator& operator++()
+        {
+            ++node_;
+            return *this;
+        }
+
+        ChildIterator operator++(int)
+        {
+            auto old = *this;
+            ++node_;
+            return old;
+        }
+
+        ChildIterator& operator--()
+        {
+            --node_;
+            return *this;
+        }
+
+        ChildIterator operator--(int)
+        {
+            auto old = *this;
+            --node_;
+            return old;
+        }
+
+        ChildIterator& operator+=(difference_type n)
+        {
+            node_ += n;
+            return *this;
+        }
+
+        ChildIterator& operator-=(difference_type n)
+        {
+            node_ -= n;
+            return *this;
+        }
 
-    void initialize_children()
+        ChildIterator operator+(difference_type n) const
+        {
+            return { node_ + n, root_, parents_ };
+        }
+
+        ChildIterator operator-(difference_type n) const
+        {
+            return { node_ - n, root_, parents_ };
+        }
+
+        difference_type operator-(const ChildIterator& other) const
+        {
+            return node_ - other.node_;
+        }
+
+        bool operator==(const ChildIterator& other) const
+        {
+            return node_ == other.node_;
+        }
+
+        bool operator!=(const ChildIterator& other) const
+        {
+            return node_ != other.node_;
+        }
+
+        bool operator<(const ChildIterator& other) const
+        {
+            return node_ < other.node_;
+        }
+
+    private:
+        x86_energy_architecture_node_t* node_;
+        x86_energy_architecture_node_t* root_;
+        const std::size_t* parents_;
+    };
+
+    /**
+     * The children of a node, usable in range-based for loops
+     */
+    class Children
     {
-        for (auto i = 0u; i < node_->nr_children; i++)
+    public:
+        Children(x86_energy_architecture_node_t* node, x86_energy_architecture_node_t* root,
+                 const std::size_t* parents)
+        : node_(node), root_(root), parents_(parents)
         {
-            children_.emplace_back(ArchitectureNode(&node_->children[i]));
         }
-    }
 
-public:
+        ChildIterator begin() const
+        {
+            return { node_->children, root_, parents_ };
+        }
+
+        ChildIterator end() const
+        {
+            return { node_->children + size(), root_, parents_ };
+        }
+
+        std::size_t size() const
+        {
+            return node_->nr_children;
+        }
+
+        bool empty() const
+        {
+            return size() == 0;
+        }
+
+        ArchitectureNode operator[](std::size_t i) const
+        {
+            return begin()[i];
+        }
+
+    private:
+        x86_energy_architecture_node_t* node_;
+        x86_energy_architecture_node_t* root_;
+        const std::size_t* parents_;
+    };
+
     Granularity granularity() const
     {
         return static_cast<Granularity>(node_->granularity);
@@ -143,21 +309,65 @@ public:
         return node_->id;
     }
 
-    std::string name() const
+    /**
+     * The name, std::string_view with C++17, a C string before
+     */
+    NameView name() const
     {
         return node_->name;
     }
 
-    const std::vector<ArchitectureNode>& children() const
+    Children children() const
+    {
+        return { node_, root_, parents_ };
+    }
+
+    bool has_parent() const
+    {
+        return node_ != root_;
+    }
+
+    /**
+     * The parent of this node, must not be called for the root node (see has_parent())
+     */
+    ArchitectureNode parent() const
+    {
+        return { root_ + parents_[node_ - root_], root_, parents_ };
+    }
+
+    /**
+     * The underlying node of the C API
+     */
+    x86_energy_architecture_node_t* get() const
     {
-        return children_;
+        return node_;
+    }
+
+    bool operator==(const ArchitectureNode& other) const
+    {
+        return node_ == other.node_;
+    }
+
+    bool operator!=(const ArchitectureNode& other) const
+    {
+        return node_ != other.node_;
     }
 
     friend class Architecture;
 
 private:
-    x86_energy_architecture_node_t* node_;
-    std::vector<ArchitectureNode> children_;
+    ArchitectureNode() = default;
+
+    ArchitectureNode(x86_energy_architecture_node_t* node, x86_energy_architecture_node_t* root,
+                     const std::size_t* parents)
+    : node_(node), root_(root), parents_(parents)
+    {
+    }
+
+    x86_energy_architecture_node_t* node_ = nullptr;
+    x86_energy_architecture_node_t* root_ = nullptr;
+    // index of the parent for each node, indexed by the position of the node in the tree
+    const std::size_t* parents_ = nullptr;
 };
 
 class Architecture : public ArchitectureNode
@@ -173,13 +383,13 @@ class Architecture : public ArchitectureNode
 public:
     Architecture() : root_node_(x86_energy_init_architecture_nodes())
     {
-        node_ = root_node_.get();
+        node_ = root_ = root_node_.get();
         if (node_ == nullptr)
         {
             throw std::runtime_error(x86_energy_error_string());
         }
 
-        initialize_children();
+        initialize_parents();
     }
 
     ArchitectureNode get_arch_for_cpu(Granularity granularity, int cpu) const
@@ -192,7 +402,7 @@ public:
             throw std::runtime_error(x86_energy_error_string());
         }
 
-        return ArchitectureNode(node);
+        return { node, root_, parents_ };
     }
 
     int size(Granularity granularity) const
@@ -207,9 +417,23 @@ public:
     }
 
 private:
+    // the nodes are stored breadth-first in one array, see x86_energy_init_architecture_nodes
+    void initialize_parents()
+    {
+        parent_table_.push_back(0);
+        for (std::size_t i = 0; i < parent_table_.size(); i++)
+        {
+            parent_table_.resize(parent_table_.size() + root_[i].nr_children, i);
+        }
+        parents_ = parent_table_.data();
+    }
+
     std::unique_ptr<x86_energy_architecture_node_t, ArchitectureNodeDeleter> root_node_;
+    std::vector<std::size_t> parent_table_;
 };
 
+class AsyncSampler;
+
 class SourceCounter
 {
 public:
@@ -262,11 +486,19 @@ public:
         return result;
     }
 
+    friend class AsyncSampler;
+
 private:
     x86_energy_access_source_t* source_;
     x86_energy_single_counter_t source_counter_;
 };
 
+template <std::size_t N, typename ReadPolicy>
+class CounterSet;
+
+template <typename ReadPolicy>
+class DynamicCounterSet;
+
 class AccessSource
 {
 public:
@@ -323,26 +555,466 @@ public:
     }
 
     SourceCounter get(Counter counter, std::size_t index)
+    {
+        return { source_, setup(counter, index) };
+    }
+
+    template <std::size_t N, typename ReadPolicy>
+    friend class CounterSet;
+
+    template <typename ReadPolicy>
+    friend class DynamicCounterSet;
+
+private:
+    x86_energy_access_source_t* initialized_source() const
     {
         if (!initialized_)
         {
             throw std::runtime_error("Trying to use an uninitialized access source");
         }
+        return source_;
+    }
 
+    x86_energy_single_counter_t setup(Counter counter, std::size_t index)
+    {
+        return setup(initialized_source(), counter, index);
+    }
+
+    static x86_energy_single_counter_t setup(x86_energy_access_source_t* source, Counter counter,
+                                             std::size_t index)
+    {
         x86_energy_single_counter_t result =
-            source_->setup(static_cast<x86_energy_counter>(counter), index);
+            source->setup(static_cast<x86_energy_counter>(counter), index);
         if (result == nullptr)
         {
             throw std::runtime_error(x86_energy_error_string());
         }
-        return { source_, result };
+        return result;
     }
 
-private:
     x86_energy_access_source_t* source_;
     bool initialized_ = false;
 };
 
+/**
+ * Default read policy of CounterSet and DynamicCounterSet, reads all counters with one call to
+ * x86_energy_read_batch.
+ *
+ * A read policy is a type with a static read function like the one below. It has to return the
+ * number of counters that could not be read and store a value < 0.0 for each of them, e.g. a
+ * policy that calls source->read for each counter instead.
+ */
+struct BatchReadPolicy
+{
+    static std::size_t read(x86_energy_access_source_t* source, std::size_t nr,
+                            x86_energy_single_counter_t* counters, double* values) noexcept
+    {
+        return static_cast<std::size_t>(x86_energy_read_batch(source, nr, counters, values));
+    }
+};
+
+/**
+ * Read policy that calls the read function of the source for each counter
+ */
+struct SingleReadPolicy
+{
+    static std::size_t read(x86_energy_access_source_t* source, std::size_t nr,
+                            x86_energy_single_counter_t* counters, double* values) noexcept
+    {
+        auto read = source->read;
+        std::size_t failed = 0;
+        for (std::size_t i = 0; i < nr; i++)
+        {
+            values[i] = read(counters[i]);
+            failed += values[i] < 0.0;
+        }
+        return failed;
+    }
+};
+
+/**
+ * A fixed number of counters of one AccessSource that are read together.
+ *
+ * Reading does not throw. Each read returns the number of counters that failed, the value of a
+ * failed counter is < 0.0 (see valid()).
+ */
+template <std::size_t N, typename ReadPolicy = BatchReadPolicy>
+class CounterSet
+{
+public:
+    using Values = std::array<double, N>;
+
+    CounterSet(AccessSource& source, const std::array<std::pair<Counter, std::size_t>, N>& counters)
+    : source_(source.initialized_source())
+    {
+        for (std::size_t i = 0; i < N; i++)
+        {
+            try
+            {
+                counters_[i] = source.setup(counters[i].first, counters[i].second);
+            }
+            catch (...)
+            {
+                close(i);
+                throw;
+            }
+        }
+    }
+
+    ~CounterSet()
+    {
+        if (source_)
+        {
+            close(N);
+        }
+    }
+
+    CounterSet(const CounterSet&) = delete;
+    CounterSet& operator=(const CounterSet&) = delete;
+
+    CounterSet(CounterSet&& other) : source_(other.source_), counters_(other.counters_)
+    {
+        other.source_ = nullptr;
+    }
+
+    CounterSet& operator=(CounterSet&& other)
+    {
+        std::swap(source_, other.source_);
+        std::swap(counters_, other.counters_);
+
+        return *this;
+    }
+
+public:
+    std::size_t read(double* values) noexcept
+    {
+        return ReadPolicy::read(source_, N, counters_.data(), values);
+    }
+
+    std::size_t read(Values& values) noexcept
+    {
+        return read(values.data());
+    }
+
+    Values read() noexcept
+    {
+        Values values;
+        read(values.data());
+        return values;
+    }
+
+    static constexpr std::size_t size() noexcept
+    {
+        return N;
+    }
+
+    static bool valid(double value) noexcept
+    {
+        return value >= 0.0;
+    }
+
+private:
+    void close(std::size_t nr) noexcept
+    {
+        for (std::size_t i = 0; i < nr; i++)
+        {
+            source_->close(counters_[i]);
+        }
+    }
+
+    x86_energy_access_source_t* source_;
+    std::array<x86_energy_single_counter_t, N> counters_;
+};
+
+/**
+ * Like CounterSet, but counters are added at runtime
+ */
+template <typename ReadPolicy = BatchReadPolicy>
+class DynamicCounterSet
+{
+public:
+    DynamicCounterSet(AccessSource& source) : source_(source.initialized_source())
+    {
+    }
+
+    ~DynamicCounterSet()
+    {
+        if (source_)
+        {
+            for (auto counter : counters_)
+            {
+                source_->close(counter);
+            }
+        }
+    }
+
+    DynamicCounterSet(const DynamicCounterSet&) = delete;
+    DynamicCounterSet& operator=(const DynamicCounterSet&) = delete;
+
+    DynamicCounterSet(DynamicCounterSet&& other)
+    : source_(other.source_), counters_(std::move(other.counters_))
+    {
+        other.source_ = nullptr;
+    }
+
+    DynamicCounterSet& operator=(DynamicCounterSet&& other)
+    {
+        std::swap(source_, other.source_);
+        std::swap(counters_, other.counters_);
+
+        return *this;
+    }
+
+public:
+    /**
+     * Adds a counter and returns its slot in the values that are read
+     */
+    std::size_t add(Counter counter, std::size_t index)
+    {
+        counters_.reserve(counters_.size() + 1);
+        counters_.push_back(AccessSource::setup(source_, counter, index));
+        return counters_.size() - 1;
+    }
+
+    std::size_t read(double* values) noexcept
+    {
+        return ReadPolicy::read(source_, counters_.size(), counters_.data(), values);
+    }
+
+    std::size_t read(std::vector<double>& values)
+    {
+        values.resize(counters_.size());
+        return read(values.data());
+    }
+
+    std::size_t size() const noexcept
+    {
+        return counters_.size();
+    }
+
+    static bool valid(double value) noexcept
+    {
+        return value >= 0.0;
+    }
+
+private:
+    x86_energy_access_source_t* source_;
+    std::vector<x86_energy_single_counter_t> counters_;
+};
+
+/**
+ * Reads a set of counters periodically on an internal thread.
+ *
+ * Samples can be consumed with a callback (called on the sampling thread), with futures for the
+ * next sample, or by draining the buffered samples. The buffer is allocated on construction and
+ * holds up to capacity samples, when it is full, the oldest sample is overwritten (see dropped()).
+ * A value < 0.0 in a sample marks a counter that could not be read.
+ */
+class AsyncSampler
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Sample
+    {
+        Clock::time_point time;
+        std::vector<double> values;
+    };
+
+    using Callback = std::function<void(Clock::time_point, const double* values, std::size_t nr)>;
+
+    AsyncSampler(std::vector<SourceCounter> counters, std::chrono::nanoseconds period,
+                 std::size_t capacity = 1024, Callback callback = nullptr)
+    : counters_(std::move(counters)), period_(period), callback_(std::move(callback)),
+      times_(capacity), values_(capacity * counters_.size()), current_(counters_.size())
+    {
+        if (capacity == 0 || period.count() <= 0)
+        {
+            throw std::invalid_argument("Sampling needs a period and capacity > 0");
+        }
+        thread_ = std::thread(&AsyncSampler::run, this);
+    }
+
+    ~AsyncSampler()
+    {
+        stop();
+    }
+
+    AsyncSampler(const AsyncSampler&) = delete;
+    AsyncSampler& operator=(const AsyncSampler&) = delete;
+
+public:
+    /**
+     * Stops sampling. Buffered samples can still be drained afterwards. Futures that have not been
+     * fulfilled yet will throw.
+     */
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        wakeup_.notify_all();
+        if (thread_.joinable())
+        {
+            thread_.join();
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto& promise : promises_)
+        {
+            promise.set_exception(
+                std::make_exception_ptr(std::runtime_error("The sampler has been stopped")));
+        }
+        promises_.clear();
+    }
+
+    /**
+     * Returns a future for the next sample that is taken
+     */
+    std::future<Sample> next()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stop_)
+        {
+            throw std::runtime_error("The sampler has been stopped");
+        }
+        promises_.emplace_back();
+        return promises_.back().get_future();
+    }
+
+    /**
+     * Moves up to max_samples of the buffered samples (oldest first) to times and values, which
+     * have to hold max_samples and max_samples * size() entries.
+     * @return the number of samples
+     */
+    std::size_t drain(Clock::time_point* times, double* values, std::size_t max_samples)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto nr = std::min(count_, max_samples);
+        auto nr_counters = counters_.size();
+        for (std::size_t i = 0; i < nr; i++)
+        {
+            times[i] = times_[head_];
+            std::copy_n(&values_[head_ * nr_counters], nr_counters, &values[i * nr_counters]);
+            head_ = (head_ + 1) % times_.size();
+        }
+        count_ -= nr;
+        return nr;
+    }
+
+    /**
+     * Appends all buffered samples to samples
+     * @return the number of samples
+     */
+    std::size_t drain(std::vector<Sample>& samples)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto nr = count_;
+        auto nr_counters = counters_.size();
+        for (std::size_t i = 0; i < nr; i++)
+        {
+            auto values = values_.begin() + head_ * nr_counters;
+            samples.push_back({ times_[head_], { values, values + nr_counters } });
+            head_ = (head_ + 1) % times_.size();
+        }
+        count_ = 0;
+        return nr;
+    }
+
+    /**
+     * Number of samples that have been overwritten before they were drained
+     */
+    std::size_t dropped() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return dropped_;
+    }
+
+    std::size_t size() const
+    {
+        return counters_.size();
+    }
+
+private:
+    void run()
+    {
+        auto next_time = Clock::now();
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!stop_)
+        {
+            lock.unlock();
+            auto time = Clock::now();
+            for (std::size_t i = 0; i < counters_.size(); i++)
+            {
+                current_[i] = counters_[i].source_->read(counters_[i].source_counter_);
+            }
+            if (callback_)
+            {
+                callback_(time, current_.data(), current_.size());
+            }
+            lock.lock();
+
+            store(time);
+
+            next_time += period_;
+            if (next_time < time)
+            {
+                // we are too late, do not try to catch up
+                next_time = time + period_;
+            }
+            wakeup_.wait_until(lock, next_time, [this]() { return stop_; });
+        }
+    }
+
+    // mutex_ has to be held
+    void store(Clock::time_point time)
+    {
+        auto capacity = times_.size();
+        std::size_t slot;
+        if (count_ == capacity)
+        {
+            slot = head_;
+            head_ = (head_ + 1) % capacity;
+            dropped_++;
+        }
+        else
+        {
+            slot = (head_ + count_) % capacity;
+            count_++;
+        }
+        times_[slot] = time;
+        std::copy(current_.begin(), current_.end(), values_.begin() + slot * current_.size());
+
+        for (auto& promise : promises_)
+        {
+            promise.set_value({ time, current_ });
+        }
+        promises_.clear();
+    }
+
+    std::vector<SourceCounter> counters_;
+    std::chrono::nanoseconds period_;
+    Callback callback_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable wakeup_;
+    bool stop_ = false;
+    std::vector<std::promise<Sample>> promises_;
+
+    // ring buffer of samples
+    std::vector<Clock::time_point> times_;
+    std::vector<double> values_;
+    std::size_t head_ = 0;
+    std::size_t count_ = 0;
+    std::size_t dropped_ = 0;
+
+    // values of the current sample, only used by the sampling thread
+    std::vector<double> current_;
+
+    std::thread thread_;
+};
+
 class Mechanism
 {
 public:
@@ -0,0 +1,150 @@
+/**
+ * x86_energy_trace.h
+ *
+ *  Created on: 19.10.2026
+ */
+
+#ifndef INCLUDE_X86_ENERGY_TRACE_H_
+#define INCLUDE_X86_ENERGY_TRACE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <x86_energy.h>
+
+/*
+ * Binary energy traces. A trace holds the architecture, a description of each counter and the
+ * samples. Values are stored as integer ticks of the counter's unit, delta and varint encoded in
+ * chunks of samples, which are indexed by time.
+ */
+
+/**
+ * Describes one counter of a trace
+ */
+struct x86_energy_trace_counter
+{
+    enum x86_energy_counter counter; /**< the type of the counter */
+    uint32_t index;                  /**< the index used for setup (e.g., the socket) */
+    double unit;   /**< Joules per tick, values are rounded to it (e.g., 1e-6 for uJ) */
+    uint32_t width; /**< width of the hardware counter in bits, informational */
+    const char* source; /**< name of the access source */
+};
+
+/**
+ * Describes a chunk of samples
+ */
+struct x86_energy_trace_chunk_info
+{
+    uint64_t first_time_ns; /**< time of the first sample */
+    uint64_t last_time_ns;  /**< time of the last sample */
+    size_t nr_samples;      /**< number of samples */
+};
+
+typedef struct x86_energy_trace_writer x86_energy_trace_writer_t;
+typedef struct x86_energy_trace_reader x86_energy_trace_reader_t;
+
+/**
+ * Creates a trace file. Encoding and writing are done by a background thread.
+ *
+ * @param file the file to write
+ * @param arch the architecture to store, as returned by x86_energy_init_architecture_nodes, might
+ * be NULL
+ * @param nr_counters the number of values of each sample
+ * @param counters the description of each counter (copied)
+ * @param samples_per_chunk number of samples per chunk, 0 for the default
+ * @return the writer, NULL on error
+ */
+x86_energy_trace_writer_t* x86_energy_trace_writer_create(
+    const char* file, const x86_energy_architecture_node_t* arch, size_t nr_counters,
+    const struct x86_energy_trace_counter* counters, size_t samples_per_chunk);
+
+/**
+ * Appends a sample. Does not block and does not allocate, so it can be used from a sampling
+ * thread. Must not be called concurrently for the same writer.
+ *
+ * @param time_ns the time of the sample, should be monotonic
+ * @param values nr_counters values in Joules, < 0.0 for counters that could not be read
+ * @return 0 on success, != 0 if the sample was dropped since the background thread is too slow
+ */
+int x86_energy_trace_writer_append(x86_energy_trace_writer_t* writer, uint64_t time_ns,
+                                   const double* values);
+
+/**
+ * Can be passed to x86_energy_session_start_sampling with the writer as argument. Samples with
+ * another number of values than the counters of the writer are counted as dropped.
+ */
+void x86_energy_trace_writer_sample_callback(uint64_t time_ns, size_t nr, const double* values,
+                                             void* writer);
+
+/**
+ * The number of samples that have been dropped
+ */
+size_t x86_energy_trace_writer_dropped(x86_energy_trace_writer_t* writer);
+
+/**
+ * Writes all samples and the index, closes the file and frees the writer
+ * @return 0 on success
+ */
+int x86_energy_trace_writer_close(x86_energy_trace_writer_t* writer);
+
+/**
+ * Opens (maps) a trace file for reading
+ * @return the reader, NULL on error
+ */
+x86_energy_trace_reader_t* x86_energy_trace_open(const char* file);
+
+void x86_energy_trace_close(x86_energy_trace_reader_t* reader);
+
+size_t x86_energy_trace_nr_counters(x86_energy_trace_reader_t* reader);
+
+/**
+ * The description of a counter, the source name points into the mapped file
+ */
+const struct x86_energy_trace_counter* x86_energy_trace_get_counter(x86_energy_trace_reader_t* reader,
+                                                                   size_t counter);
+
+/**
+ * The architecture stored in the trace (NULL if there is none), valid until the reader is closed.
+ * The names point into the mapped file.
+ */
+x86_energy_architecture_node_t* x86_energy_trace_get_architecture(x86_energy_trace_reader_t* reader);
+
+size_t x86_energy_trace_nr_chunks(x86_energy_trace_reader_t* reader);
+
+/**
+ * @return 0 on success
+ */
+int x86_energy_trace_get_chunk_info(x86_energy_trace_reader_t* reader, size_t chunk,
+                                    struct x86_energy_trace_chunk_info* info);
+
+/**
+ * Finds the first chunk that holds samples at or after time_ns
+ * @return the chunk, x86_energy_trace_nr_chunks if there is none
+ */
+size_t x86_energy_trace_find_chunk(x86_energy_trace_reader_t* reader, uint64_t time_ns);
+
+/**
+ * Decodes the timestamps of a chunk
+ * @param times will hold nr_samples of the chunk timestamps
+ * @return 0 on success
+ */
+int x86_energy_trace_read_times(x86_energy_trace_reader_t* reader, size_t chunk, uint64_t* times);
+
+/**
+ * Decodes the raw ticks of one counter of a chunk, INT64_MIN marks samples that could not be read
+ * @param ticks will hold nr_samples of the chunk values
+ * @return 0 on success
+ */
+int x86_energy_trace_read_ticks(x86_energy_trace_reader_t* reader, size_t chunk, size_t counter,
+                                int64_t* ticks);
+
+/**
+ * Decodes the values of one counter of a chunk in Joules, < 0.0 marks samples that could not be
+ * read
+ * @param values will hold nr_samples of the chunk values
+ * @return 0 on success
+ */
+int x86_energy_trace_read_values(x86_energy_trace_reader_t* reader, size_t chunk, size_t counter,
+                                 double* values);
+
+#endif /* INCLUDE_X86_ENERGY_TRACE_H_ */
@@ -0,0 +1,23 @@
+/*
+ * batch.c
+ *
+ *  Created on: 19.10.2026
+ */
+
+#include "../../include/x86_energy.h"
+
+int x86_energy_read_batch(x86_energy_access_source_t* source, size_t nr,
+                          x86_energy_single_counter_t* counters, double* values)
+{
+    if (source->read_batch != NULL)
+        return source->read_batch(nr, counters, values);
+
+    int failed = 0;
+    for (size_t i = 0; i < nr; i++)
+    {
+        values[i] = source->read(counters[i]);
+        if (values[i] < 0.0)
+            failed++;
+    }
+    return failed;
+}
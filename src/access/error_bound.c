@@ -0,0 +1,15 @@
+/*
+ * error_bound.c
+ *
+ *  Created on: 19.10.2026
+ */
+
+#include "../../include/x86_energy.h"
+
+double x86_energy_error_bound(x86_energy_access_source_t* source,
+                              x86_energy_single_counter_t counter)
+{
+    if (source->error_bound != NULL)
+        return source->error_bound(counter);
+    return 0.0;
+}
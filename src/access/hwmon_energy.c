@@ -0,0 +1,274 @@
+/*
+ * hwmon_energy.c
+ *
+ *  Created on: 19.10.2026
+ */
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../include/access.h"
+#include "../include/architecture.h"
+#include "../include/error.h"
+
+#define HWMON_PATH "/sys/class/hwmon"
+
+#define BUFFER_SIZE 4096
+
+/*
+ * Energy sensors of hwmon drivers like amd_energy. Their energyN_input files hold energy in uJ,
+ * accumulated to 64 bit by the driver, so no overflow threads are needed.
+ * Labels are "Ecore<cpu>" for cores (the number is the first cpu of the core) and "Esocket<id>".
+ */
+struct sensor
+{
+    enum x86_energy_granularity granularity;
+    long int number;
+    char* path;
+};
+
+struct reader_def
+{
+    int fd;
+};
+
+static size_t nr_sensors;
+static struct sensor* sensors;
+
+
+/* reads a small file, returns 0 on success */
+static int read_file(const char* path, char* buffer, size_t size)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return 1;
+    ssize_t result = pread(fd, buffer, size - 1, 0);
+    close(fd);
+    if (result <= 0)
+        return 1;
+    buffer[result] = '\0';
+    return 0;
+}
+
+static int add_sensor(const char* dir, const char* input)
+{
+    char path[BUFFER_SIZE];
+    char label[64];
+    int channel;
+    int len = 0;
+    if (sscanf(input, "energy%d_input%n", &channel, &len) != 1 || len == 0 || input[len] != '\0')
+        return 0;
+    snprintf(path, BUFFER_SIZE, "%s/energy%d_label", dir, channel);
+    if (read_file(path, label, sizeof(label)) != 0)
+        return 0;
+
+    struct sensor sensor;
+    if (sscanf(label, "Ecore%ld", &sensor.number) == 1)
+        sensor.granularity = X86_ENERGY_GRANULARITY_CORE;
+    else if (sscanf(label, "Esocket%ld", &sensor.number) == 1)
+        sensor.granularity = X86_ENERGY_GRANULARITY_SOCKET;
+    else
+        return 0;
+
+    snprintf(path, BUFFER_SIZE, "%s/%s", dir, input);
+    sensor.path = strdup(path);
+    struct sensor* new_sensors = realloc(sensors, (nr_sensors + 1) * sizeof(struct sensor));
+    if (sensor.path == NULL || new_sensors == NULL)
+    {
+        free(sensor.path);
+        X86_ENERGY_SET_ERROR("could not allocate memory for hwmon sensor %s", path);
+        return 1;
+    }
+    sensors = new_sensors;
+    sensors[nr_sensors++] = sensor;
+    return 0;
+}
+
+static int scan_hwmon(const char* dir)
+{
+    DIR* hwmon = opendir(dir);
+    if (hwmon == NULL)
+        return 0;
+    struct dirent* entry;
+    int ret = 0;
+    while (ret == 0 && (entry = readdir(hwmon)) != NULL)
+        if (strncmp(entry->d_name, "energy", 6) == 0)
+            ret = add_sensor(dir, entry->d_name);
+    closedir(hwmon);
+    return ret;
+}
+
+static void free_sensors(void)
+{
+    for (size_t i = 0; i < nr_sensors; i++)
+        free(sensors[i].path);
+    free(sensors);
+    sensors = NULL;
+    nr_sensors = 0;
+}
+
+static int init(void)
+{
+    DIR* dir = opendir(HWMON_PATH);
+    if (dir == NULL)
+    {
+        X86_ENERGY_SET_ERROR("HWMON_PATH (%s) can not be read", HWMON_PATH);
+        return 1;
+    }
+    struct dirent* entry;
+    char path[BUFFER_SIZE];
+    int ret = 0;
+    while (ret == 0 && (entry = readdir(dir)) != NULL)
+    {
+        if (entry->d_name[0] == '.')
+            continue;
+        snprintf(path, BUFFER_SIZE, HWMON_PATH "/%s", entry->d_name);
+        ret = scan_hwmon(path);
+    }
+    closedir(dir);
+    if (ret != 0)
+    {
+        free_sensors();
+        return 1;
+    }
+    if (nr_sensors == 0)
+    {
+        X86_ENERGY_SET_ERROR("no hwmon energy sensors with Ecore or Esocket labels in %s",
+                             HWMON_PATH);
+        return 1;
+    }
+    return 0;
+}
+
+static struct sensor* find_sensor(enum x86_energy_counter counter_type, size_t index)
+{
+    switch (counter_type)
+    {
+    case X86_ENERGY_COUNTER_PCKG:
+        for (size_t i = 0; i < nr_sensors; i++)
+            if (sensors[i].granularity == X86_ENERGY_GRANULARITY_SOCKET &&
+                sensors[i].number == (long int)index)
+                return &sensors[i];
+        X86_ENERGY_SET_ERROR("no hwmon energy sensor for socket %zu", index);
+        return NULL;
+    case X86_ENERGY_COUNTER_SINGLE_CORE:
+    {
+        long int cpu = get_test_cpu(X86_ENERGY_GRANULARITY_CORE, index);
+        if (cpu < 0)
+        {
+            X86_ENERGY_APPEND_ERROR("could not find a cpu with granularity core");
+            return NULL;
+        }
+        x86_energy_architecture_node_t* arch = x86_energy_arch_lock();
+        if (arch == NULL)
+            return NULL;
+        x86_energy_architecture_node_t* core =
+            x86_energy_find_arch_for_cpu(arch, X86_ENERGY_GRANULARITY_CORE, cpu);
+        for (size_t i = 0; i < nr_sensors && core != NULL; i++)
+            if (sensors[i].granularity == X86_ENERGY_GRANULARITY_CORE &&
+                x86_energy_find_arch_for_cpu(arch, X86_ENERGY_GRANULARITY_CORE,
+                                             sensors[i].number) == core)
+            {
+                x86_energy_arch_unlock();
+                return &sensors[i];
+            }
+        x86_energy_arch_unlock();
+        X86_ENERGY_SET_ERROR("no hwmon energy sensor for core %zu (cpu %ld)", index, cpu);
+        return NULL;
+    }
+    default:
+        X86_ENERGY_SET_ERROR("can't handle counter_type %d", counter_type);
+        return NULL;
+    }
+}
+
+static double read_fd(int fd)
+{
+    char buffer[32];
+    ssize_t result = pread(fd, buffer, sizeof(buffer) - 1, 0);
+    if (result <= 0)
+    {
+        X86_ENERGY_SET_ERROR("could not read hwmon energy sensor");
+        return -1.0;
+    }
+    buffer[result] = '\0';
+    char* end;
+    unsigned long long energy_in_uJ = strtoull(buffer, &end, 10);
+    if (end == buffer)
+    {
+        X86_ENERGY_SET_ERROR("contents of hwmon energy sensor are not a number");
+        return -1.0;
+    }
+    return 1E-6 * energy_in_uJ;
+}
+
+static x86_energy_single_counter_t setup(enum x86_energy_counter counter_type, size_t index)
+{
+    struct sensor* sensor = find_sensor(counter_type, index);
+    if (sensor == NULL)
+        return NULL;
+    struct reader_def* def = malloc(sizeof(struct reader_def));
+    if (def == NULL)
+    {
+        X86_ENERGY_SET_ERROR("could not allocate %zu bytes", sizeof(struct reader_def));
+        return NULL;
+    }
+    def->fd = open(sensor->path, O_RDONLY);
+    if (def->fd < 0)
+    {
+        free(def);
+        X86_ENERGY_SET_ERROR("could not open \"%s\"", sensor->path);
+        return NULL;
+    }
+    if (read_fd(def->fd) < 0.0)
+    {
+        close(def->fd);
+        free(def);
+        X86_ENERGY_APPEND_ERROR("while reading \"%s\"", sensor->path);
+        return NULL;
+    }
+    return (x86_energy_single_counter_t)def;
+}
+
+static double do_read(x86_energy_single_counter_t counter)
+{
+    struct reader_def* def = (struct reader_def*)counter;
+    return read_fd(def->fd);
+}
+
+static int do_read_batch(size_t nr, x86_energy_single_counter_t* counters, double* values)
+{
+    int failed = 0;
+    for (size_t i = 0; i < nr; i++)
+    {
+        values[i] = read_fd(((struct reader_def*)counters[i])->fd);
+        if (values[i] < 0.0)
+            failed++;
+    }
+    return failed;
+}
+
+static void do_close(x86_energy_single_counter_t counter)
+{
+    struct reader_def* def = (struct reader_def*)counter;
+    close(def->fd);
+    free(def);
+}
+
+static void fini(void)
+{
+    free_sensors();
+}
+
+x86_energy_access_source_t hwmon_energy_source = {.name = "hwmon-energy",
+                                                  .init = init,
+                                                  .setup = setup,
+                                                  .read = do_read,
+                                                  .close = do_close,
+                                                  .fini = fini,
+                                                  .read_batch = do_read_batch };
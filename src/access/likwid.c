@@ -14,6 +14,7 @@
 #include "../include/architecture.h"
 #include "../include/error.h"
 #include "../include/overflow_thread.h"
+#include "../include/unwrap.h"
 
 #define MSR_PKG_ENERGY_STATUS 0x611
 #define MSR_PP0_ENERGY_STATUS 0x639
@@ -24,10 +25,11 @@
 struct reader_def
 {
     int cpuId;
-    uint64_t last_reading;
+    struct x86_energy_unwrap unwrap;
     uint64_t reg;
     pthread_t thread;
     pthread_mutex_t mutex;
+    struct ov_call* ov_call;
     double unit;
 };
 
@@ -66,7 +68,7 @@ static double do_read(x86_energy_single_counter_t counter);
 
 static int init(void)
 {
-    memset(&likwid_ov, 0, sizeof(struct ov_struct));
+    x86_energy_overflow_init(&likwid_ov);
     int ret;
     HPMmode(ACCESSMODE_DAEMON);
     ret = topology_init();
@@ -177,16 +179,17 @@ static x86_energy_single_counter_t setup(enum x86_energy_counter counter_type, s
     }
     def->reg = reg;
     def->cpuId = cpu;
-    def->last_reading = reading;
+    def->unit = power_getEnergyUnit(domain);
+    x86_energy_unwrap_init(&def->unwrap, counter_type, 1ULL << 32, def->unit,
+                           reading & 0xFFFFFFFFULL);
     if (x86_energy_overflow_thread_create(&likwid_ov, cpu, &def->thread, &def->mutex, do_read, def,
-                                          30000000))
+                                          30000000, &def->ov_call))
     {
         X86_ENERGY_SET_ERROR("Error creating a thread for CPU %li", cpu);
         free(def);
         return NULL;
     }
 
-    def->unit = power_getEnergyUnit(domain);
     return (x86_energy_single_counter_t)def;
 }
 
@@ -201,14 +204,11 @@ static double do_read(x86_energy_single_counter_t counter)
         pthread_mutex_unlock(&def->mutex);
         return -1.0;
     }
-    if (reading < (def->last_reading & 0xFFFFFFFFULL))
-    {
-        def->last_reading = (def->last_reading & 0xFFFFFFFF00000000ULL) + 0x100000000 + reading;
-    }
-    else
-        def->last_reading = (def->last_reading & 0xFFFFFFFF00000000ULL) + reading;
+    uint64_t total =
+        x86_energy_unwrap(&def->unwrap, reading & 0xFFFFFFFFULL, x86_energy_overflow_now());
     pthread_mutex_unlock(&def->mutex);
-    return def->unit * def->last_reading;
+    x86_energy_overflow_mark_read(def->ov_call);
+    return def->unit * total;
 }
 
 static void do_close(x86_energy_single_counter_t counter)
@@ -216,6 +216,15 @@ static void do_close(x86_energy_single_counter_t counter)
     struct reader_def* def = (struct reader_def*)counter;
     x86_energy_overflow_thread_remove_call(&likwid_ov, def->cpuId, do_read, counter);
 }
+
+static void glitch_stats(x86_energy_single_counter_t counter, x86_energy_glitch_stats_t* stats)
+{
+    struct reader_def* def = (struct reader_def*)counter;
+    pthread_mutex_lock(&def->mutex);
+    *stats = def->unwrap.stats;
+    pthread_mutex_unlock(&def->mutex);
+}
+
 static void fini(void)
 {
     x86_energy_overflow_thread_killall(&likwid_ov);
@@ -234,4 +243,5 @@ x86_energy_access_source_t likwid_source = {.name = "likwid-rapl",
                                             .setup = setup,
                                             .read = do_read,
                                             .close = do_close,
-                                            .fini = fini };
+                                            .fini = fini,
+                                            .glitch_stats = glitch_stats };
@@ -5,25 +5,17 @@
  *      Author: rschoene
  */
 
-#include <dirent.h>
-#include <errno.h>
-#include <fcntl.h>
 #include <math.h>
 #include <pthread.h>
+#include <stdbool.h>
 #include <stddef.h>
-#include <stdint.h>
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <unistd.h>
 
 #include "../include/access.h"
 #include "../include/architecture.h"
 #include "../include/cpuid.h"
 #include "../include/error.h"
-#include "../include/overflow_thread.h"
-
-#define BUFFER_SIZE 4096
+#include "../include/msr_device.h"
+#include "../include/msr_engine.h"
 
 #define MSR_RAPL_POWER_UNIT 0x606
 
@@ -33,343 +25,264 @@
 #define MSR_DRAM_ENERGY_STATUS 0x619
 #define MSR_PLATFORM_ENERGY_STATUS 0x64D
 
-struct reader_def
-{
-    int cpuId;
-    uint64_t last_reading;
-    uint64_t reg;
-    pthread_t thread;
-    pthread_mutex_t mutex;
-    double unit;
-};
+#define MSR_PKG_PERF_STATUS 0x613
+#define MSR_PP0_PERF_STATUS 0x63B
+#define MSR_DRAM_PERF_STATUS 0x61B
 
-static struct ov_struct msr_ov;
+#define MSR_PKG_POWER_LIMIT 0x610
+#define MSR_DRAM_POWER_LIMIT 0x618
+#define MSR_PP0_POWER_LIMIT 0x638
+#define MSR_PP1_POWER_LIMIT 0x640
+#define MSR_PLATFORM_POWER_LIMIT 0x65C
 
-static double do_read(x86_energy_single_counter_t counter);
-
-/* this will return the maximal number of CPUs by looking for /dev/cpu/(nr)/msr[-safe]
- * It will also check whether these can be read
- * time complexity is O(num_cpus) for the first call. Afterwards its O(1), since the return value is
- * buffered
+/*
+ * Each limit has the power in bits 14:0, enable in bit 15, clamp in bit 16 and the time window in
+ * bits 23:17. The short term limit of package and platform uses the same layout in bits 55:32.
  */
-static int freq_gen_msr_get_max_entries()
-{
-    static long long int max = -1;
-    if (max != -1)
-    {
-        return max;
-    }
-    char buffer[BUFFER_SIZE];
-    DIR* dir = opendir("/dev/cpu/");
-    if (dir == NULL)
-    {
-        X86_ENERGY_APPEND_ERROR("opendir(\"/dev/cpu/\") returned NULL");
-        return -EIO;
-    }
-    struct dirent* entry;
-
-    while ((entry = readdir(dir)) != NULL)
-    {
-        if (entry->d_type == DT_DIR)
-        {
-            /* first after cpu == numerical digit? */
-
-            char* end;
-            long long int current = strtoll(entry->d_name, &end, 10);
-            if (end != (entry->d_name + strlen(entry->d_name)))
-                continue;
-
-            /* check access to msr */
-            if (snprintf(buffer, BUFFER_SIZE, "/dev/cpu/%lli/msr", current) == BUFFER_SIZE)
-            {
-                closedir(dir);
-                X86_ENERGY_SET_ERROR("cpu number too big for string buffer (%d bytes)",
-                                     BUFFER_SIZE);
-                return -ENOMEM;
-            }
-
-            /* can not be accessed? check msr-safe */
-            if (access(buffer, R_OK) != 0)
-            {
+#define LIMIT_BITS 24
+#define LIMIT_POWER_MASK 0x7FFFULL
+#define LIMIT_ENABLE_BIT 15
+#define LIMIT_WINDOW_SHIFT 17
+#define LIMIT_WINDOW_MASK 0x7FULL
+#define SHORT_TERM_SHIFT 32
 
-                /* check access to msr */
-                if (snprintf(buffer, BUFFER_SIZE, "/dev/cpu/%lli/msr_safe", current) == BUFFER_SIZE)
-                {
-                    closedir(dir);
-                    X86_ENERGY_SET_ERROR("cpu number too big for string buffer (%d bytes)",
-                                         BUFFER_SIZE);
-                    return -ENOMEM;
-                }
-                if (access(buffer, R_OK) != 0)
-                {
-                    continue;
-                }
-            }
-
-            if (current > max)
-                max = current;
-        }
+/* 32 bit counters per package, energy status units in bits 12:8 of MSR_RAPL_POWER_UNIT */
+#define RAPL_DOMAIN(counter_type, status_reg)                                                      \
+    {                                                                                              \
+        .counter = counter_type, .granularity = X86_ENERGY_GRANULARITY_SOCKET, .reg = status_reg,  \
+        .width = 32, .unit_reg = MSR_RAPL_POWER_UNIT, .unit_shift = 8, .unit_mask = 0x1F           \
     }
-    closedir(dir);
-    if (max == -1)
-    {
-        X86_ENERGY_APPEND_ERROR("could not access cpu data in /dev/cpu");
-        return -EACCES;
-    }
-    max = max + 1;
-    return max;
-}
-
-static int* fds;
-
-static double get_default_unit(long unsigned cpu)
-{
-    static double default_unit = -1.0;
-    if (default_unit > 0.0)
-        return default_unit;
-    int already_opened = fds[cpu];
-    /* if not already open, open. if fail, return NULL */
-    if (fds[cpu] <= 0)
-    {
-        char buffer[BUFFER_SIZE];
-        /* get uncore msr */
 
-        if (snprintf(buffer, BUFFER_SIZE, "/dev/cpu/%lu/msr", cpu) == BUFFER_SIZE)
-        {
-            X86_ENERGY_SET_ERROR("cpu number too big for string buffer (%d bytes)", BUFFER_SIZE);
-            return -1.0;
-        }
-
-        fds[cpu] = open(buffer, O_RDONLY);
-        if (fds[cpu] < 0)
-        {
-            if (snprintf(buffer, BUFFER_SIZE, "/dev/cpu/%lu/msr_safe", cpu) == BUFFER_SIZE)
-            {
-                X86_ENERGY_SET_ERROR("cpu number too big for string buffer (%d bytes)",
-                                     BUFFER_SIZE);
-                return -1.0;
-            }
-            fds[cpu] = open(buffer, O_RDONLY);
-            if (fds[cpu] < 0)
-            {
-                X86_ENERGY_SET_ERROR("Could not obtain a file descriptor for cpu %lu/msr_safe",
-                                     cpu);
-                return -1.0;
-            }
-        }
+/* 32 bit counters of the time a domain was throttled, time units in bits 19:16 */
+#define RAPL_THROTTLE_DOMAIN(counter_type, status_reg)                                             \
+    {                                                                                              \
+        .counter = counter_type, .granularity = X86_ENERGY_GRANULARITY_SOCKET, .reg = status_reg,  \
+        .width = 32, .unit_reg = MSR_RAPL_POWER_UNIT, .unit_shift = 16, .unit_mask = 0xF           \
     }
-    uint64_t modifier_u64;
-    int result = pread(fds[cpu], &modifier_u64, 8, MSR_RAPL_POWER_UNIT);
 
-    /* close if was not open before*/
-    if (already_opened <= 0)
-    {
-        close(fds[cpu]);
-        fds[cpu] = -1;
-    }
-    if (result != 8)
-    {
-        X86_ENERGY_SET_ERROR("Could not read MSR_RAPL_POWER_UNIT, msr/msr_safe file too short",
-                             cpu);
-        return -1.0;
-    }
-
-    modifier_u64 &= 0x1F00;
-    modifier_u64 = modifier_u64 >> 8;
-    default_unit = modifier_u64;
-    default_unit = 1.0 / pow(2.0, default_unit);
-    return default_unit;
-}
+static const struct x86_energy_msr_domain domains[] = {
+    RAPL_DOMAIN(X86_ENERGY_COUNTER_PCKG, MSR_PKG_ENERGY_STATUS),
+    RAPL_DOMAIN(X86_ENERGY_COUNTER_CORES, MSR_PP0_ENERGY_STATUS),
+    RAPL_DOMAIN(X86_ENERGY_COUNTER_DRAM, MSR_DRAM_ENERGY_STATUS),
+    RAPL_DOMAIN(X86_ENERGY_COUNTER_GPU, MSR_PP1_ENERGY_STATUS),
+    RAPL_DOMAIN(X86_ENERGY_COUNTER_PLATFORM, MSR_PLATFORM_ENERGY_STATUS),
+    RAPL_THROTTLE_DOMAIN(X86_ENERGY_COUNTER_PCKG_THROTTLE, MSR_PKG_PERF_STATUS),
+    RAPL_THROTTLE_DOMAIN(X86_ENERGY_COUNTER_CORES_THROTTLE, MSR_PP0_PERF_STATUS),
+    RAPL_THROTTLE_DOMAIN(X86_ENERGY_COUNTER_DRAM_THROTTLE, MSR_DRAM_PERF_STATUS),
+};
 
-static double get_dram_unit(long unsigned cpu)
+/* server processors use a fixed DRAM unit instead of the one in MSR_RAPL_POWER_UNIT */
+static double fixed_unit(const struct x86_energy_msr_domain* domain)
 {
-    static double dram_unit = -1.0;
-    if (dram_unit > 0.0)
-        return dram_unit;
+    if (domain->counter != X86_ENERGY_COUNTER_DRAM)
+        return -1.0;
     unsigned int eax = 1, ebx = 0, ecx = 0, edx = 0;
     cpuid(&eax, &ebx, &ecx, &edx);
     if (FAMILY(eax) != 6)
-    {
-        X86_ENERGY_SET_ERROR("Unknown CPU family %x", FAMILY(eax));
-        return 0;
-    }
+        return -1.0;
     switch ((EXT_MODEL(eax) << 4) + MODEL(eax))
     {
     case 0x3f: /* Haswell-EP, fall-through */
     case 0x4e: /* Broadwell-EP, fall-through */
     case 0x55: /* SKL SP*/
-        dram_unit = 1.0 / pow(2.0, 16.0);
-        break;
+        return 1.0 / pow(2.0, 16.0);
     /* none of the above */
     default:
-        dram_unit = get_default_unit(cpu);
+        return -1.0;
     }
-    return dram_unit;
 }
 
-static int init(void)
+static struct x86_energy_msr_engine engine = { .domains = domains,
+                                               .nr_domains = sizeof(domains) / sizeof(domains[0]),
+                                               .fixed_unit = fixed_unit,
+                                               .overflow_us = 30000000,
+                                               .mutex = PTHREAD_MUTEX_INITIALIZER };
+
+struct limit_register
 {
-    memset(&msr_ov, 0, sizeof(struct ov_struct));
-    int max_msr = freq_gen_msr_get_max_entries();
-    if (max_msr < 0)
-    {
-        X86_ENERGY_APPEND_ERROR("Could not figure out maximum cpu count, errorcode %d", max_msr);
-        return 1;
-    }
-    fds = calloc(max_msr, sizeof(int));
-    if (fds == NULL)
+    enum x86_energy_counter counter;
+    uint64_t reg;
+    bool has_short_term;
+    unsigned int lock_bit;
+};
+
+static const struct limit_register limit_registers[] = {
+    { X86_ENERGY_COUNTER_PCKG, MSR_PKG_POWER_LIMIT, true, 63 },
+    { X86_ENERGY_COUNTER_CORES, MSR_PP0_POWER_LIMIT, false, 31 },
+    { X86_ENERGY_COUNTER_DRAM, MSR_DRAM_POWER_LIMIT, false, 31 },
+    { X86_ENERGY_COUNTER_GPU, MSR_PP1_POWER_LIMIT, false, 31 },
+    { X86_ENERGY_COUNTER_PLATFORM, MSR_PLATFORM_POWER_LIMIT, true, 63 },
+};
+
+/* serializes read-modify-write cycles of limit registers */
+static pthread_mutex_t limit_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static const struct limit_register* find_limit_register(
+    enum x86_energy_counter counter_type, enum x86_energy_power_limit_constraint constraint)
+{
+    for (size_t i = 0; i < sizeof(limit_registers) / sizeof(limit_registers[0]); i++)
+        if (limit_registers[i].counter == counter_type &&
+            (constraint == X86_ENERGY_POWER_LIMIT_LONG_TERM || limit_registers[i].has_short_term))
+            return &limit_registers[i];
+    X86_ENERGY_SET_ERROR("counter type %d has no power limit with constraint %d", counter_type,
+                         constraint);
+    return NULL;
+}
+
+/* power units in bits 3:0 and time units in bits 19:16 of MSR_RAPL_POWER_UNIT */
+static int get_limit_units(int cpu, double* power_unit, double* time_unit)
+{
+    uint64_t value;
+    if (x86_energy_msr_read_cached(cpu, MSR_RAPL_POWER_UNIT, &value) != 0)
     {
-        X86_ENERGY_SET_ERROR("Could not allocate %d bytes for file descriptors",
-                             max_msr * sizeof(int));
+        X86_ENERGY_APPEND_ERROR("Could not read MSR_RAPL_POWER_UNIT");
         return 1;
     }
+    *power_unit = 1.0 / pow(2.0, value & 0xF);
+    *time_unit = 1.0 / pow(2.0, (value >> 16) & 0xF);
     return 0;
 }
 
-static x86_energy_single_counter_t setup(enum x86_energy_counter counter_type, size_t index)
+/* the window is 2^Y * (1 + Z / 4) time units, with Y in bits 4:0 and Z in bits 6:5 */
+static double decode_window(uint64_t bits, double time_unit)
 {
-    int cpu = get_test_cpu(X86_ENERGY_GRANULARITY_SOCKET, index);
-    if (cpu < 0)
-    {
-        X86_ENERGY_APPEND_ERROR("No cpu with granularity socket");
-        return NULL;
-    }
-    /* if not already open, open. if fail, return NULL */
-    if (fds[cpu] <= 0)
-    {
-        char buffer[BUFFER_SIZE];
-        /* get uncore msr */
-
-        if (snprintf(buffer, BUFFER_SIZE, "/dev/cpu/%i/msr", cpu) == BUFFER_SIZE)
-        {
-            X86_ENERGY_SET_ERROR("cpu number too big for string buffer (%d bytes)", BUFFER_SIZE);
-            return NULL;
-        }
+    return pow(2.0, bits & 0x1F) * (1.0 + ((bits >> 5) & 0x3) / 4.0) * time_unit;
+}
 
-        fds[cpu] = open(buffer, O_RDONLY);
-        if (fds[cpu] < 0)
+static uint64_t encode_window(double seconds, double time_unit)
+{
+    uint64_t best = 0;
+    double best_error = INFINITY;
+    for (uint64_t bits = 0; bits <= LIMIT_WINDOW_MASK; bits++)
+    {
+        double error = fabs(decode_window(bits, time_unit) - seconds);
+        if (error < best_error)
         {
-            if (snprintf(buffer, BUFFER_SIZE, "/dev/cpu/%i/msr_safe", cpu) == BUFFER_SIZE)
-            {
-                X86_ENERGY_SET_ERROR("cpu number too big for string buffer (%d bytes)",
-                                     BUFFER_SIZE);
-                return NULL;
-            }
-            fds[cpu] = open(buffer, O_RDONLY);
-            if (fds[cpu] < 0)
-            {
-                X86_ENERGY_SET_ERROR("could not obtain a file descriptor for cpu %lu/msr_safe",
-                                     cpu);
-                return NULL;
-            }
+            best = bits;
+            best_error = error;
         }
     }
+    return best;
+}
 
-    /* try to read */
-    uint64_t reg;
-    double unit;
-    switch (counter_type)
+static void decode_limit(const struct limit_register* lr, uint64_t value, unsigned int shift,
+                         double power_unit, double time_unit, x86_energy_power_limit_t* limit)
+{
+    uint64_t bits = value >> shift;
+    limit->power = (bits & LIMIT_POWER_MASK) * power_unit;
+    limit->enabled = (bits >> LIMIT_ENABLE_BIT) & 1;
+    limit->time_window =
+        decode_window((bits >> LIMIT_WINDOW_SHIFT) & LIMIT_WINDOW_MASK, time_unit);
+    limit->locked = (value >> lr->lock_bit) & 1;
+}
+
+static int read_limit_register(int cpu, uint64_t reg, uint64_t* value)
+{
+    int fd = x86_energy_msr_get(cpu);
+    if (fd < 0)
+        return 1;
+    int result = x86_energy_msr_read(fd, reg, value);
+    x86_energy_msr_put(cpu);
+    if (result != 0)
+        X86_ENERGY_SET_ERROR("could not read power limit msr 0x%llx of cpu %d",
+                             (unsigned long long)reg, cpu);
+    return result;
+}
+
+static int get_power_limit(enum x86_energy_counter counter_type, size_t index,
+                           enum x86_energy_power_limit_constraint constraint,
+                           x86_energy_power_limit_t* limit)
+{
+    const struct limit_register* lr = find_limit_register(counter_type, constraint);
+    if (lr == NULL)
+        return 1;
+    long cpu = get_test_cpu(X86_ENERGY_GRANULARITY_SOCKET, index);
+    double power_unit, time_unit;
+    uint64_t value;
+    if (cpu < 0 || get_limit_units(cpu, &power_unit, &time_unit) != 0 ||
+        read_limit_register(cpu, lr->reg, &value) != 0)
+        return 1;
+    unsigned int shift = constraint == X86_ENERGY_POWER_LIMIT_SHORT_TERM ? SHORT_TERM_SHIFT : 0;
+    decode_limit(lr, value, shift, power_unit, time_unit, limit);
+    return 0;
+}
+
+static int set_power_limit(enum x86_energy_counter counter_type, size_t index,
+                           enum x86_energy_power_limit_constraint constraint,
+                           x86_energy_power_limit_t* limit, int flags)
+{
+    const struct limit_register* lr = find_limit_register(counter_type, constraint);
+    if (lr == NULL)
+        return 1;
+    long cpu = get_test_cpu(X86_ENERGY_GRANULARITY_SOCKET, index);
+    double power_unit, time_unit;
+    if (cpu < 0 || get_limit_units(cpu, &power_unit, &time_unit) != 0)
+        return 1;
+    uint64_t power_bits = llround(limit->power / power_unit);
+    if (power_bits > LIMIT_POWER_MASK)
     {
-    case X86_ENERGY_COUNTER_PCKG:
-        reg = MSR_PKG_ENERGY_STATUS;
-        unit = get_default_unit(cpu);
-        break;
-    case X86_ENERGY_COUNTER_CORES:
-        reg = MSR_PP0_ENERGY_STATUS;
-        unit = get_default_unit(cpu);
-        break;
-    case X86_ENERGY_COUNTER_DRAM:
-        reg = MSR_DRAM_ENERGY_STATUS;
-        unit = get_dram_unit(cpu);
-        break;
-    case X86_ENERGY_COUNTER_GPU:
-        reg = MSR_PP1_ENERGY_STATUS;
-        unit = get_default_unit(cpu);
-        break;
-    case X86_ENERGY_COUNTER_PLATFORM:
-        reg = MSR_PLATFORM_ENERGY_STATUS;
-        unit = get_default_unit(cpu);
-        break;
-    default:
-        X86_ENERGY_SET_ERROR("can't handle counter type %d", counter_type);
-        return NULL;
+        X86_ENERGY_SET_ERROR("power limit %f W exceeds the maximum of %f W", limit->power,
+                             LIMIT_POWER_MASK * power_unit);
+        return 1;
     }
-    int64_t reading;
-    int result = pread(fds[cpu], &reading, 8, reg);
-    if (result != 8)
+    unsigned int shift = constraint == X86_ENERGY_POWER_LIMIT_SHORT_TERM ? SHORT_TERM_SHIFT : 0;
+
+    pthread_mutex_lock(&limit_mutex);
+    uint64_t value;
+    if (read_limit_register(cpu, lr->reg, &value) != 0)
     {
-        close(fds[cpu]);
-        fds[cpu] = 0;
-        X86_ENERGY_SET_ERROR(
-            "could not read 8 bytes at offset %llu from file descriptor pointing to CPU number %d",
-            reg, cpu);
-        return NULL;
+        pthread_mutex_unlock(&limit_mutex);
+        return 1;
     }
-    struct reader_def* def = malloc(sizeof(struct reader_def));
-    if (def == NULL)
+    if ((value >> lr->lock_bit) & 1)
     {
-        close(fds[cpu]);
-        fds[cpu] = 0;
-        X86_ENERGY_SET_ERROR("could not allocate %d bytes", sizeof(struct reader_def));
-        return NULL;
+        pthread_mutex_unlock(&limit_mutex);
+        X86_ENERGY_SET_ERROR("power limit msr 0x%llx of cpu %ld is locked",
+                             (unsigned long long)lr->reg, cpu);
+        return 1;
     }
-    def->reg = reg;
-    def->cpuId = cpu;
-    def->last_reading = reading;
-    def->unit = unit;
-    if (x86_energy_overflow_thread_create(&msr_ov, cpu, &def->thread, &def->mutex, do_read, def,
-                                          30000000))
+    uint64_t current = value >> shift;
+    uint64_t window_bits = limit->time_window > 0.0 ?
+                               encode_window(limit->time_window, time_unit) :
+                               (current >> LIMIT_WINDOW_SHIFT) & LIMIT_WINDOW_MASK;
+    /* the clamp bit is kept */
+    uint64_t field = power_bits | ((uint64_t)(limit->enabled != 0) << LIMIT_ENABLE_BIT) |
+                     (current & (1ULL << (LIMIT_ENABLE_BIT + 1))) |
+                     (window_bits << LIMIT_WINDOW_SHIFT);
+    uint64_t mask = ((1ULL << LIMIT_BITS) - 1) << shift;
+    value = (value & ~mask) | (field << shift);
+    if (!(flags & X86_ENERGY_POWER_LIMIT_DRY_RUN) && x86_energy_msr_write(cpu, lr->reg, value) != 0)
     {
-        close(fds[cpu]);
-        fds[cpu] = 0;
-        free(def);
-        X86_ENERGY_SET_ERROR("could not create thread for cpu %d", cpu);
-        return NULL;
+        pthread_mutex_unlock(&limit_mutex);
+        return 1;
     }
-    return (x86_energy_single_counter_t)def;
+    pthread_mutex_unlock(&limit_mutex);
+    decode_limit(lr, value, shift, power_unit, time_unit, limit);
+    return 0;
 }
 
-static double do_read(x86_energy_single_counter_t counter)
+static int init(void)
 {
-    struct reader_def* def = (struct reader_def*)counter;
-    uint64_t reading;
-    pthread_mutex_lock(&def->mutex);
-    int result = pread(fds[def->cpuId], &reading, 8, def->reg);
-    if (result != 8)
-    {
-        pthread_mutex_unlock(&def->mutex);
-        X86_ENERGY_SET_ERROR("could not read 8 bytes at offset %llu from file descriptor pointing "
-                             "to CPU number %d. Resetting file descriptor",
-                             def->reg, def->cpuId);
-        return -1.0;
-    }
-    if (reading < (def->last_reading & 0xFFFFFFFFULL))
-    {
-        def->last_reading = (def->last_reading & 0xFFFFFFFF00000000ULL) + 0x100000000 + reading;
-    }
-    else
-        def->last_reading = (def->last_reading & 0xFFFFFFFF00000000ULL) + reading;
-    pthread_mutex_unlock(&def->mutex);
-    return def->unit * def->last_reading;
+    return x86_energy_msr_engine_init(&engine);
 }
 
-static void do_close(x86_energy_single_counter_t counter)
+static x86_energy_single_counter_t setup(enum x86_energy_counter counter_type, size_t index)
 {
-    struct reader_def* def = (struct reader_def*)counter;
-    x86_energy_overflow_thread_remove_call(&msr_ov, def->cpuId, do_read, counter);
-    close(fds[def->cpuId]);
-    fds[def->cpuId] = 0;
-    free(def);
+    return x86_energy_msr_engine_setup(&engine, counter_type, index);
 }
+
 static void fini(void)
 {
-    x86_energy_overflow_thread_killall(&msr_ov);
-    x86_energy_overflow_freeall(&msr_ov);
+    x86_energy_msr_engine_fini(&engine);
 }
 
 x86_energy_access_source_t msr_source = {.name = "msr-rapl",
                                          .init = init,
                                          .setup = setup,
-                                         .read = do_read,
-                                         .close = do_close,
-                                         .fini = fini };
+                                         .read = x86_energy_msr_engine_read,
+                                         .close = x86_energy_msr_engine_close,
+                                         .fini = fini,
+                                         .read_batch = x86_energy_msr_engine_read_batch,
+                                         .glitch_stats = x86_energy_msr_engine_glitch_stats,
+                                         .get_power_limit = get_power_limit,
+                                         .set_power_limit = set_power_limit };
@@ -0,0 +1,237 @@
+/*
+ * msr_device.c
+ *
+ *  Created on: 19.10.2026
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../include/error.h"
+#include "../include/msr_device.h"
+
+#define BUFFER_SIZE 4096
+
+#define DEFAULT_MSR_DIR "/dev/cpu"
+
+/* registers that are cached by x86_energy_msr_read_cached, e.g. unit registers of each vendor */
+#define MAX_CACHED_REGISTERS 8
+
+struct msr_handle
+{
+    int fd;
+    unsigned int references;
+};
+
+struct cached_register
+{
+    uint64_t reg;
+    uint64_t value;
+};
+
+static pthread_mutex_t msr_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static struct msr_handle* handles;
+static int nr_handles;
+
+static int nr_cpus = -1;
+
+static struct cached_register cached[MAX_CACHED_REGISTERS];
+static size_t nr_cached;
+
+const char* x86_energy_msr_dir(void)
+{
+    const char* dir = getenv("X86_ENERGY_MSR_DIR");
+    return dir != NULL ? dir : DEFAULT_MSR_DIR;
+}
+
+/* opens <dir>/<cpu>/msr or msr_safe, returns -1 on error */
+static int open_msr(int cpu, int flags)
+{
+    char buffer[BUFFER_SIZE];
+    snprintf(buffer, BUFFER_SIZE, "%s/%d/msr", x86_energy_msr_dir(), cpu);
+    int fd = open(buffer, flags);
+    if (fd >= 0)
+        return fd;
+    snprintf(buffer, BUFFER_SIZE, "%s/%d/msr_safe", x86_energy_msr_dir(), cpu);
+    return open(buffer, flags);
+}
+
+/* must be called with msr_mutex held */
+static int scan_cpus(void)
+{
+    const char* dir_name = x86_energy_msr_dir();
+    DIR* dir = opendir(dir_name);
+    if (dir == NULL)
+    {
+        X86_ENERGY_SET_ERROR("opendir(\"%s\") returned NULL", dir_name);
+        return -EIO;
+    }
+    char buffer[BUFFER_SIZE];
+    long max = -1;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        char* end;
+        long current = strtol(entry->d_name, &end, 10);
+        if (end == entry->d_name || *end != '\0' || current <= max)
+            continue;
+        snprintf(buffer, BUFFER_SIZE, "%s/%ld/msr", dir_name, current);
+        if (access(buffer, R_OK) != 0)
+        {
+            snprintf(buffer, BUFFER_SIZE, "%s/%ld/msr_safe", dir_name, current);
+            if (access(buffer, R_OK) != 0)
+                continue;
+        }
+        max = current;
+    }
+    closedir(dir);
+    if (max == -1)
+    {
+        X86_ENERGY_SET_ERROR("could not access cpu data in %s", dir_name);
+        return -EACCES;
+    }
+    return max + 1;
+}
+
+int x86_energy_msr_nr_cpus(void)
+{
+    pthread_mutex_lock(&msr_mutex);
+    if (nr_cpus < 0)
+        nr_cpus = scan_cpus();
+    int result = nr_cpus;
+    /* retry on the next call, the msr module might be loaded later */
+    if (nr_cpus < 0)
+        nr_cpus = -1;
+    pthread_mutex_unlock(&msr_mutex);
+    return result;
+}
+
+/* must be called with msr_mutex held, grows handles for new cpus */
+static int reserve_handles(int cpu)
+{
+    if (cpu < nr_handles)
+        return 0;
+    struct msr_handle* new_handles = realloc(handles, (cpu + 1) * sizeof(struct msr_handle));
+    if (new_handles == NULL)
+    {
+        X86_ENERGY_SET_ERROR("could not allocate %zu bytes for file descriptors",
+                             (cpu + 1) * sizeof(struct msr_handle));
+        return 1;
+    }
+    for (int i = nr_handles; i <= cpu; i++)
+    {
+        new_handles[i].fd = -1;
+        new_handles[i].references = 0;
+    }
+    handles = new_handles;
+    nr_handles = cpu + 1;
+    return 0;
+}
+
+int x86_energy_msr_get(int cpu)
+{
+    if (cpu < 0)
+    {
+        X86_ENERGY_SET_ERROR("invalid cpu %d", cpu);
+        return -1;
+    }
+    pthread_mutex_lock(&msr_mutex);
+    if (reserve_handles(cpu) != 0)
+    {
+        pthread_mutex_unlock(&msr_mutex);
+        return -1;
+    }
+    struct msr_handle* handle = &handles[cpu];
+    if (handle->references == 0)
+    {
+        handle->fd = open_msr(cpu, O_RDONLY | O_CLOEXEC);
+        if (handle->fd < 0)
+        {
+            pthread_mutex_unlock(&msr_mutex);
+            X86_ENERGY_SET_ERROR("could not obtain a file descriptor for %s/%d/msr or msr_safe",
+                                 x86_energy_msr_dir(), cpu);
+            return -1;
+        }
+    }
+    handle->references++;
+    int fd = handle->fd;
+    pthread_mutex_unlock(&msr_mutex);
+    return fd;
+}
+
+void x86_energy_msr_put(int cpu)
+{
+    pthread_mutex_lock(&msr_mutex);
+    if (cpu >= 0 && cpu < nr_handles && handles[cpu].references > 0 &&
+        --handles[cpu].references == 0)
+    {
+        close(handles[cpu].fd);
+        handles[cpu].fd = -1;
+    }
+    pthread_mutex_unlock(&msr_mutex);
+}
+
+int x86_energy_msr_read(int fd, uint64_t reg, uint64_t* value)
+{
+    return pread(fd, value, 8, reg) != 8;
+}
+
+int x86_energy_msr_read_cached(int cpu, uint64_t reg, uint64_t* value)
+{
+    pthread_mutex_lock(&msr_mutex);
+    for (size_t i = 0; i < nr_cached; i++)
+        if (cached[i].reg == reg)
+        {
+            *value = cached[i].value;
+            pthread_mutex_unlock(&msr_mutex);
+            return 0;
+        }
+    pthread_mutex_unlock(&msr_mutex);
+
+    int fd = x86_energy_msr_get(cpu);
+    if (fd < 0)
+        return 1;
+    int result = x86_energy_msr_read(fd, reg, value);
+    x86_energy_msr_put(cpu);
+    if (result != 0)
+    {
+        X86_ENERGY_SET_ERROR("could not read msr 0x%llx of cpu %d", (unsigned long long)reg, cpu);
+        return 1;
+    }
+    pthread_mutex_lock(&msr_mutex);
+    if (nr_cached < MAX_CACHED_REGISTERS)
+    {
+        cached[nr_cached].reg = reg;
+        cached[nr_cached].value = *value;
+        nr_cached++;
+    }
+    pthread_mutex_unlock(&msr_mutex);
+    return 0;
+}
+
+int x86_energy_msr_write(int cpu, uint64_t reg, uint64_t value)
+{
+    int fd = open_msr(cpu, O_WRONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        X86_ENERGY_SET_ERROR("could not open %s/%d/msr or msr_safe for writing",
+                             x86_energy_msr_dir(), cpu);
+        return 1;
+    }
+    ssize_t result = pwrite(fd, &value, 8, reg);
+    close(fd);
+    if (result != 8)
+    {
+        X86_ENERGY_SET_ERROR("could not write msr 0x%llx of cpu %d", (unsigned long long)reg, cpu);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,393 @@
+/*
+ * msr_engine.c
+ *
+ *  Created on: 19.10.2026
+ */
+
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/architecture.h"
+#include "../include/error.h"
+#include "../include/hotplug.h"
+#include "../include/msr_device.h"
+#include "../include/msr_engine.h"
+#include "../include/unwrap.h"
+
+struct msr_counter
+{
+    struct x86_energy_msr_scope* scope;
+    const struct x86_energy_msr_domain* domain;
+    double unit;
+    struct x86_energy_unwrap unwrap;
+    uint64_t last_read_ns;
+};
+
+/* the counters of one node, e.g. all RAPL domains of a socket */
+struct x86_energy_msr_scope
+{
+    struct x86_energy_msr_engine* engine;
+    enum x86_energy_granularity granularity;
+    size_t index;
+    int cpu;                     /* the cpu that is read, changes if it goes offline */
+    int fd;                      /* shared msr handle of cpu */
+    int thread_cpu;              /* the cpu the overflow thread was created for */
+    uint64_t hotplug_generation; /* cpu is checked when this changes */
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    struct ov_call* ov_call;
+    size_t nr_counters;
+    struct msr_counter** counters;
+    struct x86_energy_msr_scope* next;
+};
+
+int x86_energy_msr_engine_init(struct x86_energy_msr_engine* engine)
+{
+    x86_energy_overflow_init(&engine->ov);
+    int nr_cpus = x86_energy_msr_nr_cpus();
+    if (nr_cpus < 0)
+    {
+        X86_ENERGY_APPEND_ERROR("Could not figure out maximum cpu count, errorcode %d", nr_cpus);
+        return 1;
+    }
+    /* without the watcher, scopes are still moved when a read fails */
+    engine->hotplug_acquired = x86_energy_hotplug_acquire() == 0;
+    return 0;
+}
+
+static const struct x86_energy_msr_domain* find_domain(struct x86_energy_msr_engine* engine,
+                                                       enum x86_energy_counter counter_type)
+{
+    for (size_t i = 0; i < engine->nr_domains; i++)
+        if (engine->domains[i].counter == counter_type)
+            return &engine->domains[i];
+    return NULL;
+}
+
+static double get_unit(struct x86_energy_msr_engine* engine,
+                       const struct x86_energy_msr_domain* domain, int cpu)
+{
+    if (engine->fixed_unit != NULL)
+    {
+        double unit = engine->fixed_unit(domain);
+        if (unit > 0.0)
+            return unit;
+    }
+    uint64_t value;
+    if (x86_energy_msr_read_cached(cpu, domain->unit_reg, &value) != 0)
+    {
+        X86_ENERGY_APPEND_ERROR("could not read the unit register 0x%llx",
+                                (unsigned long long)domain->unit_reg);
+        return -1.0;
+    }
+    return 1.0 / pow(2.0, (value >> domain->unit_shift) & domain->unit_mask);
+}
+
+/* a range of 0 lets 64 bit counters wrap naturally in the unwrap arithmetic */
+static uint64_t range(const struct x86_energy_msr_domain* domain)
+{
+    return domain->width >= 64 ? 0 : 1ULL << domain->width;
+}
+
+static uint64_t mask(const struct x86_energy_msr_domain* domain)
+{
+    return domain->width >= 64 ? UINT64_MAX : (1ULL << domain->width) - 1;
+}
+
+/*
+ * moves the scope to another online cpu of its node if its cpu went offline, the counters and
+ * their unwrapped state stay the same. Must be called with scope->mutex held.
+ * Returns 0 if the scope has been moved
+ */
+static int move_scope(struct x86_energy_msr_scope* scope, uint64_t generation)
+{
+    scope->hotplug_generation = generation;
+    if (x86_energy_cpu_online(scope->cpu))
+        return 1;
+    long cpu = get_test_cpu(scope->granularity, scope->index);
+    int fd = cpu < 0 ? -1 : x86_energy_msr_get(cpu);
+    if (fd < 0)
+    {
+        X86_ENERGY_APPEND_ERROR("could not move counters of offline cpu %d", scope->cpu);
+        return 1;
+    }
+    x86_energy_msr_put(scope->cpu);
+    scope->cpu = cpu;
+    scope->fd = fd;
+    return 0;
+}
+
+/* must be called with scope->mutex held */
+static void check_hotplug(struct x86_energy_msr_scope* scope)
+{
+    uint64_t generation = x86_energy_hotplug_generation();
+    if (generation != scope->hotplug_generation)
+        move_scope(scope, generation);
+}
+
+/* must be called with scope->mutex held, returns 0 on success */
+static int read_counter(struct msr_counter* counter, uint64_t now, uint64_t* total)
+{
+    struct x86_energy_msr_scope* scope = counter->scope;
+    uint64_t reading;
+    int failed = x86_energy_msr_read(scope->fd, counter->domain->reg, &reading);
+    /* the watcher might not have seen the cpu going offline yet */
+    if (failed && move_scope(scope, x86_energy_hotplug_refresh()) == 0)
+        failed = x86_energy_msr_read(scope->fd, counter->domain->reg, &reading);
+    if (failed)
+    {
+        X86_ENERGY_SET_ERROR("could not read msr 0x%llx of cpu %d",
+                             (unsigned long long)counter->domain->reg, scope->cpu);
+        return 1;
+    }
+    *total = x86_energy_unwrap(&counter->unwrap, reading & mask(counter->domain), now);
+    counter->last_read_ns = now;
+    return 0;
+}
+
+/*
+ * the overflow thread reads a scope when one of its counters has not been read for the period.
+ * Must be called with scope->mutex held.
+ */
+static void mark_scope_read(struct x86_energy_msr_scope* scope)
+{
+    if (scope->ov_call == NULL)
+        return;
+    uint64_t oldest = UINT64_MAX;
+    for (size_t i = 0; i < scope->nr_counters; i++)
+        if (scope->counters[i]->last_read_ns < oldest)
+            oldest = scope->counters[i]->last_read_ns;
+    if (oldest != UINT64_MAX)
+        __atomic_store_n(&scope->ov_call->last_read_ns, oldest, __ATOMIC_RELAXED);
+}
+
+/* called by the overflow thread */
+static double read_scope(x86_energy_single_counter_t arg)
+{
+    struct x86_energy_msr_scope* scope = arg;
+    pthread_mutex_lock(&scope->mutex);
+    check_hotplug(scope);
+    uint64_t now = x86_energy_overflow_now();
+    for (size_t i = 0; i < scope->nr_counters; i++)
+    {
+        uint64_t total;
+        read_counter(scope->counters[i], now, &total);
+    }
+    pthread_mutex_unlock(&scope->mutex);
+    return 0.0;
+}
+
+/* must be called with engine->mutex held */
+static struct x86_energy_msr_scope* get_scope(struct x86_energy_msr_engine* engine,
+                                              enum x86_energy_granularity granularity,
+                                              size_t index)
+{
+    for (struct x86_energy_msr_scope* scope = engine->scopes; scope != NULL; scope = scope->next)
+        if (scope->granularity == granularity && scope->index == index)
+            return scope;
+
+    uint64_t hotplug_generation = x86_energy_hotplug_generation();
+    long cpu = get_test_cpu(granularity, index);
+    if (cpu < 0)
+    {
+        X86_ENERGY_APPEND_ERROR("No cpu with granularity %d and index %zu", granularity, index);
+        return NULL;
+    }
+    struct x86_energy_msr_scope* scope = calloc(1, sizeof(struct x86_energy_msr_scope));
+    if (scope == NULL)
+    {
+        X86_ENERGY_SET_ERROR("could not allocate %zu bytes", sizeof(struct x86_energy_msr_scope));
+        return NULL;
+    }
+    scope->fd = x86_energy_msr_get(cpu);
+    if (scope->fd < 0)
+    {
+        free(scope);
+        return NULL;
+    }
+    scope->engine = engine;
+    scope->granularity = granularity;
+    scope->index = index;
+    scope->cpu = cpu;
+    scope->thread_cpu = cpu;
+    scope->hotplug_generation = hotplug_generation;
+    if (x86_energy_overflow_thread_create(&engine->ov, cpu, &scope->thread, &scope->mutex,
+                                          read_scope, scope, engine->overflow_us,
+                                          &scope->ov_call))
+    {
+        x86_energy_msr_put(cpu);
+        free(scope);
+        X86_ENERGY_SET_ERROR("could not create thread for cpu %ld", cpu);
+        return NULL;
+    }
+    scope->next = engine->scopes;
+    engine->scopes = scope;
+    return scope;
+}
+
+/* frees the scope if it has no counters left, must be called with engine->mutex held */
+static void put_scope(struct x86_energy_msr_scope* scope)
+{
+    if (scope->nr_counters > 0)
+        return;
+    struct x86_energy_msr_engine* engine = scope->engine;
+    for (struct x86_energy_msr_scope** pos = &engine->scopes; *pos != NULL; pos = &(*pos)->next)
+        if (*pos == scope)
+        {
+            *pos = scope->next;
+            break;
+        }
+    x86_energy_overflow_thread_remove_call(&engine->ov, scope->thread_cpu, read_scope, scope);
+    x86_energy_msr_put(scope->cpu);
+    pthread_mutex_destroy(&scope->mutex);
+    free(scope->counters);
+    free(scope);
+}
+
+x86_energy_single_counter_t x86_energy_msr_engine_setup(struct x86_energy_msr_engine* engine,
+                                                        enum x86_energy_counter counter_type,
+                                                        size_t index)
+{
+    const struct x86_energy_msr_domain* domain = find_domain(engine, counter_type);
+    if (domain == NULL)
+    {
+        X86_ENERGY_SET_ERROR("can't handle counter type %d", counter_type);
+        return NULL;
+    }
+    struct msr_counter* counter = calloc(1, sizeof(struct msr_counter));
+    if (counter == NULL)
+    {
+        X86_ENERGY_SET_ERROR("could not allocate %zu bytes", sizeof(struct msr_counter));
+        return NULL;
+    }
+    pthread_mutex_lock(&engine->mutex);
+    struct x86_energy_msr_scope* scope = get_scope(engine, domain->granularity, index);
+    if (scope == NULL)
+    {
+        pthread_mutex_unlock(&engine->mutex);
+        free(counter);
+        return NULL;
+    }
+    counter->scope = scope;
+    counter->domain = domain;
+
+    pthread_mutex_lock(&scope->mutex);
+    check_hotplug(scope);
+    counter->unit = get_unit(engine, domain, scope->cpu);
+    uint64_t reading;
+    struct msr_counter** counters =
+        realloc(scope->counters, (scope->nr_counters + 1) * sizeof(struct msr_counter*));
+    if (counters != NULL)
+        scope->counters = counters;
+    if (counter->unit <= 0.0 || counters == NULL ||
+        x86_energy_msr_read(scope->fd, domain->reg, &reading) != 0)
+    {
+        X86_ENERGY_SET_ERROR("could not set up counter type %d with msr 0x%llx on cpu %d",
+                             counter_type, (unsigned long long)domain->reg, scope->cpu);
+        pthread_mutex_unlock(&scope->mutex);
+        put_scope(scope);
+        pthread_mutex_unlock(&engine->mutex);
+        free(counter);
+        return NULL;
+    }
+    x86_energy_unwrap_init(&counter->unwrap, counter_type, range(domain), counter->unit,
+                           reading & mask(domain));
+    counter->last_read_ns = counter->unwrap.last_ns;
+    scope->counters[scope->nr_counters++] = counter;
+    pthread_mutex_unlock(&scope->mutex);
+    pthread_mutex_unlock(&engine->mutex);
+    return (x86_energy_single_counter_t)counter;
+}
+
+double x86_energy_msr_engine_read(x86_energy_single_counter_t t)
+{
+    struct msr_counter* counter = (struct msr_counter*)t;
+    struct x86_energy_msr_scope* scope = counter->scope;
+    uint64_t total;
+    pthread_mutex_lock(&scope->mutex);
+    check_hotplug(scope);
+    int failed = read_counter(counter, x86_energy_overflow_now(), &total);
+    if (!failed)
+        mark_scope_read(scope);
+    pthread_mutex_unlock(&scope->mutex);
+    return failed ? -1.0 : counter->unit * total;
+}
+
+int x86_energy_msr_engine_read_batch(size_t nr, x86_energy_single_counter_t* counters,
+                                     double* values)
+{
+    int failed = 0;
+    for (size_t i = 0; i < nr; i++)
+    {
+        struct x86_energy_msr_scope* scope = ((struct msr_counter*)counters[i])->scope;
+        /* all counters of a scope are read with its first one, at the same time */
+        bool done = false;
+        for (size_t j = 0; j < i && !done; j++)
+            done = ((struct msr_counter*)counters[j])->scope == scope;
+        if (done)
+            continue;
+        pthread_mutex_lock(&scope->mutex);
+        check_hotplug(scope);
+        uint64_t now = x86_energy_overflow_now();
+        for (size_t j = i; j < nr; j++)
+        {
+            struct msr_counter* counter = (struct msr_counter*)counters[j];
+            if (counter->scope != scope)
+                continue;
+            uint64_t total;
+            if (read_counter(counter, now, &total) == 0)
+            {
+                values[j] = counter->unit * total;
+            }
+            else
+            {
+                values[j] = -1.0;
+                failed++;
+            }
+        }
+        mark_scope_read(scope);
+        pthread_mutex_unlock(&scope->mutex);
+    }
+    return failed;
+}
+
+void x86_energy_msr_engine_close(x86_energy_single_counter_t t)
+{
+    struct msr_counter* counter = (struct msr_counter*)t;
+    struct x86_energy_msr_scope* scope = counter->scope;
+    struct x86_energy_msr_engine* engine = scope->engine;
+    pthread_mutex_lock(&engine->mutex);
+    pthread_mutex_lock(&scope->mutex);
+    for (size_t i = 0; i < scope->nr_counters; i++)
+        if (scope->counters[i] == counter)
+        {
+            memmove(&scope->counters[i], &scope->counters[i + 1],
+                    (scope->nr_counters - i - 1) * sizeof(struct msr_counter*));
+            scope->nr_counters--;
+            break;
+        }
+    pthread_mutex_unlock(&scope->mutex);
+    put_scope(scope);
+    pthread_mutex_unlock(&engine->mutex);
+    free(counter);
+}
+
+void x86_energy_msr_engine_glitch_stats(x86_energy_single_counter_t t,
+                                        x86_energy_glitch_stats_t* stats)
+{
+    struct msr_counter* counter = (struct msr_counter*)t;
+    pthread_mutex_lock(&counter->scope->mutex);
+    *stats = counter->unwrap.stats;
+    pthread_mutex_unlock(&counter->scope->mutex);
+}
+
+void x86_energy_msr_engine_fini(struct x86_energy_msr_engine* engine)
+{
+    x86_energy_overflow_thread_killall(&engine->ov);
+    x86_energy_overflow_freeall(&engine->ov);
+    if (engine->hotplug_acquired)
+        x86_energy_hotplug_release();
+    engine->hotplug_acquired = false;
+}
@@ -5,32 +5,386 @@
  *      Author: rschoene
  */
 
-#include "../../include/x86_energy.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../include/access.h"
+#include "../include/architecture.h"
+#include "../include/cpuid.h"
 #include "../include/error.h"
+#include "../include/hotplug.h"
+#include "../include/msr_device.h"
+#include "../include/overflow_thread.h"
+
+#define BUFFER_SIZE 4096
+
+/*
+ * Accumulated power of a compute unit, as read by the fam15h_power hwmon driver (family 15h model
+ * 60h and later). The average power in uW of an interval is
+ * delta(accumulator) * sample ratio * 1000 / delta(PTSC).
+ */
+#define MSR_F15H_CU_PWR_ACCUMULATOR 0xc001007a
+#define MSR_F15H_CU_MAX_PWR_ACCUMULATOR 0xc001007b
+#define MSR_F15H_PTSC 0xc0010280
+
+#define CPUID_POWER_MANAGEMENT 0x80000007
+#define CPUID_ACC_POWER_BIT (1U << 12) /* edx */
+
+/* the cpuid instruction is used if the cpuid device can not be read from the default dir */
+#define DEFAULT_MSR_DIR "/dev/cpu"
+
+/* the accumulator wraps at MaxCpuSwPwrAcc, the hwmon driver reads it at least once a second */
+#define UPDATE_RATE_US 1000000
+
+struct compute_unit
+{
+    int32_t core_id;
+    int cpu; /* changes if the cpu goes offline */
+    int fd;  /* shared msr handle of cpu, < 0 while all cpus of the compute unit are offline */
+    uint64_t max_accumulator;
+    uint64_t last_accumulator;
+    uint64_t last_ptsc;
+};
+
+struct reader_def
+{
+    size_t socket;
+    int cpu; /* first cpu of the socket, used for the overflow thread */
+    size_t nr_cus;
+    struct compute_unit* cus;
+    uint64_t last_reading_ns;
+    uint64_t hotplug_generation;
+    double energy;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    struct ov_call* ov_call;
+};
+
+static struct ov_struct msr_ov;
+
+static const char* msr_dir;
+
+/* CPUID 0x80000007 ecx, CpuPwrSampleTimeRatio */
+static uint32_t sample_ratio;
+
+static bool hotplug_acquired;
+
+static double do_read(x86_energy_single_counter_t counter);
+
+/* executes cpuid on cpu via the cpuid device, or via the instruction if the default dir is used */
+static int read_cpuid(int cpu, uint32_t leaf, uint32_t regs[4])
+{
+    char buffer[BUFFER_SIZE];
+    snprintf(buffer, BUFFER_SIZE, "%s/%d/cpuid", msr_dir, cpu);
+    int fd = open(buffer, O_RDONLY);
+    if (fd >= 0)
+    {
+        ssize_t result = pread(fd, regs, 16, leaf);
+        close(fd);
+        if (result == 16)
+            return 0;
+    }
+    if (strcmp(msr_dir, DEFAULT_MSR_DIR) != 0)
+        return 1;
+    regs[0] = leaf;
+    regs[2] = 0;
+    cpuid(&regs[0], &regs[1], &regs[2], &regs[3]);
+    return 0;
+}
 
 static int init(void)
 {
-    X86_ENERGY_SET_ERROR("Not yet implemented");
-    return 1;
+    x86_energy_overflow_init(&msr_ov);
+    msr_dir = x86_energy_msr_dir();
+
+    uint32_t regs[4];
+    if (read_cpuid(0, CPUID_POWER_MANAGEMENT, regs) != 0)
+    {
+        X86_ENERGY_SET_ERROR("could not read cpuid 0x%x from %s/0/cpuid", CPUID_POWER_MANAGEMENT,
+                             msr_dir);
+        return 1;
+    }
+    if (!(regs[3] & CPUID_ACC_POWER_BIT) || regs[2] == 0)
+    {
+        X86_ENERGY_SET_ERROR("processor does not support accumulated power (cpuid 0x%x edx 0x%x)",
+                             CPUID_POWER_MANAGEMENT, regs[3]);
+        return 1;
+    }
+    sample_ratio = regs[2];
+
+    if (x86_energy_msr_get(0) < 0)
+        return 1;
+    x86_energy_msr_put(0);
+
+    /* without the watcher, compute units are still moved when a read fails */
+    hotplug_acquired = x86_energy_hotplug_acquire() == 0;
+    return 0;
 }
-static x86_energy_single_counter_t setup(enum x86_energy_counter counter, size_t index)
+
+static x86_energy_architecture_node_t* find_socket(x86_energy_architecture_node_t* node,
+                                                   size_t index)
 {
-    X86_ENERGY_SET_ERROR("Not yet implemented");
+    if (node->granularity == X86_ENERGY_GRANULARITY_SOCKET)
+        return node->id == (int32_t)index ? node : NULL;
+    for (size_t i = 0; i < node->nr_children; i++)
+    {
+        x86_energy_architecture_node_t* found = find_socket(&node->children[i], index);
+        if (found != NULL)
+            return found;
+    }
     return NULL;
 }
-static double do_read(x86_energy_single_counter_t t)
+
+/*
+ * adds the first cpu of each core below node. Like the hwmon driver, this relies on the kernel
+ * reporting the two cores of a compute unit as one core with two threads
+ */
+static int add_compute_units(x86_energy_architecture_node_t* node, struct reader_def* def)
+{
+    if (node->granularity == X86_ENERGY_GRANULARITY_CORE)
+    {
+        int32_t core_id = node->id;
+        while (node->granularity != X86_ENERGY_GRANULARITY_THREAD)
+        {
+            if (node->nr_children == 0)
+                return 0;
+            node = node->children;
+        }
+        struct compute_unit* cus = realloc(def->cus, (def->nr_cus + 1) * sizeof(*cus));
+        if (cus == NULL)
+        {
+            X86_ENERGY_SET_ERROR("could not allocate memory for compute unit of cpu %d", node->id);
+            return 1;
+        }
+        def->cus = cus;
+        struct compute_unit* cu = &def->cus[def->nr_cus++];
+        memset(cu, 0, sizeof(*cu));
+        cu->core_id = core_id;
+        cu->cpu = node->id;
+        cu->fd = -1;
+        return 0;
+    }
+    for (size_t i = 0; i < node->nr_children; i++)
+        if (add_compute_units(&node->children[i], def) != 0)
+            return 1;
+    return 0;
+}
+
+static void free_def(struct reader_def* def)
+{
+    for (size_t i = 0; i < def->nr_cus; i++)
+        if (def->cus[i].fd >= 0)
+            x86_energy_msr_put(def->cus[i].cpu);
+    free(def->cus);
+    free(def);
+}
+
+static x86_energy_single_counter_t setup(enum x86_energy_counter counter_type, size_t index)
+{
+    if (counter_type != X86_ENERGY_COUNTER_PCKG)
+    {
+        X86_ENERGY_SET_ERROR(
+            "can't handle any other counter_type than COUNTER_PCKG, counter type %d refused",
+            counter_type);
+        return NULL;
+    }
+    struct reader_def* def = calloc(1, sizeof(struct reader_def));
+    if (def == NULL)
+    {
+        X86_ENERGY_SET_ERROR("could not allocate %zu bytes", sizeof(struct reader_def));
+        return NULL;
+    }
+    def->socket = index;
+    x86_energy_architecture_node_t* arch = x86_energy_arch_lock();
+    if (arch == NULL)
+    {
+        free_def(def);
+        return NULL;
+    }
+    x86_energy_architecture_node_t* socket = find_socket(arch, index);
+    int ret = socket != NULL ? add_compute_units(socket, def) : 1;
+    x86_energy_arch_unlock();
+    if (ret != 0 || def->nr_cus == 0)
+    {
+        X86_ENERGY_SET_ERROR("no compute units found for socket %zu", index);
+        free_def(def);
+        return NULL;
+    }
+    for (size_t i = 0; i < def->nr_cus; i++)
+    {
+        struct compute_unit* cu = &def->cus[i];
+        cu->fd = x86_energy_msr_get(cu->cpu);
+        if (cu->fd < 0)
+        {
+            free_def(def);
+            return NULL;
+        }
+        if (x86_energy_msr_read(cu->fd, MSR_F15H_CU_MAX_PWR_ACCUMULATOR, &cu->max_accumulator) ||
+            x86_energy_msr_read(cu->fd, MSR_F15H_CU_PWR_ACCUMULATOR, &cu->last_accumulator) ||
+            x86_energy_msr_read(cu->fd, MSR_F15H_PTSC, &cu->last_ptsc))
+        {
+            X86_ENERGY_SET_ERROR("could not read accumulated power msrs of cpu %d", cu->cpu);
+            free_def(def);
+            return NULL;
+        }
+    }
+    def->cpu = def->cus[0].cpu;
+    def->hotplug_generation = x86_energy_hotplug_generation();
+    def->last_reading_ns = x86_energy_overflow_now();
+    if (x86_energy_overflow_thread_create(&msr_ov, def->cpu, &def->thread, &def->mutex, do_read,
+                                          def, UPDATE_RATE_US, &def->ov_call))
+    {
+        free_def(def);
+        X86_ENERGY_SET_ERROR("could not create thread for cpu %d", def->cpu);
+        return NULL;
+    }
+    return (x86_energy_single_counter_t)def;
+}
+
+/*
+ * moves compute units whose cpu went offline to another cpu of the same core of the socket. The
+ * accumulator is shared by the cpus of a compute unit, so it continues. Compute units whose cpus
+ * are all offline do not add power until one comes back. Must be called with def->mutex held.
+ */
+static void move_compute_units(struct reader_def* def, uint64_t generation)
+{
+    def->hotplug_generation = generation;
+    for (size_t i = 0; i < def->nr_cus; i++)
+    {
+        struct compute_unit* cu = &def->cus[i];
+        if (cu->fd >= 0 && x86_energy_cpu_online(cu->cpu))
+            continue;
+        bool was_offline = cu->fd < 0;
+        if (cu->fd >= 0)
+            x86_energy_msr_put(cu->cpu);
+        cu->fd = -1;
+        long cpu = get_test_cpu_in(X86_ENERGY_GRANULARITY_SOCKET, def->socket,
+                                   X86_ENERGY_GRANULARITY_CORE, cu->core_id);
+        if (cpu < 0 || (cu->fd = x86_energy_msr_get(cpu)) < 0)
+            continue;
+        cu->cpu = cpu;
+        /* the power while the compute unit was offline is unknown, start a new interval */
+        if (was_offline &&
+            (x86_energy_msr_read(cu->fd, MSR_F15H_CU_PWR_ACCUMULATOR, &cu->last_accumulator) ||
+             x86_energy_msr_read(cu->fd, MSR_F15H_PTSC, &cu->last_ptsc)))
+        {
+            x86_energy_msr_put(cu->cpu);
+            cu->fd = -1;
+        }
+    }
+}
+
+static int read_compute_unit(struct compute_unit* cu, uint64_t* accumulator, uint64_t* ptsc)
 {
-    X86_ENERGY_SET_ERROR("Not yet implemented");
-    return -1.0;
+    return x86_energy_msr_read(cu->fd, MSR_F15H_CU_PWR_ACCUMULATOR, accumulator) ||
+           x86_energy_msr_read(cu->fd, MSR_F15H_PTSC, ptsc);
 }
-static void do_close(x86_energy_single_counter_t t)
+
+/* must be called with def->mutex held, now is the time of the read */
+static int update(struct reader_def* def, uint64_t now)
+{
+    uint64_t generation = x86_energy_hotplug_generation();
+    if (generation != def->hotplug_generation)
+        move_compute_units(def, generation);
+    double seconds = 1E-9 * (now - def->last_reading_ns);
+    double power_uW = 0.0;
+    for (size_t i = 0; i < def->nr_cus; i++)
+    {
+        struct compute_unit* cu = &def->cus[i];
+        uint64_t accumulator, ptsc;
+        if (cu->fd < 0)
+            continue;
+        int failed = read_compute_unit(cu, &accumulator, &ptsc);
+        /* the watcher might not have seen the cpu going offline yet */
+        if (failed && x86_energy_hotplug_refresh() != def->hotplug_generation)
+        {
+            move_compute_units(def, x86_energy_hotplug_generation());
+            if (cu->fd < 0)
+                continue;
+            failed = read_compute_unit(cu, &accumulator, &ptsc);
+        }
+        if (failed)
+        {
+            X86_ENERGY_SET_ERROR("could not read accumulated power msrs of cpu %d", cu->cpu);
+            return 1;
+        }
+        uint64_t delta = accumulator >= cu->last_accumulator ?
+                             accumulator - cu->last_accumulator :
+                             cu->max_accumulator - cu->last_accumulator + accumulator;
+        if (ptsc != cu->last_ptsc)
+            power_uW += (double)delta * sample_ratio * 1000 / (double)(ptsc - cu->last_ptsc);
+        cu->last_accumulator = accumulator;
+        cu->last_ptsc = ptsc;
+    }
+    def->energy += 1E-6 * power_uW * seconds;
+    def->last_reading_ns = now;
+    return 0;
+}
+
+static double do_read(x86_energy_single_counter_t counter)
+{
+    struct reader_def* def = (struct reader_def*)counter;
+    pthread_mutex_lock(&def->mutex);
+    if (update(def, x86_energy_overflow_now()) != 0)
+    {
+        pthread_mutex_unlock(&def->mutex);
+        return -1.0;
+    }
+    double energy = def->energy;
+    pthread_mutex_unlock(&def->mutex);
+    x86_energy_overflow_mark_read(def->ov_call);
+    return energy;
+}
+
+/* reads all sockets with a common timestamp */
+static int do_read_batch(size_t nr, x86_energy_single_counter_t* counters, double* values)
+{
+    int failed = 0;
+    uint64_t now = x86_energy_overflow_now();
+    for (size_t i = 0; i < nr; i++)
+    {
+        struct reader_def* def = (struct reader_def*)counters[i];
+        pthread_mutex_lock(&def->mutex);
+        if (update(def, now) != 0)
+        {
+            values[i] = -1.0;
+            failed++;
+        }
+        else
+            values[i] = def->energy;
+        pthread_mutex_unlock(&def->mutex);
+        if (values[i] >= 0.0)
+            x86_energy_overflow_mark_read(def->ov_call);
+    }
+    return failed;
+}
+
+static void do_close(x86_energy_single_counter_t counter)
+{
+    struct reader_def* def = (struct reader_def*)counter;
+    x86_energy_overflow_thread_remove_call(&msr_ov, def->cpu, do_read, counter);
+    pthread_mutex_destroy(&def->mutex);
+    free_def(def);
+}
+
+static void fini(void)
 {
+    x86_energy_overflow_thread_killall(&msr_ov);
+    x86_energy_overflow_freeall(&msr_ov);
+    if (hotplug_acquired)
+        x86_energy_hotplug_release();
+    hotplug_acquired = false;
 }
-static void fini(void){};
 
-x86_energy_access_source_t msr_fam15_source = {.name = "msr-Fam15-n/a",
+x86_energy_access_source_t msr_fam15_source = {.name = "msr-Fam15",
                                                .init = init,
                                                .setup = setup,
                                                .read = do_read,
                                                .close = do_close,
-                                               .fini = fini };
+                                               .fini = fini,
+                                               .read_batch = do_read_batch };
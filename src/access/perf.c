@@ -7,8 +7,9 @@
 
 #define _GNU_SOURCE
 
-#include <getopt.h>
+#include <dirent.h>
 #include <inttypes.h>
+#include <pthread.h>
 #include <sched.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -23,28 +24,66 @@
 #include "../include/access.h"
 #include "../include/architecture.h"
 #include "../include/error.h"
+#include "../include/threads.h"
 
+#define EVENT_SOURCE_PATH "/sys/bus/event_source/devices"
+
+#define BUFFER_SIZE 4096
+
+/* events of one pmu and cpu are read together, a group is read as nr + (value, id) pairs */
+#define MAX_GROUP_SIZE 16
+#define GROUP_BUFFER_SIZE (1 + 2 * MAX_GROUP_SIZE)
+
+/* event names are energy-<suffix>, SINGLE_CORE is provided by a core-scoped pmu (power_core) */
 static char* strings_for_events[X86_ENERGY_COUNTER_SIZE] = {
-    "pkg", "cores", "ram", "gpu", "psys",
+    "pkg", "cores", "ram", "gpu", "psys", "core",
+};
+
+/*
+ * A power-type pmu ("power", "power_core", ...). The kernel only accepts events on the cpus in
+ * cpumask, one per package for the socket-scoped pmu, one per core for the core-scoped pmu.
+ */
+struct power_pmu
+{
+    char* name;
+    int type;
+    bool has_cpumask;
+    cpu_set_t cpumask;
+};
+
+/* counters of the same pmu and cpu share a group, which is closed with its last member */
+struct perf_group
+{
+    int type;
+    int cpu;
+    int leader_fd;
+    size_t nr_members;
+    struct perf_group* next;
 };
 
 struct reader_def
 {
     int cpuId;
-    uint64_t last_reading;
-    uint64_t fd;
+    int fd;
+    uint64_t id;
     double unit;
+    struct perf_group* group;
 };
 
-static int type = 0;
+static size_t nr_pmus;
+static struct power_pmu* pmus;
+
+
+static pthread_mutex_t groups_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct perf_group* groups;
 
 /* returns < 0 as failure */
-static int get_event_id(char* suffix)
+static int get_event_id(const char* pmu, char* suffix)
 {
     char file_name_buffer[1024];
-    int ret = snprintf(file_name_buffer, 1024,
-                       "/sys/bus/event_source/devices/power/events/energy-%s", suffix);
-    if (ret < 0 || ret == 1024)
+    int ret = snprintf(file_name_buffer, 1024, EVENT_SOURCE_PATH "/%s/events/energy-%s", pmu,
+                       suffix);
+    if (ret < 0 || ret >= 1024)
     {
     	if(ret < 0) X86_ENERGY_SET_ERROR("output error while trying to assemble sysfs-path-string");
     	else        X86_ENERGY_SET_ERROR("specified suffix was too long");
@@ -62,24 +101,27 @@ static int get_event_id(char* suffix)
     fclose(fp);
     if (read <= 0)
     {
+        free(buffer);
     	X86_ENERGY_SET_ERROR("could not read any bytes from \"%s\"", file_name_buffer);
         return -1;
     }
     unsigned int result;
     if (sscanf(buffer, "event=0x%xi", &result) != 1)
     {
+        free(buffer);
     	X86_ENERGY_SET_ERROR("invalid content in file \"%s\", does not conform with mask event=0xFFFF", file_name_buffer);
-        return 1;
+        return -1;
     }
+    free(buffer);
     return result;
 }
 /* returns < 0 as failure */
-static double get_event_unit(char* suffix)
+static double get_event_unit(const char* pmu, char* suffix)
 {
     char file_name_buffer[1024];
-    int ret = snprintf(file_name_buffer, 1024,
-                       "/sys/bus/event_source/devices/power/events/energy-%s.scale", suffix);
-    if (ret < 0 || ret == 1024)
+    int ret = snprintf(file_name_buffer, 1024, EVENT_SOURCE_PATH "/%s/events/energy-%s.scale",
+                       pmu, suffix);
+    if (ret < 0 || ret >= 1024)
     {
     	if(ret < 0) X86_ENERGY_SET_ERROR("output error while trying to assemble sysfs-path-string");
     	else        X86_ENERGY_SET_ERROR("specified suffix was too long");
@@ -102,43 +144,246 @@ static double get_event_unit(char* suffix)
     return scale;
 }
 
-static int init(void)
+/* reads type and cpumask of pmu name, returns 0 if it is not a usable power pmu */
+static int add_pmu(const char* name)
 {
-    /* try to find event source and pkg event, which should be there always */
-    if (get_event_id("pkg") < 0)
+    char path[BUFFER_SIZE];
+    char buffer[BUFFER_SIZE];
+    struct power_pmu pmu;
+    memset(&pmu, 0, sizeof(pmu));
+
+    snprintf(path, BUFFER_SIZE, EVENT_SOURCE_PATH "/%s/type", name);
+    FILE* fp = fopen(path, "r");
+    if (fp == NULL)
+        return 0;
+    int result = fscanf(fp, "%d", &pmu.type);
+    fclose(fp);
+    if (result != 1)
+        return 0;
+
+    /* pmus without a cpumask accept events on every cpu */
+    snprintf(path, BUFFER_SIZE, EVENT_SOURCE_PATH "/%s/cpumask", name);
+    fp = fopen(path, "r");
+    if (fp != NULL)
     {
-    	X86_ENERGY_APPEND_ERROR("event id \"pkg\" not accessible");
+        if (fgets(buffer, BUFFER_SIZE, fp) != NULL &&
+            x86_energy_parse_cpu_list(buffer, &pmu.cpumask) == 0 && CPU_COUNT(&pmu.cpumask) > 0)
+            pmu.has_cpumask = true;
+        fclose(fp);
+    }
+
+    pmu.name = strdup(name);
+    struct power_pmu* new_pmus = realloc(pmus, (nr_pmus + 1) * sizeof(struct power_pmu));
+    if (pmu.name == NULL || new_pmus == NULL)
+    {
+        free(pmu.name);
+        X86_ENERGY_SET_ERROR("could not allocate memory for pmu %s", name);
         return 1;
     }
+    pmus = new_pmus;
+    pmus[nr_pmus++] = pmu;
+    return 0;
+}
 
-    /* try to find power perf type */
-    FILE* fp = fopen("/sys/bus/event_source/devices/power/type", "r");
-    if (fp == NULL)
+static void free_pmus(void)
+{
+    for (size_t i = 0; i < nr_pmus; i++)
+        free(pmus[i].name);
+    free(pmus);
+    pmus = NULL;
+    nr_pmus = 0;
+}
+
+/* returns the first pmu that provides the event for counter_type or NULL */
+static struct power_pmu* find_pmu(enum x86_energy_counter counter_type)
+{
+    char path[BUFFER_SIZE];
+    for (size_t i = 0; i < nr_pmus; i++)
+    {
+        snprintf(path, BUFFER_SIZE, EVENT_SOURCE_PATH "/%s/events/energy-%s", pmus[i].name,
+                 strings_for_events[counter_type]);
+        if (access(path, R_OK) == 0)
+            return &pmus[i];
+    }
+    return NULL;
+}
+
+static int init(void)
+{
+    DIR* dir = opendir(EVENT_SOURCE_PATH);
+    if (dir == NULL)
     {
-    	X86_ENERGY_SET_ERROR("could not obtain file pointer to file \"/sys/bus/event_source/devices/power/type\"");
+        X86_ENERGY_SET_ERROR("could not open \"%s\"", EVENT_SOURCE_PATH);
         return 1;
     }
-    if (fscanf(fp, "%d", &type) != 1)
+    struct dirent* entry;
+    int ret = 0;
+    while (ret == 0 && (entry = readdir(dir)) != NULL)
+        if (strcmp(entry->d_name, "power") == 0 || strncmp(entry->d_name, "power_", 6) == 0)
+            ret = add_pmu(entry->d_name);
+    closedir(dir);
+    if (ret != 0)
     {
-        fclose(fp);
-        X86_ENERGY_SET_ERROR("file \"/sys/bus/event_source/devices/power/type\" does not contain a single number");
+        free_pmus();
+        return 1;
+    }
+
+    /* try to find a pmu with the pkg or per-core event, one should be there always */
+    if (find_pmu(X86_ENERGY_COUNTER_PCKG) == NULL &&
+        find_pmu(X86_ENERGY_COUNTER_SINGLE_CORE) == NULL)
+    {
+        free_pmus();
+        X86_ENERGY_SET_ERROR("no power pmu in \"%s\" provides energy-pkg or energy-core",
+                             EVENT_SOURCE_PATH);
         return 1;
     }
-    fclose(fp);
     return 0;
 }
 
-static x86_energy_single_counter_t setup(enum x86_energy_counter counter_type, size_t index)
+/* returns the cpu of the pmu's cpumask that is part of node index of granularity, < 0 on error */
+static int find_cpu(struct power_pmu* pmu, enum x86_energy_granularity granularity, size_t index)
 {
-    int cpu = get_test_cpu(X86_ENERGY_GRANULARITY_SOCKET, index);
+    if (granularity == X86_ENERGY_GRANULARITY_SYSTEM)
+    {
+        if (pmu->has_cpumask)
+            for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+                if (CPU_ISSET(cpu, &pmu->cpumask))
+                    return cpu;
+        granularity = X86_ENERGY_GRANULARITY_SOCKET;
+    }
+    long test_cpu = get_test_cpu(granularity, index);
+    if (test_cpu < 0)
+    {
+        X86_ENERGY_APPEND_ERROR("could not find a cpu for node %zu", index);
+        return -1;
+    }
+    if (!pmu->has_cpumask || (test_cpu < CPU_SETSIZE && CPU_ISSET(test_cpu, &pmu->cpumask)))
+        return test_cpu;
+
+    /* the shared tree also contains cpus that came online after init */
+    x86_energy_architecture_node_t* arch = x86_energy_arch_lock();
+    if (arch == NULL)
+        return -1;
+    x86_energy_architecture_node_t* node =
+        x86_energy_find_arch_for_cpu(arch, granularity, test_cpu);
+    for (int cpu = 0; cpu < CPU_SETSIZE && node != NULL; cpu++)
+        if (CPU_ISSET(cpu, &pmu->cpumask) &&
+            x86_energy_find_arch_for_cpu(arch, granularity, cpu) == node)
+        {
+            x86_energy_arch_unlock();
+            return cpu;
+        }
+    x86_energy_arch_unlock();
+    X86_ENERGY_SET_ERROR("no cpu of the cpumask of pmu %s belongs to the node of cpu %ld",
+                         pmu->name, test_cpu);
+    return -1;
+}
 
+static int perf_event_open(struct perf_event_attr* attr, int cpu, int group_fd)
+{
+    return syscall(__NR_perf_event_open, attr, -1, cpu, group_fd, 0);
+}
+
+/*
+ * opens the event in a group of type and cpu, or as leader of a new group if there is none or the
+ * pmu refuses grouping. Must be called with groups_mutex held. Returns the fd, < 0 on error
+ */
+static int open_in_group(struct perf_event_attr* attr, int cpu, struct perf_group** group)
+{
+    for (struct perf_group* current = groups; current != NULL; current = current->next)
+    {
+        if (current->type != (int)attr->type || current->cpu != cpu ||
+            current->nr_members == MAX_GROUP_SIZE)
+            continue;
+        int fd = perf_event_open(attr, cpu, current->leader_fd);
+        if (fd >= 0)
+        {
+            current->nr_members++;
+            *group = current;
+            return fd;
+        }
+    }
+    struct perf_group* new_group = malloc(sizeof(struct perf_group));
+    if (new_group == NULL)
+    {
+        X86_ENERGY_SET_ERROR("could not allocate %zu bytes", sizeof(struct perf_group));
+        return -1;
+    }
+    int fd = perf_event_open(attr, cpu, -1);
+    if (fd < 0)
+    {
+        free(new_group);
+        X86_ENERGY_SET_ERROR("could not perform syscall to perf_event_open (pid=-1, cpu=%d)", cpu);
+        return -1;
+    }
+    new_group->type = attr->type;
+    new_group->cpu = cpu;
+    new_group->leader_fd = fd;
+    new_group->nr_members = 1;
+    new_group->next = groups;
+    groups = new_group;
+    *group = new_group;
+    return fd;
+}
+
+/* must be called with groups_mutex held */
+static void leave_group(struct perf_group* group, int fd)
+{
+    /* the leader stays open while there are members, closing it would split the group */
+    if (fd != group->leader_fd)
+        close(fd);
+    if (--group->nr_members > 0)
+        return;
+    close(group->leader_fd);
+    for (struct perf_group** current = &groups; *current != NULL; current = &(*current)->next)
+        if (*current == group)
+        {
+            *current = group->next;
+            break;
+        }
+    free(group);
+}
+
+/* reads all members of the group to buffer, returns the number of values, < 0 on error */
+static int read_group(struct perf_group* group, uint64_t* buffer)
+{
+    ssize_t result = read(group->leader_fd, buffer, GROUP_BUFFER_SIZE * sizeof(uint64_t));
+    if (result < (ssize_t)sizeof(uint64_t) ||
+        (size_t)result < (1 + 2 * buffer[0]) * sizeof(uint64_t))
+    {
+        X86_ENERGY_SET_ERROR("could not read perf group of cpu %d", group->cpu);
+        return -1;
+    }
+    return buffer[0];
+}
+
+/* returns the value of def from a group read, < 0 if it is not contained */
+static double value_of(struct reader_def* def, const uint64_t* buffer, int nr)
+{
+    for (int i = 0; i < nr; i++)
+        if (buffer[2 + 2 * i] == def->id)
+            return buffer[1 + 2 * i] * def->unit;
+    X86_ENERGY_SET_ERROR("perf event %" PRIu64 " is missing in the group of cpu %d", def->id,
+                         def->cpuId);
+    return -1.0;
+}
+
+static x86_energy_single_counter_t setup(enum x86_energy_counter counter_type, size_t index)
+{
+    enum x86_energy_granularity granularity;
     switch (counter_type)
     {
     case X86_ENERGY_COUNTER_PCKG:  /* fall-through */
     case X86_ENERGY_COUNTER_CORES: /* fall-through */
     case X86_ENERGY_COUNTER_DRAM:  /* fall-through */
-    case X86_ENERGY_COUNTER_GPU:   /* fall-through */
+    case X86_ENERGY_COUNTER_GPU:
+        granularity = X86_ENERGY_GRANULARITY_SOCKET;
+        break;
     case X86_ENERGY_COUNTER_PLATFORM:
+        granularity = X86_ENERGY_GRANULARITY_SYSTEM;
+        break;
+    case X86_ENERGY_COUNTER_SINGLE_CORE:
+        granularity = X86_ENERGY_GRANULARITY_CORE;
         break;
     default:
         X86_ENERGY_SET_ERROR("can't handle counter_type %d", counter_type);
@@ -146,75 +391,125 @@ static x86_energy_single_counter_t setup(enum x86_energy_counter counter_type, s
     }
 
     char* suffix = strings_for_events[counter_type];
-    if (suffix == NULL)
+    struct power_pmu* pmu = find_pmu(counter_type);
+    if (pmu == NULL)
     {
-        X86_ENERGY_SET_ERROR("can't handle counter type counter size");
+        X86_ENERGY_SET_ERROR("no power pmu provides event \"energy-%s\"", suffix);
         return NULL;
     }
 
-    int event_id = get_event_id(suffix);
+    int event_id = get_event_id(pmu->name, suffix);
     if (event_id < 0)
     {
-    	X86_ENERGY_SET_ERROR("could not obtain event_id for event suffix \"%s\"", suffix);
+    	X86_ENERGY_APPEND_ERROR("could not obtain event_id for event suffix \"%s\"", suffix);
         return NULL;
     }
-    double unit = get_event_unit(suffix);
+    double unit = get_event_unit(pmu->name, suffix);
     if (unit < 0.0)
     {
-    	X86_ENERGY_SET_ERROR("could not read unit for event suffix \"%s\"", suffix);
+    	X86_ENERGY_APPEND_ERROR("could not read unit for event suffix \"%s\"", suffix);
         return NULL;
     }
+    int cpu = find_cpu(pmu, granularity, index);
+    if (cpu < 0)
+        return NULL;
 
-    struct perf_event_attr attr;
-    memset(&attr, 0, sizeof(struct perf_event_attr));
-    attr.type = type;
-    attr.config = event_id;
-    int fd = syscall(__NR_perf_event_open, &attr, -1, cpu, -1, 0);
-    if (fd <= 0)
+    struct reader_def* def = malloc(sizeof(struct reader_def));
+    if (def == NULL)
     {
-    	X86_ENERGY_SET_ERROR("could not perform syscall to perf_event_open (pid=-1, cpu=%d)", cpu);
+    	X86_ENERGY_SET_ERROR("could not allocate %zu bytes of memory", sizeof(struct reader_def));
         return NULL;
     }
 
-    struct reader_def* def = malloc(sizeof(struct reader_def));
-    if (def == NULL)
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(struct perf_event_attr));
+    attr.size = sizeof(struct perf_event_attr);
+    attr.type = pmu->type;
+    attr.config = event_id;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_ID;
+
+    pthread_mutex_lock(&groups_mutex);
+    def->fd = open_in_group(&attr, cpu, &def->group);
+    if (def->fd < 0)
     {
-    	X86_ENERGY_SET_ERROR("could not allocate %d bytes of memory", sizeof(struct reader_def));
+        pthread_mutex_unlock(&groups_mutex);
+        free(def);
         return NULL;
     }
-    uint64_t reading;
-    if (read(fd, &reading, 8) != 8)
+    if (ioctl(def->fd, PERF_EVENT_IOC_ID, &def->id) != 0)
     {
-        close(fd);
-        X86_ENERGY_SET_ERROR("could not read the first 8 bytes from perf_event_open stream");
+        leave_group(def->group, def->fd);
+        pthread_mutex_unlock(&groups_mutex);
+        free(def);
+        X86_ENERGY_SET_ERROR("could not get the id of perf event on cpu %d", cpu);
         return NULL;
     }
-    def->fd = fd;
+    pthread_mutex_unlock(&groups_mutex);
     def->cpuId = cpu;
     def->unit = unit;
+
+    uint64_t buffer[GROUP_BUFFER_SIZE];
+    int nr = read_group(def->group, buffer);
+    if (nr < 0 || value_of(def, buffer, nr) < 0.0)
+    {
+        pthread_mutex_lock(&groups_mutex);
+        leave_group(def->group, def->fd);
+        pthread_mutex_unlock(&groups_mutex);
+        free(def);
+        X86_ENERGY_APPEND_ERROR("could not read the first value of perf event on cpu %d", cpu);
+        return NULL;
+    }
     return (x86_energy_single_counter_t)def;
 }
 
 static double do_read(x86_energy_single_counter_t counter)
 {
-    uint64_t reading;
+    uint64_t buffer[GROUP_BUFFER_SIZE];
     struct reader_def* def = (struct reader_def*)counter;
-    if (read(def->fd, &reading, 8) != 8)
-    {
-    	X86_ENERGY_SET_ERROR("could not read 8 bytes");
+    int nr = read_group(def->group, buffer);
+    if (nr < 0)
         return -1.0;
+    return value_of(def, buffer, nr);
+}
+
+/* reads each group once, e.g., pkg, cores and ram of a socket with a single read */
+static int do_read_batch(size_t nr, x86_energy_single_counter_t* counters, double* values)
+{
+    int failed = 0;
+    uint64_t buffer[GROUP_BUFFER_SIZE];
+    for (size_t i = 0; i < nr; i++)
+    {
+        struct perf_group* group = ((struct reader_def*)counters[i])->group;
+        bool done = false;
+        for (size_t j = 0; j < i && !done; j++)
+            done = ((struct reader_def*)counters[j])->group == group;
+        if (done)
+            continue;
+        int nr_values = read_group(group, buffer);
+        for (size_t j = i; j < nr; j++)
+        {
+            struct reader_def* def = (struct reader_def*)counters[j];
+            if (def->group != group)
+                continue;
+            values[j] = nr_values < 0 ? -1.0 : value_of(def, buffer, nr_values);
+            if (values[j] < 0.0)
+                failed++;
+        }
     }
-    return reading * def->unit;
+    return failed;
 }
 
 static void do_close(x86_energy_single_counter_t counter)
 {
     struct reader_def* def = (struct reader_def*)counter;
-    close(def->fd);
+    pthread_mutex_lock(&groups_mutex);
+    leave_group(def->group, def->fd);
+    pthread_mutex_unlock(&groups_mutex);
     free(def);
 }
 static void fini(void)
 {
+    free_pmus();
 }
 
 x86_energy_access_source_t perf_source = {.name = "perf-rapl",
@@ -222,4 +517,5 @@ x86_energy_access_source_t perf_source = {.name = "perf-rapl",
                                           .setup = setup,
                                           .read = do_read,
                                           .close = do_close,
-                                          .fini = fini };
+                                          .fini = fini,
+                                          .read_batch = do_read_batch };
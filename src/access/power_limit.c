@@ -0,0 +1,49 @@
+/*
+ * power_limit.c
+ *
+ *  Created on: 19.10.2026
+ */
+
+#include <stdbool.h>
+
+#include "../include/error.h"
+
+static int check(x86_energy_access_source_t* source, enum x86_energy_counter counter,
+                 enum x86_energy_power_limit_constraint constraint, bool supported)
+{
+    if (!supported)
+    {
+        X86_ENERGY_SET_ERROR("source %s does not support power limits", source->name);
+        return 1;
+    }
+    if (!x86_energy_counter_is_energy(counter) || constraint < 0 ||
+        constraint >= X86_ENERGY_POWER_LIMIT_SIZE)
+    {
+        X86_ENERGY_SET_ERROR("invalid counter %d or constraint %d", counter, constraint);
+        return 1;
+    }
+    return 0;
+}
+
+int x86_energy_get_power_limit(x86_energy_access_source_t* source, enum x86_energy_counter counter,
+                               size_t index, enum x86_energy_power_limit_constraint constraint,
+                               x86_energy_power_limit_t* limit)
+{
+    if (check(source, counter, constraint, source->get_power_limit != NULL) != 0)
+        return 1;
+    return source->get_power_limit(counter, index, constraint, limit);
+}
+
+int x86_energy_set_power_limit(x86_energy_access_source_t* source, enum x86_energy_counter counter,
+                               size_t index, enum x86_energy_power_limit_constraint constraint,
+                               x86_energy_power_limit_t* limit, int flags)
+{
+    if (check(source, counter, constraint, source->set_power_limit != NULL) != 0)
+        return 1;
+    if (limit->power < 0.0)
+    {
+        X86_ENERGY_SET_ERROR("invalid power limit %f W", limit->power);
+        return 1;
+    }
+    return source->set_power_limit(counter, index, constraint, limit, flags);
+}
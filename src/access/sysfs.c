@@ -8,7 +8,9 @@
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <math.h>
 #include <pthread.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -19,6 +21,7 @@
 #include "../include/architecture.h"
 #include "../include/error.h"
 #include "../include/overflow_thread.h"
+#include "../include/unwrap.h"
 
 #define RAPL_PATH "/sys/class/powercap"
 
@@ -28,12 +31,11 @@ struct reader_def
 {
     FILE* fp;
     int package;
-    long long int last_reading;
-    long long int overflow;
-    long long int max;
+    struct x86_energy_unwrap unwrap; /* in uJ, wraps at max_energy_range_uj */
     int cpu;
     pthread_t thread;
     pthread_mutex_t mutex;
+    struct ov_call* ov_call;
 };
 
 static struct ov_struct sysfs_ov;
@@ -42,7 +44,7 @@ static double do_read(x86_energy_single_counter_t counter);
 
 static int init()
 {
-    memset(&sysfs_ov, 0, sizeof(struct ov_struct));
+    x86_energy_overflow_init(&sysfs_ov);
     DIR* test = opendir(RAPL_PATH);
     if (test != NULL)
     {
@@ -82,6 +84,103 @@ static int init()
     return 1;
 }
 
+/* reads the first line of RAPL_PATH/<zone>/<file> without the newline, returns 0 on success */
+static int read_zone_file(const char* zone, const char* file, char* buffer, size_t size)
+{
+    char file_name_buffer[2048];
+    snprintf(file_name_buffer, sizeof(file_name_buffer), "%s/%s/%s", RAPL_PATH, zone, file);
+    FILE* fp = fopen(file_name_buffer, "r");
+    if (fp == NULL)
+        return 1;
+    char* result = fgets(buffer, size, fp);
+    fclose(fp);
+    if (result == NULL)
+        return 1;
+    buffer[strcspn(buffer, "\n")] = '\0';
+    return 0;
+}
+
+static int read_zone_value(const char* zone, const char* file, long long int* value)
+{
+    char buffer[64];
+    if (read_zone_file(zone, file, buffer, sizeof(buffer)) != 0)
+        return 1;
+    char* end;
+    *value = strtoll(buffer, &end, 10);
+    return end == buffer;
+}
+
+static int write_zone_value(const char* zone, const char* file, long long int value)
+{
+    char file_name_buffer[2048];
+    snprintf(file_name_buffer, sizeof(file_name_buffer), "%s/%s/%s", RAPL_PATH, zone, file);
+    FILE* fp = fopen(file_name_buffer, "w");
+    if (fp == NULL)
+    {
+        X86_ENERGY_SET_ERROR("could not open \"%s\" for writing", file_name_buffer);
+        return 1;
+    }
+    int failed = fprintf(fp, "%lld\n", value) < 0;
+    failed |= fclose(fp) != 0;
+    if (failed)
+        X86_ENERGY_SET_ERROR("could not write %lld to \"%s\"", value, file_name_buffer);
+    return failed;
+}
+
+/*
+ * finds the powercap zone (e.g. "intel-rapl:0:1") of a counter in RAPL_PATH. Packages are
+ * identified by the name "package-<index>" of intel-rapl:<N>, sub-zones by their name.
+ * Returns 0 on success.
+ */
+static int find_zone(enum x86_energy_counter counter_type, size_t index, char* zone, size_t size)
+{
+    const char* name = sysfs_names[counter_type];
+    struct dirent** namelist;
+    int total_files = scandir(RAPL_PATH, &namelist, NULL, alphasort);
+    if (total_files < 0)
+    {
+        X86_ENERGY_SET_ERROR("can't open RAPL_PATH (%s)", RAPL_PATH);
+        return 1;
+    }
+    bool found = false;
+    for (int n = total_files - 1; n >= 0 && !found; n--)
+    {
+        int package;
+        int dummy;
+        // first we go through all
+        // /sys/class/powercap/intel-rapl\:<N> and /sys/class/powercap/intel-rapl\:<N>:<M>
+        if (sscanf(namelist[n]->d_name, "intel-rapl:%d:%d", &package, &dummy) <= 0)
+            continue;
+        // now we verify that we are using the correct package in
+        // /sys/class/powercap/intel-rapl\:<N>/name, the content should be package-N
+        char package_zone[64];
+        char buffer[256];
+        snprintf(package_zone, sizeof(package_zone), "intel-rapl:%d", package);
+        if (read_zone_file(package_zone, "name", buffer, sizeof(buffer)) != 0 ||
+            strncmp(buffer, "package-", 8) != 0)
+            break;
+        // not the package we were looking for?
+        if (strtol(&buffer[8], NULL, 10) != (long)index)
+            continue;
+        if (read_zone_file(namelist[n]->d_name, "name", buffer, sizeof(buffer)) != 0)
+            break;
+        // packages have indices
+        if (strncmp(buffer, "package", 7) == 0)
+            buffer[7] = '\0';
+        if (strcmp(name, buffer) == 0)
+        {
+            snprintf(zone, size, "%s", namelist[n]->d_name);
+            found = true;
+        }
+    }
+    for (int n = 0; n < total_files; n++)
+        free(namelist[n]);
+    free(namelist);
+    if (!found)
+        X86_ENERGY_SET_ERROR("no powercap zone %s with index %zu in %s", name, index, RAPL_PATH);
+    return !found;
+}
+
 static x86_energy_single_counter_t setup(enum x86_energy_counter counter_type, size_t index)
 {
     switch (counter_type)
@@ -115,116 +214,26 @@ static x86_energy_single_counter_t setup(enum x86_energy_counter counter_type, s
         }
     }
     int given_package = index;
-    char* name = sysfs_names[counter_type];
-    struct dirent** namelist;
-    int n, ret, total_files, read_items=0;
+    char zone[256];
     char file_name_buffer[2048];
-    FILE* final_fp = NULL;
+    int ret;
+    if (find_zone(counter_type, index, zone, sizeof(zone)) != 0)
+        return NULL;
+    sprintf(file_name_buffer, RAPL_PATH "/%s/max_energy_range_uj", zone);
     long long int final_max = -1;
-
-    DIR* test = opendir(RAPL_PATH);
-    if (test != NULL)
+    FILE* fp = fopen(file_name_buffer, "r");
+    if (fp != NULL)
     {
-        closedir(test);
-
-        n = total_files = scandir(RAPL_PATH, &namelist, NULL, alphasort);
-
-        while (n--)
-        {
-            int package;
-            int dummy;
-            // first we go through all
-            // /sys/class/powercap/intel-rapl\:<N> and /sys/class/powercap/intel-rapl\:<N>:<M>
-            read_items = sscanf(namelist[n]->d_name, "intel-rapl:%d:%d", &package, &dummy);
-            if (read_items <= 0)
-                continue;
-            // now we verify that we are using the correct package in
-            // /sys/class/powercap/intel-rapl\:<N>/name
-            sprintf(file_name_buffer, "%s/intel-rapl:%d/name", RAPL_PATH, package);
-            FILE* fp = fopen(file_name_buffer, "r");
-            if (fp == NULL)
-                break;
-            char* buffer = NULL;
-            size_t len = 0;
-            int read = getline(&buffer, &len, fp);
-            fclose(fp);
-            if (read <= 0)
-            {
-                break;
-            }
-            // remove \n
-            buffer[strlen(buffer) - 1] = '\0';
-            // the content should be package-N
-            if (strncmp(buffer, "package", 7) != 0)
-                break;
-            // try to read real package
-            errno = 0;
-            package = strtol(&buffer[8], NULL, 10);
-            if (package == 0 && errno != 0)
-                break;
-            // not the package we were looking for?
-            if (package != given_package)
-                continue;
-            sprintf(file_name_buffer, "%s/%s/name", RAPL_PATH, namelist[n]->d_name);
-            fp = fopen(file_name_buffer, "r");
-            if (fp == NULL)
-                break;
-
-            buffer = NULL;
-            len = 0;
-            read = getline(&buffer, &len, fp);
-            fclose(fp);
-            if (read <= 0)
-            {
-                break;
-            }
-            // remove \n
-            buffer[strlen(buffer) - 1] = '\0';
-            // packages have indices
-            if (strncmp(buffer, "package", 7) == 0)
-                buffer[7] = '\0';
-
-            if (strcmp(name, buffer) == 0)
-            {
-                sprintf(file_name_buffer, RAPL_PATH "/%s/energy_uj", namelist[n]->d_name);
-                final_fp = fopen(file_name_buffer, "r");
-                if (final_fp <= 0)
-                    break;
-                sprintf(file_name_buffer, RAPL_PATH "/%s/max_energy_range_uj", namelist[n]->d_name);
-                fp = fopen(file_name_buffer, "r");
-                if (fp == NULL)
-                    break;
-                long long int max;
-                int read = fscanf(fp, "%llu", &max);
-                fclose(fp);
-                if (read == 0)
-                    break;
-                final_max = max;
-                break;
-            }
-        }
-        for (n = 0; n < total_files; n++)
-            free(namelist[n]);
-        free(namelist);
-    }
-    else
-    {
-        X86_ENERGY_SET_ERROR("can't open RAPL_PATH (%s)", RAPL_PATH);
-        return NULL;
+        if (fscanf(fp, "%llu", &final_max) != 1)
+            final_max = -1;
+        fclose(fp);
     }
-
+    sprintf(file_name_buffer, RAPL_PATH "/%s/energy_uj", zone);
+    FILE* final_fp = fopen(file_name_buffer, "r");
     if (final_fp == NULL)
     {
-        if ( read_items <= 0 )
-        {
-            X86_ENERGY_SET_ERROR("No valid files found in " RAPL_PATH);
-            return NULL;
-        }
-        else
-        {
-            X86_ENERGY_SET_ERROR("could not get a file pointer to \"%s\"", file_name_buffer);
-            return NULL;
-        }
+        X86_ENERGY_SET_ERROR("could not get a file pointer to \"%s\"", file_name_buffer);
+        return NULL;
     }
 
     if (final_max == -1)
@@ -258,12 +267,10 @@ static x86_energy_single_counter_t setup(enum x86_energy_counter counter_type, s
     struct reader_def* def = malloc(sizeof(struct reader_def));
     def->fp = final_fp;
     def->cpu = cpu;
-    def->max = final_max;
     def->package = given_package;
-    def->last_reading = last_reading;
-    def->overflow = 0;
+    x86_energy_unwrap_init(&def->unwrap, counter_type, final_max, 1.0E-6, last_reading);
     if (x86_energy_overflow_thread_create(&sysfs_ov, cpu, &def->thread, &def->mutex, do_read, def,
-                                          30000000))
+                                          30000000, &def->ov_call))
     {
         fclose(final_fp);
         free(def);
@@ -299,14 +306,11 @@ static double do_read(x86_energy_single_counter_t counter)
             def->cpu);
         return -1.0;
     }
-    if (reading < def->last_reading)
-    {
-        def->overflow += 1;
-    }
-    def->last_reading = reading;
+    uint64_t total = x86_energy_unwrap(&def->unwrap, reading, x86_energy_overflow_now());
     pthread_mutex_unlock(&def->mutex);
+    x86_energy_overflow_mark_read(def->ov_call);
 
-    return 1.0E-6 * (def->overflow * def->max + def->last_reading);
+    return 1.0E-6 * total;
 }
 
 static void do_close(x86_energy_single_counter_t counter)
@@ -317,9 +321,147 @@ static void do_close(x86_energy_single_counter_t counter)
     free(def);
 }
 
+static void glitch_stats(x86_energy_single_counter_t counter, x86_energy_glitch_stats_t* stats)
+{
+    struct reader_def* def = (struct reader_def*)counter;
+    pthread_mutex_lock(&def->mutex);
+    *stats = def->unwrap.stats;
+    pthread_mutex_unlock(&def->mutex);
+}
+
+static const char* constraint_names[X86_ENERGY_POWER_LIMIT_SIZE] = { "long_term", "short_term" };
+
+/* serializes read-modify-write cycles of constraints */
+static pthread_mutex_t limit_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* finds the zone and the number of the constraint with the given name, returns 0 on success */
+static int find_constraint(enum x86_energy_counter counter_type, size_t index,
+                           enum x86_energy_power_limit_constraint constraint, char* zone,
+                           size_t size, int* number)
+{
+    if (find_zone(counter_type, index, zone, size) != 0)
+        return 1;
+    for (int i = 0;; i++)
+    {
+        char file[64];
+        char buffer[64];
+        snprintf(file, sizeof(file), "constraint_%d_name", i);
+        if (read_zone_file(zone, file, buffer, sizeof(buffer)) != 0)
+            break;
+        if (strcmp(buffer, constraint_names[constraint]) == 0)
+        {
+            *number = i;
+            return 0;
+        }
+    }
+    X86_ENERGY_SET_ERROR("powercap zone %s has no %s constraint", zone,
+                         constraint_names[constraint]);
+    return 1;
+}
+
+static int read_constraint(const char* zone, int number, const char* item, long long int* value)
+{
+    char file[64];
+    snprintf(file, sizeof(file), "constraint_%d_%s", number, item);
+    if (read_zone_value(zone, file, value) != 0)
+    {
+        X86_ENERGY_SET_ERROR("could not read %s of powercap zone %s", file, zone);
+        return 1;
+    }
+    return 0;
+}
+
+static int write_constraint(const char* zone, int number, const char* item, long long int value)
+{
+    char file[64];
+    snprintf(file, sizeof(file), "constraint_%d_%s", number, item);
+    return write_zone_value(zone, file, value);
+}
+
+/*
+ * powercap has no lock bit, a locked limit fails to be written. enabled belongs to the zone, so it
+ * is the same for both constraints
+ */
+static int get_power_limit(enum x86_energy_counter counter_type, size_t index,
+                           enum x86_energy_power_limit_constraint constraint,
+                           x86_energy_power_limit_t* limit)
+{
+    char zone[256];
+    int number;
+    long long int power_uw, window_us, enabled;
+    if (find_constraint(counter_type, index, constraint, zone, sizeof(zone), &number) != 0 ||
+        read_constraint(zone, number, "power_limit_uw", &power_uw) != 0 ||
+        read_constraint(zone, number, "time_window_us", &window_us) != 0)
+        return 1;
+    if (read_zone_value(zone, "enabled", &enabled) != 0)
+        enabled = 1;
+    limit->power = 1.0E-6 * power_uw;
+    limit->time_window = 1.0E-6 * window_us;
+    limit->enabled = enabled != 0;
+    limit->locked = 0;
+    return 0;
+}
+
+static int set_power_limit(enum x86_energy_counter counter_type, size_t index,
+                           enum x86_energy_power_limit_constraint constraint,
+                           x86_energy_power_limit_t* limit, int flags)
+{
+    char zone[256];
+    int number;
+    if (find_constraint(counter_type, index, constraint, zone, sizeof(zone), &number) != 0)
+        return 1;
+    long long int power_uw = llround(1.0E6 * limit->power);
+    long long int max_power_uw;
+    if (read_constraint(zone, number, "max_power_uw", &max_power_uw) == 0 && max_power_uw > 0 &&
+        power_uw > max_power_uw)
+    {
+        X86_ENERGY_SET_ERROR("power limit %f W exceeds the maximum of %f W", limit->power,
+                             1.0E-6 * max_power_uw);
+        return 1;
+    }
+
+    /* powercap only enables whole zones, which would also switch the other constraint */
+    long long int zone_enabled;
+    if (read_zone_value(zone, "enabled", &zone_enabled) != 0)
+        zone_enabled = 1;
+    if ((limit->enabled != 0) != (zone_enabled != 0))
+    {
+        X86_ENERGY_SET_ERROR("powercap zone %s can not %s the %s constraint alone", zone,
+                             limit->enabled ? "enable" : "disable", constraint_names[constraint]);
+        return 1;
+    }
+
+    pthread_mutex_lock(&limit_mutex);
+    long long int window_us;
+    if (limit->time_window > 0.0)
+        window_us = llround(1.0E6 * limit->time_window);
+    else if (read_constraint(zone, number, "time_window_us", &window_us) != 0)
+    {
+        pthread_mutex_unlock(&limit_mutex);
+        return 1;
+    }
+    /* the driver rounds to what the hardware can represent, read back what it applied */
+    if (!(flags & X86_ENERGY_POWER_LIMIT_DRY_RUN) &&
+        (write_constraint(zone, number, "time_window_us", window_us) != 0 ||
+         write_constraint(zone, number, "power_limit_uw", power_uw) != 0 ||
+         read_constraint(zone, number, "power_limit_uw", &power_uw) != 0 ||
+         read_constraint(zone, number, "time_window_us", &window_us) != 0))
+    {
+        pthread_mutex_unlock(&limit_mutex);
+        return 1;
+    }
+    pthread_mutex_unlock(&limit_mutex);
+    limit->power = 1.0E-6 * power_uw;
+    limit->time_window = 1.0E-6 * window_us;
+    limit->enabled = zone_enabled != 0;
+    limit->locked = 0;
+    return 0;
+}
+
 static void fini()
 {
     x86_energy_overflow_thread_killall(&sysfs_ov);
+    x86_energy_overflow_freeall(&sysfs_ov);
 }
 
 x86_energy_access_source_t sysfs_source = {.name = "sysfs-powercap-rapl",
@@ -327,4 +469,7 @@ x86_energy_access_source_t sysfs_source = {.name = "sysfs-powercap-rapl",
                                            .setup = setup,
                                            .read = do_read,
                                            .close = do_close,
-                                           .fini = fini };
+                                           .fini = fini,
+                                           .glitch_stats = glitch_stats,
+                                           .get_power_limit = get_power_limit,
+                                           .set_power_limit = set_power_limit };
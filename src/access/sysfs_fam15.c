@@ -9,11 +9,11 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <pthread.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/time.h>
 #include <unistd.h>
 
 #include "../include/access.h"
@@ -25,36 +25,68 @@
 #define APM_PREFIX "/hwmon/hwmon"
 #define APM_PREFIX2 "/power1_input"
 
+/*
+ * power1_input is integrated to energy with the trapezoidal rule. Counters are polled with the
+ * minimal period while the power changes and the period is doubled up to the maximum while it is
+ * stable. Both can be set with X86_ENERGY_FAM15H_POLL_US=MIN[:MAX].
+ */
+#define DEFAULT_MIN_PERIOD_US 10000
+#define DEFAULT_MAX_PERIOD_US 160000
+
+/* a change of power by more than this (in W or relative) counts as not stable */
+#define STABLE_POWER_W 0.5
+#define STABLE_POWER_RELATIVE 0.02
+
 struct reader_def
 {
     FILE* fp;
     int package;
-    struct timeval last_reading_tv;
+    uint64_t last_reading_ns;
+    double last_power;
     double energy;
+    double error_bound;
+    uint64_t period_us;
     int cpu;
     pthread_t thread;
     pthread_mutex_t mutex;
+    struct ov_call* ov_call;
 };
 
 static struct ov_struct sysfs_ov;
 
-static x86_energy_architecture_node_t* arch_info;
+
+static uint64_t min_period_us;
+static uint64_t max_period_us;
 
 static double do_read(x86_energy_single_counter_t counter);
 
+static void read_poll_periods(void)
+{
+    min_period_us = DEFAULT_MIN_PERIOD_US;
+    max_period_us = DEFAULT_MAX_PERIOD_US;
+    const char* env = getenv("X86_ENERGY_FAM15H_POLL_US");
+    if (env == NULL)
+        return;
+    unsigned long long min, max;
+    int items = sscanf(env, "%llu:%llu", &min, &max);
+    if (items < 1 || min == 0)
+        return;
+    if (items == 1)
+        max = min;
+    if (max < min)
+        return;
+    min_period_us = min;
+    max_period_us = max;
+}
+
 static int init()
 {
-    memset(&sysfs_ov, 0, sizeof(struct ov_struct));
+    x86_energy_overflow_init(&sysfs_ov);
+    read_poll_periods();
     DIR* test = opendir(APM_PATH);
     if (test != NULL)
     {
         closedir(test);
-        arch_info = x86_energy_init_architecture_nodes();
-        if (arch_info == NULL)
-        {
-            X86_ENERGY_APPEND_ERROR("could not initialize architecture");
-            return 1;
-        }
         return 0;
     }
     X86_ENERGY_SET_ERROR("call to opendir(%s) returned NULL", APM_PATH);
@@ -104,9 +136,14 @@ static x86_energy_single_counter_t setup(enum x86_energy_counter counter_type, s
             fclose(fp);
             if (ret != 1)
                 break;
+            x86_energy_architecture_node_t* arch = x86_energy_arch_lock();
+            if (arch == NULL)
+                break;
             x86_energy_architecture_node_t* package_node =
-                x86_energy_find_arch_for_cpu(arch_info, X86_ENERGY_GRANULARITY_SOCKET, cpu);
-            if (package_node == NULL || package_node->id != given_package)
+                x86_energy_find_arch_for_cpu(arch, X86_ENERGY_GRANULARITY_SOCKET, cpu);
+            bool other_package = package_node == NULL || package_node->id != given_package;
+            x86_energy_arch_unlock();
+            if (other_package)
                 continue;
 
             sprintf(file_name_buffer, APM_PATH "/%s/" APM_PREFIX "%d" APM_PREFIX2,
@@ -157,13 +194,22 @@ static x86_energy_single_counter_t setup(enum x86_energy_counter counter_type, s
     }
 
     struct reader_def* def = malloc(sizeof(struct reader_def));
+    if (def == NULL)
+    {
+        fclose(final_fp);
+        X86_ENERGY_SET_ERROR("could not allocate %zu bytes", sizeof(struct reader_def));
+        return NULL;
+    }
     def->fp = final_fp;
     def->cpu = cpu;
     def->package = given_package;
     def->energy = 0;
-    gettimeofday(&def->last_reading_tv, NULL);
+    def->error_bound = 0;
+    def->last_power = 1E-6 * last_reading;
+    def->last_reading_ns = x86_energy_overflow_now();
+    def->period_us = min_period_us;
     if (x86_energy_overflow_thread_create(&sysfs_ov, cpu, &def->thread, &def->mutex, do_read, def,
-                                          10000))
+                                          min_period_us, &def->ov_call))
     {
         fclose(final_fp);
         free(def);
@@ -178,9 +224,8 @@ static double do_read(x86_energy_single_counter_t counter)
     struct reader_def* def = (struct reader_def*)counter;
     long long power_in_uW;
     pthread_mutex_lock(&def->mutex);
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    int ret = fscanf(def->fp, "%llu", &power_in_uW);
+    uint64_t now = x86_energy_overflow_now();
+    int ret = fscanf(def->fp, "%lld", &power_in_uW);
     if (fseek(def->fp, 0, SEEK_SET) != 0)
     {
         pthread_mutex_unlock(&def->mutex);
@@ -201,14 +246,41 @@ static double do_read(x86_energy_single_counter_t counter)
             def->cpu);
         return -1.0;
     }
-    double time = 1E-6 * ((1000000 * tv.tv_sec) + tv.tv_usec - def->last_reading_tv.tv_usec -
-                          (1000000 * def->last_reading_tv.tv_sec));
+    double time = 1E-9 * (now - def->last_reading_ns);
     double power = (double)1E-6 * power_in_uW;
-    def->energy += time * power;
-    def->last_reading_tv = tv;
+    double change = power > def->last_power ? power - def->last_power : def->last_power - power;
+    def->energy += time * (def->last_power + power) / 2;
+    /* the real power was somewhere between both readings */
+    def->error_bound += time * change / 2;
+
+    /* poll fast while the power changes, slow down while it is stable */
+    uint64_t period_us = def->period_us;
+    if (change > STABLE_POWER_W || change > STABLE_POWER_RELATIVE * def->last_power)
+        period_us = min_period_us;
+    else if (period_us < max_period_us)
+        period_us = 2 * period_us < max_period_us ? 2 * period_us : max_period_us;
+    if (period_us != def->period_us)
+    {
+        def->period_us = period_us;
+        x86_energy_overflow_set_period(def->ov_call, 1000 * period_us);
+    }
+
+    def->last_power = power;
+    def->last_reading_ns = now;
+    double energy = def->energy;
     pthread_mutex_unlock(&def->mutex);
+    x86_energy_overflow_mark_read(def->ov_call);
 
-    return def->energy;
+    return energy;
+}
+
+static double get_error_bound(x86_energy_single_counter_t counter)
+{
+    struct reader_def* def = (struct reader_def*)counter;
+    pthread_mutex_lock(&def->mutex);
+    double error_bound = def->error_bound;
+    pthread_mutex_unlock(&def->mutex);
+    return error_bound;
 }
 
 static void do_close(x86_energy_single_counter_t counter)
@@ -222,6 +294,7 @@ static void do_close(x86_energy_single_counter_t counter)
 static void fini()
 {
     x86_energy_overflow_thread_killall(&sysfs_ov);
+    x86_energy_overflow_freeall(&sysfs_ov);
 }
 
 x86_energy_access_source_t sysfs_fam15_source = {.name = "sysfs-Fam15h",
@@ -229,4 +302,5 @@ x86_energy_access_source_t sysfs_fam15_source = {.name = "sysfs-Fam15h",
                                                  .setup = setup,
                                                  .read = do_read,
                                                  .close = do_close,
-                                                 .fini = fini };
+                                                 .fini = fini,
+                                                 .error_bound = get_error_bound };
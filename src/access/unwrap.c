@@ -0,0 +1,163 @@
+/*
+ * unwrap.c
+ *
+ *  Created on: 19.10.2026
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "../include/error.h"
+#include "../include/overflow_thread.h"
+#include "../include/unwrap.h"
+
+/* counters are updated about every millisecond, a reading may include one more update */
+#define SLACK_NS 2000000
+
+static pthread_mutex_t max_power_mutex = PTHREAD_MUTEX_INITIALIZER;
+static bool max_power_initialized;
+static double max_power[X86_ENERGY_COUNTER_SIZE];
+
+/* parses "500" (all energy domains) or "PCKG=400,DRAM=100,...", returns 0 on success */
+static int parse_max_power(const char* string, double* bounds)
+{
+    const char* pos = string;
+    while (*pos != '\0')
+    {
+        const char* equals = strchr(pos, '=');
+        const char* comma = strchr(pos, ',');
+        if (comma == NULL)
+            comma = pos + strlen(pos);
+        int first = 0, last = X86_ENERGY_COUNTER_SIZE - 1;
+        if (equals != NULL && equals < comma)
+        {
+            for (first = 0; first < X86_ENERGY_COUNTER_SIZE; first++)
+                if (strncasecmp(pos, x86_energy_counter_name(first), equals - pos) == 0 &&
+                    strlen(x86_energy_counter_name(first)) == (size_t)(equals - pos))
+                    break;
+            if (first == X86_ENERGY_COUNTER_SIZE)
+                return 1;
+            last = first;
+            pos = equals + 1;
+        }
+        char* end;
+        double watts = strtod(pos, &end);
+        if (end == pos || end != comma || watts < 0.0)
+            return 1;
+        for (int i = first; i <= last; i++)
+            if (first == last || x86_energy_counter_is_energy(i))
+                bounds[i] = watts;
+        pos = *comma == ',' ? comma + 1 : comma;
+    }
+    return 0;
+}
+
+/* must be called with max_power_mutex held */
+static void init_max_power(void)
+{
+    if (max_power_initialized)
+        return;
+    max_power_initialized = true;
+    const char* env = getenv("X86_ENERGY_MAX_POWER");
+    if (env != NULL && parse_max_power(env, max_power) != 0)
+    {
+        fprintf(stderr, "Ignoring invalid X86_ENERGY_MAX_POWER \"%s\"\n", env);
+        memset(max_power, 0, sizeof(max_power));
+    }
+}
+
+int x86_energy_set_max_power(enum x86_energy_counter counter_type, double watts)
+{
+    if (counter_type < 0 || counter_type >= X86_ENERGY_COUNTER_SIZE || watts < 0.0)
+    {
+        X86_ENERGY_SET_ERROR("invalid maximal power %f W for counter type %d", watts,
+                             counter_type);
+        return 1;
+    }
+    pthread_mutex_lock(&max_power_mutex);
+    init_max_power();
+    max_power[counter_type] = watts;
+    pthread_mutex_unlock(&max_power_mutex);
+    return 0;
+}
+
+void x86_energy_unwrap_init(struct x86_energy_unwrap* unwrap, enum x86_energy_counter counter_type,
+                            uint64_t range, double unit, uint64_t raw)
+{
+    memset(unwrap, 0, sizeof(*unwrap));
+    unwrap->range = range;
+    unwrap->last_raw = raw;
+    unwrap->last_ns = x86_energy_overflow_now();
+    unwrap->total = raw;
+    pthread_mutex_lock(&max_power_mutex);
+    init_max_power();
+    if (counter_type >= 0 && counter_type < X86_ENERGY_COUNTER_SIZE && unit > 0.0)
+        unwrap->max_ticks_per_ns = 1E-9 * max_power[counter_type] / unit;
+    pthread_mutex_unlock(&max_power_mutex);
+}
+
+static uint64_t delta(const struct x86_energy_unwrap* unwrap, uint64_t from, uint64_t to,
+                      bool* wrapped)
+{
+    *wrapped = to < from;
+    return *wrapped ? unwrap->range - from + to : to - from;
+}
+
+static bool plausible(const struct x86_energy_unwrap* unwrap, uint64_t ticks, uint64_t ns)
+{
+    return unwrap->max_ticks_per_ns == 0.0 ||
+           ticks <= unwrap->max_ticks_per_ns * (double)(ns + SLACK_NS);
+}
+
+uint64_t x86_energy_unwrap(struct x86_energy_unwrap* unwrap, uint64_t raw, uint64_t now)
+{
+    bool wrapped;
+    uint64_t ticks = delta(unwrap, unwrap->last_raw, raw, &wrapped);
+    if (plausible(unwrap, ticks, now - unwrap->last_ns))
+    {
+        unwrap->total += ticks;
+    }
+    else
+    {
+        bool suspect_wrapped;
+        uint64_t after = unwrap->has_suspect ?
+                             delta(unwrap, unwrap->suspect_raw, raw, &suspect_wrapped) :
+                             0;
+        if (!unwrap->has_suspect || !plausible(unwrap, after, now - unwrap->suspect_ns))
+        {
+            if (wrapped)
+                unwrap->stats.false_wraps++;
+            else
+                unwrap->stats.spikes++;
+            unwrap->has_suspect = true;
+            unwrap->suspect_raw = raw;
+            unwrap->suspect_ns = now;
+            return unwrap->total;
+        }
+        /* the jump is confirmed, its interval gets the power of the interval after it */
+        uint64_t jump_ns = unwrap->suspect_ns - unwrap->last_ns;
+        uint64_t after_ns = now - unwrap->suspect_ns;
+        if (after_ns > 0)
+            unwrap->total += (uint64_t)((double)after * jump_ns / after_ns);
+        unwrap->total += after;
+        unwrap->stats.resyncs++;
+        wrapped = suspect_wrapped;
+    }
+    if (wrapped)
+        unwrap->stats.wraps++;
+    unwrap->has_suspect = false;
+    unwrap->last_raw = raw;
+    unwrap->last_ns = now;
+    return unwrap->total;
+}
+
+void x86_energy_glitch_stats(x86_energy_access_source_t* source,
+                             x86_energy_single_counter_t counter, x86_energy_glitch_stats_t* stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    if (source->glitch_stats != NULL)
+        source->glitch_stats(counter, stats);
+}
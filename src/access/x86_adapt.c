@@ -18,6 +18,7 @@
 #include "../include/cpuid.h"
 #include "../include/error.h"
 #include "../include/overflow_thread.h"
+#include "../include/unwrap.h"
 
 #define BUFFER_SIZE 4096
 #define POWER_UNIT_REGISTER "Intel_RAPL_Power_Unit"
@@ -29,7 +30,7 @@ static char* x86a_names[X86_ENERGY_COUNTER_SIZE] = { "Intel_RAPL_Pckg_Energy",
 
 struct reader_def
 {
-    uint64_t last_reading;
+    struct x86_energy_unwrap unwrap;
     uint64_t reg;
     double unit;
     int device;
@@ -37,6 +38,7 @@ struct reader_def
     int cpu;
     pthread_t thread;
     pthread_mutex_t mutex;
+    struct ov_call* ov_call;
 };
 
 static struct ov_struct x86a_ov;
@@ -45,7 +47,7 @@ static double do_read(x86_energy_single_counter_t counter);
 
 static int init(void)
 {
-    memset(&x86a_ov, 0, sizeof(struct ov_struct));
+    x86_energy_overflow_init(&x86a_ov);
     int ret = x86_adapt_init();
 
     if (ret)
@@ -171,13 +173,14 @@ static x86_energy_single_counter_t setup(enum x86_energy_counter counter_type, s
 
     struct reader_def* def = malloc(sizeof(struct reader_def));
     def->reg = xa_index;
-    def->last_reading = current_setting;
     def->cpu = cpu;
     def->unit = modifier_dbl;
+    x86_energy_unwrap_init(&def->unwrap, counter_type, 1ULL << 32, def->unit,
+                           current_setting & 0xFFFFFFFFULL);
     def->device = fd;
     def->pkg = index;
     if (x86_energy_overflow_thread_create(&x86a_ov, cpu, &def->thread, &def->mutex, do_read, def,
-                                          30000000))
+                                          30000000, &def->ov_call))
     {
         X86_ENERGY_SET_ERROR("setup Error creating a thread for cpu %d", cpu);
         free(def);
@@ -191,18 +194,18 @@ static double do_read(x86_energy_single_counter_t counter)
 {
     struct reader_def* def = (struct reader_def*)counter;
     uint64_t reading;
+    pthread_mutex_lock(&def->mutex);
     if (x86_adapt_get_setting(def->device, def->reg, &reading) != 8)
     {
+        pthread_mutex_unlock(&def->mutex);
         X86_ENERGY_SET_ERROR("could not retrieve 8 bytes from x86_adapt");
         return -1.0;
     }
-    if (reading < (def->last_reading & 0xFFFFFFFFULL))
-    {
-        def->last_reading = (def->last_reading & 0xFFFFFFFF00000000ULL) + 0x100000000 + reading;
-    }
-    else
-        def->last_reading = (def->last_reading & 0xFFFFFFFF00000000ULL) + reading;
-    return def->unit * def->last_reading;
+    uint64_t total =
+        x86_energy_unwrap(&def->unwrap, reading & 0xFFFFFFFFULL, x86_energy_overflow_now());
+    pthread_mutex_unlock(&def->mutex);
+    x86_energy_overflow_mark_read(def->ov_call);
+    return def->unit * total;
 }
 
 static void do_close(x86_energy_single_counter_t counter)
@@ -212,6 +215,15 @@ static void do_close(x86_energy_single_counter_t counter)
     x86_adapt_put_device(X86_ADAPT_DIE, def->pkg);
     free(def);
 }
+
+static void glitch_stats(x86_energy_single_counter_t counter, x86_energy_glitch_stats_t* stats)
+{
+    struct reader_def* def = (struct reader_def*)counter;
+    pthread_mutex_lock(&def->mutex);
+    *stats = def->unwrap.stats;
+    pthread_mutex_unlock(&def->mutex);
+}
+
 static void fini(void)
 {
     x86_energy_overflow_thread_killall(&x86a_ov);
@@ -223,4 +235,5 @@ x86_energy_access_source_t x86a_source = {.name = "x86a-rapl",
                                           .setup = setup,
                                           .read = do_read,
                                           .close = do_close,
-                                          .fini = fini };
+                                          .fini = fini,
+                                          .glitch_stats = glitch_stats };
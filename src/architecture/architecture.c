@@ -5,36 +5,49 @@
  *      Author: rschoene
  */
 
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <unistd.h>
 
 #include "../include/architecture.h"
 
 #include "../../include/x86_energy.h"
 #include "../include/access.h"
+#include "../include/cache.h"
 #include "../include/cpuid.h"
 #include "../include/error.h"
+#include "../include/hotplug.h"
 
 
+/*
+ * built once per process and shared by get_test_cpu and the sources, cpus that come online are
+ * inserted
+ */
 static x86_energy_architecture_node_t* arch;
+static uint64_t arch_generation;
+static pthread_mutex_t arch_mutex = PTHREAD_MUTEX_INITIALIZER;
 
+static x86_energy_architecture_node_t* get_arch(void);
 
-static bool is_selected_source(x86_energy_access_source_t source)
+static pthread_once_t env_once = PTHREAD_ONCE_INIT;
+static char* env_string = NULL;
+
+static void read_selected_source(void)
 {
-    static bool env_initialized = false;
-    static char * env_string = NULL;
-    if ( !env_initialized )
+    env_string = getenv("X86_ENERGY_SOURCE");
+    if (env_string != NULL)
     {
-        env_string = getenv("X86_ENERGY_SOURCE");
-        if ( env_string != NULL )
-        {
-            env_string =strdup( env_string );
-            /* TODO check return value */
-        }
-        env_initialized = true;
+        env_string = strdup(env_string);
+        /* TODO check return value */
     }
+}
+
+static bool is_selected_source(x86_energy_access_source_t source)
+{
+    pthread_once(&env_once, read_selected_source);
     if ( env_string == NULL )
     {
         return true;
@@ -46,24 +59,11 @@ static bool is_selected_source(x86_energy_access_source_t source)
     return false;
 }
 
-x86_energy_mechanisms_t* x86_energy_get_avail_mechanism(void)
+static x86_energy_mechanisms_t* detect_mechanism(void)
 {
-    arch = x86_energy_init_architecture_nodes();
-
-    if (arch == NULL)
-    {
-        X86_ENERGY_APPEND_ERROR("while calling x86_energy_init_architecture_nodes");
-        return NULL;
-    }
-    int num_packages = x86_energy_arch_count(arch, X86_ENERGY_GRANULARITY_SOCKET);
-
-    if (num_packages <= 0)
-    {
-        X86_ENERGY_APPEND_ERROR("while calling x86_energy_arch_count");
-        return NULL;
-    }
-
     bool is_intel = false, is_amd = false, is_amd_rapl = false;
+    /* the RAPL perf status msrs, which count throttled time, mostly exist on server parts only */
+    bool has_perf_status = false;
     bool supported[X86_ENERGY_COUNTER_SIZE];
     for (int i = 0; i < X86_ENERGY_COUNTER_SIZE; i++)
         supported[i] = false;
@@ -167,6 +167,7 @@ x86_energy_mechanisms_t* x86_energy_get_avail_mechanism(void)
             supported[X86_ENERGY_COUNTER_PCKG] = true;
             supported[X86_ENERGY_COUNTER_CORES] = true;
             supported[X86_ENERGY_COUNTER_DRAM] = true;
+            has_perf_status = true;
             is_intel = true;
             break;
         /* Ivy Bridge */
@@ -180,6 +181,7 @@ x86_energy_mechanisms_t* x86_energy_get_avail_mechanism(void)
             supported[X86_ENERGY_COUNTER_PCKG] = true;
             supported[X86_ENERGY_COUNTER_CORES] = true;
             supported[X86_ENERGY_COUNTER_DRAM] = true;
+            has_perf_status = true;
             is_intel = true;
             break;
         /* Haswell */
@@ -205,6 +207,7 @@ x86_energy_mechanisms_t* x86_energy_get_avail_mechanism(void)
         case 0x3f:
             supported[X86_ENERGY_COUNTER_PCKG] = true;
             supported[X86_ENERGY_COUNTER_DRAM] = true;
+            has_perf_status = true;
             is_intel = true;
             break;
         /* Broadwell*/
@@ -224,11 +227,13 @@ x86_energy_mechanisms_t* x86_energy_get_avail_mechanism(void)
         case 0x56:
             supported[X86_ENERGY_COUNTER_PCKG] = true;
             supported[X86_ENERGY_COUNTER_DRAM] = true;
+            has_perf_status = true;
             is_intel = true;
             break;
         case 0x4f:
             supported[X86_ENERGY_COUNTER_PCKG] = true;
             supported[X86_ENERGY_COUNTER_DRAM] = true;
+            has_perf_status = true;
             is_intel = true;
             break;
         /* Skylake*/
@@ -239,6 +244,7 @@ x86_energy_mechanisms_t* x86_energy_get_avail_mechanism(void)
         case 0x55:
             supported[X86_ENERGY_COUNTER_PCKG] = true;
             supported[X86_ENERGY_COUNTER_DRAM] = true;
+            has_perf_status = true;
             is_intel = true;
             break;
         case 0x5e:
@@ -268,6 +274,7 @@ x86_energy_mechanisms_t* x86_energy_get_avail_mechanism(void)
         case 0x8f:
             supported[X86_ENERGY_COUNTER_PCKG] = true;
             supported[X86_ENERGY_COUNTER_DRAM] = true;
+            has_perf_status = true;
             is_intel = true;
             break;
         /* none of the above */
@@ -293,6 +300,7 @@ x86_energy_mechanisms_t* x86_energy_get_avail_mechanism(void)
             is_amd_rapl = true;
             supported[X86_ENERGY_COUNTER_PCKG] = true;
             supported[X86_ENERGY_COUNTER_CORES] = true;
+            supported[X86_ENERGY_COUNTER_SINGLE_CORE] = true;
         } else
         {
         	X86_ENERGY_SET_ERROR("Not a recognized AMD processor (family 0x%x, model 0x%x)", cpu_family, cpu_model);
@@ -322,6 +330,21 @@ x86_energy_mechanisms_t* x86_energy_get_avail_mechanism(void)
         if (supported[X86_ENERGY_COUNTER_SINGLE_CORE])
             t->source_granularities[X86_ENERGY_COUNTER_SINGLE_CORE] = X86_ENERGY_GRANULARITY_CORE;
 
+        /* the perf status msrs count the time the RAPL domains were throttled, only msr-rapl
+         * reads them */
+        if (has_perf_status && is_selected_source(msr_source))
+        {
+            if (supported[X86_ENERGY_COUNTER_PCKG])
+                t->source_granularities[X86_ENERGY_COUNTER_PCKG_THROTTLE] =
+                    X86_ENERGY_GRANULARITY_SOCKET;
+            if (supported[X86_ENERGY_COUNTER_CORES])
+                t->source_granularities[X86_ENERGY_COUNTER_CORES_THROTTLE] =
+                    X86_ENERGY_GRANULARITY_SOCKET;
+            if (supported[X86_ENERGY_COUNTER_DRAM])
+                t->source_granularities[X86_ENERGY_COUNTER_DRAM_THROTTLE] =
+                    X86_ENERGY_GRANULARITY_SOCKET;
+        }
+
         t->nr_avail_sources = 0;
         if ( is_selected_source ( sysfs_source ) )
         {
@@ -403,24 +426,40 @@ x86_energy_mechanisms_t* x86_energy_get_avail_mechanism(void)
             else
                 t->source_granularities[i] = X86_ENERGY_GRANULARITY_SIZE;
 
-        if ( ! is_selected_source ( sysfs_fam15_source ) )
+        t->nr_avail_sources = 0;
+        if ( is_selected_source ( msr_fam15_source ) )
+        {
+            t->nr_avail_sources += 1;
+        }
+        if ( is_selected_source ( sysfs_fam15_source ) )
+        {
+            t->nr_avail_sources += 1;
+        }
+        if ( t->nr_avail_sources == 0 )
         {
             X86_ENERGY_SET_ERROR("No available source selected");
             free( t );
             return NULL;
         }
 
-        t->nr_avail_sources = 1;
-        t->avail_sources = malloc(1 * sizeof(x86_energy_access_source_t));
+        t->avail_sources = malloc(t->nr_avail_sources * sizeof(x86_energy_access_source_t));
         if ( t->avail_sources == NULL )
         {
             X86_ENERGY_SET_ERROR("Error allocating memory");
             free( t );
             return NULL;
         }
-        t->avail_sources[0] = sysfs_fam15_source;
+        int current = 0;
+        /* avoids parsing sysfs strings, but requires msr access and model 60h or later */
+        if ( is_selected_source ( msr_fam15_source ) )
+        {
+            t->avail_sources[current++] = msr_fam15_source;
+        }
+        if ( is_selected_source ( sysfs_fam15_source ) )
+        {
+            t->avail_sources[current++] = sysfs_fam15_source;
+        }
 
-// TODO msr
 #ifdef USEX86_ADAPT
 // TODO x86a
 #endif
@@ -444,6 +483,11 @@ x86_energy_mechanisms_t* x86_energy_get_avail_mechanism(void)
         t->source_granularities[X86_ENERGY_COUNTER_PCKG] = X86_ENERGY_GRANULARITY_SOCKET;
 
         t->nr_avail_sources = 0;
+        if ( is_selected_source ( hwmon_energy_source ) )
+        {
+            t->nr_avail_sources += 1;
+        }
+
         if ( is_selected_source ( msr_fam23_source ) )
         {
             t->nr_avail_sources += 1;
@@ -480,6 +524,12 @@ x86_energy_mechanisms_t* x86_energy_get_avail_mechanism(void)
         }
 	int current_entry=0;
 
+        /* does not need msr access */
+        if ( is_selected_source ( hwmon_energy_source ) )
+        {
+            t->avail_sources[current_entry++] = hwmon_energy_source;
+        }
+
         if ( is_selected_source ( msr_fam23_source ) )
         {
             t->avail_sources[current_entry++] = msr_fam23_source;
@@ -511,6 +561,70 @@ x86_energy_mechanisms_t* x86_energy_get_avail_mechanism(void)
     return NULL;
 }
 
+x86_energy_mechanisms_t* x86_energy_get_avail_mechanism(void)
+{
+    pthread_mutex_lock(&arch_mutex);
+    if (get_arch() == NULL)
+    {
+        pthread_mutex_unlock(&arch_mutex);
+        X86_ENERGY_APPEND_ERROR("while calling x86_energy_init_architecture_nodes");
+        return NULL;
+    }
+    int num_packages = x86_energy_arch_count(arch, X86_ENERGY_GRANULARITY_SOCKET);
+
+    if (num_packages <= 0)
+    {
+        pthread_mutex_unlock(&arch_mutex);
+        X86_ENERGY_APPEND_ERROR("while calling x86_energy_arch_count");
+        return NULL;
+    }
+
+    x86_energy_mechanisms_t* t = x86_energy_cache_load_mechanism();
+    if (t == NULL)
+    {
+        t = detect_mechanism();
+        if (t != NULL)
+            x86_energy_cache_store(arch, t);
+    }
+    pthread_mutex_unlock(&arch_mutex);
+    return t;
+}
+
+void x86_energy_free_mechanism(x86_energy_mechanisms_t* mechanism)
+{
+    if (mechanism == NULL)
+        return;
+    free(mechanism->avail_sources);
+    free(mechanism);
+}
+
+const char* x86_energy_counter_name(enum x86_energy_counter counter)
+{
+    static const char* names[X86_ENERGY_COUNTER_SIZE] = { "PCKG",          "CORES",
+                                                          "DRAM",          "GPU",
+                                                          "PLATFORM",      "SINGLE_CORE",
+                                                          "PCKG_THROTTLE", "CORES_THROTTLE",
+                                                          "DRAM_THROTTLE" };
+    if (counter < 0 || counter >= X86_ENERGY_COUNTER_SIZE)
+        return NULL;
+    return names[counter];
+}
+
+int x86_energy_counter_is_energy(enum x86_energy_counter counter)
+{
+    return counter >= 0 && counter < X86_ENERGY_COUNTER_PCKG_THROTTLE;
+}
+
+const char* x86_energy_granularity_name(enum x86_energy_granularity granularity)
+{
+    static const char* names[X86_ENERGY_GRANULARITY_SIZE] = { "SYSTEM", "SOCKET", "DIE",
+                                                              "MODULE", "CORE",   "THREAD",
+                                                              "DEVICE" };
+    if (granularity < 0 || granularity >= X86_ENERGY_GRANULARITY_SIZE)
+        return NULL;
+    return names[granularity];
+}
+
 static x86_energy_architecture_node_t*
 find_node_internal(x86_energy_architecture_node_t* current,
                    enum x86_energy_granularity given_granularity, unsigned long int id)
@@ -529,19 +643,135 @@ find_node_internal(x86_energy_architecture_node_t* current,
     return NULL;
 }
 
-long get_test_cpu(enum x86_energy_granularity given_granularity, unsigned long int id)
+static bool arch_has_cpu(x86_energy_architecture_node_t* node, long cpu)
+{
+    if (node->granularity == X86_ENERGY_GRANULARITY_THREAD)
+        return node->id == cpu;
+    for (size_t i = 0; i < node->nr_children; i++)
+        if (arch_has_cpu(&node->children[i], cpu))
+            return true;
+    return false;
+}
+
+x86_energy_architecture_node_t*
+x86_energy_arch_add_online_cpus(x86_energy_architecture_node_t* root)
+{
+    x86_energy_architecture_node_t* current = root;
+    long nr_cpus = sysconf(_SC_NPROCESSORS_CONF);
+    for (long cpu = 0; cpu < nr_cpus; cpu++)
+    {
+        if (!x86_energy_cpu_online(cpu) || arch_has_cpu(current, cpu))
+            continue;
+        x86_energy_architecture_node_t* updated = x86_energy_arch_add_cpu(current, cpu);
+        if (updated == NULL)
+            continue;
+        if (current != root)
+            x86_energy_free_architecture_nodes(current);
+        current = updated;
+    }
+    return current;
+}
+
+/*
+ * Offline cpus are skipped by get_test_cpu, so only cpus that came online and are not part of the
+ * tree have to be inserted. Must be called with arch_mutex held.
+ */
+static void update_arch(void)
+{
+    uint64_t generation = x86_energy_hotplug_generation();
+    if (arch == NULL || generation == arch_generation)
+        return;
+    arch_generation = generation;
+    x86_energy_architecture_node_t* updated = x86_energy_arch_add_online_cpus(arch);
+    if (updated != arch)
+    {
+        x86_energy_free_architecture_nodes(arch);
+        arch = updated;
+    }
+}
+
+/* must be called with arch_mutex held */
+static x86_energy_architecture_node_t* get_arch(void)
 {
-    x86_energy_architecture_node_t* current = arch;
+    if (arch == NULL)
+    {
+        arch_generation = x86_energy_hotplug_generation();
+        arch = x86_energy_init_architecture_nodes();
+    }
+    else
+        update_arch();
+    return arch;
+}
 
-    x86_energy_architecture_node_t* sub_node = find_node_internal(current, given_granularity, id);
+x86_energy_architecture_node_t* x86_energy_arch_lock(void)
+{
+    pthread_mutex_lock(&arch_mutex);
+    if (get_arch() == NULL)
+    {
+        pthread_mutex_unlock(&arch_mutex);
+        X86_ENERGY_APPEND_ERROR("while calling x86_energy_init_architecture_nodes");
+        return NULL;
+    }
+    return arch;
+}
 
+void x86_energy_arch_unlock(void)
+{
+    pthread_mutex_unlock(&arch_mutex);
+}
+
+static long first_online_cpu(x86_energy_architecture_node_t* node)
+{
+    if (node->granularity == X86_ENERGY_GRANULARITY_THREAD)
+        return x86_energy_cpu_online(node->id) ? node->id : -1;
+    for (size_t i = 0; i < node->nr_children; i++)
+    {
+        long cpu = first_online_cpu(&node->children[i]);
+        if (cpu >= 0)
+            return cpu;
+    }
+    return -1;
+}
+
+/* returns the first online cpu of the node of granularity and id below root, < 0 on error */
+static long online_cpu_below(x86_energy_architecture_node_t* root,
+                             enum x86_energy_granularity given_granularity, unsigned long int id)
+{
+    x86_energy_architecture_node_t* sub_node =
+        root != NULL ? find_node_internal(root, given_granularity, id) : NULL;
     if (sub_node == NULL)
     {
-    	X86_ENERGY_APPEND_ERROR("search for node with granularity value %d returned NULL", given_granularity);
+        X86_ENERGY_APPEND_ERROR("search for node with granularity value %d returned NULL",
+                                given_granularity);
         return -1;
     }
+    long cpu = first_online_cpu(sub_node);
+    if (cpu < 0)
+        X86_ENERGY_SET_ERROR("all cpus of node %s are offline", sub_node->name);
+    return cpu;
+}
 
-    while (sub_node->granularity != X86_ENERGY_GRANULARITY_THREAD)
-        sub_node = sub_node->children;
-    return sub_node->id;
+long get_test_cpu(enum x86_energy_granularity given_granularity, unsigned long int id)
+{
+    pthread_mutex_lock(&arch_mutex);
+    long cpu = online_cpu_below(get_arch(), given_granularity, id);
+    pthread_mutex_unlock(&arch_mutex);
+    return cpu;
+}
+
+long get_test_cpu_in(enum x86_energy_granularity parent_granularity, unsigned long int parent_id,
+                     enum x86_energy_granularity given_granularity, unsigned long int id)
+{
+    pthread_mutex_lock(&arch_mutex);
+    x86_energy_architecture_node_t* root = get_arch();
+    x86_energy_architecture_node_t* parent =
+        root != NULL ? find_node_internal(root, parent_granularity, parent_id) : NULL;
+    long cpu = -1;
+    if (parent == NULL)
+        X86_ENERGY_APPEND_ERROR("search for node with granularity value %d returned NULL",
+                                parent_granularity);
+    else
+        cpu = online_cpu_below(parent, given_granularity, id);
+    pthread_mutex_unlock(&arch_mutex);
+    return cpu;
 }
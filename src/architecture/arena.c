@@ -0,0 +1,215 @@
+/*
+ * arena.c
+ *
+ *  Created on: 19.10.2026
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/arena.h"
+#include "../include/error.h"
+
+#define NODES_PER_CHUNK 256
+
+struct arch_build_chunk
+{
+    struct arch_build_chunk* next;
+    size_t used;
+    struct arch_build_node nodes[NODES_PER_CHUNK];
+};
+
+void x86_energy_arch_builder_init(struct arch_builder* builder)
+{
+    memset(builder, 0, sizeof(*builder));
+}
+
+static int mark_cpu(struct arch_builder* builder, long int cpu)
+{
+    if (cpu < 0)
+        return 0;
+    if (cpu >= builder->nr_cpus)
+    {
+        long int new_nr = builder->nr_cpus ? builder->nr_cpus : 64;
+        while (cpu >= new_nr)
+            new_nr *= 2;
+        uint8_t* tmp = realloc(builder->cpus, new_nr);
+        if (tmp == NULL)
+            return 1;
+        memset(tmp + builder->nr_cpus, 0, new_nr - builder->nr_cpus);
+        builder->cpus = tmp;
+        builder->nr_cpus = new_nr;
+    }
+    builder->cpus[cpu] = 1;
+    return 0;
+}
+
+bool x86_energy_arch_builder_has_cpu(struct arch_builder* builder, long int cpu)
+{
+    return cpu >= 0 && cpu < builder->nr_cpus && builder->cpus[cpu];
+}
+
+struct arch_build_node* x86_energy_arch_builder_add(struct arch_builder* builder,
+                                                    struct arch_build_node* parent,
+                                                    enum x86_energy_granularity granularity,
+                                                    int32_t id, long int name_number,
+                                                    const char* name, size_t name_len)
+{
+    if (builder->chunks == NULL || builder->chunks->used == NODES_PER_CHUNK)
+    {
+        struct arch_build_chunk* chunk = malloc(sizeof(struct arch_build_chunk));
+        if (chunk == NULL)
+        {
+            X86_ENERGY_SET_ERROR("could not allocate %zu bytes for architecture nodes",
+                                 sizeof(struct arch_build_chunk));
+            return NULL;
+        }
+        chunk->next = builder->chunks;
+        chunk->used = 0;
+        builder->chunks = chunk;
+    }
+    if (granularity == X86_ENERGY_GRANULARITY_THREAD && mark_cpu(builder, id))
+    {
+        X86_ENERGY_SET_ERROR("could not allocate memory for cpu %" PRId32, id);
+        return NULL;
+    }
+    struct arch_build_node* node = &builder->chunks->nodes[builder->chunks->used++];
+    memset(node, 0, sizeof(*node));
+    node->granularity = granularity;
+    node->id = id;
+    node->name_number = name_number;
+    node->name = name;
+    node->name_len = name_len;
+    node->sequence = builder->nr_nodes++;
+    if (parent != NULL)
+    {
+        if (parent->last_child != NULL)
+            parent->last_child->next_sibling = node;
+        else
+            parent->first_child = node;
+        parent->last_child = node;
+        parent->nr_children++;
+    }
+    return node;
+}
+
+struct arch_build_node* x86_energy_arch_builder_find_child(struct arch_build_node* parent,
+                                                           long int id)
+{
+    for (struct arch_build_node* child = parent->first_child; child != NULL;
+         child = child->next_sibling)
+        if (child->id == id)
+            return child;
+    return NULL;
+}
+
+/* writes the name to buffer (if not NULL) and returns its length without '\0' */
+static size_t format_name(const struct arch_build_node* node, char* buffer, size_t size)
+{
+    if (node->name != NULL)
+    {
+        if (buffer != NULL)
+        {
+            memcpy(buffer, node->name, node->name_len);
+            buffer[node->name_len] = '\0';
+        }
+        return node->name_len;
+    }
+    const char* format;
+    switch (node->granularity)
+    {
+    case X86_ENERGY_GRANULARITY_SOCKET:
+        format = "Processor %ld";
+        break;
+    case X86_ENERGY_GRANULARITY_MODULE:
+        format = "module %ld";
+        break;
+    case X86_ENERGY_GRANULARITY_CORE:
+        format = "Core %ld";
+        break;
+    case X86_ENERGY_GRANULARITY_THREAD:
+        format = "CPU %ld";
+        break;
+    default:
+        format = "%ld";
+        break;
+    }
+    return snprintf(buffer, size, format, node->name_number);
+}
+
+static int compare_nodes(const void* a, const void* b)
+{
+    const struct arch_build_node* node_a = *(const struct arch_build_node* const*)a;
+    const struct arch_build_node* node_b = *(const struct arch_build_node* const*)b;
+    if (node_a->id != node_b->id)
+        return node_a->id < node_b->id ? -1 : 1;
+    return node_a->sequence < node_b->sequence ? -1 : (node_a->sequence > node_b->sequence);
+}
+
+x86_energy_architecture_node_t* x86_energy_arch_builder_finish(struct arch_builder* builder,
+                                                               struct arch_build_node* root,
+                                                               bool sort)
+{
+    /* nodes in the order they will be stored, breadth-first */
+    struct arch_build_node** order = malloc(builder->nr_nodes * sizeof(struct arch_build_node*));
+    if (order == NULL)
+    {
+        X86_ENERGY_SET_ERROR("could not allocate memory for sorting the architecture");
+        return NULL;
+    }
+    size_t nr_ordered = 1;
+    order[0] = root;
+    size_t name_bytes = 0;
+    for (size_t current = 0; current < nr_ordered; current++)
+    {
+        struct arch_build_node* node = order[current];
+        name_bytes += format_name(node, NULL, 0) + 1;
+        size_t first = nr_ordered;
+        for (struct arch_build_node* child = node->first_child; child != NULL;
+             child = child->next_sibling)
+            order[nr_ordered++] = child;
+        if (sort && node->nr_children > 1)
+            qsort(&order[first], node->nr_children, sizeof(struct arch_build_node*),
+                  compare_nodes);
+    }
+
+    size_t nodes_size = nr_ordered * sizeof(x86_energy_architecture_node_t);
+    x86_energy_architecture_node_t* nodes = malloc(nodes_size + name_bytes);
+    if (nodes == NULL)
+    {
+        free(order);
+        X86_ENERGY_SET_ERROR("could not allocate %zu bytes for the architecture",
+                             nodes_size + name_bytes);
+        return NULL;
+    }
+    char* names = (char*)nodes + nodes_size;
+    char* names_end = names + name_bytes;
+    size_t next_child = 1;
+    for (size_t current = 0; current < nr_ordered; current++)
+    {
+        struct arch_build_node* node = order[current];
+        nodes[current].granularity = node->granularity;
+        nodes[current].id = node->id;
+        nodes[current].name = names;
+        names += format_name(node, names, names_end - names) + 1;
+        nodes[current].nr_children = node->nr_children;
+        nodes[current].children = node->nr_children ? &nodes[next_child] : NULL;
+        next_child += node->nr_children;
+    }
+    free(order);
+    return nodes;
+}
+
+void x86_energy_arch_builder_free(struct arch_builder* builder)
+{
+    while (builder->chunks != NULL)
+    {
+        struct arch_build_chunk* next = builder->chunks->next;
+        free(builder->chunks);
+        builder->chunks = next;
+    }
+    free(builder->cpus);
+    memset(builder, 0, sizeof(*builder));
+}
@@ -0,0 +1,485 @@
+/*
+ * cache.c
+ *
+ *  Created on: 19.10.2026
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "../include/access.h"
+#include "../include/arena.h"
+#include "../include/cache.h"
+
+#define CACHE_MAGIC "X86ECACH"
+#define CACHE_VERSION 2
+
+#define BOOT_ID_FILE "/proc/sys/kernel/random/boot_id"
+#define ONLINE_FILE "/sys/devices/system/cpu/online"
+
+#define NO_STRING 0xFFFFFFFFU
+
+/* all sources that can be part of a cached mechanism */
+static x86_energy_access_source_t* known_sources[] = {
+    &sysfs_source,      &perf_source,        &msr_source, &msr_fam23_source,
+    &sysfs_fam15_source, &msr_fam15_source,  &hwmon_energy_source,
+#ifdef USELIKWID
+    &likwid_source,
+#endif
+#ifdef USEX86_ADAPT
+    &x86a_source,       &x86a_fam23_source,
+#endif
+};
+
+/* mechanism names, so cached mechanisms use the same (static) strings as detected ones */
+static const char* known_mechanisms[] = { "Intel RAPL", "AMD APM", "AMD RAPL" };
+
+/* protects the blob, sessions can be created concurrently */
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* the validated contents of the cache file, read once per process */
+static char* cache_blob;
+static size_t cache_blob_size;
+static size_t cache_key_size;
+static bool cache_blob_loaded;
+
+struct buffer
+{
+    char* data;
+    size_t size;
+    size_t capacity;
+    size_t pos;
+    bool failed;
+};
+
+static const char* get_cache_file(void)
+{
+    const char* file = getenv("X86_ENERGY_CACHE_FILE");
+    if (file == NULL || *file == '\0')
+        return NULL;
+    return file;
+}
+
+/* reads a small sysfs/procfs file and strips the trailing newline, returns length or -1 */
+static int read_small_file(const char* file, char* buffer, size_t size)
+{
+    int fd = open(file, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    ssize_t read_bytes = read(fd, buffer, size - 1);
+    close(fd);
+    if (read_bytes <= 0)
+        return -1;
+    while (read_bytes > 0 && (buffer[read_bytes - 1] == '\n' || buffer[read_bytes - 1] == '\0'))
+        read_bytes--;
+    buffer[read_bytes] = '\0';
+    return read_bytes;
+}
+
+/* writing */
+
+static void put(struct buffer* b, const void* data, size_t size)
+{
+    if (b->failed)
+        return;
+    if (b->size + size > b->capacity)
+    {
+        size_t new_capacity = b->capacity ? b->capacity : 4096;
+        while (b->size + size > new_capacity)
+            new_capacity *= 2;
+        char* tmp = realloc(b->data, new_capacity);
+        if (tmp == NULL)
+        {
+            b->failed = true;
+            return;
+        }
+        b->data = tmp;
+        b->capacity = new_capacity;
+    }
+    memcpy(b->data + b->size, data, size);
+    b->size += size;
+}
+
+static void put_u32(struct buffer* b, uint32_t value)
+{
+    put(b, &value, sizeof(value));
+}
+
+static void put_i32(struct buffer* b, int32_t value)
+{
+    put(b, &value, sizeof(value));
+}
+
+static void put_string(struct buffer* b, const char* string)
+{
+    if (string == NULL)
+    {
+        put_u32(b, NO_STRING);
+        return;
+    }
+    uint32_t len = strlen(string);
+    put_u32(b, len);
+    put(b, string, len);
+}
+
+static void put_node(struct buffer* b, const x86_energy_architecture_node_t* node)
+{
+    put_i32(b, node->granularity);
+    put_i32(b, node->id);
+    put_u32(b, node->nr_children);
+    put_string(b, node->name);
+    for (size_t i = 0; i < node->nr_children; i++)
+        put_node(b, &node->children[i]);
+}
+
+static size_t count_nodes(const x86_energy_architecture_node_t* node)
+{
+    size_t nr = 1;
+    for (size_t i = 0; i < node->nr_children; i++)
+        nr += count_nodes(&node->children[i]);
+    return nr;
+}
+
+/* the key the cache is valid for: boot id, online cpus and selected source */
+static bool put_key(struct buffer* b)
+{
+    char boot_id[64];
+    char online[4096];
+    if (read_small_file(BOOT_ID_FILE, boot_id, sizeof(boot_id)) < 0)
+        return false;
+    if (read_small_file(ONLINE_FILE, online, sizeof(online)) < 0)
+        return false;
+    put(b, CACHE_MAGIC, 8);
+    put_u32(b, CACHE_VERSION);
+    put_u32(b, X86_ENERGY_COUNTER_SIZE);
+    put_string(b, boot_id);
+    put_string(b, online);
+    put_string(b, getenv("X86_ENERGY_SOURCE"));
+    return !b->failed;
+}
+
+/* reading */
+
+static const void* get(struct buffer* b, size_t size)
+{
+    if (b->failed || size > b->size - b->pos)
+    {
+        b->failed = true;
+        return NULL;
+    }
+    const void* result = b->data + b->pos;
+    b->pos += size;
+    return result;
+}
+
+static uint32_t get_u32(struct buffer* b)
+{
+    uint32_t value = 0;
+    const void* data = get(b, sizeof(value));
+    if (data != NULL)
+        memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+static int32_t get_i32(struct buffer* b)
+{
+    int32_t value = 0;
+    const void* data = get(b, sizeof(value));
+    if (data != NULL)
+        memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+/* returns a newly allocated string, NULL on error or if there was no string */
+static char* get_string(struct buffer* b)
+{
+    uint32_t len = get_u32(b);
+    if (b->failed || len == NO_STRING)
+        return NULL;
+    const char* data = get(b, len);
+    if (data == NULL)
+        return NULL;
+    char* result = malloc(len + 1);
+    if (result == NULL)
+    {
+        b->failed = true;
+        return NULL;
+    }
+    memcpy(result, data, len);
+    result[len] = '\0';
+    return result;
+}
+
+/* reads a node and its children into the builder, names point into the cache blob */
+static struct arch_build_node* get_node(struct buffer* b, struct arch_builder* builder,
+                                        struct arch_build_node* parent, size_t* nodes_left)
+{
+    if (*nodes_left == 0)
+    {
+        b->failed = true;
+        return NULL;
+    }
+    (*nodes_left)--;
+    int32_t granularity = get_i32(b);
+    int32_t id = get_i32(b);
+    uint32_t nr_children = get_u32(b);
+    uint32_t name_len = get_u32(b);
+    const char* name = name_len == NO_STRING ? NULL : get(b, name_len);
+    if (b->failed || name == NULL || granularity < 0 ||
+        granularity >= X86_ENERGY_GRANULARITY_SIZE || nr_children > *nodes_left)
+    {
+        b->failed = true;
+        return NULL;
+    }
+    struct arch_build_node* node =
+        x86_energy_arch_builder_add(builder, parent, granularity, id, id, name, name_len);
+    if (node == NULL)
+    {
+        b->failed = true;
+        return NULL;
+    }
+    for (uint32_t i = 0; i < nr_children; i++)
+        if (get_node(b, builder, node, nodes_left) == NULL)
+            return NULL;
+    return node;
+}
+
+/* skips the tree and positions the buffer after it */
+static bool skip_architecture(struct buffer* b)
+{
+    uint32_t nr_nodes = get_u32(b);
+    for (uint32_t i = 0; i < nr_nodes && !b->failed; i++)
+    {
+        get_i32(b);
+        get_i32(b);
+        get_u32(b);
+        uint32_t len = get_u32(b);
+        if (len != NO_STRING)
+            get(b, len);
+    }
+    return !b->failed;
+}
+
+/* compares the key in the file with the current system, positions b after the key */
+static bool check_key(struct buffer* b)
+{
+    struct buffer current = { 0 };
+    if (!put_key(&current))
+    {
+        free(current.data);
+        return false;
+    }
+    const void* key = get(b, current.size);
+    bool valid = key != NULL && memcmp(key, current.data, current.size) == 0;
+    free(current.data);
+    return valid;
+}
+
+static bool load_blob(void)
+{
+    if (cache_blob_loaded)
+        return cache_blob != NULL;
+    cache_blob_loaded = true;
+
+    const char* file = get_cache_file();
+    if (file == NULL)
+        return false;
+    int fd = open(file, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0)
+    {
+        close(fd);
+        return false;
+    }
+    char* data = malloc(st.st_size);
+    if (data == NULL)
+    {
+        close(fd);
+        return false;
+    }
+    ssize_t read_bytes = read(fd, data, st.st_size);
+    close(fd);
+    struct buffer b = { .data = data, .size = read_bytes > 0 ? read_bytes : 0 };
+    if (read_bytes != st.st_size || !check_key(&b))
+    {
+        free(data);
+        return false;
+    }
+    cache_blob = data;
+    cache_blob_size = read_bytes;
+    cache_key_size = b.pos;
+    return true;
+}
+
+static x86_energy_architecture_node_t* load_architecture(void)
+{
+    if (!load_blob())
+        return NULL;
+    struct buffer b = { .data = cache_blob, .size = cache_blob_size, .pos = cache_key_size };
+    size_t nr_nodes = get_u32(&b);
+    if (b.failed || nr_nodes == 0)
+        return NULL;
+
+    struct arch_builder builder;
+    x86_energy_arch_builder_init(&builder);
+    struct arch_build_node* root = get_node(&b, &builder, NULL, &nr_nodes);
+    x86_energy_architecture_node_t* result = NULL;
+    if (root != NULL && root->granularity == X86_ENERGY_GRANULARITY_SYSTEM)
+        /* already stored in order */
+        result = x86_energy_arch_builder_finish(&builder, root, false);
+    x86_energy_arch_builder_free(&builder);
+    return result;
+}
+
+static x86_energy_mechanisms_t* load_mechanism(void)
+{
+    if (!load_blob())
+        return NULL;
+    struct buffer b = { .data = cache_blob, .size = cache_blob_size, .pos = cache_key_size };
+    if (!skip_architecture(&b) || get_u32(&b) != 1)
+        return NULL;
+
+    x86_energy_mechanisms_t* t = calloc(1, sizeof(x86_energy_mechanisms_t));
+    if (t == NULL)
+        return NULL;
+    char* name = get_string(&b);
+    if (name == NULL)
+        goto error;
+    for (size_t i = 0; i < sizeof(known_mechanisms) / sizeof(known_mechanisms[0]); i++)
+        if (strcmp(known_mechanisms[i], name) == 0)
+            t->name = (char*)known_mechanisms[i];
+    free(name);
+    for (int i = 0; i < X86_ENERGY_COUNTER_SIZE; i++)
+    {
+        int32_t granularity = get_i32(&b);
+        if (granularity < 0 || granularity > X86_ENERGY_GRANULARITY_SIZE)
+            b.failed = true;
+        t->source_granularities[i] = granularity;
+    }
+    t->nr_avail_sources = get_u32(&b);
+    if (b.failed || t->name == NULL || t->nr_avail_sources == 0 ||
+        t->nr_avail_sources > sizeof(known_sources) / sizeof(known_sources[0]))
+        goto error;
+    t->avail_sources = malloc(t->nr_avail_sources * sizeof(x86_energy_access_source_t));
+    if (t->avail_sources == NULL)
+        goto error;
+    for (size_t i = 0; i < t->nr_avail_sources; i++)
+    {
+        char* name = get_string(&b);
+        if (name == NULL)
+            goto error;
+        size_t j;
+        for (j = 0; j < sizeof(known_sources) / sizeof(known_sources[0]); j++)
+            if (strcmp(known_sources[j]->name, name) == 0)
+                break;
+        free(name);
+        /* source not compiled in (anymore)? */
+        if (j == sizeof(known_sources) / sizeof(known_sources[0]))
+            goto error;
+        t->avail_sources[i] = *known_sources[j];
+    }
+    return t;
+
+error:
+    free(t->avail_sources);
+    free(t);
+    return NULL;
+}
+
+static void store(const x86_energy_architecture_node_t* root,
+                  const x86_energy_mechanisms_t* mechanism)
+{
+    const char* file = get_cache_file();
+    if (file == NULL || root == NULL)
+        return;
+
+    struct buffer b = { 0 };
+    if (!put_key(&b))
+    {
+        free(b.data);
+        return;
+    }
+    size_t key_size = b.size;
+    put_u32(&b, count_nodes(root));
+    put_node(&b, root);
+    if (mechanism != NULL)
+    {
+        put_u32(&b, 1);
+        put_string(&b, mechanism->name);
+        for (int i = 0; i < X86_ENERGY_COUNTER_SIZE; i++)
+            put_i32(&b, mechanism->source_granularities[i]);
+        put_u32(&b, mechanism->nr_avail_sources);
+        for (size_t i = 0; i < mechanism->nr_avail_sources; i++)
+            put_string(&b, mechanism->avail_sources[i].name);
+    }
+    else
+        put_u32(&b, 0);
+    if (b.failed)
+    {
+        free(b.data);
+        return;
+    }
+
+    /* write to a temporary file and rename it, so readers never see a partial cache */
+    char tmp_file[4096];
+    if (snprintf(tmp_file, sizeof(tmp_file), "%s.%ld.tmp", file, (long)getpid()) >=
+        (int)sizeof(tmp_file))
+    {
+        free(b.data);
+        return;
+    }
+    int fd = open(tmp_file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        free(b.data);
+        return;
+    }
+    ssize_t written = write(fd, b.data, b.size);
+    if (close(fd) != 0 || written != (ssize_t)b.size || rename(tmp_file, file) != 0)
+    {
+        unlink(tmp_file);
+        free(b.data);
+        return;
+    }
+
+    free(cache_blob);
+    cache_blob = b.data;
+    cache_blob_size = b.size;
+    cache_key_size = key_size;
+    cache_blob_loaded = true;
+}
+
+x86_energy_architecture_node_t* x86_energy_cache_load_architecture(void)
+{
+    pthread_mutex_lock(&cache_mutex);
+    x86_energy_architecture_node_t* result = load_architecture();
+    pthread_mutex_unlock(&cache_mutex);
+    return result;
+}
+
+x86_energy_mechanisms_t* x86_energy_cache_load_mechanism(void)
+{
+    pthread_mutex_lock(&cache_mutex);
+    x86_energy_mechanisms_t* result = load_mechanism();
+    pthread_mutex_unlock(&cache_mutex);
+    return result;
+}
+
+void x86_energy_cache_store(const x86_energy_architecture_node_t* root,
+                            const x86_energy_mechanisms_t* mechanism)
+{
+    pthread_mutex_lock(&cache_mutex);
+    store(root, mechanism);
+    pthread_mutex_unlock(&cache_mutex);
+}
@@ -0,0 +1,204 @@
+/*
+ * hotplug.c
+ *
+ *  Created on: 19.10.2026
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <linux/netlink.h>
+
+#include "../include/error.h"
+#include "../include/hotplug.h"
+#include "../include/threads.h"
+
+#define ONLINE_FILE "/sys/devices/system/cpu/online"
+
+/* the online file is also polled in case uevents are not delivered, e.g. in containers */
+#define POLL_MS 1000
+
+#define UEVENT_BUFFER_SIZE 8192
+
+struct watcher
+{
+    pthread_t thread;
+    int stop_fd;
+    int uevent_fd; /* < 0 if only polling */
+};
+
+static pthread_mutex_t hotplug_mutex = PTHREAD_MUTEX_INITIALIZER;
+static bool online_read;
+static cpu_set_t online;
+static uint64_t generation;
+
+static size_t users;
+static struct watcher* watcher;
+
+/* must be called with hotplug_mutex held */
+static void read_online(void)
+{
+    char buffer[4096];
+    cpu_set_t set;
+    FILE* f = fopen(ONLINE_FILE, "r");
+    if (f == NULL)
+        return;
+    bool valid = fgets(buffer, sizeof(buffer), f) != NULL &&
+                 x86_energy_parse_cpu_list(buffer, &set) == 0 && CPU_COUNT(&set) > 0;
+    fclose(f);
+    if (!valid || (online_read && CPU_EQUAL(&set, &online)))
+        return;
+    online = set;
+    online_read = true;
+    __atomic_add_fetch(&generation, 1, __ATOMIC_RELEASE);
+}
+
+uint64_t x86_energy_hotplug_refresh(void)
+{
+    pthread_mutex_lock(&hotplug_mutex);
+    read_online();
+    pthread_mutex_unlock(&hotplug_mutex);
+    return x86_energy_hotplug_generation();
+}
+
+uint64_t x86_energy_hotplug_generation(void)
+{
+    return __atomic_load_n(&generation, __ATOMIC_ACQUIRE);
+}
+
+bool x86_energy_cpu_online(long cpu)
+{
+    pthread_mutex_lock(&hotplug_mutex);
+    if (!online_read)
+        read_online();
+    /* without the online file, every cpu is assumed to be online */
+    bool result = !online_read || (cpu >= 0 && cpu < CPU_SETSIZE && CPU_ISSET(cpu, &online));
+    pthread_mutex_unlock(&hotplug_mutex);
+    return result;
+}
+
+/* uevents start with "<action>@<devpath>", e.g. "offline@/devices/system/cpu/cpu3" */
+static bool is_cpu_uevent(const char* message, size_t len)
+{
+    const char* at = memchr(message, '@', len);
+    return at != NULL && (size_t)(at - message) + 24 <= len &&
+           strncmp(at + 1, "/devices/system/cpu/cpu", 23) == 0;
+}
+
+static void* watch(void* arg)
+{
+    struct watcher* self = arg;
+    struct pollfd fds[2] = { { .fd = self->stop_fd, .events = POLLIN },
+                             { .fd = self->uevent_fd, .events = POLLIN } };
+    nfds_t nfds = self->uevent_fd >= 0 ? 2 : 1;
+    while (true)
+    {
+        int ret = poll(fds, nfds, POLL_MS);
+        if (ret < 0 && errno != EINTR)
+            break;
+        if (ret > 0 && fds[0].revents != 0)
+            break;
+        bool changed = ret == 0;
+        if (ret > 0 && nfds == 2 && fds[1].revents != 0)
+        {
+            char buffer[UEVENT_BUFFER_SIZE];
+            ssize_t len = recv(self->uevent_fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+            changed = len > 0 && is_cpu_uevent(buffer, len);
+        }
+        if (changed)
+            x86_energy_hotplug_refresh();
+    }
+    return NULL;
+}
+
+static int open_uevent_socket(void)
+{
+    int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+    if (fd < 0)
+        return -1;
+    struct sockaddr_nl addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = 1; /* kernel uevents */
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int x86_energy_hotplug_acquire(void)
+{
+    pthread_mutex_lock(&hotplug_mutex);
+    if (users > 0)
+    {
+        users++;
+        pthread_mutex_unlock(&hotplug_mutex);
+        return 0;
+    }
+    read_online();
+    struct watcher* new_watcher = malloc(sizeof(struct watcher));
+    if (new_watcher == NULL)
+    {
+        pthread_mutex_unlock(&hotplug_mutex);
+        X86_ENERGY_SET_ERROR("could not allocate %zu bytes", sizeof(struct watcher));
+        return 1;
+    }
+    new_watcher->stop_fd = eventfd(0, EFD_CLOEXEC);
+    if (new_watcher->stop_fd < 0)
+    {
+        free(new_watcher);
+        pthread_mutex_unlock(&hotplug_mutex);
+        X86_ENERGY_SET_ERROR("could not create eventfd for the hotplug thread");
+        return 1;
+    }
+    new_watcher->uevent_fd = open_uevent_socket();
+    if (x86_energy_thread_create(&new_watcher->thread, "x86e-hotplug", watch, new_watcher) != 0)
+    {
+        if (new_watcher->uevent_fd >= 0)
+            close(new_watcher->uevent_fd);
+        close(new_watcher->stop_fd);
+        free(new_watcher);
+        pthread_mutex_unlock(&hotplug_mutex);
+        X86_ENERGY_SET_ERROR("could not create the hotplug thread");
+        return 1;
+    }
+    watcher = new_watcher;
+    users = 1;
+    pthread_mutex_unlock(&hotplug_mutex);
+    return 0;
+}
+
+void x86_energy_hotplug_release(void)
+{
+    pthread_mutex_lock(&hotplug_mutex);
+    if (users == 0 || --users > 0)
+    {
+        pthread_mutex_unlock(&hotplug_mutex);
+        return;
+    }
+    struct watcher* old = watcher;
+    watcher = NULL;
+    /* the thread takes hotplug_mutex for refreshing, so it is joined without holding it */
+    pthread_mutex_unlock(&hotplug_mutex);
+
+    uint64_t stop = 1;
+    while (write(old->stop_fd, &stop, sizeof(stop)) < 0 && errno == EINTR)
+        ;
+    pthread_join(old->thread, NULL);
+    if (old->uevent_fd >= 0)
+        close(old->uevent_fd);
+    close(old->stop_fd);
+    free(old);
+}
@@ -5,6 +5,7 @@
  *      Author: rschoene
  */
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -12,26 +13,49 @@
 
 #include "../include/overflow_thread.h"
 #include "../include/error.h"
+#include "../include/threads.h"
 
 static bool override_update_rate;
 static long long int override_update_rate_us;
 
+/* set by sessions while they set up counters */
+static __thread bool thread_update_rate;
+static __thread long long int thread_update_rate_us;
+
 void x86_energy_set_internal_update_thread_rate(long long int time)
 {
     override_update_rate = true;
     override_update_rate_us = time;
 }
 
+void x86_energy_overflow_set_thread_rate(long long int time)
+{
+    thread_update_rate = true;
+    thread_update_rate_us = time;
+}
+
+void x86_energy_overflow_clear_thread_rate(void)
+{
+    thread_update_rate = false;
+}
+
+void x86_energy_overflow_init(struct ov_struct* ov)
+{
+    memset(ov, 0, sizeof(struct ov_struct));
+    pthread_mutex_init(&ov->mutex, NULL);
+}
+
+/* must be called with ov->mutex held, like add_thread_info */
 static struct thread_info* get_thread_info(struct ov_struct* ov, int cpu)
 {
     if (ov->thread_infos == NULL)
         return NULL;
-    for (int i = 0; i < ov->nr_thread_infos; i++)
+    for (size_t i = 0; i < ov->nr_thread_infos; i++)
         if (ov->thread_infos[i]->cpu == cpu)
             return ov->thread_infos[i];
     return NULL;
 }
-static struct thread_info* add_thread_info(struct ov_struct* ov, int cpu, long long usleep_time)
+static struct thread_info* add_thread_info(struct ov_struct* ov, int cpu)
 {
     struct thread_info** new_infos =
         realloc(ov->thread_infos, sizeof(struct thread_info*) * (ov->nr_thread_infos + 1));
@@ -41,103 +65,179 @@ static struct thread_info* add_thread_info(struct ov_struct* ov, int cpu, long l
         return NULL;
     }
     ov->thread_infos = new_infos;
-    ov->nr_thread_infos++;
     struct thread_info* info = malloc(sizeof(struct thread_info));
     if (info == NULL)
     {
-    	X86_ENERGY_SET_ERROR("could not allocate %d bytes for storing thread_info", sizeof(struct thread_info));
+    	X86_ENERGY_SET_ERROR("could not allocate %zu bytes for storing thread_info", sizeof(struct thread_info));
         return NULL;
     }
     memset(info, 0, sizeof(struct thread_info));
     pthread_mutex_init(&info->mutex, NULL);
-    ov->thread_infos[ov->nr_thread_infos - 1] = info;
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&info->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    ov->thread_infos[ov->nr_thread_infos++] = info;
     info->cpu = cpu;
-    info->usleep_time = usleep_time;
     return info;
 }
 
-static int add_call(struct thread_info* info, double (*read)(x86_energy_single_counter_t),
-                    x86_energy_single_counter_t t)
+static struct ov_call* add_call(struct thread_info* info,
+                                double (*read)(x86_energy_single_counter_t),
+                                x86_energy_single_counter_t t, long long usleep_time)
 {
-    pthread_mutex_lock(&info->mutex);
-    read_function_t* new_functions =
-        realloc(info->functions, sizeof(read_function_t) * (info->nr_functions + 1));
-    if (new_functions == NULL)
+    struct ov_call* call = malloc(sizeof(struct ov_call));
+    if (call == NULL)
     {
-        pthread_mutex_unlock(&info->mutex);
-        X86_ENERGY_SET_ERROR("could not allocate a few more bytes for storing read function");
-        return 1;
+        X86_ENERGY_SET_ERROR("could not allocate %zu bytes for storing read function", sizeof(struct ov_call));
+        return NULL;
     }
-    x86_energy_single_counter_t* new_t =
-        realloc(info->t, sizeof(x86_energy_single_counter_t) * (info->nr_functions + 1));
-    if (new_t == NULL)
+    call->read = read;
+    call->t = t;
+    call->period_ns = usleep_time * 1000ULL;
+    call->last_read_ns = x86_energy_overflow_now();
+
+    pthread_mutex_lock(&info->mutex);
+    struct ov_call** new_calls =
+        realloc(info->calls, sizeof(struct ov_call*) * (info->nr_calls + 1));
+    if (new_calls == NULL)
     {
-        info->functions = new_functions;
         pthread_mutex_unlock(&info->mutex);
-        X86_ENERGY_SET_ERROR("could not allocate %d bytes for storing thread_info", sizeof(struct thread_info));
-        return 1;
+        free(call);
+        X86_ENERGY_SET_ERROR("could not allocate a few more bytes for storing read function");
+        return NULL;
     }
-    info->functions = new_functions;
-    info->functions[info->nr_functions] = read;
-    info->t = new_t;
-    info->t[info->nr_functions] = t;
-    info->nr_functions++;
+    info->calls = new_calls;
+    info->calls[info->nr_calls++] = call;
+    /* the new counter might be due earlier than all others */
+    pthread_cond_signal(&info->cond);
     pthread_mutex_unlock(&info->mutex);
-    return 0;
+    return call;
 }
 
+/*
+ * Reads each counter only when it has not been read for its period, e.g., by the application.
+ * Sleeps until the next counter is due, so counters that are read often never cause wakeups.
+ */
 static void* on_overflow(void* arg)
 {
     struct thread_info* info = (struct thread_info*)arg;
-    while (1)
+    pthread_mutex_lock(&info->mutex);
+    while (!info->stop)
     {
-        usleep(info->usleep_time);
-        for (int i = 0; i < info->nr_functions; i++)
-            info->functions[i](info->t[i]);
+        uint64_t now = x86_energy_overflow_now();
+        uint64_t next = UINT64_MAX;
+        for (size_t i = 0; i < info->nr_calls; i++)
+        {
+            struct ov_call* call = info->calls[i];
+            uint64_t period = __atomic_load_n(&call->period_ns, __ATOMIC_RELAXED);
+            uint64_t deadline = __atomic_load_n(&call->last_read_ns, __ATOMIC_RELAXED) + period;
+            if (deadline <= now)
+            {
+                call->read(call->t);
+                /* also if the read failed, otherwise it would be retried immediately */
+                now = x86_energy_overflow_now();
+                __atomic_store_n(&call->last_read_ns, now, __ATOMIC_RELAXED);
+                deadline = now + __atomic_load_n(&call->period_ns, __ATOMIC_RELAXED);
+            }
+            if (deadline < next)
+                next = deadline;
+        }
+        if (next == UINT64_MAX)
+        {
+            pthread_cond_wait(&info->cond, &info->mutex);
+            continue;
+        }
+        struct timespec until = { .tv_sec = next / 1000000000ULL, .tv_nsec = next % 1000000000ULL };
+        pthread_cond_timedwait(&info->cond, &info->mutex, &until);
     }
-    /* will be canceled anyway */
+    pthread_mutex_unlock(&info->mutex);
     return NULL;
 }
 
+static void remove_call(struct thread_info* info, double (*read)(x86_energy_single_counter_t),
+                        x86_energy_single_counter_t t)
+{
+    /* the thread holds the mutex while reading, so the counter is not in use afterwards */
+    pthread_mutex_lock(&info->mutex);
+    size_t i;
+    for (i = 0; i < info->nr_calls; i++)
+    {
+        if ((info->calls[i]->read == read) && (info->calls[i]->t == t))
+            break;
+    }
+    if (i == info->nr_calls)
+	{
+    	pthread_mutex_unlock(&info->mutex);
+        return;
+	}
+
+    free(info->calls[i]);
+    memmove(&(info->calls[i]), &(info->calls[i + 1]),
+            sizeof(struct ov_call*) * (info->nr_calls - i - 1));
+
+    info->nr_calls--;
+    pthread_mutex_unlock(&info->mutex);
+}
+
 int x86_energy_overflow_thread_create(struct ov_struct* ov, int cpu, pthread_t* thread,
                                       pthread_mutex_t* mutex,
                                       double (*read)(x86_energy_single_counter_t),
-                                      x86_energy_single_counter_t t, long long usleep_time)
+                                      x86_energy_single_counter_t t, long long usleep_time,
+                                      struct ov_call** call)
 {
-    if ( override_update_rate )
+    pthread_mutex_init(mutex, NULL);
+    *call = NULL;
+    if ( thread_update_rate )
+    {
+        if ( thread_update_rate_us == 0 )
+            return 0 ;
+
+        usleep_time = thread_update_rate_us;
+    }
+    else if ( override_update_rate )
     {
         if ( override_update_rate_us == 0 )
             return 0 ;
 
-        usleep_time = override_update_rate;
+        usleep_time = override_update_rate_us;
     }
 
+    /* two sources might otherwise add the same cpu or start two threads for it */
+    pthread_mutex_lock(&ov->mutex);
     struct thread_info* info = get_thread_info(ov, cpu);
     if (info == NULL)
     {
-        if (add_thread_info(ov, cpu, usleep_time) == NULL)
+        info = add_thread_info(ov, cpu);
+        if (info == NULL)
         {
+            pthread_mutex_unlock(&ov->mutex);
         	X86_ENERGY_APPEND_ERROR("could not set up thread info for thread related to cpu %d", cpu);
             return 1;
         }
     }
-    else
+    *call = add_call(info, read, t, usleep_time);
+    if (*call == NULL)
     {
-        if (info->usleep_time > usleep_time)
-            info->usleep_time = usleep_time;
+        pthread_mutex_unlock(&ov->mutex);
+        return 1;
     }
-    info = get_thread_info(ov, cpu);
-    add_call(info, read, t);
     if (info->thread == 0)
     {
-        if (pthread_create(&(info->thread), NULL, on_overflow, info) != 0)
+        char name[16];
+        snprintf(name, sizeof(name), "x86e-ovf-%d", cpu);
+        if (x86_energy_thread_create(&(info->thread), name, on_overflow, info) != 0)
         {
+            remove_call(info, read, t);
+            pthread_mutex_unlock(&ov->mutex);
+            *call = NULL;
         	X86_ENERGY_SET_ERROR("failed to create pthread for cpu %d", cpu);
             return 1;
         }
     }
     *thread = info->thread;
-    *mutex = info->mutex;
+    pthread_mutex_unlock(&ov->mutex);
     return 0;
 }
 
@@ -145,50 +245,53 @@ void x86_energy_overflow_thread_remove_call(struct ov_struct* ov, int cpu,
                                             double (*read)(x86_energy_single_counter_t),
                                             x86_energy_single_counter_t t)
 {
+    pthread_mutex_lock(&ov->mutex);
     struct thread_info* info = get_thread_info(ov, cpu);
     if (info == NULL)
     {
+        pthread_mutex_unlock(&ov->mutex);
     	X86_ENERGY_SET_ERROR("could not retrieve thread info for thread related to cpu %d", cpu);
         return;
     }
-    pthread_mutex_lock(&info->mutex);
-    size_t i;
-    for (i = 0; i < info->nr_functions; i++)
-    {
-        if ((info->functions[i] == read) && (info->t[i] == t))
-            break;
-    }
-    if (i == info->nr_functions)
-	{
-    	pthread_mutex_unlock(&info->mutex);
-        return;
-	}
-
-    memcpy(&(info->functions[i]), &(info->functions[i + 1]),
-           sizeof(read_function_t) * (info->nr_functions - i - 1));
-    memcpy(&(info->t[i]), &(info->t[i + 1]),
-           sizeof(read_function_t) * (info->nr_functions - i - 1));
-
-    info->nr_functions--;
-    pthread_mutex_unlock(&info->mutex);
+    remove_call(info, read, t);
+    pthread_mutex_unlock(&ov->mutex);
 }
 
 int x86_energy_overflow_thread_killall(struct ov_struct* ov)
 {
-    if (ov->thread_infos == NULL)
-        return 0;
+    pthread_mutex_lock(&ov->mutex);
     int ret = 0;
-    for (int i = 0; i < ov->nr_thread_infos; i++)
-        ret |= pthread_cancel(ov->thread_infos[i]->thread);
+    for (size_t i = 0; i < ov->nr_thread_infos; i++)
+    {
+        struct thread_info* info = ov->thread_infos[i];
+        if (info->thread == 0)
+            continue;
+        pthread_mutex_lock(&info->mutex);
+        info->stop = true;
+        pthread_cond_signal(&info->cond);
+        pthread_mutex_unlock(&info->mutex);
+        ret |= pthread_join(info->thread, NULL);
+        info->thread = 0;
+        info->stop = false;
+    }
+    pthread_mutex_unlock(&ov->mutex);
     return ret;
 }
 
 void x86_energy_overflow_freeall(struct ov_struct* ov)
 {
-    if (ov->thread_infos == NULL)
-        return;
-    for (int i = 0; i < ov->nr_thread_infos; i++)
-        free(ov->thread_infos[i]);
+    for (size_t i = 0; i < ov->nr_thread_infos; i++)
+    {
+        struct thread_info* info = ov->thread_infos[i];
+        for (size_t j = 0; j < info->nr_calls; j++)
+            free(info->calls[j]);
+        free(info->calls);
+        pthread_cond_destroy(&info->cond);
+        pthread_mutex_destroy(&info->mutex);
+        free(info);
+    }
     free(ov->thread_infos);
     ov->thread_infos = NULL;
+    ov->nr_thread_infos = 0;
+    pthread_mutex_destroy(&ov->mutex);
 }
@@ -1,5 +1,6 @@
 #include <errno.h>
 #include <error.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -17,36 +18,48 @@
 #include <inttypes.h>
 
 #include "../../include/x86_energy.h"
+#include "../include/architecture.h"
+#include "../include/arena.h"
+#include "../include/cache.h"
 #include "../include/error.h"
 
-static int read_file_long(char* file, long int* result)
+/* worker threads must not touch the error string, so they read files with report == false */
+#define REPORT_ERROR(...)                                                                          \
+    do                                                                                             \
+    {                                                                                              \
+        if (report)                                                                                \
+            X86_ENERGY_SET_ERROR(__VA_ARGS__);                                                     \
+    } while (0)
+
+static int read_file_long(const char* file, long int* result, bool report)
 {
     char buffer[2048];
-    int fd = open(file, O_RDONLY);
+    int fd = open(file, O_RDONLY | O_CLOEXEC);
     if (fd < 0)
     {
-        X86_ENERGY_SET_ERROR("Could not open %s",file );
+        REPORT_ERROR("Could not open %s",file );
         return 1;
     }
-    int read_bytes = read(fd, buffer, 2048);
+    int read_bytes = read(fd, buffer, sizeof(buffer) - 1);
     close(fd);
     if (read_bytes < 0)
     {
-        X86_ENERGY_SET_ERROR("Could not read %s",file );
+        REPORT_ERROR("Could not read %s",file );
         return 1;
     }
+    buffer[read_bytes] = '\0';
     char* endptr;
     *result = strtol(buffer, &endptr, 10);
     return 0;
 }
 
-static int read_file_long_list(char* file, long int** result, int* length)
+static int read_file_long_list(const char* file, long int** result, int* length, bool report)
 {
     char buffer[2048];
-    int fd = open(file, O_RDONLY);
+    int fd = open(file, O_RDONLY | O_CLOEXEC);
     if (fd < 0)
     {
-        X86_ENERGY_SET_ERROR("Could not open %s",file );
+        REPORT_ERROR("Could not open %s",file );
         return 1;
     }
     int read_bytes = read(fd, buffer, 2048);
@@ -54,14 +67,15 @@ static int read_file_long_list(char* file, long int** result, int* length)
     /* would need larger buffer */
     if (read_bytes == 2048)
     {
-        X86_ENERGY_SET_ERROR("Could not read %s (insufficient buffer)",file );
+        REPORT_ERROR("Could not read %s (insufficient buffer)",file );
         return 1;
     }
     if (read_bytes < 0)
     {
-        X86_ENERGY_SET_ERROR("Could not read %s",file );
+        REPORT_ERROR("Could not read %s",file );
         return 1;
     }
+    buffer[read_bytes] = '\0';
     int end_of_text = read_bytes - 1;
     *result = NULL;
     *length = 0;
@@ -83,7 +97,7 @@ static int read_file_long_list(char* file, long int** result, int* length)
         if ( next_ptr == current_ptr || errno !=0 )
         {
             /* sth went wrong */
-            X86_ENERGY_SET_ERROR("Could not read next CPU: %s",current_ptr );
+            REPORT_ERROR("Could not read next CPU: %s",current_ptr );
             free(*result);
             *result = NULL;
             *length = 0;
@@ -92,12 +106,14 @@ static int read_file_long_list(char* file, long int** result, int* length)
         switch ( *next_ptr )
         {
         /* add cpu */
-        case ',':
+        case ',':  /* fall-through */
+        case '\n': /* fall-through */
+        case '\0':
         {
             long int* tmp = realloc(*result, ((*length) + 1) * sizeof(**result));
             if (!tmp)
             {
-                X86_ENERGY_SET_ERROR("Could not realloc for CPUs" );
+                REPORT_ERROR("Could not realloc for CPUs" );
                 free(*result);
                 *result = NULL;
                 *length = 0;
@@ -106,14 +122,13 @@ static int read_file_long_list(char* file, long int** result, int* length)
             *result = tmp;
             tmp[*length] = read_cpu;
             (*length)++;
+            /* return on end */
+            if (*next_ptr != ',')
+                return 0;
             /*continue at ',' +1 */
             current_ptr = next_ptr + 1;
             break;
         }
-        /* just return on end */
-        case '\n': /* fall-through */
-        case '\0':
-            return 0;
         /* range: read another long int */
         case '-':
         {
@@ -123,7 +138,7 @@ static int read_file_long_list(char* file, long int** result, int* length)
             /* if read error return error */
             if ( next_ptr == current_ptr || errno !=0 )
             {
-                X86_ENERGY_SET_ERROR("Could not read next CPU(2): %s",current_ptr );
+                REPORT_ERROR("Could not read next CPU(2): %s",current_ptr );
                 free(*result);
                 *result = NULL;
                 *length = 0;
@@ -134,7 +149,7 @@ static int read_file_long_list(char* file, long int** result, int* length)
 
             if (!tmp)
             {
-                X86_ENERGY_SET_ERROR("Could not realloc for CPUs(2)" );
+                REPORT_ERROR("Could not realloc for CPUs(2)" );
                 free(*result);
                 *result = NULL;
                 *length = 0;
@@ -157,7 +172,7 @@ static int read_file_long_list(char* file, long int** result, int* length)
                 current_ptr = next_ptr + 1;
                 break;
             default:
-                X86_ENERGY_SET_ERROR("Unexpected cpulist encoding (%s) %s",file, next_ptr );
+                REPORT_ERROR("Unexpected cpulist encoding (%s) %s",file, next_ptr );
                 free(*result);
                 *result = NULL;
                 *length = 0;
@@ -167,7 +182,7 @@ static int read_file_long_list(char* file, long int** result, int* length)
         }
         /* unexpected character return error */
         default:
-            X86_ENERGY_SET_ERROR("Unexpected cpulist encoding(2) (%s) %s",file, next_ptr );
+            REPORT_ERROR("Unexpected cpulist encoding(2) (%s) %s",file, next_ptr );
             free(*result);
             *result = NULL;
             *length = 0;
@@ -177,35 +192,207 @@ static int read_file_long_list(char* file, long int** result, int* length)
     return 0;
 }
 
-static void sort_children(x86_energy_architecture_node_t* node)
+/* the number of threads that read the topology files of NUMA nodes concurrently */
+#define MAX_TOPOLOGY_THREADS 8
+
+#define TOPOLOGY_PACKAGE 0x1
+#define TOPOLOGY_CORE 0x2
+#define TOPOLOGY_CACHES 0x4
+
+/* the topology files of a single CPU, read ahead by a worker thread */
+struct cpu_topology
+{
+    long int cpu;
+    int valid; /* TOPOLOGY_* flags for the entries that could be read */
+    long int package_id;
+    long int core_id;
+    long int* shared_cpus_l2;
+    int nr_shared_cpus_l2;
+    int nr_shared_cpus_l1;
+};
+
+/* the cpulist of a NUMA node and the topology of its CPUs */
+struct node_topology
+{
+    long int* cpus;
+    int nr_cpus;
+    struct cpu_topology* topology;
+};
+
+struct topology_prefetch
+{
+    struct node_topology* nodes;
+    struct cpu_topology** by_cpu;
+    long int nr_by_cpu;
+};
+
+struct prefetch_worker
+{
+    pthread_t thread;
+    const char* sysfs_path;
+    int32_t* nodes;
+    struct node_topology* results;
+    int nr_nodes;
+    int first;
+    int stride;
+};
+
+static void prefetch_cpu(const char* sysfs_path, struct cpu_topology* topology)
+{
+    char filename[2048];
+    long int cpu = topology->cpu;
+    long int* shared_cpus_l1;
+
+    snprintf(filename, sizeof(filename),
+             "%s/devices/system/cpu/cpu%ld/topology/physical_package_id", sysfs_path, cpu);
+    if (read_file_long(filename, &topology->package_id, false) == 0)
+        topology->valid |= TOPOLOGY_PACKAGE;
+
+    snprintf(filename, sizeof(filename), "%s/devices/system/cpu/cpu%ld/topology/core_id",
+             sysfs_path, cpu);
+    if (read_file_long(filename, &topology->core_id, false) == 0)
+        topology->valid |= TOPOLOGY_CORE;
+
+    snprintf(filename, sizeof(filename), "%s/devices/system/cpu/cpu%ld/cache/index2/shared_cpu_list",
+             sysfs_path, cpu);
+    if (read_file_long_list(filename, &topology->shared_cpus_l2, &topology->nr_shared_cpus_l2,
+                            false))
+        return;
+    snprintf(filename, sizeof(filename), "%s/devices/system/cpu/cpu%ld/cache/index1/shared_cpu_list",
+             sysfs_path, cpu);
+    if (read_file_long_list(filename, &shared_cpus_l1, &topology->nr_shared_cpus_l1, false))
+    {
+        free(topology->shared_cpus_l2);
+        topology->shared_cpus_l2 = NULL;
+        return;
+    }
+    free(shared_cpus_l1);
+    topology->valid |= TOPOLOGY_CACHES;
+}
+
+static void prefetch_node(const char* sysfs_path, int32_t node_id, struct node_topology* result)
+{
+    char filename[2048];
+    snprintf(filename, sizeof(filename), "%s/devices/system/node/node%" PRId32 "/cpulist",
+             sysfs_path, node_id);
+    if (read_file_long_list(filename, &result->cpus, &result->nr_cpus, false))
+    {
+        result->cpus = NULL;
+        result->nr_cpus = 0;
+        return;
+    }
+    result->topology = calloc(result->nr_cpus, sizeof(struct cpu_topology));
+    if (result->topology == NULL)
+        return;
+    for (int i = 0; i < result->nr_cpus; i++)
+    {
+        result->topology[i].cpu = result->cpus[i];
+        prefetch_cpu(sysfs_path, &result->topology[i]);
+    }
+}
+
+static void* prefetch_worker_run(void* arg)
+{
+    struct prefetch_worker* worker = arg;
+    for (int i = worker->first; i < worker->nr_nodes; i += worker->stride)
+        prefetch_node(worker->sysfs_path, worker->nodes[i], &worker->results[i]);
+    return NULL;
+}
+
+/* Reads the topology files of all NUMA nodes with a small pool of threads, one partition of the
+ * nodes per thread. Nothing here is reported as error, anything that is missing is read (and
+ * reported) again while merging the tree.
+ */
+static int prefetch_topology(const char* sysfs_path, int32_t* nodes, int nr_nodes,
+                             struct topology_prefetch* prefetch)
+{
+    memset(prefetch, 0, sizeof(*prefetch));
+    prefetch->nodes = calloc(nr_nodes, sizeof(struct node_topology));
+    if (prefetch->nodes == NULL && nr_nodes > 0)
+        return 1;
+
+    int nr_threads = nr_nodes < MAX_TOPOLOGY_THREADS ? nr_nodes : MAX_TOPOLOGY_THREADS;
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    if (online > 0 && nr_threads > online)
+        nr_threads = online;
+    if (nr_threads < 1)
+        nr_threads = 1;
+
+    struct prefetch_worker workers[MAX_TOPOLOGY_THREADS];
+    for (int i = 0; i < nr_threads; i++)
+    {
+        workers[i].sysfs_path = sysfs_path;
+        workers[i].nodes = nodes;
+        workers[i].results = prefetch->nodes;
+        workers[i].nr_nodes = nr_nodes;
+        workers[i].first = i;
+        workers[i].stride = nr_threads;
+    }
+    /* the calling thread handles the first partition, and any partition without a thread */
+    bool started[MAX_TOPOLOGY_THREADS] = { false };
+    for (int i = 1; i < nr_threads; i++)
+        started[i] = pthread_create(&workers[i].thread, NULL, prefetch_worker_run, &workers[i]) == 0;
+    for (int i = 0; i < nr_threads; i++)
+        if (!started[i])
+            prefetch_worker_run(&workers[i]);
+    for (int i = 1; i < nr_threads; i++)
+        if (started[i])
+            pthread_join(workers[i].thread, NULL);
+
+    /* index by cpu */
+    long int max_cpu = -1;
+    for (int i = 0; i < nr_nodes; i++)
+        if (prefetch->nodes[i].topology != NULL)
+            for (int j = 0; j < prefetch->nodes[i].nr_cpus; j++)
+                if (prefetch->nodes[i].cpus[j] > max_cpu)
+                    max_cpu = prefetch->nodes[i].cpus[j];
+    if (max_cpu < 0)
+        return 0;
+    prefetch->by_cpu = calloc(max_cpu + 1, sizeof(struct cpu_topology*));
+    if (prefetch->by_cpu == NULL)
+        return 0;
+    prefetch->nr_by_cpu = max_cpu + 1;
+    for (int i = 0; i < nr_nodes; i++)
+        if (prefetch->nodes[i].topology != NULL)
+            for (int j = 0; j < prefetch->nodes[i].nr_cpus; j++)
+                if (prefetch->nodes[i].cpus[j] >= 0)
+                    prefetch->by_cpu[prefetch->nodes[i].cpus[j]] = &prefetch->nodes[i].topology[j];
+    return 0;
+}
+
+static void free_topology_prefetch(struct topology_prefetch* prefetch, int nr_nodes)
 {
-    for (size_t n=node->nr_children; n>1; --n)
-        for (size_t i=0 ; i<n-1 ; ++i)
+    if (prefetch->nodes != NULL)
+    {
+        for (int i = 0; i < nr_nodes; i++)
         {
-            if (node->children[i].id > node->children[i+1].id)
-            {
-                x86_energy_architecture_node_t tmp=node->children[i];
-                node->children[i] = node->children[i+1];
-                node->children[i+1]=tmp;
-            }
+            if (prefetch->nodes[i].topology != NULL)
+                for (int j = 0; j < prefetch->nodes[i].nr_cpus; j++)
+                    free(prefetch->nodes[i].topology[j].shared_cpus_l2);
+            free(prefetch->nodes[i].topology);
+            free(prefetch->nodes[i].cpus);
         }
+    }
+    free(prefetch->nodes);
+    free(prefetch->by_cpu);
+    memset(prefetch, 0, sizeof(*prefetch));
 }
 
-static void sort_children_recursive(x86_energy_architecture_node_t* node)
+static struct cpu_topology* lookup_cpu(struct topology_prefetch* prefetch, long int cpu,
+                                       int flag)
 {
-   sort_children(node);
-   for (size_t i=0 ; i < node->nr_children ; i++)
-   {
-       sort_children_recursive(&node->children[i]);
-   }
+    if (cpu < 0 || cpu >= prefetch->nr_by_cpu || prefetch->by_cpu[cpu] == NULL)
+        return NULL;
+    if (!(prefetch->by_cpu[cpu]->valid & flag))
+        return NULL;
+    return prefetch->by_cpu[cpu];
 }
 
 /*checks for /sys/devices/system/cpu/node/node<n> */
-static int get_nodes(char* sysfs, x86_energy_architecture_node_t** nodes, int* nr_nodes)
+static int get_nodes(char* sysfs, int32_t** nodes, int* nr_nodes)
 {
     *nodes = NULL;
     *nr_nodes = 0;
-    /* TODO get filenames */
     char fs[256];
     int ret = snprintf(fs, 256, "%s/devices/system/node", sysfs);
 
@@ -218,8 +405,7 @@ static int get_nodes(char* sysfs, x86_energy_architecture_node_t** nodes, int* n
     DIR* d;
     struct dirent* dir;
     d = opendir(fs);
-    char** filenames = NULL;
-    int nr_filenames = 0;
+    int capacity = 0;
     if (d)
     {
         while ((dir = readdir(d)) != NULL)
@@ -227,148 +413,72 @@ static int get_nodes(char* sysfs, x86_energy_architecture_node_t** nodes, int* n
             if (strncmp(dir->d_name, "node", 4) == 0 && dir->d_type == DT_DIR &&
                 dir->d_name[4] >= '0' && dir->d_name[4] <= '9')
             {
-                char** tmp = realloc(filenames, sizeof(char*) * (nr_filenames + 1));
-                if (tmp == NULL)
-                {
-                    X86_ENERGY_SET_ERROR("Could not realloc for get_nodes" );
-                    for (int i = 0; i < nr_filenames; i++)
-                    {
-                        free(filenames[i]);
-                    }
-                    if (filenames)
-                        free(filenames);
-                    closedir(d);
-                    return 1;
-                }
-                filenames = tmp;
-                filenames[nr_filenames] = strdup(dir->d_name);
-                if (filenames[nr_filenames] == NULL)
+                if (*nr_nodes == capacity)
                 {
-                    X86_ENERGY_SET_ERROR("Could not strdup for get_nodes" );
-                    for (int i = 0; i < nr_filenames; i++)
+                    capacity = capacity ? 2 * capacity : 16;
+                    int32_t* tmp = realloc(*nodes, sizeof(int32_t) * capacity);
+                    if (tmp == NULL)
                     {
-                        free(filenames[i]);
+                        X86_ENERGY_SET_ERROR("Could not realloc for get_nodes" );
+                        free(*nodes);
+                        *nodes = NULL;
+                        *nr_nodes = 0;
+                        closedir(d);
+                        return 1;
                     }
-                    if (filenames)
-                        free(filenames);
-                    closedir(d);
-                    return 1;
+                    *nodes = tmp;
                 }
-                nr_filenames++;
+                /* get %d */
+                (*nodes)[*nr_nodes] = strtol(dir->d_name + 4, NULL, 10);
+                (*nr_nodes)++;
             }
         }
         closedir(d);
     }
-
-    for (int i = 0; i < nr_filenames; i++)
-    {
-        char* filename = filenames[i];
-        char* endptr;
-        /* get %d */
-        long int node = strtol(filename + 4, &endptr, 10);
-        x86_energy_architecture_node_t* tmp = realloc(*nodes, (*nr_nodes + 1) * sizeof(**nodes));
-        if (tmp == NULL)
-        {
-            X86_ENERGY_SET_ERROR("Could not realloc(2) for get_nodes" );
-            for (int i = 0; i < *nr_nodes; i++)
-                free((*nodes)[i].name);
-            free(*nodes);
-            *nodes = NULL;
-            *nr_nodes = 0;
-            return -1;
-        }
-        *nodes = tmp;
-        (*nodes)[*nr_nodes].granularity = X86_ENERGY_GRANULARITY_DIE;
-        (*nodes)[*nr_nodes].id = node;
-        (*nodes)[*nr_nodes].children = NULL;
-        (*nodes)[*nr_nodes].nr_children = 0;
-        char buffer[16];
-        sprintf(buffer, "%ld", node);
-        (*nodes)[*nr_nodes].name = strdup(buffer);
-        (*nr_nodes)++;
-        free(filenames[i]);
-        filenames[i] = NULL;
-    }
-    free(filenames);
     return 0;
 }
 
-static int insert_new_child(x86_energy_architecture_node_t* parent_node, int granularity,
-                            long int id, const char* name)
+static struct arch_build_node* find_or_add_child(struct arch_builder* builder,
+                                                 struct arch_build_node* parent_node,
+                                                 enum x86_energy_granularity granularity,
+                                                 long int id)
 {
-    char* new_name = strdup(name);
-    if (new_name == NULL)
+    struct arch_build_node* child = x86_energy_arch_builder_find_child(parent_node, id);
+    if (child == NULL)
     {
-        X86_ENERGY_SET_ERROR("Could not strdup for insert_new_child" );
-        return 1;
+        child = x86_energy_arch_builder_add(builder, parent_node, granularity, id, id, NULL, 0);
+        if (child == NULL)
+            X86_ENERGY_APPEND_ERROR("could not insert child with granularity %d, id %ld",
+                                    granularity, id);
     }
-    x86_energy_architecture_node_t* tmp =
-        realloc(parent_node->children,
-                (parent_node->nr_children + 1) * sizeof(x86_energy_architecture_node_t));
-    if (tmp == NULL)
-    {
-        X86_ENERGY_SET_ERROR("Could not realloc for insert_new_child" );
-        return 1;
-    }
-    parent_node->children = tmp;
-    parent_node->children[parent_node->nr_children].id = id;
-    parent_node->children[parent_node->nr_children].name = new_name;
-    parent_node->children[parent_node->nr_children].granularity = granularity;
-    parent_node->children[parent_node->nr_children].children = NULL;
-    parent_node->children[parent_node->nr_children].nr_children = 0;
-    parent_node->nr_children++;
-    return 0;
+    return child;
 }
 
-static x86_energy_architecture_node_t* find_child(x86_energy_architecture_node_t* parent_node,
-                                                  long id)
+static int add_cpu_and_core_to_node(struct arch_builder* builder, const char* sysfs_path,
+                                    struct topology_prefetch* prefetch,
+                                    struct arch_build_node* parent_node, long int cpu)
 {
-    for (int i = 0; i < parent_node->nr_children; i++)
-    {
-        if (id == parent_node->children[i].id)
-        {
-            return &parent_node->children[i];
-        }
-    }
-    X86_ENERGY_SET_ERROR("could not find a child with id %ld", id);
-    return NULL;
-}
-
-static int add_cpu_and_core_to_node(const char* sysfs_path,
-                                    x86_energy_architecture_node_t* parent_node, long int cpu)
-{
-    char buffer[512];
-    snprintf(buffer, 512, "%s/devices/system/cpu/cpu%ld/topology/core_id", sysfs_path, cpu);
-    /* TODO test */
     long int core;
-    if (read_file_long(buffer, &core))
-    {
-    	X86_ENERGY_SET_ERROR("could not read file \"%s\"", buffer);
-        return 1;
-    }
-    x86_energy_architecture_node_t* core_node = find_child(parent_node, core);
-    if (core_node == NULL)
-    {
-        char name[256];
-        sprintf(name, "Core %ld", core);
-        if (insert_new_child(parent_node, X86_ENERGY_GRANULARITY_CORE, core, name))
-        {
-        	X86_ENERGY_APPEND_ERROR("could not insert child with granularity core, id %d and name \"%s\"", core, name);
-            return 1;
-        }
-        core_node = &parent_node->children[parent_node->nr_children - 1];
-    }
-    x86_energy_architecture_node_t* cpu_node = find_child(core_node, cpu);
-    if (cpu_node == NULL)
+    struct cpu_topology* topology = lookup_cpu(prefetch, cpu, TOPOLOGY_CORE);
+    if (topology != NULL)
+        core = topology->core_id;
+    else
     {
-        char name[256];
-        sprintf(name, "CPU %ld", cpu);
-        if (insert_new_child(core_node, X86_ENERGY_GRANULARITY_THREAD, cpu, name))
+        char buffer[512];
+        snprintf(buffer, 512, "%s/devices/system/cpu/cpu%ld/topology/core_id", sysfs_path, cpu);
+        /* TODO test */
+        if (read_file_long(buffer, &core, true))
         {
+            X86_ENERGY_SET_ERROR("could not read file \"%s\"", buffer);
             return 1;
-            X86_ENERGY_APPEND_ERROR("could not insert child with granularity thread, id %d and name \"%s\"", cpu, name);
         }
     }
+    struct arch_build_node* core_node =
+        find_or_add_child(builder, parent_node, X86_ENERGY_GRANULARITY_CORE, core);
+    if (core_node == NULL)
+        return 1;
+    if (find_or_add_child(builder, core_node, X86_ENERGY_GRANULARITY_THREAD, cpu) == NULL)
+        return 1;
     return 0;
 }
 
@@ -387,55 +497,22 @@ static bool find_cpu(x86_energy_architecture_node_t* node, int cpu)
     return false;
 }
 
-static int add_package(x86_energy_architecture_node_t* sys_node, long int package_id,
-                       x86_energy_architecture_node_t** package_node)
-{
-    *package_node = find_child(sys_node, package_id);
-    if (*package_node == NULL)
-    {
-        char package_name[512];
-        sprintf(package_name, "Processor %ld", package_id);
-        if (insert_new_child(sys_node, X86_ENERGY_GRANULARITY_SOCKET, package_id, package_name))
-        {
-        	X86_ENERGY_APPEND_ERROR("could not insert child with granularity socket, id %d and name \"%s\"", package_id, package_name);
-            return 1;
-        }
-        *package_node = &sys_node->children[sys_node->nr_children - 1];
-    }
-    return 0;
-}
-
-static int add_node_to_package(x86_energy_architecture_node_t* package,
-                               x86_energy_architecture_node_t** node)
-{
-    x86_energy_architecture_node_t* found_node = find_child(package, (*node)->id);
-    if (found_node == NULL)
-    {
-        x86_energy_architecture_node_t* tmp = realloc(
-            package->children, sizeof(x86_energy_architecture_node_t) * (package->nr_children + 1));
-        if (tmp == NULL)
-        {
-        	X86_ENERGY_SET_ERROR("could not get memory for adding new node. realloc with %d bytes failed", sizeof(x86_energy_architecture_node_t) * (package->nr_children + 1));
-            return 1;
-        }
-        package->children = tmp;
-        package->children[package->nr_children] = **node;
-        (*node)->name = NULL;
-        found_node = &package->children[package->nr_children];
-        package->nr_children++;
-    }
-    *node = found_node;
-    return 0;
-}
-
-static int process_node(const char* sysfs_path, x86_energy_architecture_node_t* sys_node,
-                        x86_energy_architecture_node_t* node)
+static int process_node(struct arch_builder* builder, const char* sysfs_path,
+                        struct arch_build_node* sys_node, int32_t node_id,
+                        struct node_topology* prefetched, struct topology_prefetch* prefetch)
 {
     long int* cpus;
     int nr_cpus;
     char filename[2048];
-    sprintf(filename, "%s/devices/system/node/node%" PRId32 "/cpulist", sysfs_path, node->id);
-    if (read_file_long_list(filename, &cpus, &nr_cpus))
+    sprintf(filename, "%s/devices/system/node/node%" PRId32 "/cpulist", sysfs_path, node_id);
+    if (prefetched->cpus != NULL)
+    {
+        /* take ownership */
+        cpus = prefetched->cpus;
+        nr_cpus = prefetched->nr_cpus;
+        prefetched->cpus = NULL;
+    }
+    else if (read_file_long_list(filename, &cpus, &nr_cpus, true))
     {
         fprintf(stderr, "Could not read %s\n",filename);
         return 1;
@@ -444,26 +521,32 @@ static int process_node(const char* sysfs_path, x86_energy_architecture_node_t*
     {
         long int cpu = cpus[current_cpu];
         /* try to find cpu */
-        if (find_cpu(node, cpu))
+        if (x86_energy_arch_builder_has_cpu(builder, cpu))
             continue;
         long int package_id;
+        struct cpu_topology* topology = lookup_cpu(prefetch, cpu, TOPOLOGY_PACKAGE);
         sprintf(filename, "%s/devices/system/cpu/cpu%ld/topology/physical_package_id", sysfs_path,
                 cpu);
-        if (read_file_long(filename, &package_id))
+        if (topology != NULL)
+            package_id = topology->package_id;
+        else if (read_file_long(filename, &package_id, true))
         {
             X86_ENERGY_APPEND_ERROR("Could not read %s",filename);
             free(cpus);
             return 1;
         }
-        x86_energy_architecture_node_t* package = NULL;
-        if (add_package(sys_node, package_id, &package))
+        struct arch_build_node* package =
+            find_or_add_child(builder, sys_node, X86_ENERGY_GRANULARITY_SOCKET, package_id);
+        if (package == NULL)
         {
             X86_ENERGY_APPEND_ERROR("Could not add package %li",package_id);
             free(cpus);
             return 1;
         }
 
-        if (add_node_to_package(package, &node))
+        struct arch_build_node* node =
+            find_or_add_child(builder, package, X86_ENERGY_GRANULARITY_DIE, node_id);
+        if (node == NULL)
         {
             X86_ENERGY_APPEND_ERROR("Could not add node to package %li",package_id);
             free(cpus);
@@ -472,49 +555,64 @@ static int process_node(const char* sysfs_path, x86_energy_architecture_node_t*
 
         /* now the module */
 
-        x86_energy_architecture_node_t* new_parent = node;
+        struct arch_build_node* new_parent = node;
 
         int nr_shared_cpus_l2;
         long int* shared_cpus_l2;
-        sprintf(filename, "%s/devices/system/cpu/cpu%ld/cache/index2/shared_cpu_list", sysfs_path,
-                cpu);
-        if (read_file_long_list(filename, &shared_cpus_l2, &nr_shared_cpus_l2))
+        int nr_shared_cpus_l1;
+        topology = lookup_cpu(prefetch, cpu, TOPOLOGY_CACHES);
+        if (topology != NULL)
         {
-            X86_ENERGY_APPEND_ERROR("Could not read %s",filename);
-            free(cpus);
-            return 1;
+            /* take ownership, every cpu is processed once */
+            shared_cpus_l2 = topology->shared_cpus_l2;
+            nr_shared_cpus_l2 = topology->nr_shared_cpus_l2;
+            nr_shared_cpus_l1 = topology->nr_shared_cpus_l1;
+            topology->shared_cpus_l2 = NULL;
+            topology->valid &= ~TOPOLOGY_CACHES;
         }
-
-        int nr_shared_cpus_l1;
-        long int* shared_cpus_l1;
-        sprintf(filename, "%s/devices/system/cpu/cpu%ld/cache/index1/shared_cpu_list", sysfs_path,
-                cpu);
-        if (read_file_long_list(filename, &shared_cpus_l1, &nr_shared_cpus_l1))
+        else
         {
-            X86_ENERGY_APPEND_ERROR("Could not read %s",filename);
-            free(cpus);
-            return 1;
+            sprintf(filename, "%s/devices/system/cpu/cpu%ld/cache/index2/shared_cpu_list",
+                    sysfs_path, cpu);
+            if (read_file_long_list(filename, &shared_cpus_l2, &nr_shared_cpus_l2, true))
+            {
+                X86_ENERGY_APPEND_ERROR("Could not read %s",filename);
+                free(cpus);
+                return 1;
+            }
+
+            long int* shared_cpus_l1;
+            sprintf(filename, "%s/devices/system/cpu/cpu%ld/cache/index1/shared_cpu_list",
+                    sysfs_path, cpu);
+            if (read_file_long_list(filename, &shared_cpus_l1, &nr_shared_cpus_l1, true))
+            {
+                X86_ENERGY_APPEND_ERROR("Could not read %s",filename);
+                free(shared_cpus_l2);
+                free(cpus);
+                return 1;
+            }
+            free(shared_cpus_l1);
         }
-        free(shared_cpus_l1);
         if (nr_shared_cpus_l2 > nr_shared_cpus_l1)
         {
-            char buffer[256];
-            sprintf(buffer, "module %d", (int)node->nr_children);
-            if (insert_new_child(node, X86_ENERGY_GRANULARITY_MODULE, node->nr_children, buffer))
+            long int module_id = node->nr_children;
+            new_parent = x86_energy_arch_builder_add(builder, node, X86_ENERGY_GRANULARITY_MODULE,
+                                                     module_id, module_id, NULL, 0);
+            if (new_parent == NULL)
             {
-                X86_ENERGY_APPEND_ERROR("Could not insert module child %s",buffer);
+                X86_ENERGY_APPEND_ERROR("Could not insert module child %ld", module_id);
                 free(shared_cpus_l2);
                 free(cpus);
                 return 1;
             }
-            new_parent = &(node->children[node->nr_children - 1]);
             for (int j = 0; j < nr_shared_cpus_l2; j++)
             {
-                add_cpu_and_core_to_node(sysfs_path, new_parent, shared_cpus_l2[j]);
+                add_cpu_and_core_to_node(builder, sysfs_path, prefetch, new_parent,
+                                         shared_cpus_l2[j]);
             }
         }
         else
-            add_cpu_and_core_to_node(sysfs_path, new_parent, cpu);
+            add_cpu_and_core_to_node(builder, sysfs_path, prefetch, new_parent, cpu);
         free(shared_cpus_l2);
     }
 
@@ -557,7 +655,10 @@ void x86_energy_print(x86_energy_architecture_node_t* node, int level)
 
 x86_energy_architecture_node_t* x86_energy_init_architecture_nodes(void)
 {
-    x86_energy_architecture_node_t* sys_node = calloc(1, sizeof(x86_energy_architecture_node_t));
+    x86_energy_architecture_node_t* cached = x86_energy_cache_load_architecture();
+    if (cached != NULL)
+        return cached;
+
     char hostname[512];
     memset(hostname, 0, sizeof(hostname));
     if (gethostname(hostname, 512))
@@ -565,43 +666,60 @@ x86_energy_architecture_node_t* x86_energy_init_architecture_nodes(void)
         X86_ENERGY_SET_ERROR("Could not get hostname via gethostname()");
         return NULL;
     }
-    sys_node->granularity = X86_ENERGY_GRANULARITY_SYSTEM;
-    sys_node->name = strdup(hostname);
-    if (sys_node->name == NULL)
+    hostname[sizeof(hostname) - 1] = '\0';
+
+    /* nodes are collected in a builder and stored in a single allocation afterwards */
+    struct arch_builder builder;
+    x86_energy_arch_builder_init(&builder);
+    struct arch_build_node* sys_build_node = x86_energy_arch_builder_add(
+        &builder, NULL, X86_ENERGY_GRANULARITY_SYSTEM, 0, 0, hostname, strlen(hostname));
+    if (sys_build_node == NULL)
     {
-        free(sys_node);
-        X86_ENERGY_SET_ERROR("Could not strdup for sys_node");
+        X86_ENERGY_APPEND_ERROR("Could not create sys_node");
         return NULL;
     }
     /* Try open sysfs */
     /* TODO look for sysfs in mnt */
     char* sysfs_path = "/sys/";
-    x86_energy_architecture_node_t* nodes;
+    int32_t* nodes;
     int nr_nodes = 0;
     if (get_nodes(sysfs_path, &nodes, &nr_nodes))
     {
-        free(sys_node->name);
-        free(sys_node);
+        x86_energy_arch_builder_free(&builder);
         X86_ENERGY_APPEND_ERROR("Could not get nodes");
         return NULL;
     }
+    /* read the topology files in parallel, then merge them into the tree in node order */
+    struct topology_prefetch prefetch;
+    if (prefetch_topology(sysfs_path, nodes, nr_nodes, &prefetch))
+    {
+        x86_energy_arch_builder_free(&builder);
+        X86_ENERGY_SET_ERROR("Could not allocate memory for reading the topology");
+        free(nodes);
+        return NULL;
+    }
     for (int i = 0; i < nr_nodes; i++)
-        if (process_node(sysfs_path, sys_node, &nodes[i]))
+        if (process_node(&builder, sysfs_path, sys_build_node, nodes[i], &prefetch.nodes[i],
+                         &prefetch))
         {
-            free(sys_node->name);
-            free(sys_node);
-            for (int i = 0; i < nr_nodes; i++)
-            {
-                free(nodes[i].name);
-            }
+            free_topology_prefetch(&prefetch, nr_nodes);
+            x86_energy_arch_builder_free(&builder);
             X86_ENERGY_APPEND_ERROR("Could not process nodes");
             free(nodes);
             return NULL;
         }
-
-    /* Sort it */
-    sort_children_recursive(sys_node);
-
+    free_topology_prefetch(&prefetch, nr_nodes);
+    free(nodes);
+
+    /* Sort it and store it breadth-first */
+    x86_energy_architecture_node_t* sys_node =
+        x86_energy_arch_builder_finish(&builder, sys_build_node, true);
+    x86_energy_arch_builder_free(&builder);
+    if (sys_node == NULL)
+    {
+        X86_ENERGY_APPEND_ERROR("Could not create architecture tree");
+        return NULL;
+    }
 
     /* Unfortunately core ids on Linux are not unique, let's make them unique ... */
     int32_t current_core=0;
@@ -634,18 +752,14 @@ x86_energy_architecture_node_t* x86_energy_init_architecture_nodes(void)
         }
     }
 
+    x86_energy_cache_store(sys_node, NULL);
+
     return sys_node;
 }
 
 void x86_energy_free_architecture_nodes(x86_energy_architecture_node_t* root)
 {
-    for (int i = 0; i < root->nr_children; i++)
-    {
-        x86_energy_free_architecture_nodes(&(root->children[i]));
-    }
-    free(root->children);
-    free(root->name);
-
+    /* the whole tree is a single allocation, starting with the root */
     if (root->granularity == X86_ENERGY_GRANULARITY_SYSTEM)
         free(root);
 }
@@ -699,3 +813,191 @@ int x86_energy_arch_count(x86_energy_architecture_node_t* root,
     }
     return sum;
 }
+
+/* returns whether the subtree of node has a thread node for cpu */
+static bool build_has_cpu(struct arch_build_node* node, long int cpu)
+{
+    if (node->granularity == X86_ENERGY_GRANULARITY_THREAD)
+        return node->id == cpu;
+    for (struct arch_build_node* child = node->first_child; child != NULL;
+         child = child->next_sibling)
+        if (build_has_cpu(child, cpu))
+            return true;
+    return false;
+}
+
+/* returns the node with the given granularity below node that contains cpu, or NULL */
+static struct arch_build_node* find_build_node(struct arch_build_node* node,
+                                               enum x86_energy_granularity granularity,
+                                               long int cpu)
+{
+    if (node->granularity == granularity)
+        return build_has_cpu(node, cpu) ? node : NULL;
+    for (struct arch_build_node* child = node->first_child; child != NULL;
+         child = child->next_sibling)
+    {
+        struct arch_build_node* found = find_build_node(child, granularity, cpu);
+        if (found != NULL)
+            return found;
+    }
+    return NULL;
+}
+
+static struct arch_build_node* copy_to_builder(struct arch_builder* builder,
+                                               struct arch_build_node* parent,
+                                               x86_energy_architecture_node_t* node)
+{
+    struct arch_build_node* copy =
+        x86_energy_arch_builder_add(builder, parent, node->granularity, node->id, node->id,
+                                    node->name, node->name != NULL ? strlen(node->name) : 0);
+    if (copy == NULL)
+        return NULL;
+    for (size_t i = 0; i < node->nr_children; i++)
+        if (copy_to_builder(builder, copy, &node->children[i]) == NULL)
+            return NULL;
+    return copy;
+}
+
+static int32_t max_core_id(x86_energy_architecture_node_t* node)
+{
+    if (node->granularity == X86_ENERGY_GRANULARITY_CORE)
+        return node->id;
+    int32_t max = -1;
+    for (size_t i = 0; i < node->nr_children; i++)
+    {
+        int32_t id = max_core_id(&node->children[i]);
+        if (id > max)
+            max = id;
+    }
+    return max;
+}
+
+/* the NUMA node of a cpu is the nodeN entry in its sysfs directory */
+static int read_numa_node(const char* sysfs_path, long int cpu, long int* node)
+{
+    char dirname[512];
+    snprintf(dirname, sizeof(dirname), "%s/devices/system/cpu/cpu%ld", sysfs_path, cpu);
+    DIR* d = opendir(dirname);
+    if (d == NULL)
+    {
+        X86_ENERGY_SET_ERROR("Could not open %s", dirname);
+        return 1;
+    }
+    struct dirent* dir;
+    bool found = false;
+    while (!found && (dir = readdir(d)) != NULL)
+        if (strncmp(dir->d_name, "node", 4) == 0 && dir->d_name[4] >= '0' &&
+            dir->d_name[4] <= '9')
+        {
+            *node = strtol(dir->d_name + 4, NULL, 10);
+            found = true;
+        }
+    closedir(d);
+    if (!found)
+        X86_ENERGY_SET_ERROR("Could not find the NUMA node of cpu %ld", cpu);
+    return !found;
+}
+
+/* places cpu below sys_node like process_node does, reading only the topology files of cpu */
+static int insert_cpu(struct arch_builder* builder, const char* sysfs_path,
+                      struct arch_build_node* sys_node, long int cpu, int32_t new_core_id)
+{
+    char filename[512];
+    long int package_id, numa_node, core_id;
+    snprintf(filename, sizeof(filename), "%s/devices/system/cpu/cpu%ld/topology/physical_package_id",
+             sysfs_path, cpu);
+    if (read_file_long(filename, &package_id, true))
+        return 1;
+    snprintf(filename, sizeof(filename), "%s/devices/system/cpu/cpu%ld/topology/core_id",
+             sysfs_path, cpu);
+    if (read_file_long(filename, &core_id, true) || read_numa_node(sysfs_path, cpu, &numa_node))
+        return 1;
+    struct arch_build_node* package =
+        find_or_add_child(builder, sys_node, X86_ENERGY_GRANULARITY_SOCKET, package_id);
+    struct arch_build_node* die =
+        package != NULL ? find_or_add_child(builder, package, X86_ENERGY_GRANULARITY_DIE,
+                                            numa_node) :
+                          NULL;
+    if (die == NULL)
+        return 1;
+
+    /* a thread of a core that is already known */
+    long int* siblings;
+    int nr_siblings;
+    struct arch_build_node* core = NULL;
+    snprintf(filename, sizeof(filename),
+             "%s/devices/system/cpu/cpu%ld/topology/thread_siblings_list", sysfs_path, cpu);
+    if (read_file_long_list(filename, &siblings, &nr_siblings, true))
+        return 1;
+    for (int i = 0; i < nr_siblings && core == NULL; i++)
+        if (siblings[i] != cpu && x86_energy_arch_builder_has_cpu(builder, siblings[i]))
+            core = find_build_node(die, X86_ENERGY_GRANULARITY_CORE, siblings[i]);
+    free(siblings);
+
+    if (core == NULL)
+    {
+        long int *shared_cpus_l2, *shared_cpus_l1;
+        int nr_shared_cpus_l2, nr_shared_cpus_l1;
+        snprintf(filename, sizeof(filename),
+                 "%s/devices/system/cpu/cpu%ld/cache/index2/shared_cpu_list", sysfs_path, cpu);
+        if (read_file_long_list(filename, &shared_cpus_l2, &nr_shared_cpus_l2, true))
+            return 1;
+        snprintf(filename, sizeof(filename),
+                 "%s/devices/system/cpu/cpu%ld/cache/index1/shared_cpu_list", sysfs_path, cpu);
+        if (read_file_long_list(filename, &shared_cpus_l1, &nr_shared_cpus_l1, true))
+        {
+            free(shared_cpus_l2);
+            return 1;
+        }
+        free(shared_cpus_l1);
+        struct arch_build_node* parent = die;
+        if (nr_shared_cpus_l2 > nr_shared_cpus_l1)
+        {
+            struct arch_build_node* module = NULL;
+            for (int i = 0; i < nr_shared_cpus_l2 && module == NULL; i++)
+                if (x86_energy_arch_builder_has_cpu(builder, shared_cpus_l2[i]))
+                    module =
+                        find_build_node(die, X86_ENERGY_GRANULARITY_MODULE, shared_cpus_l2[i]);
+            if (module == NULL)
+            {
+                long int module_id = die->nr_children;
+                module = x86_energy_arch_builder_add(
+                    builder, die, X86_ENERGY_GRANULARITY_MODULE, module_id, module_id, NULL, 0);
+            }
+            parent = module;
+        }
+        free(shared_cpus_l2);
+        if (parent == NULL)
+            return 1;
+        /* core ids are unique in the tree, see x86_energy_init_architecture_nodes */
+        core = x86_energy_arch_builder_add(builder, parent, X86_ENERGY_GRANULARITY_CORE,
+                                           new_core_id, core_id, NULL, 0);
+        if (core == NULL)
+            return 1;
+    }
+    if (x86_energy_arch_builder_add(builder, core, X86_ENERGY_GRANULARITY_THREAD, cpu, cpu, NULL,
+                                    0) == NULL)
+        return 1;
+    return 0;
+}
+
+x86_energy_architecture_node_t* x86_energy_arch_add_cpu(x86_energy_architecture_node_t* root,
+                                                        long int cpu)
+{
+    struct arch_builder builder;
+    x86_energy_arch_builder_init(&builder);
+    struct arch_build_node* sys_build_node = copy_to_builder(&builder, NULL, root);
+    if (sys_build_node == NULL ||
+        insert_cpu(&builder, "/sys/", sys_build_node, cpu, max_core_id(root) + 1) != 0)
+    {
+        x86_energy_arch_builder_free(&builder);
+        X86_ENERGY_APPEND_ERROR("Could not add cpu %ld to the architecture", cpu);
+        return NULL;
+    }
+    x86_energy_architecture_node_t* result =
+        x86_energy_arch_builder_finish(&builder, sys_build_node, true);
+    x86_energy_arch_builder_free(&builder);
+    if (result == NULL)
+        X86_ENERGY_APPEND_ERROR("Could not create architecture tree");
+    return result;
+}
@@ -0,0 +1,258 @@
+/*
+ * threads.c
+ *
+ *  Created on: 19.10.2026
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "../include/error.h"
+#include "../include/threads.h"
+
+#define CPU_DIR "/sys/devices/system/cpu/"
+
+/* name of a thread including the '\0', see pthread_setname_np */
+#define THREAD_NAME_LEN 16
+
+struct thread_config
+{
+    bool pin;
+    cpu_set_t cpus;
+    enum x86_energy_thread_policy policy;
+    int priority;
+};
+
+static pthread_mutex_t config_mutex = PTHREAD_MUTEX_INITIALIZER;
+static bool config_initialized;
+static struct thread_config config;
+
+struct thread_start
+{
+    void* (*start)(void*);
+    void* arg;
+    char name[THREAD_NAME_LEN];
+    struct thread_config config;
+};
+
+int x86_energy_parse_cpu_list(const char* list, cpu_set_t* set)
+{
+    CPU_ZERO(set);
+    const char* pos = list;
+    while (*pos != '\0' && *pos != '\n')
+    {
+        char* end;
+        long first = strtol(pos, &end, 10);
+        if (end == pos || first < 0)
+            return 1;
+        long last = first;
+        pos = end;
+        if (*pos == '-')
+        {
+            pos++;
+            last = strtol(pos, &end, 10);
+            if (end == pos || last < first)
+                return 1;
+            pos = end;
+        }
+        if (last >= CPU_SETSIZE)
+            return 1;
+        for (long cpu = first; cpu <= last; cpu++)
+            CPU_SET(cpu, set);
+        if (*pos == ',')
+            pos++;
+        else if (*pos != '\0' && *pos != '\n')
+            return 1;
+    }
+    return 0;
+}
+
+/* reads a cpu list file of sysfs, missing or unparsable files are empty */
+static void read_cpu_list(const char* file, cpu_set_t* set)
+{
+    char buffer[4096];
+    CPU_ZERO(set);
+    FILE* f = fopen(file, "r");
+    if (f == NULL)
+        return;
+    if (fgets(buffer, sizeof(buffer), f) != NULL && x86_energy_parse_cpu_list(buffer, set) != 0)
+        CPU_ZERO(set);
+    fclose(f);
+}
+
+/* online CPUs that are neither isolated nor nohz_full, returns false if there are none */
+static bool housekeeping_cpus(cpu_set_t* set)
+{
+    cpu_set_t isolated, nohz_full;
+    read_cpu_list(CPU_DIR "online", set);
+    read_cpu_list(CPU_DIR "isolated", &isolated);
+    read_cpu_list(CPU_DIR "nohz_full", &nohz_full);
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        if (CPU_ISSET(cpu, &isolated) || CPU_ISSET(cpu, &nohz_full))
+            CPU_CLR(cpu, set);
+    return CPU_COUNT(set) > 0;
+}
+
+/* parses "idle", "other[:nice]" or "fifo[:priority]", returns 0 on success */
+static int parse_policy(const char* string, enum x86_energy_thread_policy* policy, int* priority)
+{
+    const char* colon = strchr(string, ':');
+    size_t len = colon != NULL ? (size_t)(colon - string) : strlen(string);
+    if (len == 4 && strncasecmp(string, "idle", len) == 0)
+        *policy = X86_ENERGY_THREAD_POLICY_IDLE;
+    else if (len == 5 && strncasecmp(string, "other", len) == 0)
+        *policy = X86_ENERGY_THREAD_POLICY_OTHER;
+    else if (len == 4 && strncasecmp(string, "fifo", len) == 0)
+        *policy = X86_ENERGY_THREAD_POLICY_FIFO;
+    else if (len == 7 && strncasecmp(string, "inherit", len) == 0)
+        *policy = X86_ENERGY_THREAD_POLICY_INHERIT;
+    else
+        return 1;
+    *priority = *policy == X86_ENERGY_THREAD_POLICY_FIFO ? 1 : 0;
+    if (colon != NULL)
+    {
+        char* end;
+        *priority = strtol(colon + 1, &end, 10);
+        if (end == colon + 1 || *end != '\0')
+            return 1;
+    }
+    return 0;
+}
+
+static int check_priority(enum x86_energy_thread_policy policy, int priority)
+{
+    switch (policy)
+    {
+    case X86_ENERGY_THREAD_POLICY_INHERIT:
+    case X86_ENERGY_THREAD_POLICY_IDLE:
+        return 0;
+    case X86_ENERGY_THREAD_POLICY_OTHER:
+        return priority < -20 || priority > 19;
+    case X86_ENERGY_THREAD_POLICY_FIFO:
+        return priority < sched_get_priority_min(SCHED_FIFO) ||
+               priority > sched_get_priority_max(SCHED_FIFO);
+    }
+    return 1;
+}
+
+/* must be called with config_mutex held */
+static void init_config(void)
+{
+    if (config_initialized)
+        return;
+    config_initialized = true;
+
+    const char* cpus = getenv("X86_ENERGY_THREAD_CPUS");
+    if (cpus != NULL && x86_energy_parse_cpu_list(cpus, &config.cpus) == 0 &&
+        CPU_COUNT(&config.cpus) > 0)
+        config.pin = true;
+    else
+        config.pin = housekeeping_cpus(&config.cpus);
+
+    const char* policy = getenv("X86_ENERGY_THREAD_POLICY");
+    if (policy == NULL || parse_policy(policy, &config.policy, &config.priority) != 0 ||
+        check_priority(config.policy, config.priority) != 0)
+    {
+        config.policy = X86_ENERGY_THREAD_POLICY_INHERIT;
+        config.priority = 0;
+    }
+}
+
+int x86_energy_set_internal_thread_cpus(const char* cpu_list)
+{
+    cpu_set_t cpus;
+    bool pin;
+    if (cpu_list == NULL)
+        pin = housekeeping_cpus(&cpus);
+    else
+    {
+        if (x86_energy_parse_cpu_list(cpu_list, &cpus) != 0 || CPU_COUNT(&cpus) == 0)
+        {
+            X86_ENERGY_SET_ERROR("invalid cpu list \"%s\"", cpu_list);
+            return 1;
+        }
+        pin = true;
+    }
+    pthread_mutex_lock(&config_mutex);
+    init_config();
+    config.pin = pin;
+    config.cpus = cpus;
+    pthread_mutex_unlock(&config_mutex);
+    return 0;
+}
+
+int x86_energy_set_internal_thread_policy(enum x86_energy_thread_policy policy, int priority)
+{
+    if (check_priority(policy, priority) != 0)
+    {
+        X86_ENERGY_SET_ERROR("invalid priority %d for thread policy %d", priority, policy);
+        return 1;
+    }
+    pthread_mutex_lock(&config_mutex);
+    init_config();
+    config.policy = policy;
+    config.priority = priority;
+    pthread_mutex_unlock(&config_mutex);
+    return 0;
+}
+
+/* applies name, affinity and policy from within the new thread */
+static void* start_thread(void* arg)
+{
+    struct thread_start start = *(struct thread_start*)arg;
+    free(arg);
+
+    pthread_setname_np(pthread_self(), start.name);
+    if (start.config.pin)
+        pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &start.config.cpus);
+
+    struct sched_param param = { .sched_priority = 0 };
+    switch (start.config.policy)
+    {
+    case X86_ENERGY_THREAD_POLICY_INHERIT:
+        break;
+    case X86_ENERGY_THREAD_POLICY_IDLE:
+        pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+        break;
+    case X86_ENERGY_THREAD_POLICY_OTHER:
+        pthread_setschedparam(pthread_self(), SCHED_OTHER, &param);
+        /* on Linux, the nice value is per thread */
+        setpriority(PRIO_PROCESS, syscall(SYS_gettid), start.config.priority);
+        break;
+    case X86_ENERGY_THREAD_POLICY_FIFO:
+        param.sched_priority = start.config.priority;
+        pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        break;
+    }
+    return start.start(start.arg);
+}
+
+int x86_energy_thread_create(pthread_t* thread, const char* name, void* (*start)(void*),
+                             void* arg)
+{
+    struct thread_start* info = malloc(sizeof(struct thread_start));
+    if (info == NULL)
+        return ENOMEM;
+    info->start = start;
+    info->arg = arg;
+    snprintf(info->name, sizeof(info->name), "%s", name);
+    pthread_mutex_lock(&config_mutex);
+    init_config();
+    info->config = config;
+    pthread_mutex_unlock(&config_mutex);
+
+    int ret = pthread_create(thread, NULL, start_thread, info);
+    if (ret != 0)
+        free(info);
+    return ret;
+}
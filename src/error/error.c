@@ -11,7 +11,8 @@
 
 #define ERROR_LEN 4096
 
-static char error_string[4096]={'\0'};
+/* per thread, so concurrent sessions do not overwrite each other's errors */
+static __thread char error_string[4096]={'\0'};
 
 static char * not_enough_space="Not enough space for writing error\n";
 static char * internal_error="Error while writing error (errorception)\n";
@@ -14,6 +14,7 @@
 extern x86_energy_access_source_t likwid_source;
 #endif
 
+extern x86_energy_access_source_t hwmon_energy_source;
 extern x86_energy_access_source_t msr_source;
 extern x86_energy_access_source_t msr_fam15_source;
 extern x86_energy_access_source_t msr_fam23_source;
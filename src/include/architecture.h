@@ -14,4 +14,34 @@
  */
 long get_test_cpu(enum x86_energy_granularity given_granularity, unsigned long int id);
 
+/**
+ * Get a specific CPU from the node with the given granularity and id below the node with
+ * parent_granularity and parent_id, e.g., a core of a given socket
+ */
+long get_test_cpu_in(enum x86_energy_granularity parent_granularity, unsigned long int parent_id,
+                     enum x86_energy_granularity given_granularity, unsigned long int id);
+
+/**
+ * Locks and returns the architecture tree shared by the sources. It contains cpus that came
+ * online later and might be replaced when new cpus come online, so it must only be used until
+ * x86_energy_arch_unlock. Returns NULL (and does not lock) on error.
+ */
+x86_energy_architecture_node_t* x86_energy_arch_lock(void);
+
+void x86_energy_arch_unlock(void);
+
+/**
+ * Returns a copy of root that also contains cpu. Only the topology files of cpu are read, the
+ * other nodes keep their ids. root is not freed. Returns NULL on error.
+ */
+x86_energy_architecture_node_t* x86_energy_arch_add_cpu(x86_energy_architecture_node_t* root,
+                                                        long int cpu);
+
+/**
+ * Adds the online cpus that are missing in root with x86_energy_arch_add_cpu. Returns root if
+ * nothing was added, otherwise a new tree. root is not freed.
+ */
+x86_energy_architecture_node_t*
+x86_energy_arch_add_online_cpus(x86_energy_architecture_node_t* root);
+
 #endif /* SRC_INCLUDE_ARCHITECTURE_H_ */
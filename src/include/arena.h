@@ -0,0 +1,79 @@
+/*
+ * arena.h
+ *
+ *  Created on: 19.10.2026
+ */
+
+#ifndef SRC_INCLUDE_ARENA_H_
+#define SRC_INCLUDE_ARENA_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "../../include/x86_energy.h"
+
+/**
+ * A node of an architecture tree that is still being built.
+ * Nodes are allocated from a pool and never move, children are kept in a list.
+ */
+struct arch_build_node
+{
+    enum x86_energy_granularity granularity;
+    int32_t id;
+    long int name_number; /* used for generating the name if name is NULL */
+    const char* name;     /* explicit name, must stay valid until the tree is finished */
+    size_t name_len;
+    size_t nr_children;
+    size_t sequence; /* creation order, keeps sorting stable */
+    struct arch_build_node* first_child;
+    struct arch_build_node* last_child;
+    struct arch_build_node* next_sibling;
+};
+
+struct arch_build_chunk;
+
+struct arch_builder
+{
+    struct arch_build_chunk* chunks;
+    size_t nr_nodes;
+    uint8_t* cpus; /* set for every cpu that has a thread node */
+    long int nr_cpus;
+};
+
+void x86_energy_arch_builder_init(struct arch_builder* builder);
+
+/**
+ * Adds a node below parent (or the root if parent is NULL). The name is either given explicitly
+ * with name/name_len or generated from granularity and name_number when the tree is finished.
+ * Returns NULL on error.
+ */
+struct arch_build_node* x86_energy_arch_builder_add(struct arch_builder* builder,
+                                                    struct arch_build_node* parent,
+                                                    enum x86_energy_granularity granularity,
+                                                    int32_t id, long int name_number,
+                                                    const char* name, size_t name_len);
+
+/**
+ * Returns the child of parent with the given id or NULL
+ */
+struct arch_build_node* x86_energy_arch_builder_find_child(struct arch_build_node* parent,
+                                                           long int id);
+
+/**
+ * Returns whether a thread node for cpu has been added
+ */
+bool x86_energy_arch_builder_has_cpu(struct arch_builder* builder, long int cpu);
+
+/**
+ * Creates the final tree in a single allocation. Nodes are stored breadth-first, so the children
+ * of each node are contiguous. If sort is set, children are sorted by id.
+ * The result is freed with x86_energy_free_architecture_nodes(). The builder is not freed.
+ */
+x86_energy_architecture_node_t* x86_energy_arch_builder_finish(struct arch_builder* builder,
+                                                               struct arch_build_node* root,
+                                                               bool sort);
+
+void x86_energy_arch_builder_free(struct arch_builder* builder);
+
+#endif /* SRC_INCLUDE_ARENA_H_ */
@@ -0,0 +1,37 @@
+/*
+ * cache.h
+ *
+ *  Created on: 19.10.2026
+ */
+
+#ifndef SRC_INCLUDE_CACHE_H_
+#define SRC_INCLUDE_CACHE_H_
+
+#include "../../include/x86_energy.h"
+
+/**
+ * Opt-in cache for the architecture tree and the detected mechanism.
+ * The cache is enabled by setting X86_ENERGY_CACHE_FILE to a writable path (e.g.
+ * /run/x86_energy.cache). It is only used when /proc/sys/kernel/random/boot_id and
+ * /sys/devices/system/cpu/online match the values it was written with.
+ */
+
+/**
+ * Returns a new architecture tree read from the cache, NULL if the cache is disabled or invalid
+ */
+x86_energy_architecture_node_t* x86_energy_cache_load_architecture(void);
+
+/**
+ * Returns a new mechanism read from the cache, NULL if the cache is disabled, invalid or does not
+ * hold a mechanism
+ */
+x86_energy_mechanisms_t* x86_energy_cache_load_mechanism(void);
+
+/**
+ * Writes the tree and (optionally) the mechanism to the cache file. mechanism might be NULL.
+ * Errors are ignored, the cache is just not written then.
+ */
+void x86_energy_cache_store(const x86_energy_architecture_node_t* root,
+                            const x86_energy_mechanisms_t* mechanism);
+
+#endif /* SRC_INCLUDE_CACHE_H_ */
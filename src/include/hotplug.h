@@ -0,0 +1,39 @@
+/*
+ * hotplug.h
+ *
+ *  Created on: 19.10.2026
+ */
+
+#ifndef SRC_INCLUDE_HOTPLUG_H_
+#define SRC_INCLUDE_HOTPLUG_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Starts the hotplug watcher thread if it is not running yet. It listens for cpu uevents on a
+ * netlink socket (or polls /sys/devices/system/cpu/online if that is not possible) and bumps the
+ * hotplug generation whenever the set of online cpus changes.
+ * Each successful call must be paired with x86_energy_hotplug_release. Returns 0 on success.
+ */
+int x86_energy_hotplug_acquire(void);
+
+void x86_energy_hotplug_release(void);
+
+/**
+ * Re-reads the online cpus, e.g. after a read on a cpu failed. Returns the hotplug generation.
+ */
+uint64_t x86_energy_hotplug_refresh(void);
+
+/**
+ * Returns a number that changes whenever the set of online cpus changes. Cheap enough to be
+ * compared on every read.
+ */
+uint64_t x86_energy_hotplug_generation(void);
+
+/**
+ * Returns whether cpu was online when the online cpus were read last
+ */
+bool x86_energy_cpu_online(long cpu);
+
+#endif /* SRC_INCLUDE_HOTPLUG_H_ */
@@ -0,0 +1,50 @@
+/*
+ * msr_device.h
+ *
+ *  Created on: 19.10.2026
+ */
+
+#ifndef SRC_INCLUDE_MSR_DEVICE_H_
+#define SRC_INCLUDE_MSR_DEVICE_H_
+
+#include <stdint.h>
+
+/**
+ * Returns the directory of the msr device files, X86_ENERGY_MSR_DIR (e.g. an emulated copy) or
+ * /dev/cpu
+ */
+const char* x86_energy_msr_dir(void);
+
+/**
+ * Returns the maximal cpu number + 1 of all readable msr or msr_safe files. The directory is only
+ * scanned once. Returns a negative errno if no file can be read.
+ */
+int x86_energy_msr_nr_cpus(void);
+
+/**
+ * Returns a file descriptor for the msr (or msr_safe) file of cpu, or -1 on error. The file is
+ * opened once and shared by all counters that read registers of this cpu. Each successful call
+ * must be paired with x86_energy_msr_put, the file is closed with the last reference.
+ */
+int x86_energy_msr_get(int cpu);
+
+void x86_energy_msr_put(int cpu);
+
+/**
+ * Reads the register reg from fd, returns 0 on success
+ */
+int x86_energy_msr_read(int fd, uint64_t reg, uint64_t* value);
+
+/**
+ * Reads a register that has the same value on all cpus, e.g. a power unit register. It is read
+ * from cpu on the first call, later calls return the cached value. Returns 0 on success.
+ */
+int x86_energy_msr_read_cached(int cpu, uint64_t reg, uint64_t* value);
+
+/**
+ * Writes value to the register reg of cpu. The msr file is opened for each write, since writes
+ * are rare and the shared handles are read-only. Returns 0 on success.
+ */
+int x86_energy_msr_write(int cpu, uint64_t reg, uint64_t value);
+
+#endif /* SRC_INCLUDE_MSR_DEVICE_H_ */
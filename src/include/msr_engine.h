@@ -0,0 +1,75 @@
+/*
+ * msr_engine.h
+ *
+ *  Created on: 19.10.2026
+ */
+
+#ifndef SRC_INCLUDE_MSR_ENGINE_H_
+#define SRC_INCLUDE_MSR_ENGINE_H_
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "../../include/x86_energy.h"
+#include "overflow_thread.h"
+
+/**
+ * One energy counter register of a register map. The energy unit is
+ * 1 / 2^((value of unit_reg >> unit_shift) & unit_mask) J, unless the fixed_unit hook of the
+ * engine returns another one.
+ */
+struct x86_energy_msr_domain
+{
+    enum x86_energy_counter counter;
+    enum x86_energy_granularity granularity; /* all cpus of one node read the same register */
+    uint64_t reg;
+    unsigned int width; /* bits of the counter, it wraps after 2^width */
+    uint64_t unit_reg;
+    unsigned int unit_shift;
+    uint64_t unit_mask;
+};
+
+struct x86_energy_msr_scope;
+
+/**
+ * Reads energy counters from msrs of the cpus of each node (a scope), e.g. RAPL on Intel or AMD.
+ * A source defines a static engine with its register map and forwards to the functions below.
+ * Counters of the same scope share the file descriptor, one overflow thread entry and the
+ * hotplug handling, and are read together by x86_energy_msr_engine_read_batch.
+ */
+struct x86_energy_msr_engine
+{
+    const struct x86_energy_msr_domain* domains;
+    size_t nr_domains;
+    /* optional, returns a unit in J that overrides the unit register, or <= 0.0 to use it */
+    double (*fixed_unit)(const struct x86_energy_msr_domain* domain);
+    long long overflow_us; /* the counters of a scope are read at least this often */
+
+    /* state, initialize mutex with PTHREAD_MUTEX_INITIALIZER */
+    pthread_mutex_t mutex;
+    struct ov_struct ov;
+    struct x86_energy_msr_scope* scopes;
+    bool hotplug_acquired;
+};
+
+int x86_energy_msr_engine_init(struct x86_energy_msr_engine* engine);
+
+x86_energy_single_counter_t x86_energy_msr_engine_setup(struct x86_energy_msr_engine* engine,
+                                                        enum x86_energy_counter counter_type,
+                                                        size_t index);
+
+double x86_energy_msr_engine_read(x86_energy_single_counter_t counter);
+
+int x86_energy_msr_engine_read_batch(size_t nr, x86_energy_single_counter_t* counters,
+                                     double* values);
+
+void x86_energy_msr_engine_close(x86_energy_single_counter_t counter);
+
+void x86_energy_msr_engine_glitch_stats(x86_energy_single_counter_t counter,
+                                        x86_energy_glitch_stats_t* stats);
+
+void x86_energy_msr_engine_fini(struct x86_energy_msr_engine* engine);
+
+#endif /* SRC_INCLUDE_MSR_ENGINE_H_ */
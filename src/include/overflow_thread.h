@@ -9,43 +9,106 @@
 #define SRC_INCLUDE_OVERFLOW_THREAD_H_
 
 #include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
 
 #include "../../include/x86_energy.h"
 
 typedef double (*read_function_t)(x86_energy_single_counter_t);
 
+/**
+ * A counter that is protected against overflows. It is only read by the overflow thread when it
+ * has not been read for period_ns.
+ */
+struct ov_call
+{
+    read_function_t read;
+    x86_energy_single_counter_t t;
+    uint64_t period_ns;    /* accessed atomically */
+    uint64_t last_read_ns; /* CLOCK_MONOTONIC, accessed atomically */
+};
+
 struct thread_info
 {
     int cpu;
     pthread_t thread;
     pthread_mutex_t mutex;
-    long long usleep_time;
-    size_t nr_functions;
-    read_function_t* functions;
-    x86_energy_single_counter_t* t;
+    pthread_cond_t cond; /* uses CLOCK_MONOTONIC, signaled when calls are added or on stop */
+    bool stop;
+    size_t nr_calls;
+    struct ov_call** calls;
 };
 
 struct ov_struct
 {
+    /* protects the list and the start of threads, counters of a source are set up concurrently */
+    pthread_mutex_t mutex;
     size_t nr_thread_infos;
     struct thread_info** thread_infos;
 };
 
+/**
+ * Initializes an empty ov_struct, called by the init function of a source. It is destroyed by
+ * x86_energy_overflow_freeall.
+ */
+void x86_energy_overflow_init(struct ov_struct* ov);
+
 /**
  * Sets up a new overflow thread (if necessary)
  * If not necessary, registers the read/single_counter pair
  * Returns 1 on fail
- * sets thread and mutex
+ * sets thread, initializes mutex and sets call, which is passed to x86_energy_overflow_mark_read
+ * (call is NULL if overflow threads are disabled)
  */
 int x86_energy_overflow_thread_create(struct ov_struct*, int cpu, pthread_t* thread,
                                       pthread_mutex_t* mutex,
                                       double (*read)(x86_energy_single_counter_t t),
-                                      x86_energy_single_counter_t t, long long sleep_time);
+                                      x86_energy_single_counter_t t, long long sleep_time,
+                                      struct ov_call** call);
+
+static inline uint64_t x86_energy_overflow_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Called by access sources after each successful read, so the overflow thread can skip counters
+ * that are read often enough by the application anyway
+ */
+static inline void x86_energy_overflow_mark_read(struct ov_call* call)
+{
+    if (call != NULL)
+        __atomic_store_n(&call->last_read_ns, x86_energy_overflow_now(), __ATOMIC_RELAXED);
+}
+
+/**
+ * Changes the period of a counter, e.g., for sources that integrate power and poll faster while it
+ * changes. Takes effect after the next read of the counter.
+ */
+static inline void x86_energy_overflow_set_period(struct ov_call* call, uint64_t period_ns)
+{
+    if (call != NULL)
+        __atomic_store_n(&call->period_ns, period_ns, __ATOMIC_RELAXED);
+}
 
 void x86_energy_overflow_thread_remove_call(struct ov_struct* ov, int cpu,
                                             double (*read)(x86_energy_single_counter_t),
                                             x86_energy_single_counter_t t);
 
+/**
+ * Overrides the update rate of overflow threads for counters set up by the calling thread, until
+ * x86_energy_overflow_clear_thread_rate is called. Takes precedence over
+ * x86_energy_set_internal_update_thread_rate. Used by sessions.
+ */
+void x86_energy_overflow_set_thread_rate(long long int time_in_us);
+void x86_energy_overflow_clear_thread_rate(void);
+
+/**
+ * Stops and joins all threads
+ */
 int x86_energy_overflow_thread_killall(struct ov_struct*);
 void x86_energy_overflow_freeall(struct ov_struct* ov);
 
@@ -0,0 +1,89 @@
+/*
+ * session.h
+ *
+ *  Created on: 19.10.2026
+ */
+
+#ifndef SRC_INCLUDE_SESSION_H_
+#define SRC_INCLUDE_SESSION_H_
+
+#include <pthread.h>
+#include <stdbool.h>
+
+#include "../../include/x86_energy.h"
+
+struct x86_energy_sampler;
+
+/* what a counter of the session measures, and its last power limit change */
+struct x86_energy_session_domain
+{
+    enum x86_energy_counter counter;
+    size_t index;
+    bool limit_changed;
+    uint64_t limit_change_ns;
+    double limit_change_energy;
+};
+struct x86_energy_triggers;
+
+struct x86_energy_session
+{
+    pthread_mutex_t mutex; /* protects everything below */
+
+    x86_energy_architecture_node_t* arch;
+    uint64_t arch_generation; /* hotplug generation arch has been updated for */
+    /* trees replaced by cpus coming online, callers might still use them */
+    size_t nr_old_archs;
+    x86_energy_architecture_node_t** old_archs;
+    x86_energy_mechanisms_t* mechanism;
+
+    bool update_rate_set;
+    long long int update_rate_us;
+
+    /* sources initialized by this session, pointing to mechanism->avail_sources */
+    size_t nr_sources;
+    x86_energy_access_source_t** sources;
+
+    /* counters in the order they were added */
+    size_t nr_counters;
+    size_t counters_capacity;
+    x86_energy_access_source_t** counter_sources;
+    x86_energy_single_counter_t* counters;
+    struct x86_energy_session_domain* domains;
+
+    struct x86_energy_sampler* sampler;
+
+    /* created with the session, has its own mutex, since it is used by the sampling thread */
+    struct x86_energy_triggers* triggers;
+};
+
+/**
+ * Reads the first nr counters of the session, returns the number of counters that failed
+ */
+int x86_energy_session_read_first(x86_energy_session_t* session, size_t nr, double* values);
+
+/**
+ * Starts a sampling thread for the first nr counters of the session, returns NULL on error
+ */
+struct x86_energy_sampler* x86_energy_sampler_start(x86_energy_session_t* session, size_t nr,
+                                                    long long int period_us,
+                                                    x86_energy_sample_callback_t callback,
+                                                    void* arg);
+
+/**
+ * Stops and frees the sampler. Must not be called with the session mutex held, since the
+ * sampling thread might wait for it. If called by the sampling thread (from a callback), the
+ * thread is detached and frees the sampler once the callback returns.
+ */
+void x86_energy_sampler_stop(struct x86_energy_sampler* sampler);
+
+struct x86_energy_triggers* x86_energy_triggers_create(void);
+
+void x86_energy_triggers_free(struct x86_energy_triggers* triggers);
+
+/**
+ * Evaluates all triggers with a new sample, called by the sampling thread
+ */
+void x86_energy_triggers_evaluate(struct x86_energy_triggers* triggers, uint64_t time_ns,
+                                  size_t nr, const double* values);
+
+#endif /* SRC_INCLUDE_SESSION_H_ */
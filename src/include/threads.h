@@ -0,0 +1,32 @@
+/*
+ * threads.h
+ *
+ *  Created on: 19.10.2026
+ */
+
+#ifndef SRC_INCLUDE_THREADS_H_
+#define SRC_INCLUDE_THREADS_H_
+
+#include <pthread.h>
+
+/**
+ * Creates an internal thread (overflow, sampling or trace writer thread). The thread is named
+ * (at most 15 characters are used), pinned to the CPUs set with
+ * x86_energy_set_internal_thread_cpus or X86_ENERGY_THREAD_CPUS (default: the housekeeping CPUs)
+ * and gets the scheduling policy set with x86_energy_set_internal_thread_policy or
+ * X86_ENERGY_THREAD_POLICY. Affinity and policy are best effort, failing to apply them is ignored.
+ * Returns 0 on success or the error of pthread_create.
+ */
+int x86_energy_thread_create(pthread_t* thread, const char* name, void* (*start)(void*),
+                             void* arg);
+
+#ifdef _GNU_SOURCE
+#include <sched.h>
+
+/**
+ * Parses a cpu list like "0-3,8,10-11" as used in sysfs into set, returns 0 on success
+ */
+int x86_energy_parse_cpu_list(const char* list, cpu_set_t* set);
+#endif
+
+#endif /* SRC_INCLUDE_THREADS_H_ */
@@ -0,0 +1,136 @@
+/*
+ * trace_format.h
+ *
+ *  Created on: 19.10.2026
+ */
+
+#ifndef SRC_INCLUDE_TRACE_FORMAT_H_
+#define SRC_INCLUDE_TRACE_FORMAT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * On-disk layout of energy traces (little endian, all records are 8 byte aligned):
+ *
+ * struct trace_header
+ * struct trace_counter_record[nr_counters]
+ * struct trace_node_record[nr_nodes]      architecture, breadth-first as in memory
+ * char strings[strings_size]              NUL terminated source and node names
+ * chunks, each:
+ *   struct trace_chunk_header
+ *   int64_t first_ticks[nr_counters]       absolute ticks of the first sample
+ *   uint32_t column_end[nr_counters + 1]   end of each column, relative to the payload
+ *   payload                                time column, then one column per counter, each holding
+ *                                          nr_samples - 1 zigzag varint deltas
+ *   padding to 8 bytes
+ * struct trace_index_entry[nr_chunks]
+ * struct trace_trailer
+ */
+
+#define TRACE_MAGIC "X86ETRC1"
+#define TRACE_CHUNK_MAGIC "CHNK"
+#define TRACE_TRAILER_MAGIC "X86EIDX1"
+#define TRACE_VERSION 1
+
+/* stored for samples that could not be read */
+#define TRACE_INVALID_TICKS INT64_MIN
+
+struct trace_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t nr_counters;
+    uint32_t nr_nodes;
+    uint32_t strings_size;
+    uint64_t header_size; /* offset of the first chunk */
+};
+
+struct trace_counter_record
+{
+    int32_t counter;
+    uint32_t index;
+    double unit;
+    uint32_t width;
+    uint32_t source_offset; /* into strings */
+};
+
+struct trace_node_record
+{
+    int32_t granularity;
+    int32_t id;
+    uint32_t nr_children;
+    uint32_t first_child; /* index of the first child */
+    uint32_t name_offset; /* into strings */
+    uint32_t reserved;
+};
+
+struct trace_chunk_header
+{
+    char magic[4];
+    uint32_t nr_samples;
+    uint64_t first_time;
+    uint64_t last_time;
+};
+
+struct trace_index_entry
+{
+    uint64_t offset;
+    uint64_t first_time;
+    uint64_t last_time;
+    uint32_t nr_samples;
+    uint32_t reserved;
+};
+
+struct trace_trailer
+{
+    uint64_t nr_chunks;
+    uint64_t index_offset;
+    char magic[8];
+};
+
+#define TRACE_ALIGN(size) (((size) + 7) & ~(size_t)7)
+
+/* maximal size of one varint */
+#define TRACE_MAX_VARINT 10
+
+static inline uint64_t trace_zigzag(int64_t value)
+{
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static inline int64_t trace_unzigzag(uint64_t value)
+{
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+static inline uint8_t* trace_put_varint(uint8_t* pos, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        *pos++ = (uint8_t)value | 0x80;
+        value >>= 7;
+    }
+    *pos++ = (uint8_t)value;
+    return pos;
+}
+
+/* returns NULL if the varint does not end before end */
+static inline const uint8_t* trace_get_varint(const uint8_t* pos, const uint8_t* end,
+                                              uint64_t* value)
+{
+    uint64_t result = 0;
+    for (int shift = 0; pos < end && shift < 64; shift += 7)
+    {
+        uint8_t byte = *pos++;
+        result |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+        {
+            *value = result;
+            return pos;
+        }
+    }
+    return NULL;
+}
+
+#endif /* SRC_INCLUDE_TRACE_FORMAT_H_ */
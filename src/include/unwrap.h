@@ -0,0 +1,49 @@
+/*
+ * unwrap.h
+ *
+ *  Created on: 19.10.2026
+ */
+
+#ifndef SRC_INCLUDE_UNWRAP_H_
+#define SRC_INCLUDE_UNWRAP_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "../../include/x86_energy.h"
+
+/**
+ * Extends a wrapping energy counter to 64 bit. If a maximal power is set for the domain (see
+ * x86_energy_set_max_power), readings are validated against the elapsed time: a reading below the
+ * last one is only a wrap if the wrapped delta is possible within the bound, other readings that
+ * imply a higher power are glitches and rejected. If the next reading continues from a rejected
+ * one, the counter really jumped: it is followed, and the energy of the jump interval is estimated
+ * from the power after it.
+ * The state is not protected, sources use it with the mutex of their counter.
+ */
+struct x86_energy_unwrap
+{
+    uint64_t range; /* raw values wrap at range */
+    uint64_t last_raw;
+    uint64_t last_ns;
+    uint64_t total; /* accumulated ticks, starting at the first raw value */
+    double max_ticks_per_ns; /* 0.0 disables validation */
+    bool has_suspect;
+    uint64_t suspect_raw;
+    uint64_t suspect_ns;
+    x86_energy_glitch_stats_t stats;
+};
+
+/**
+ * Starts unwrapping at raw, read now. unit is Joules per tick. Like the raw counter, the total
+ * starts at raw, so sources keep returning the absolute counter value and not energy since setup
+ */
+void x86_energy_unwrap_init(struct x86_energy_unwrap* unwrap, enum x86_energy_counter counter_type,
+                            uint64_t range, double unit, uint64_t raw);
+
+/**
+ * Adds raw, read at now (x86_energy_overflow_now), returns the accumulated ticks
+ */
+uint64_t x86_energy_unwrap(struct x86_energy_unwrap* unwrap, uint64_t raw, uint64_t now);
+
+#endif /* SRC_INCLUDE_UNWRAP_H_ */
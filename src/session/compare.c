@@ -0,0 +1,177 @@
+/*
+ * compare.c
+ *
+ *  Created on: 19.10.2026
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/error.h"
+#include "../include/overflow_thread.h"
+#include "../include/session.h"
+
+struct compare_state
+{
+    x86_energy_source_comparison_t* result;
+    int slot; /* < 0 if the counter could not be set up */
+    x86_energy_single_counter_t counter;
+    x86_energy_access_source_t* source;
+
+    /* current round */
+    double value;
+    uint64_t time_ns;
+
+    double first;
+    double last;
+    double latency_sum;
+    uint64_t first_change_ns;
+    uint64_t last_change_ns;
+    size_t nr_changes;
+
+    /* sums for a linear fit of the difference to the reference over time */
+    size_t n;
+    double sum_t;
+    double sum_d;
+    double sum_tt;
+    double sum_td;
+};
+
+static void read_counter(struct compare_state* state)
+{
+    uint64_t before = x86_energy_overflow_now();
+    double value = state->source->read(state->counter);
+    uint64_t after = x86_energy_overflow_now();
+    state->value = value;
+    state->time_ns = before + (after - before) / 2;
+    if (value < 0.0)
+        return;
+
+    x86_energy_source_comparison_t* result = state->result;
+    double latency = 1E-9 * (after - before);
+    state->latency_sum += latency;
+    if (latency > result->max_read_latency)
+        result->max_read_latency = latency;
+    if (result->nr_reads == 0)
+    {
+        state->first = value;
+    }
+    else if (value != state->last)
+    {
+        if (state->nr_changes == 0)
+            state->first_change_ns = state->time_ns;
+        state->last_change_ns = state->time_ns;
+        state->nr_changes++;
+    }
+    state->last = value;
+    result->nr_reads++;
+}
+
+static void add_difference(struct compare_state* state, const struct compare_state* reference,
+                           uint64_t start_ns)
+{
+    double t = 1E-9 * (state->time_ns - start_ns);
+    double d = (state->value - state->first) - (reference->value - reference->first);
+    state->n++;
+    state->sum_t += t;
+    state->sum_d += d;
+    state->sum_tt += t * t;
+    state->sum_td += t * d;
+}
+
+static void finish(struct compare_state* state, uint64_t duration_ns)
+{
+    x86_energy_source_comparison_t* result = state->result;
+    if (result->nr_reads == 0)
+    {
+        result->status = 1;
+        return;
+    }
+    result->energy = state->last - state->first;
+    result->power = result->energy / (1E-9 * duration_ns);
+    result->mean_read_latency = state->latency_sum / result->nr_reads;
+    if (state->nr_changes > 1)
+        result->update_period =
+            1E-9 * (state->last_change_ns - state->first_change_ns) / (state->nr_changes - 1);
+    double denominator = state->n * state->sum_tt - state->sum_t * state->sum_t;
+    if (state->n > 1 && denominator != 0.0)
+    {
+        result->drift = (state->n * state->sum_td - state->sum_t * state->sum_d) / denominator;
+        result->offset = (state->sum_d - result->drift * state->sum_t) / state->n;
+    }
+}
+
+int x86_energy_compare_sources(enum x86_energy_counter counter, size_t index,
+                               long long int duration_us, x86_energy_source_comparison_t** results)
+{
+    if (counter < 0 || counter >= X86_ENERGY_COUNTER_SIZE || duration_us <= 0)
+    {
+        X86_ENERGY_SET_ERROR("invalid counter %d or duration %lld", counter, duration_us);
+        return -1;
+    }
+    x86_energy_session_t* session = x86_energy_session_create();
+    if (session == NULL)
+        return -1;
+    x86_energy_mechanisms_t* mechanism = session->mechanism;
+    size_t nr = mechanism->nr_avail_sources;
+    x86_energy_source_comparison_t* result = calloc(nr, sizeof(x86_energy_source_comparison_t));
+    struct compare_state* states = calloc(nr, sizeof(struct compare_state));
+    if (nr == 0 || result == NULL || states == NULL)
+    {
+        free(result);
+        free(states);
+        x86_energy_session_destroy(session);
+        X86_ENERGY_SET_ERROR("could not allocate memory for comparing %zu sources", nr);
+        return -1;
+    }
+
+    for (size_t i = 0; i < nr; i++)
+    {
+        states[i].result = &result[i];
+        states[i].slot = -1;
+        result[i].source = mechanism->avail_sources[i].name;
+        result[i].status = 1;
+        x86_energy_access_source_t* source =
+            x86_energy_session_init_source(session, mechanism->avail_sources[i].name);
+        if (source == NULL)
+            continue;
+        states[i].slot = x86_energy_session_add_counter(session, source, counter, index);
+        if (states[i].slot < 0)
+            continue;
+        states[i].source = source;
+        states[i].counter = session->counters[states[i].slot];
+        result[i].status = 0;
+    }
+
+    /* the session is private, so its counters can be read without the session mutex */
+    uint64_t start_ns = x86_energy_overflow_now();
+    uint64_t end_ns = start_ns + 1000ULL * duration_us;
+    size_t round = 0;
+    struct compare_state* reference = NULL;
+    do
+    {
+        for (size_t j = 0; j < nr; j++)
+        {
+            struct compare_state* state = &states[(round + j) % nr];
+            if (state->slot >= 0)
+                read_counter(state);
+        }
+        for (size_t i = 0; i < nr && reference == NULL; i++)
+            if (states[i].slot >= 0 && states[i].result->nr_reads > 0)
+                reference = &states[i];
+        for (size_t i = 0; i < nr && reference != NULL; i++)
+            if (&states[i] != reference && states[i].slot >= 0 && states[i].value >= 0.0 &&
+                reference->value >= 0.0)
+                add_difference(&states[i], reference, start_ns);
+        round++;
+    } while (x86_energy_overflow_now() < end_ns);
+    uint64_t duration_ns = x86_energy_overflow_now() - start_ns;
+
+    for (size_t i = 0; i < nr; i++)
+        if (states[i].slot >= 0)
+            finish(&states[i], duration_ns);
+    free(states);
+    x86_energy_session_destroy(session);
+    *results = result;
+    return nr;
+}
@@ -0,0 +1,158 @@
+/*
+ * sampler.c
+ *
+ *  Created on: 19.10.2026
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../include/error.h"
+#include "../include/session.h"
+#include "../include/threads.h"
+
+#define NSEC_PER_SEC 1000000000LL
+
+struct x86_energy_sampler
+{
+    x86_energy_session_t* session;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond; /* uses CLOCK_MONOTONIC */
+    bool stop;
+    bool detached; /* stopped from a callback, the thread frees the sampler when it returns */
+    long long int period_us;
+    x86_energy_sample_callback_t callback;
+    void* arg;
+    size_t nr;
+    double* values;
+};
+
+static uint64_t to_ns(const struct timespec* time)
+{
+    return (uint64_t)time->tv_sec * NSEC_PER_SEC + time->tv_nsec;
+}
+
+static void add_us(struct timespec* time, long long int us)
+{
+    long long int nsec = time->tv_nsec + us * 1000;
+    time->tv_sec += nsec / NSEC_PER_SEC;
+    time->tv_nsec = nsec % NSEC_PER_SEC;
+}
+
+static void free_sampler(struct x86_energy_sampler* sampler)
+{
+    pthread_cond_destroy(&sampler->cond);
+    pthread_mutex_destroy(&sampler->mutex);
+    free(sampler->values);
+    free(sampler);
+}
+
+static void* sample(void* arg)
+{
+    struct x86_energy_sampler* sampler = arg;
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+
+    pthread_mutex_lock(&sampler->mutex);
+    while (!sampler->stop)
+    {
+        pthread_mutex_unlock(&sampler->mutex);
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        x86_energy_session_read_first(sampler->session, sampler->nr, sampler->values);
+        x86_energy_triggers_evaluate(sampler->session->triggers, to_ns(&now), sampler->nr,
+                                     sampler->values);
+        /* a trigger callback might have stopped sampling */
+        pthread_mutex_lock(&sampler->mutex);
+        bool stopped = sampler->stop;
+        pthread_mutex_unlock(&sampler->mutex);
+        if (sampler->callback != NULL && !stopped)
+            sampler->callback(to_ns(&now), sampler->nr, sampler->values, sampler->arg);
+
+        add_us(&next, sampler->period_us);
+        /* we are too late, do not try to catch up */
+        if (to_ns(&next) < to_ns(&now))
+        {
+            next = now;
+            add_us(&next, sampler->period_us);
+        }
+
+        pthread_mutex_lock(&sampler->mutex);
+        while (!sampler->stop &&
+               pthread_cond_timedwait(&sampler->cond, &sampler->mutex, &next) != ETIMEDOUT)
+            ;
+    }
+    bool detached = sampler->detached;
+    pthread_mutex_unlock(&sampler->mutex);
+    if (detached)
+        free_sampler(sampler);
+    return NULL;
+}
+
+struct x86_energy_sampler* x86_energy_sampler_start(x86_energy_session_t* session, size_t nr,
+                                                    long long int period_us,
+                                                    x86_energy_sample_callback_t callback,
+                                                    void* arg)
+{
+    struct x86_energy_sampler* sampler = calloc(1, sizeof(struct x86_energy_sampler));
+    if (sampler == NULL)
+    {
+        X86_ENERGY_SET_ERROR("could not allocate memory for sampler");
+        return NULL;
+    }
+    sampler->values = calloc(nr ? nr : 1, sizeof(double));
+    if (sampler->values == NULL)
+    {
+        free(sampler);
+        X86_ENERGY_SET_ERROR("could not allocate memory for %zu values", nr);
+        return NULL;
+    }
+    sampler->session = session;
+    sampler->period_us = period_us;
+    sampler->callback = callback;
+    sampler->arg = arg;
+    sampler->nr = nr;
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&sampler->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&sampler->mutex, NULL);
+
+    int ret = x86_energy_thread_create(&sampler->thread, "x86e-sampler", sample, sampler);
+    if (ret != 0)
+    {
+        pthread_cond_destroy(&sampler->cond);
+        pthread_mutex_destroy(&sampler->mutex);
+        free(sampler->values);
+        free(sampler);
+        X86_ENERGY_SET_ERROR("failed to create sampling thread (%d)", ret);
+        return NULL;
+    }
+    return sampler;
+}
+
+void x86_energy_sampler_stop(struct x86_energy_sampler* sampler)
+{
+    /* a thread can not join itself */
+    bool detach = pthread_equal(pthread_self(), sampler->thread);
+    pthread_mutex_lock(&sampler->mutex);
+    sampler->stop = true;
+    sampler->detached = detach;
+    pthread_cond_signal(&sampler->cond);
+    pthread_mutex_unlock(&sampler->mutex);
+    if (detach)
+    {
+        pthread_detach(sampler->thread);
+        return;
+    }
+    pthread_join(sampler->thread, NULL);
+    free_sampler(sampler);
+}
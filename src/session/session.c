@@ -0,0 +1,416 @@
+/*
+ * session.c
+ *
+ *  Created on: 19.10.2026
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/architecture.h"
+#include "../include/error.h"
+#include "../include/hotplug.h"
+#include "../include/overflow_thread.h"
+#include "../include/session.h"
+
+/*
+ * Sources keep their state in static variables, so they are shared by all sessions.
+ * Sources are identified by their init function, since every mechanism holds copies of them.
+ */
+struct source_ref
+{
+    int (*init)(void);
+    void (*fini)(void);
+    size_t users;
+};
+
+static pthread_mutex_t source_refs_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct source_ref* source_refs;
+static size_t nr_source_refs;
+
+static struct source_ref* find_source_ref(x86_energy_access_source_t* source)
+{
+    for (size_t i = 0; i < nr_source_refs; i++)
+        if (source_refs[i].init == source->init)
+            return &source_refs[i];
+    return NULL;
+}
+
+/* calls source->init if no other session uses the source */
+static int acquire_source(x86_energy_access_source_t* source)
+{
+    pthread_mutex_lock(&source_refs_mutex);
+    struct source_ref* ref = find_source_ref(source);
+    if (ref == NULL)
+    {
+        struct source_ref* new_refs =
+            realloc(source_refs, (nr_source_refs + 1) * sizeof(struct source_ref));
+        if (new_refs == NULL)
+        {
+            pthread_mutex_unlock(&source_refs_mutex);
+            X86_ENERGY_SET_ERROR("could not allocate memory for source %s", source->name);
+            return 1;
+        }
+        source_refs = new_refs;
+        ref = &source_refs[nr_source_refs++];
+        ref->init = source->init;
+        ref->fini = source->fini;
+        ref->users = 0;
+    }
+    if (ref->users == 0)
+    {
+        int ret = source->init();
+        if (ret != 0)
+        {
+            pthread_mutex_unlock(&source_refs_mutex);
+            X86_ENERGY_APPEND_ERROR("while initializing source %s", source->name);
+            return ret;
+        }
+    }
+    ref->users++;
+    pthread_mutex_unlock(&source_refs_mutex);
+    return 0;
+}
+
+/* calls source->fini if this was the last session using the source */
+static void release_source(x86_energy_access_source_t* source)
+{
+    pthread_mutex_lock(&source_refs_mutex);
+    struct source_ref* ref = find_source_ref(source);
+    if (ref != NULL && ref->users > 0)
+    {
+        ref->users--;
+        if (ref->users == 0)
+            ref->fini();
+    }
+    pthread_mutex_unlock(&source_refs_mutex);
+}
+
+x86_energy_session_t* x86_energy_session_create(void)
+{
+    x86_energy_session_t* session = calloc(1, sizeof(x86_energy_session_t));
+    if (session == NULL)
+    {
+        X86_ENERGY_SET_ERROR("could not allocate memory for session");
+        return NULL;
+    }
+    session->arch = x86_energy_init_architecture_nodes();
+    if (session->arch == NULL)
+    {
+        X86_ENERGY_APPEND_ERROR("while creating session");
+        free(session);
+        return NULL;
+    }
+    session->mechanism = x86_energy_get_avail_mechanism();
+    if (session->mechanism == NULL)
+    {
+        X86_ENERGY_APPEND_ERROR("while creating session");
+        x86_energy_free_architecture_nodes(session->arch);
+        free(session);
+        return NULL;
+    }
+    session->triggers = x86_energy_triggers_create();
+    if (session->triggers == NULL)
+    {
+        X86_ENERGY_APPEND_ERROR("while creating session");
+        x86_energy_free_mechanism(session->mechanism);
+        x86_energy_free_architecture_nodes(session->arch);
+        free(session);
+        return NULL;
+    }
+    session->arch_generation = x86_energy_hotplug_generation();
+    pthread_mutex_init(&session->mutex, NULL);
+    return session;
+}
+
+void x86_energy_session_destroy(x86_energy_session_t* session)
+{
+    if (session == NULL)
+        return;
+    x86_energy_session_stop_sampling(session);
+
+    for (size_t i = 0; i < session->nr_counters; i++)
+        session->counter_sources[i]->close(session->counters[i]);
+    for (size_t i = 0; i < session->nr_sources; i++)
+        release_source(session->sources[i]);
+
+    x86_energy_triggers_free(session->triggers);
+    free(session->counters);
+    free(session->domains);
+    free(session->counter_sources);
+    free(session->sources);
+    x86_energy_free_mechanism(session->mechanism);
+    x86_energy_free_architecture_nodes(session->arch);
+    for (size_t i = 0; i < session->nr_old_archs; i++)
+        x86_energy_free_architecture_nodes(session->old_archs[i]);
+    free(session->old_archs);
+    pthread_mutex_destroy(&session->mutex);
+    free(session);
+}
+
+x86_energy_architecture_node_t* x86_energy_session_get_architecture(x86_energy_session_t* session)
+{
+    pthread_mutex_lock(&session->mutex);
+    uint64_t generation = x86_energy_hotplug_generation();
+    if (generation != session->arch_generation)
+    {
+        session->arch_generation = generation;
+        x86_energy_architecture_node_t* updated = x86_energy_arch_add_online_cpus(session->arch);
+        x86_energy_architecture_node_t** old_archs = updated != session->arch ?
+            realloc(session->old_archs, (session->nr_old_archs + 1) * sizeof(*old_archs)) :
+            NULL;
+        if (old_archs != NULL)
+        {
+            old_archs[session->nr_old_archs++] = session->arch;
+            session->old_archs = old_archs;
+            session->arch = updated;
+        }
+        else if (updated != session->arch)
+            x86_energy_free_architecture_nodes(updated);
+    }
+    x86_energy_architecture_node_t* arch = session->arch;
+    pthread_mutex_unlock(&session->mutex);
+    return arch;
+}
+
+x86_energy_mechanisms_t* x86_energy_session_get_mechanism(x86_energy_session_t* session)
+{
+    return session->mechanism;
+}
+
+void x86_energy_session_set_update_rate(x86_energy_session_t* session, long long int time_in_us)
+{
+    pthread_mutex_lock(&session->mutex);
+    session->update_rate_set = true;
+    session->update_rate_us = time_in_us;
+    pthread_mutex_unlock(&session->mutex);
+}
+
+static bool session_has_source(x86_energy_session_t* session, x86_energy_access_source_t* source)
+{
+    for (size_t i = 0; i < session->nr_sources; i++)
+        if (session->sources[i] == source)
+            return true;
+    return false;
+}
+
+/* session mutex has to be held */
+static int init_source(x86_energy_session_t* session, x86_energy_access_source_t* source)
+{
+    if (session_has_source(session, source))
+        return 0;
+    x86_energy_access_source_t** new_sources =
+        realloc(session->sources, (session->nr_sources + 1) * sizeof(x86_energy_access_source_t*));
+    if (new_sources == NULL)
+    {
+        X86_ENERGY_SET_ERROR("could not allocate memory for source %s", source->name);
+        return 1;
+    }
+    session->sources = new_sources;
+    int ret = acquire_source(source);
+    if (ret != 0)
+        return ret;
+    session->sources[session->nr_sources++] = source;
+    return 0;
+}
+
+x86_energy_access_source_t* x86_energy_session_init_source(x86_energy_session_t* session,
+                                                          const char* name)
+{
+    x86_energy_access_source_t* result = NULL;
+    pthread_mutex_lock(&session->mutex);
+    for (size_t i = 0; i < session->mechanism->nr_avail_sources; i++)
+    {
+        x86_energy_access_source_t* source = &session->mechanism->avail_sources[i];
+        if (name != NULL && strcmp(source->name, name) != 0)
+            continue;
+        if (init_source(session, source) == 0)
+        {
+            result = source;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&session->mutex);
+    if (result == NULL && name != NULL)
+        X86_ENERGY_APPEND_ERROR("source %s is not available", name);
+    else if (result == NULL)
+        X86_ENERGY_APPEND_ERROR("no source could be initialized");
+    return result;
+}
+
+int x86_energy_session_add_counter(x86_energy_session_t* session,
+                                   x86_energy_access_source_t* source,
+                                   enum x86_energy_counter counter, size_t index)
+{
+    pthread_mutex_lock(&session->mutex);
+    if (!session_has_source(session, source))
+    {
+        pthread_mutex_unlock(&session->mutex);
+        X86_ENERGY_SET_ERROR("source %s has not been initialized by this session", source->name);
+        return -1;
+    }
+    if (session->sampler != NULL)
+    {
+        pthread_mutex_unlock(&session->mutex);
+        X86_ENERGY_SET_ERROR("cannot add counters while the session is sampling");
+        return -1;
+    }
+    if (session->nr_counters == session->counters_capacity)
+    {
+        size_t capacity = session->counters_capacity ? 2 * session->counters_capacity : 8;
+        x86_energy_access_source_t** new_sources =
+            realloc(session->counter_sources, capacity * sizeof(x86_energy_access_source_t*));
+        if (new_sources != NULL)
+            session->counter_sources = new_sources;
+        x86_energy_single_counter_t* new_counters =
+            realloc(session->counters, capacity * sizeof(x86_energy_single_counter_t));
+        if (new_counters != NULL)
+            session->counters = new_counters;
+        struct x86_energy_session_domain* new_domains =
+            realloc(session->domains, capacity * sizeof(struct x86_energy_session_domain));
+        if (new_domains != NULL)
+            session->domains = new_domains;
+        if (new_sources == NULL || new_counters == NULL || new_domains == NULL)
+        {
+            pthread_mutex_unlock(&session->mutex);
+            X86_ENERGY_SET_ERROR("could not allocate memory for %zu counters", capacity);
+            return -1;
+        }
+        session->counters_capacity = capacity;
+    }
+
+    /* overflow threads created during setup use the rate of this session */
+    if (session->update_rate_set)
+        x86_energy_overflow_set_thread_rate(session->update_rate_us);
+    x86_energy_single_counter_t t = source->setup(counter, index);
+    x86_energy_overflow_clear_thread_rate();
+
+    if (t == NULL)
+    {
+        pthread_mutex_unlock(&session->mutex);
+        X86_ENERGY_APPEND_ERROR("while adding counter %d (%zu) of source %s", counter, index,
+                                source->name);
+        return -1;
+    }
+    int slot = session->nr_counters++;
+    session->counter_sources[slot] = source;
+    session->counters[slot] = t;
+    memset(&session->domains[slot], 0, sizeof(struct x86_energy_session_domain));
+    session->domains[slot].counter = counter;
+    session->domains[slot].index = index;
+    pthread_mutex_unlock(&session->mutex);
+    return slot;
+}
+
+size_t x86_energy_session_nr_counters(x86_energy_session_t* session)
+{
+    pthread_mutex_lock(&session->mutex);
+    size_t nr = session->nr_counters;
+    pthread_mutex_unlock(&session->mutex);
+    return nr;
+}
+
+int x86_energy_session_read_first(x86_energy_session_t* session, size_t nr, double* values)
+{
+    int failed = 0;
+    pthread_mutex_lock(&session->mutex);
+    if (nr > session->nr_counters)
+        nr = session->nr_counters;
+    /* read consecutive counters of the same source together */
+    for (size_t first = 0, last; first < nr; first = last)
+    {
+        x86_energy_access_source_t* source = session->counter_sources[first];
+        for (last = first + 1; last < nr && session->counter_sources[last] == source; last++)
+            ;
+        failed += x86_energy_read_batch(source, last - first, &session->counters[first],
+                                        &values[first]);
+    }
+    pthread_mutex_unlock(&session->mutex);
+    return failed;
+}
+
+int x86_energy_session_read(x86_energy_session_t* session, double* values)
+{
+    return x86_energy_session_read_first(session, SIZE_MAX, values);
+}
+
+int x86_energy_session_start_sampling(x86_energy_session_t* session, long long int period_us,
+                                      x86_energy_sample_callback_t callback, void* arg)
+{
+    if (period_us <= 0)
+    {
+        X86_ENERGY_SET_ERROR("invalid sampling period %lld", period_us);
+        return 1;
+    }
+    pthread_mutex_lock(&session->mutex);
+    if (session->sampler != NULL)
+    {
+        pthread_mutex_unlock(&session->mutex);
+        X86_ENERGY_SET_ERROR("the session is already sampling");
+        return 1;
+    }
+    session->sampler =
+        x86_energy_sampler_start(session, session->nr_counters, period_us, callback, arg);
+    int ret = session->sampler == NULL;
+    pthread_mutex_unlock(&session->mutex);
+    return ret;
+}
+
+int x86_energy_session_stop_sampling(x86_energy_session_t* session)
+{
+    pthread_mutex_lock(&session->mutex);
+    struct x86_energy_sampler* sampler = session->sampler;
+    session->sampler = NULL;
+    pthread_mutex_unlock(&session->mutex);
+    if (sampler == NULL)
+        return 1;
+    x86_energy_sampler_stop(sampler);
+    return 0;
+}
+
+int x86_energy_session_set_power_limit(x86_energy_session_t* session, size_t counter,
+                                       enum x86_energy_power_limit_constraint constraint,
+                                       x86_energy_power_limit_t* limit, int flags)
+{
+    pthread_mutex_lock(&session->mutex);
+    if (counter >= session->nr_counters)
+    {
+        pthread_mutex_unlock(&session->mutex);
+        X86_ENERGY_SET_ERROR("the session has no counter %zu", counter);
+        return 1;
+    }
+    struct x86_energy_session_domain* domain = &session->domains[counter];
+    x86_energy_access_source_t* source = session->counter_sources[counter];
+    int ret = x86_energy_set_power_limit(source, domain->counter, domain->index, constraint, limit,
+                                         flags);
+    if (ret == 0 && !(flags & X86_ENERGY_POWER_LIMIT_DRY_RUN))
+    {
+        double energy = source->read(session->counters[counter]);
+        domain->limit_changed = energy >= 0.0;
+        domain->limit_change_ns = x86_energy_overflow_now();
+        domain->limit_change_energy = energy;
+    }
+    pthread_mutex_unlock(&session->mutex);
+    return ret;
+}
+
+int x86_energy_session_power_since_limit(x86_energy_session_t* session, size_t counter,
+                                         double* power)
+{
+    pthread_mutex_lock(&session->mutex);
+    if (counter >= session->nr_counters || !session->domains[counter].limit_changed)
+    {
+        pthread_mutex_unlock(&session->mutex);
+        X86_ENERGY_SET_ERROR("the power limit of counter %zu has not been changed", counter);
+        return 1;
+    }
+    struct x86_energy_session_domain* domain = &session->domains[counter];
+    double energy = session->counter_sources[counter]->read(session->counters[counter]);
+    uint64_t now = x86_energy_overflow_now();
+    int ret = energy < 0.0 || now <= domain->limit_change_ns;
+    if (ret == 0)
+        *power = (energy - domain->limit_change_energy) / (1E-9 * (now - domain->limit_change_ns));
+    pthread_mutex_unlock(&session->mutex);
+    return ret;
+}
@@ -0,0 +1,361 @@
+/*
+ * trigger.c
+ *
+ *  Created on: 19.10.2026
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "../include/error.h"
+#include "../include/session.h"
+
+/* events of triggers without callback, must be a power of two */
+#define QUEUE_SIZE 256
+
+struct sample
+{
+    uint64_t time_ns;
+    double energy;
+};
+
+struct trigger
+{
+    int id;
+    enum x86_energy_trigger_type type;
+    size_t counter;
+    double threshold;
+    uint64_t window_ns;
+    x86_energy_trigger_callback_t callback;
+    void* arg;
+    bool armed; /* the condition was false since the trigger fired last */
+    bool has_baseline;
+    double baseline; /* first energy, for budgets */
+
+    /* samples of the last window (two windows for slopes) in a ring, oldest first */
+    size_t first;
+    size_t nr_samples;
+    size_t capacity;
+    struct sample* samples;
+};
+
+struct x86_energy_triggers
+{
+    pthread_mutex_t mutex; /* protects the triggers and event_fd, not the queue */
+    int next_id;
+    size_t nr_triggers;
+    struct trigger** triggers;
+    int event_fd; /* < 0 until it is used */
+
+    /* ring with a single producer (the sampling thread) and a single consumer */
+    x86_energy_trigger_event_t events[QUEUE_SIZE];
+    uint64_t head; /* next event to fetch, written by the consumer */
+    uint64_t tail; /* next free slot, written by the producer */
+    size_t dropped; /* events that did not fit into the ring, accessed atomically */
+};
+
+struct x86_energy_triggers* x86_energy_triggers_create(void)
+{
+    struct x86_energy_triggers* triggers = calloc(1, sizeof(struct x86_energy_triggers));
+    if (triggers == NULL)
+    {
+        X86_ENERGY_SET_ERROR("could not allocate memory for triggers");
+        return NULL;
+    }
+    pthread_mutex_init(&triggers->mutex, NULL);
+    triggers->event_fd = -1;
+    return triggers;
+}
+
+static void free_trigger(struct trigger* trigger)
+{
+    free(trigger->samples);
+    free(trigger);
+}
+
+void x86_energy_triggers_free(struct x86_energy_triggers* triggers)
+{
+    for (size_t i = 0; i < triggers->nr_triggers; i++)
+        free_trigger(triggers->triggers[i]);
+    free(triggers->triggers);
+    if (triggers->event_fd >= 0)
+        close(triggers->event_fd);
+    pthread_mutex_destroy(&triggers->mutex);
+    free(triggers);
+}
+
+/* must be called with triggers->mutex held */
+static int open_event_fd(struct x86_energy_triggers* triggers)
+{
+    if (triggers->event_fd < 0)
+        __atomic_store_n(&triggers->event_fd, eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK),
+                         __ATOMIC_RELEASE);
+    if (triggers->event_fd < 0)
+        X86_ENERGY_SET_ERROR("could not create eventfd for triggers (%d)", errno);
+    return triggers->event_fd;
+}
+
+/* called by the sampling thread with triggers->mutex held */
+static void push_event(struct x86_energy_triggers* triggers,
+                       const x86_energy_trigger_event_t* event)
+{
+    uint64_t tail = __atomic_load_n(&triggers->tail, __ATOMIC_RELAXED);
+    uint64_t head = __atomic_load_n(&triggers->head, __ATOMIC_ACQUIRE);
+    if (tail - head == QUEUE_SIZE)
+    {
+        __atomic_add_fetch(&triggers->dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    triggers->events[tail % QUEUE_SIZE] = *event;
+    __atomic_store_n(&triggers->tail, tail + 1, __ATOMIC_RELEASE);
+    /* only fails if the counter would overflow, then the eventfd is readable anyway */
+    if (triggers->event_fd >= 0)
+        eventfd_write(triggers->event_fd, 1);
+}
+
+static struct sample* sample_at(struct trigger* trigger, size_t i)
+{
+    return &trigger->samples[(trigger->first + i) % trigger->capacity];
+}
+
+static void add_sample(struct trigger* trigger, uint64_t time_ns, double energy)
+{
+    if (trigger->nr_samples == trigger->capacity)
+    {
+        size_t capacity = trigger->capacity ? 2 * trigger->capacity : 16;
+        struct sample* samples = malloc(capacity * sizeof(struct sample));
+        if (samples == NULL)
+        {
+            /* keep the capacity, drop the oldest sample */
+            trigger->first = (trigger->first + 1) % trigger->capacity;
+            trigger->nr_samples--;
+        }
+        else
+        {
+            for (size_t i = 0; i < trigger->nr_samples; i++)
+                samples[i] = *sample_at(trigger, i);
+            free(trigger->samples);
+            trigger->samples = samples;
+            trigger->capacity = capacity;
+            trigger->first = 0;
+        }
+    }
+    struct sample* sample = sample_at(trigger, trigger->nr_samples++);
+    sample->time_ns = time_ns;
+    sample->energy = energy;
+}
+
+/* drops samples that are not needed for windows ending now anymore */
+static void prune(struct trigger* trigger, uint64_t now, uint64_t horizon_ns)
+{
+    while (trigger->nr_samples >= 2 && sample_at(trigger, 1)->time_ns + horizon_ns <= now)
+    {
+        trigger->first = (trigger->first + 1) % trigger->capacity;
+        trigger->nr_samples--;
+    }
+}
+
+/* returns the newest sample at or before time_ns, NULL if there is none */
+static struct sample* sample_before(struct trigger* trigger, uint64_t time_ns)
+{
+    for (size_t i = trigger->nr_samples; i > 0; i--)
+        if (sample_at(trigger, i - 1)->time_ns <= time_ns)
+            return sample_at(trigger, i - 1);
+    return NULL;
+}
+
+/* computes the power of the window that ends at end_ns, returns false if it is not covered */
+static bool window_power(struct trigger* trigger, uint64_t end_ns, double* power)
+{
+    if (end_ns < trigger->window_ns)
+        return false;
+    struct sample* from = sample_before(trigger, end_ns - trigger->window_ns);
+    struct sample* to = sample_before(trigger, end_ns);
+    if (from == NULL || to == NULL || to->time_ns <= from->time_ns)
+        return false;
+    *power = (to->energy - from->energy) / (1E-9 * (to->time_ns - from->time_ns));
+    return true;
+}
+
+/* returns whether the condition of the trigger is true, sets value */
+static bool evaluate(struct trigger* trigger, uint64_t now, double energy, double* value)
+{
+    if (trigger->type == X86_ENERGY_TRIGGER_ENERGY_BUDGET)
+    {
+        if (!trigger->has_baseline)
+        {
+            trigger->has_baseline = true;
+            trigger->baseline = energy;
+        }
+        *value = energy - trigger->baseline;
+        return *value >= trigger->threshold;
+    }
+    bool slope = trigger->type == X86_ENERGY_TRIGGER_POWER_SLOPE;
+    add_sample(trigger, now, energy);
+    prune(trigger, now, slope ? 2 * trigger->window_ns : trigger->window_ns);
+    double power;
+    if (!window_power(trigger, now, &power))
+        return false;
+    switch (trigger->type)
+    {
+    case X86_ENERGY_TRIGGER_POWER_ABOVE:
+        *value = power;
+        return power > trigger->threshold;
+    case X86_ENERGY_TRIGGER_POWER_BELOW:
+        *value = power;
+        return power < trigger->threshold;
+    default:
+    {
+        double previous;
+        if (now < trigger->window_ns || !window_power(trigger, now - trigger->window_ns, &previous))
+            return false;
+        *value = (power - previous) / (1E-9 * trigger->window_ns);
+        return fabs(*value) > trigger->threshold;
+    }
+    }
+}
+
+void x86_energy_triggers_evaluate(struct x86_energy_triggers* triggers, uint64_t time_ns,
+                                  size_t nr, const double* values)
+{
+    pthread_mutex_lock(&triggers->mutex);
+    for (size_t i = 0; i < triggers->nr_triggers; i++)
+    {
+        struct trigger* trigger = triggers->triggers[i];
+        if (trigger->counter >= nr || values[trigger->counter] < 0.0)
+            continue;
+        double value = 0.0;
+        if (!evaluate(trigger, time_ns, values[trigger->counter], &value))
+        {
+            /* budgets fire only once */
+            if (trigger->type != X86_ENERGY_TRIGGER_ENERGY_BUDGET)
+                trigger->armed = true;
+            continue;
+        }
+        if (!trigger->armed)
+            continue;
+        trigger->armed = false;
+        x86_energy_trigger_event_t event = { .id = trigger->id,
+                                             .type = trigger->type,
+                                             .counter = trigger->counter,
+                                             .time_ns = time_ns,
+                                             .value = value };
+        if (trigger->callback != NULL)
+            trigger->callback(&event, trigger->arg);
+        else
+            push_event(triggers, &event);
+    }
+    pthread_mutex_unlock(&triggers->mutex);
+}
+
+int x86_energy_session_add_trigger(x86_energy_session_t* session,
+                                   enum x86_energy_trigger_type type, size_t counter,
+                                   double threshold, long long int window_us,
+                                   x86_energy_trigger_callback_t callback, void* arg)
+{
+    if (type < 0 || type >= X86_ENERGY_TRIGGER_SIZE ||
+        (type != X86_ENERGY_TRIGGER_ENERGY_BUDGET && window_us <= 0))
+    {
+        X86_ENERGY_SET_ERROR("invalid trigger type %d or window %lld", type, window_us);
+        return -1;
+    }
+    if (counter >= x86_energy_session_nr_counters(session))
+    {
+        X86_ENERGY_SET_ERROR("the session has no counter %zu", counter);
+        return -1;
+    }
+    struct trigger* trigger = calloc(1, sizeof(struct trigger));
+    if (trigger == NULL)
+    {
+        X86_ENERGY_SET_ERROR("could not allocate memory for trigger");
+        return -1;
+    }
+    trigger->type = type;
+    trigger->counter = counter;
+    trigger->threshold = threshold;
+    trigger->window_ns = type == X86_ENERGY_TRIGGER_ENERGY_BUDGET ? 0 : 1000ULL * window_us;
+    trigger->callback = callback;
+    trigger->arg = arg;
+    trigger->armed = true;
+
+    struct x86_energy_triggers* triggers = session->triggers;
+    pthread_mutex_lock(&triggers->mutex);
+    struct trigger** new_triggers =
+        realloc(triggers->triggers, (triggers->nr_triggers + 1) * sizeof(struct trigger*));
+    if (new_triggers == NULL || (callback == NULL && open_event_fd(triggers) < 0))
+    {
+        if (new_triggers != NULL)
+            triggers->triggers = new_triggers;
+        pthread_mutex_unlock(&triggers->mutex);
+        free_trigger(trigger);
+        X86_ENERGY_APPEND_ERROR("could not add trigger");
+        return -1;
+    }
+    triggers->triggers = new_triggers;
+    trigger->id = triggers->next_id++;
+    triggers->triggers[triggers->nr_triggers++] = trigger;
+    int id = trigger->id;
+    pthread_mutex_unlock(&triggers->mutex);
+    return id;
+}
+
+int x86_energy_session_remove_trigger(x86_energy_session_t* session, int id)
+{
+    struct x86_energy_triggers* triggers = session->triggers;
+    pthread_mutex_lock(&triggers->mutex);
+    for (size_t i = 0; i < triggers->nr_triggers; i++)
+    {
+        struct trigger* trigger = triggers->triggers[i];
+        if (trigger->id != id)
+            continue;
+        memmove(&triggers->triggers[i], &triggers->triggers[i + 1],
+                (triggers->nr_triggers - i - 1) * sizeof(struct trigger*));
+        triggers->nr_triggers--;
+        pthread_mutex_unlock(&triggers->mutex);
+        free_trigger(trigger);
+        return 0;
+    }
+    pthread_mutex_unlock(&triggers->mutex);
+    X86_ENERGY_SET_ERROR("no trigger with id %d", id);
+    return 1;
+}
+
+int x86_energy_session_trigger_fd(x86_energy_session_t* session)
+{
+    pthread_mutex_lock(&session->triggers->mutex);
+    int fd = open_event_fd(session->triggers);
+    pthread_mutex_unlock(&session->triggers->mutex);
+    return fd;
+}
+
+size_t x86_energy_session_poll_triggers(x86_energy_session_t* session,
+                                        x86_energy_trigger_event_t* events, size_t max)
+{
+    struct x86_energy_triggers* triggers = session->triggers;
+    /* reset before fetching, events that are pushed afterwards signal the eventfd again */
+    int fd = __atomic_load_n(&triggers->event_fd, __ATOMIC_ACQUIRE);
+    eventfd_t count;
+    if (fd >= 0)
+        eventfd_read(fd, &count);
+    uint64_t head = __atomic_load_n(&triggers->head, __ATOMIC_RELAXED);
+    uint64_t tail = __atomic_load_n(&triggers->tail, __ATOMIC_ACQUIRE);
+    size_t nr = 0;
+    for (; head != tail && nr < max; head++, nr++)
+        events[nr] = triggers->events[head % QUEUE_SIZE];
+    __atomic_store_n(&triggers->head, head, __ATOMIC_RELEASE);
+    /* events that did not fit into events keep the eventfd readable */
+    if (fd >= 0 && head != tail)
+        eventfd_write(fd, 1);
+    return nr;
+}
+
+size_t x86_energy_session_dropped_trigger_events(x86_energy_session_t* session)
+{
+    return __atomic_load_n(&session->triggers->dropped, __ATOMIC_RELAXED);
+}
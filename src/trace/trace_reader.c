@@ -0,0 +1,347 @@
+/*
+ * trace_reader.c
+ *
+ *  Created on: 19.10.2026
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../../include/x86_energy_trace.h"
+#include "../include/error.h"
+#include "../include/trace_format.h"
+
+struct x86_energy_trace_reader
+{
+    const uint8_t* data;
+    size_t size;
+
+    size_t nr_counters;
+    struct x86_energy_trace_counter* counters;
+    x86_energy_architecture_node_t* arch;
+
+    size_t nr_chunks;
+    const struct trace_index_entry* index;
+};
+
+/* checks that [offset, offset + size) lies within the file */
+static bool in_file(const x86_energy_trace_reader_t* reader, uint64_t offset, uint64_t size)
+{
+    return offset <= reader->size && size <= reader->size - offset;
+}
+
+static bool valid_string(const char* strings, uint32_t strings_size, uint32_t offset)
+{
+    return offset < strings_size && memchr(strings + offset, '\0', strings_size - offset) != NULL;
+}
+
+static int parse_header(x86_energy_trace_reader_t* reader)
+{
+    if (!in_file(reader, 0, sizeof(struct trace_header)))
+        return 1;
+    const struct trace_header* header = (const struct trace_header*)reader->data;
+    if (memcmp(header->magic, TRACE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != TRACE_VERSION)
+        return 1;
+
+    uint64_t counters_offset = sizeof(struct trace_header);
+    uint64_t nodes_offset =
+        counters_offset + (uint64_t)header->nr_counters * sizeof(struct trace_counter_record);
+    uint64_t strings_offset =
+        nodes_offset + (uint64_t)header->nr_nodes * sizeof(struct trace_node_record);
+    if (!in_file(reader, strings_offset, header->strings_size) ||
+        header->header_size < strings_offset + header->strings_size ||
+        !in_file(reader, header->header_size, 0))
+        return 1;
+
+    const struct trace_counter_record* counters =
+        (const struct trace_counter_record*)(reader->data + counters_offset);
+    const struct trace_node_record* nodes =
+        (const struct trace_node_record*)(reader->data + nodes_offset);
+    const char* strings = (const char*)reader->data + strings_offset;
+
+    reader->nr_counters = header->nr_counters;
+    reader->counters = calloc(reader->nr_counters ? reader->nr_counters : 1,
+                              sizeof(struct x86_energy_trace_counter));
+    if (reader->counters == NULL)
+        return 1;
+    for (size_t i = 0; i < reader->nr_counters; i++)
+    {
+        if (!valid_string(strings, header->strings_size, counters[i].source_offset))
+            return 1;
+        reader->counters[i].counter = counters[i].counter;
+        reader->counters[i].index = counters[i].index;
+        reader->counters[i].unit = counters[i].unit;
+        reader->counters[i].width = counters[i].width;
+        reader->counters[i].source = strings + counters[i].source_offset;
+    }
+
+    if (header->nr_nodes == 0)
+        return 0;
+    reader->arch = calloc(header->nr_nodes, sizeof(x86_energy_architecture_node_t));
+    if (reader->arch == NULL)
+        return 1;
+    for (size_t i = 0; i < header->nr_nodes; i++)
+    {
+        /* children are stored after their parent */
+        if (!valid_string(strings, header->strings_size, nodes[i].name_offset) ||
+            (nodes[i].nr_children > 0 &&
+             (nodes[i].first_child <= i || nodes[i].first_child > header->nr_nodes ||
+              nodes[i].nr_children > header->nr_nodes - nodes[i].first_child)))
+            return 1;
+        reader->arch[i].granularity = nodes[i].granularity;
+        reader->arch[i].id = nodes[i].id;
+        reader->arch[i].name = (char*)strings + nodes[i].name_offset;
+        reader->arch[i].nr_children = nodes[i].nr_children;
+        reader->arch[i].children =
+            nodes[i].nr_children ? &reader->arch[nodes[i].first_child] : NULL;
+    }
+    return 0;
+}
+
+static int parse_index(x86_energy_trace_reader_t* reader)
+{
+    if (reader->size < sizeof(struct trace_trailer))
+        return 1;
+    const struct trace_trailer* trailer =
+        (const struct trace_trailer*)(reader->data + reader->size - sizeof(struct trace_trailer));
+    if (memcmp(trailer->magic, TRACE_TRAILER_MAGIC, sizeof(trailer->magic)) != 0 ||
+        trailer->nr_chunks > reader->size / sizeof(struct trace_index_entry) ||
+        !in_file(reader, trailer->index_offset,
+                 trailer->nr_chunks * sizeof(struct trace_index_entry)))
+        return 1;
+    reader->nr_chunks = trailer->nr_chunks;
+    reader->index = (const struct trace_index_entry*)(reader->data + trailer->index_offset);
+    return 0;
+}
+
+x86_energy_trace_reader_t* x86_energy_trace_open(const char* file)
+{
+    int fd = open(file, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        X86_ENERGY_SET_ERROR("could not open trace file %s: %s", file, strerror(errno));
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        X86_ENERGY_SET_ERROR("could not get size of trace file %s", file);
+        close(fd);
+        return NULL;
+    }
+    void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        X86_ENERGY_SET_ERROR("could not map trace file %s: %s", file, strerror(errno));
+        return NULL;
+    }
+
+    x86_energy_trace_reader_t* reader = calloc(1, sizeof(x86_energy_trace_reader_t));
+    if (reader == NULL)
+    {
+        munmap(data, st.st_size);
+        X86_ENERGY_SET_ERROR("could not allocate memory for trace reader");
+        return NULL;
+    }
+    reader->data = data;
+    reader->size = st.st_size;
+    if (parse_header(reader) != 0 || parse_index(reader) != 0)
+    {
+        x86_energy_trace_close(reader);
+        X86_ENERGY_SET_ERROR("%s is not a valid trace file", file);
+        return NULL;
+    }
+    return reader;
+}
+
+void x86_energy_trace_close(x86_energy_trace_reader_t* reader)
+{
+    if (reader == NULL)
+        return;
+    munmap((void*)reader->data, reader->size);
+    free(reader->counters);
+    free(reader->arch);
+    free(reader);
+}
+
+size_t x86_energy_trace_nr_counters(x86_energy_trace_reader_t* reader)
+{
+    return reader->nr_counters;
+}
+
+const struct x86_energy_trace_counter* x86_energy_trace_get_counter(x86_energy_trace_reader_t* reader,
+                                                                   size_t counter)
+{
+    if (counter >= reader->nr_counters)
+    {
+        X86_ENERGY_SET_ERROR("invalid counter %zu", counter);
+        return NULL;
+    }
+    return &reader->counters[counter];
+}
+
+x86_energy_architecture_node_t* x86_energy_trace_get_architecture(x86_energy_trace_reader_t* reader)
+{
+    return reader->arch;
+}
+
+size_t x86_energy_trace_nr_chunks(x86_energy_trace_reader_t* reader)
+{
+    return reader->nr_chunks;
+}
+
+int x86_energy_trace_get_chunk_info(x86_energy_trace_reader_t* reader, size_t chunk,
+                                    struct x86_energy_trace_chunk_info* info)
+{
+    if (chunk >= reader->nr_chunks)
+    {
+        X86_ENERGY_SET_ERROR("invalid chunk %zu", chunk);
+        return 1;
+    }
+    info->first_time_ns = reader->index[chunk].first_time;
+    info->last_time_ns = reader->index[chunk].last_time;
+    info->nr_samples = reader->index[chunk].nr_samples;
+    return 0;
+}
+
+size_t x86_energy_trace_find_chunk(x86_energy_trace_reader_t* reader, uint64_t time_ns)
+{
+    size_t low = 0, high = reader->nr_chunks;
+    while (low < high)
+    {
+        size_t mid = low + (high - low) / 2;
+        if (reader->index[mid].last_time < time_ns)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+/* locates a column within a chunk, column 0 holds the timestamps */
+static int get_column(x86_energy_trace_reader_t* reader, size_t chunk, size_t column,
+                      const struct trace_chunk_header** header, const uint8_t** start,
+                      const uint8_t** end)
+{
+    if (chunk >= reader->nr_chunks)
+    {
+        X86_ENERGY_SET_ERROR("invalid chunk %zu", chunk);
+        return 1;
+    }
+    uint64_t offset = reader->index[chunk].offset;
+    uint64_t fixed_size = sizeof(struct trace_chunk_header) + reader->nr_counters * sizeof(int64_t) +
+                          (reader->nr_counters + 1) * sizeof(uint32_t);
+    if (!in_file(reader, offset, fixed_size))
+        goto invalid;
+    *header = (const struct trace_chunk_header*)(reader->data + offset);
+    if (memcmp((*header)->magic, TRACE_CHUNK_MAGIC, sizeof((*header)->magic)) != 0 ||
+        (*header)->nr_samples == 0 || (*header)->nr_samples != reader->index[chunk].nr_samples)
+        goto invalid;
+    const uint32_t* column_end =
+        (const uint32_t*)(reader->data + offset + sizeof(struct trace_chunk_header) +
+                          reader->nr_counters * sizeof(int64_t));
+    const uint8_t* payload = reader->data + offset + fixed_size;
+    uint32_t column_start = column > 0 ? column_end[column - 1] : 0;
+    if (column_start > column_end[column] ||
+        !in_file(reader, offset + fixed_size, column_end[reader->nr_counters]) ||
+        column_end[column] > column_end[reader->nr_counters])
+        goto invalid;
+    *start = payload + column_start;
+    *end = payload + column_end[column];
+    return 0;
+
+invalid:
+    X86_ENERGY_SET_ERROR("chunk %zu of the trace is corrupt", chunk);
+    return 1;
+}
+
+static int decode_column(const uint8_t* pos, const uint8_t* end, uint64_t first, size_t nr,
+                         uint64_t* values)
+{
+    values[0] = first;
+    for (size_t i = 1; i < nr; i++)
+    {
+        uint64_t delta;
+        pos = trace_get_varint(pos, end, &delta);
+        if (pos == NULL)
+            return 1;
+        values[i] = values[i - 1] + (uint64_t)trace_unzigzag(delta);
+    }
+    return 0;
+}
+
+int x86_energy_trace_read_times(x86_energy_trace_reader_t* reader, size_t chunk, uint64_t* times)
+{
+    const struct trace_chunk_header* header;
+    const uint8_t *start, *end;
+    if (get_column(reader, chunk, 0, &header, &start, &end) != 0)
+        return 1;
+    if (decode_column(start, end, header->first_time, header->nr_samples, times) != 0)
+    {
+        X86_ENERGY_SET_ERROR("chunk %zu of the trace is corrupt", chunk);
+        return 1;
+    }
+    return 0;
+}
+
+int x86_energy_trace_read_ticks(x86_energy_trace_reader_t* reader, size_t chunk, size_t counter,
+                                int64_t* ticks)
+{
+    if (counter >= reader->nr_counters)
+    {
+        X86_ENERGY_SET_ERROR("invalid counter %zu", counter);
+        return 1;
+    }
+    const struct trace_chunk_header* header;
+    const uint8_t *start, *end;
+    if (get_column(reader, chunk, counter + 1, &header, &start, &end) != 0)
+        return 1;
+    const int64_t* first_ticks = (const int64_t*)(header + 1);
+    if (decode_column(start, end, first_ticks[counter], header->nr_samples, (uint64_t*)ticks) != 0)
+    {
+        X86_ENERGY_SET_ERROR("chunk %zu of the trace is corrupt", chunk);
+        return 1;
+    }
+    return 0;
+}
+
+int x86_energy_trace_read_values(x86_energy_trace_reader_t* reader, size_t chunk, size_t counter,
+                                 double* values)
+{
+    if (counter >= reader->nr_counters)
+    {
+        X86_ENERGY_SET_ERROR("invalid counter %zu", counter);
+        return 1;
+    }
+    const struct trace_chunk_header* header;
+    const uint8_t *pos, *end;
+    if (get_column(reader, chunk, counter + 1, &header, &pos, &end) != 0)
+        return 1;
+    double unit = reader->counters[counter].unit;
+    const int64_t* first_ticks = (const int64_t*)(header + 1);
+    uint64_t ticks = first_ticks[counter];
+    for (size_t i = 0; i < header->nr_samples; i++)
+    {
+        if (i > 0)
+        {
+            uint64_t delta;
+            pos = trace_get_varint(pos, end, &delta);
+            if (pos == NULL)
+            {
+                X86_ENERGY_SET_ERROR("chunk %zu of the trace is corrupt", chunk);
+                return 1;
+            }
+            ticks += (uint64_t)trace_unzigzag(delta);
+        }
+        values[i] = (int64_t)ticks == TRACE_INVALID_TICKS ? -1.0 : (int64_t)ticks * unit;
+    }
+    return 0;
+}
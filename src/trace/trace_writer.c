@@ -0,0 +1,416 @@
+/*
+ * trace_writer.c
+ *
+ *  Created on: 19.10.2026
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../../include/x86_energy_trace.h"
+#include "../include/error.h"
+#include "../include/threads.h"
+#include "../include/trace_format.h"
+
+#define DEFAULT_SAMPLES_PER_CHUNK 1024
+
+/* number of chunks that can be filled while older ones are written */
+#define NR_BUFFERS 4
+
+/* samples of one chunk, not encoded yet */
+struct chunk_buffer
+{
+    size_t nr_samples;
+    uint64_t* times;
+    int64_t* ticks; /* column-major, ticks[counter * samples_per_chunk + sample] */
+};
+
+struct x86_energy_trace_writer
+{
+    int fd;
+    uint64_t offset;
+    size_t nr_counters;
+    size_t samples_per_chunk;
+    double* units;
+
+    struct chunk_buffer buffers[NR_BUFFERS];
+    struct chunk_buffer* current; /* only used by the appending thread */
+
+    pthread_mutex_t mutex; /* protects the lists and stop */
+    pthread_cond_t cond;
+    struct chunk_buffer* free_buffers[NR_BUFFERS];
+    size_t nr_free;
+    struct chunk_buffer* full_buffers[NR_BUFFERS]; /* fifo */
+    size_t first_full;
+    size_t nr_full;
+    bool stop;
+
+    size_t dropped;
+
+    /* used by the writing thread */
+    pthread_t thread;
+    uint8_t* encoded;
+    size_t nr_chunks;
+    size_t index_capacity;
+    struct trace_index_entry* index;
+    int error;
+};
+
+static int write_all(x86_energy_trace_writer_t* writer, const void* data, size_t size)
+{
+    const char* pos = data;
+    while (size > 0)
+    {
+        ssize_t written = write(writer->fd, pos, size);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return errno;
+        }
+        pos += written;
+        size -= written;
+        writer->offset += written;
+    }
+    return 0;
+}
+
+static int write_padding(x86_energy_trace_writer_t* writer)
+{
+    static const char zeros[8] = { 0 };
+    return write_all(writer, zeros, TRACE_ALIGN(writer->offset) - writer->offset);
+}
+
+static int add_index_entry(x86_energy_trace_writer_t* writer, const struct trace_index_entry* entry)
+{
+    if (writer->nr_chunks == writer->index_capacity)
+    {
+        size_t capacity = writer->index_capacity ? 2 * writer->index_capacity : 64;
+        struct trace_index_entry* index =
+            realloc(writer->index, capacity * sizeof(struct trace_index_entry));
+        if (index == NULL)
+            return ENOMEM;
+        writer->index = index;
+        writer->index_capacity = capacity;
+    }
+    writer->index[writer->nr_chunks++] = *entry;
+    return 0;
+}
+
+static uint8_t* encode_column(uint8_t* pos, const int64_t* values, size_t nr)
+{
+    for (size_t i = 1; i < nr; i++)
+        /* unsigned, so deltas of invalid values wrap instead of overflowing */
+        pos = trace_put_varint(pos, trace_zigzag((int64_t)((uint64_t)values[i] -
+                                                          (uint64_t)values[i - 1])));
+    return pos;
+}
+
+static int write_chunk(x86_energy_trace_writer_t* writer, const struct chunk_buffer* buffer)
+{
+    size_t nr = buffer->nr_samples;
+    uint32_t column_end[writer->nr_counters + 1];
+    int64_t first_ticks[writer->nr_counters + 1];
+
+    uint8_t* pos = encode_column(writer->encoded, (const int64_t*)buffer->times, nr);
+    column_end[0] = pos - writer->encoded;
+    for (size_t i = 0; i < writer->nr_counters; i++)
+    {
+        const int64_t* column = &buffer->ticks[i * writer->samples_per_chunk];
+        first_ticks[i] = column[0];
+        pos = encode_column(pos, column, nr);
+        column_end[i + 1] = pos - writer->encoded;
+    }
+
+    struct trace_chunk_header header = { .magic = TRACE_CHUNK_MAGIC,
+                                         .nr_samples = nr,
+                                         .first_time = buffer->times[0],
+                                         .last_time = buffer->times[nr - 1] };
+    struct trace_index_entry entry = { .offset = writer->offset,
+                                       .first_time = header.first_time,
+                                       .last_time = header.last_time,
+                                       .nr_samples = nr };
+    int ret = write_all(writer, &header, sizeof(header));
+    if (ret == 0)
+        ret = write_all(writer, first_ticks, writer->nr_counters * sizeof(int64_t));
+    if (ret == 0)
+        ret = write_all(writer, column_end, sizeof(column_end));
+    if (ret == 0)
+        ret = write_all(writer, writer->encoded, pos - writer->encoded);
+    if (ret == 0)
+        ret = write_padding(writer);
+    if (ret == 0)
+        ret = add_index_entry(writer, &entry);
+    return ret;
+}
+
+static void* write_chunks(void* arg)
+{
+    x86_energy_trace_writer_t* writer = arg;
+    pthread_mutex_lock(&writer->mutex);
+    while (true)
+    {
+        while (writer->nr_full == 0 && !writer->stop)
+            pthread_cond_wait(&writer->cond, &writer->mutex);
+        if (writer->nr_full == 0)
+            break;
+        struct chunk_buffer* buffer = writer->full_buffers[writer->first_full];
+        writer->first_full = (writer->first_full + 1) % NR_BUFFERS;
+        writer->nr_full--;
+        pthread_mutex_unlock(&writer->mutex);
+
+        if (writer->error == 0)
+            writer->error = write_chunk(writer, buffer);
+        buffer->nr_samples = 0;
+
+        pthread_mutex_lock(&writer->mutex);
+        writer->free_buffers[writer->nr_free++] = buffer;
+    }
+    pthread_mutex_unlock(&writer->mutex);
+    return NULL;
+}
+
+static size_t count_nodes(const x86_energy_architecture_node_t* node)
+{
+    size_t nr = 1;
+    for (size_t i = 0; i < node->nr_children; i++)
+        nr += count_nodes(&node->children[i]);
+    return nr;
+}
+
+static int write_header(x86_energy_trace_writer_t* writer, const x86_energy_architecture_node_t* arch,
+                        const struct x86_energy_trace_counter* counters)
+{
+    size_t nr_nodes = arch != NULL ? count_nodes(arch) : 0;
+    size_t strings_size = 0;
+    for (size_t i = 0; i < writer->nr_counters; i++)
+        strings_size += strlen(counters[i].source) + 1;
+    for (size_t i = 0; i < nr_nodes; i++)
+        strings_size += strlen(arch[i].name) + 1;
+
+    struct trace_header header = { .magic = TRACE_MAGIC,
+                                   .version = TRACE_VERSION,
+                                   .nr_counters = writer->nr_counters,
+                                   .nr_nodes = nr_nodes,
+                                   .strings_size = strings_size };
+    header.header_size = TRACE_ALIGN(sizeof(header) +
+                                     writer->nr_counters * sizeof(struct trace_counter_record) +
+                                     nr_nodes * sizeof(struct trace_node_record) + strings_size);
+    int ret = write_all(writer, &header, sizeof(header));
+
+    uint32_t string_offset = 0;
+    for (size_t i = 0; i < writer->nr_counters && ret == 0; i++)
+    {
+        struct trace_counter_record record = { .counter = counters[i].counter,
+                                               .index = counters[i].index,
+                                               .unit = counters[i].unit,
+                                               .width = counters[i].width,
+                                               .source_offset = string_offset };
+        string_offset += strlen(counters[i].source) + 1;
+        ret = write_all(writer, &record, sizeof(record));
+    }
+    /* the tree is stored breadth-first in one array, so children can be stored as indices */
+    for (size_t i = 0; i < nr_nodes && ret == 0; i++)
+    {
+        struct trace_node_record record = { .granularity = arch[i].granularity,
+                                            .id = arch[i].id,
+                                            .nr_children = arch[i].nr_children,
+                                            .first_child = arch[i].nr_children ?
+                                                               arch[i].children - arch :
+                                                               0,
+                                            .name_offset = string_offset };
+        string_offset += strlen(arch[i].name) + 1;
+        ret = write_all(writer, &record, sizeof(record));
+    }
+    for (size_t i = 0; i < writer->nr_counters && ret == 0; i++)
+        ret = write_all(writer, counters[i].source, strlen(counters[i].source) + 1);
+    for (size_t i = 0; i < nr_nodes && ret == 0; i++)
+        ret = write_all(writer, arch[i].name, strlen(arch[i].name) + 1);
+    if (ret == 0)
+        ret = write_padding(writer);
+    return ret;
+}
+
+static void free_writer(x86_energy_trace_writer_t* writer)
+{
+    for (int i = 0; i < NR_BUFFERS; i++)
+    {
+        free(writer->buffers[i].times);
+        free(writer->buffers[i].ticks);
+    }
+    free(writer->units);
+    free(writer->encoded);
+    free(writer->index);
+    free(writer);
+}
+
+x86_energy_trace_writer_t* x86_energy_trace_writer_create(
+    const char* file, const x86_energy_architecture_node_t* arch, size_t nr_counters,
+    const struct x86_energy_trace_counter* counters, size_t samples_per_chunk)
+{
+    if (samples_per_chunk == 0)
+        samples_per_chunk = DEFAULT_SAMPLES_PER_CHUNK;
+    for (size_t i = 0; i < nr_counters; i++)
+    {
+        if (!(counters[i].unit > 0.0) || counters[i].source == NULL)
+        {
+            X86_ENERGY_SET_ERROR("invalid unit or source for trace counter %zu", i);
+            return NULL;
+        }
+    }
+
+    x86_energy_trace_writer_t* writer = calloc(1, sizeof(x86_energy_trace_writer_t));
+    if (writer == NULL)
+    {
+        X86_ENERGY_SET_ERROR("could not allocate memory for trace writer");
+        return NULL;
+    }
+    writer->nr_counters = nr_counters;
+    writer->samples_per_chunk = samples_per_chunk;
+    writer->units = malloc((nr_counters ? nr_counters : 1) * sizeof(double));
+    writer->encoded = malloc((nr_counters + 1) * samples_per_chunk * TRACE_MAX_VARINT);
+    bool failed = writer->units == NULL || writer->encoded == NULL;
+    for (int i = 0; i < NR_BUFFERS && !failed; i++)
+    {
+        writer->buffers[i].times = malloc(samples_per_chunk * sizeof(uint64_t));
+        writer->buffers[i].ticks = malloc((nr_counters ? nr_counters : 1) * samples_per_chunk *
+                                          sizeof(int64_t));
+        failed = writer->buffers[i].times == NULL || writer->buffers[i].ticks == NULL;
+        writer->free_buffers[writer->nr_free++] = &writer->buffers[i];
+    }
+    if (failed)
+    {
+        free_writer(writer);
+        X86_ENERGY_SET_ERROR("could not allocate memory for trace buffers");
+        return NULL;
+    }
+    for (size_t i = 0; i < nr_counters; i++)
+        writer->units[i] = counters[i].unit;
+
+    writer->fd = open(file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (writer->fd < 0)
+    {
+        X86_ENERGY_SET_ERROR("could not open trace file %s: %s", file, strerror(errno));
+        free_writer(writer);
+        return NULL;
+    }
+    int ret = write_header(writer, arch, counters);
+    if (ret != 0)
+    {
+        X86_ENERGY_SET_ERROR("could not write trace file %s: %s", file, strerror(ret));
+        close(writer->fd);
+        free_writer(writer);
+        return NULL;
+    }
+
+    pthread_mutex_init(&writer->mutex, NULL);
+    pthread_cond_init(&writer->cond, NULL);
+    ret = x86_energy_thread_create(&writer->thread, "x86e-trace", write_chunks, writer);
+    if (ret != 0)
+    {
+        X86_ENERGY_SET_ERROR("failed to create trace writer thread (%d)", ret);
+        pthread_cond_destroy(&writer->cond);
+        pthread_mutex_destroy(&writer->mutex);
+        close(writer->fd);
+        free_writer(writer);
+        return NULL;
+    }
+    return writer;
+}
+
+static void submit(x86_energy_trace_writer_t* writer, struct chunk_buffer* buffer)
+{
+    pthread_mutex_lock(&writer->mutex);
+    writer->full_buffers[(writer->first_full + writer->nr_full) % NR_BUFFERS] = buffer;
+    writer->nr_full++;
+    pthread_cond_signal(&writer->cond);
+    pthread_mutex_unlock(&writer->mutex);
+}
+
+int x86_energy_trace_writer_append(x86_energy_trace_writer_t* writer, uint64_t time_ns,
+                                   const double* values)
+{
+    struct chunk_buffer* buffer = writer->current;
+    if (buffer == NULL)
+    {
+        /* the lock is only held for list operations, never during I/O */
+        pthread_mutex_lock(&writer->mutex);
+        if (writer->nr_free > 0)
+            buffer = writer->free_buffers[--writer->nr_free];
+        pthread_mutex_unlock(&writer->mutex);
+        if (buffer == NULL)
+        {
+            __atomic_add_fetch(&writer->dropped, 1, __ATOMIC_RELAXED);
+            return 1;
+        }
+        writer->current = buffer;
+    }
+
+    size_t sample = buffer->nr_samples;
+    buffer->times[sample] = time_ns;
+    for (size_t i = 0; i < writer->nr_counters; i++)
+        buffer->ticks[i * writer->samples_per_chunk + sample] =
+            values[i] < 0.0 ? TRACE_INVALID_TICKS : llround(values[i] / writer->units[i]);
+
+    if (++buffer->nr_samples == writer->samples_per_chunk)
+    {
+        submit(writer, buffer);
+        writer->current = NULL;
+    }
+    return 0;
+}
+
+void x86_energy_trace_writer_sample_callback(uint64_t time_ns, size_t nr, const double* values,
+                                             void* arg)
+{
+    x86_energy_trace_writer_t* writer = arg;
+    /* the counters of the session do not match the writer, e.g. after one was added */
+    if (nr != writer->nr_counters)
+    {
+        __atomic_add_fetch(&writer->dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    x86_energy_trace_writer_append(writer, time_ns, values);
+}
+
+size_t x86_energy_trace_writer_dropped(x86_energy_trace_writer_t* writer)
+{
+    return __atomic_load_n(&writer->dropped, __ATOMIC_RELAXED);
+}
+
+int x86_energy_trace_writer_close(x86_energy_trace_writer_t* writer)
+{
+    if (writer->current != NULL && writer->current->nr_samples > 0)
+        submit(writer, writer->current);
+    writer->current = NULL;
+
+    pthread_mutex_lock(&writer->mutex);
+    writer->stop = true;
+    pthread_cond_signal(&writer->cond);
+    pthread_mutex_unlock(&writer->mutex);
+    pthread_join(writer->thread, NULL);
+
+    int ret = writer->error;
+    struct trace_trailer trailer = { .nr_chunks = writer->nr_chunks,
+                                     .index_offset = writer->offset,
+                                     .magic = TRACE_TRAILER_MAGIC };
+    if (ret == 0)
+        ret = write_all(writer, writer->index, writer->nr_chunks * sizeof(struct trace_index_entry));
+    if (ret == 0)
+        ret = write_all(writer, &trailer, sizeof(trailer));
+    if (close(writer->fd) != 0 && ret == 0)
+        ret = errno;
+    if (ret != 0)
+        X86_ENERGY_SET_ERROR("could not write trace: %s", strerror(ret));
+
+    pthread_cond_destroy(&writer->cond);
+    pthread_mutex_destroy(&writer->mutex);
+    free_writer(writer);
+    return ret;
+}
@@ -0,0 +1,73 @@
+/*
+ * fake_source.h
+ *
+ * An access source whose counters return energies set by the test, added to the mechanism of a
+ * session so that sessions can be tested without energy counters
+ *
+ *  Created on: 19.10.2026
+ */
+
+#ifndef TEST_FAKE_SOURCE_H_
+#define TEST_FAKE_SOURCE_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <x86_energy.h>
+
+#define FAKE_MAX_COUNTERS 4
+
+/* energy of each counter in uJ, accessed atomically since the sampling thread reads them */
+static int64_t fake_energy_uj[FAKE_MAX_COUNTERS];
+
+static int fake_init(void)
+{
+    return 0;
+}
+
+static x86_energy_single_counter_t fake_setup(enum x86_energy_counter counter_type, size_t index)
+{
+    (void)counter_type;
+    return index < FAKE_MAX_COUNTERS ? (x86_energy_single_counter_t)&fake_energy_uj[index] : NULL;
+}
+
+static double fake_read(x86_energy_single_counter_t counter)
+{
+    return 1E-6 * __atomic_load_n((int64_t*)counter, __ATOMIC_RELAXED);
+}
+
+static void fake_close(x86_energy_single_counter_t counter)
+{
+    (void)counter;
+}
+
+static void fake_fini(void)
+{
+}
+
+static inline void fake_set_energy(size_t index, double joules)
+{
+    __atomic_store_n(&fake_energy_uj[index], (int64_t)(joules * 1E6), __ATOMIC_RELAXED);
+}
+
+/* appends the source "fake" to the mechanism of the session and initializes it */
+static inline x86_energy_access_source_t* fake_source_add(x86_energy_session_t* session)
+{
+    x86_energy_mechanisms_t* mechanism = x86_energy_session_get_mechanism(session);
+    x86_energy_access_source_t* sources =
+        realloc(mechanism->avail_sources,
+                (mechanism->nr_avail_sources + 1) * sizeof(x86_energy_access_source_t));
+    if (sources == NULL)
+        return NULL;
+    sources[mechanism->nr_avail_sources] = (x86_energy_access_source_t){ .name = "fake",
+                                                                         .init = fake_init,
+                                                                         .setup = fake_setup,
+                                                                         .read = fake_read,
+                                                                         .close = fake_close,
+                                                                         .fini = fake_fini };
+    mechanism->avail_sources = sources;
+    mechanism->nr_avail_sources++;
+    return x86_energy_session_init_source(session, "fake");
+}
+
+#endif /* TEST_FAKE_SOURCE_H_ */
@@ -0,0 +1,230 @@
+/*
+ * msr_fam15_test.c
+ *
+ * Checks the energy of msr-Fam15 against the power formula of the fam15h_power hwmon driver, using
+ * an emulated register file in X86_ENERGY_MSR_DIR
+ *
+ *  Created on: 19.10.2026
+ */
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../src/include/access.h"
+#include "../src/include/overflow_thread.h"
+
+#define MSR_F15H_CU_PWR_ACCUMULATOR 0xc001007a
+#define MSR_F15H_CU_MAX_PWR_ACCUMULATOR 0xc001007b
+#define MSR_F15H_PTSC 0xc0010280
+
+#define CPUID_POWER_MANAGEMENT 0x80000007
+#define CPUID_ACC_POWER_BIT (1U << 12)
+
+#define SAMPLE_RATIO 16
+/*
+ * the emulated file is addressed by byte, so the accumulator overlaps the lower bytes of its
+ * maximum. Only the highest byte of the maximum is kept, which keeps it above all accumulators.
+ */
+#define MAX_ACCUMULATOR (1ULL << 56)
+
+#define BUFFER_SIZE 4096
+
+static char dir[] = "/tmp/x86_energy_fam15_XXXXXX";
+
+/* cpus with a register file, i.e. all cpus of the architecture */
+static long* cpus;
+static size_t nr_cpus;
+
+/* compute units of socket 0, the kernel reports each as one core */
+static size_t nr_cus;
+
+static int failed;
+
+#define CHECK(condition)                                                                           \
+    do                                                                                             \
+    {                                                                                              \
+        if (!(condition))                                                                          \
+        {                                                                                          \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition);          \
+            failed++;                                                                              \
+        }                                                                                          \
+    } while (0)
+
+static void collect(x86_energy_architecture_node_t* node, bool in_socket_0)
+{
+    if (node->granularity == X86_ENERGY_GRANULARITY_SOCKET)
+        in_socket_0 = node->id == 0;
+    if (node->granularity == X86_ENERGY_GRANULARITY_CORE && in_socket_0)
+        nr_cus++;
+    if (node->granularity == X86_ENERGY_GRANULARITY_THREAD)
+    {
+        long* new_cpus = realloc(cpus, (nr_cpus + 1) * sizeof(long));
+        if (new_cpus == NULL)
+            return;
+        cpus = new_cpus;
+        cpus[nr_cpus++] = node->id;
+    }
+    for (size_t i = 0; i < node->nr_children; i++)
+        collect(&node->children[i], in_socket_0);
+}
+
+static int write_file(long cpu, const char* name, off_t offset, const void* data, size_t size)
+{
+    char buffer[BUFFER_SIZE];
+    snprintf(buffer, BUFFER_SIZE, "%s/%ld/%s", dir, cpu, name);
+    int fd = open(buffer, O_WRONLY | O_CREAT, 0600);
+    if (fd < 0)
+        return 1;
+    ssize_t written = pwrite(fd, data, size, offset);
+    close(fd);
+    return written != (ssize_t)size;
+}
+
+/* writes a register of every cpu */
+static int write_msr(uint64_t reg, uint64_t value)
+{
+    for (size_t i = 0; i < nr_cpus; i++)
+        if (write_file(cpus[i], "msr", reg, &value, sizeof(value)) != 0)
+            return 1;
+    return 0;
+}
+
+static uint64_t read_msr(uint64_t reg)
+{
+    char buffer[BUFFER_SIZE];
+    snprintf(buffer, BUFFER_SIZE, "%s/%ld/msr", dir, cpus[0]);
+    uint64_t value = 0;
+    int fd = open(buffer, O_RDONLY);
+    if (fd >= 0)
+    {
+        if (pread(fd, &value, sizeof(value), reg) != sizeof(value))
+            value = 0;
+        close(fd);
+    }
+    return value;
+}
+
+static int setup_dir(void)
+{
+    if (mkdtemp(dir) == NULL)
+        return 1;
+    uint32_t regs[4] = { 0, 0, SAMPLE_RATIO, CPUID_ACC_POWER_BIT };
+    for (size_t i = 0; i < nr_cpus; i++)
+    {
+        char buffer[BUFFER_SIZE];
+        snprintf(buffer, BUFFER_SIZE, "%s/%ld", dir, cpus[i]);
+        if (mkdir(buffer, 0700) != 0 ||
+            write_file(cpus[i], "cpuid", CPUID_POWER_MANAGEMENT, regs, sizeof(regs)) != 0)
+            return 1;
+    }
+    return write_msr(MSR_F15H_CU_MAX_PWR_ACCUMULATOR, MAX_ACCUMULATOR) ||
+           write_msr(MSR_F15H_CU_PWR_ACCUMULATOR, 1000) || write_msr(MSR_F15H_PTSC, 1000000);
+}
+
+static void remove_dir(void)
+{
+    char buffer[BUFFER_SIZE];
+    for (size_t i = 0; i < nr_cpus; i++)
+    {
+        snprintf(buffer, BUFFER_SIZE, "%s/%ld/msr", dir, cpus[i]);
+        unlink(buffer);
+        snprintf(buffer, BUFFER_SIZE, "%s/%ld/cpuid", dir, cpus[i]);
+        unlink(buffer);
+        snprintf(buffer, BUFFER_SIZE, "%s/%ld", dir, cpus[i]);
+        rmdir(buffer);
+    }
+    rmdir(dir);
+}
+
+/* power of the socket in W, as computed by the hwmon driver for each compute unit */
+static double hwmon_power(uint64_t accumulator_delta, uint64_t ptsc_delta)
+{
+    double power_uW = (double)accumulator_delta * SAMPLE_RATIO * 1000 / (double)ptsc_delta;
+    return 1E-6 * power_uW * nr_cus;
+}
+
+/*
+ * advances the registers, waits and reads. The source integrates the power since the last read
+ * with its own clock, so the energy is checked against the interval as seen from outside the read
+ */
+static double check_interval(x86_energy_single_counter_t counter, uint64_t accumulator,
+                             uint64_t ptsc, double power, double energy, uint64_t* last_before,
+                             uint64_t* last_after)
+{
+    write_msr(MSR_F15H_CU_PWR_ACCUMULATOR, accumulator);
+    write_msr(MSR_F15H_PTSC, ptsc);
+    nanosleep(&(struct timespec){ .tv_nsec = 50000000 }, NULL);
+    uint64_t before = x86_energy_overflow_now();
+    double value = msr_fam15_source.read(counter);
+    uint64_t after = x86_energy_overflow_now();
+    double min = power * 1E-9 * (before - *last_after);
+    double max = power * 1E-9 * (after - *last_before);
+    CHECK(value - energy >= min * (1 - 1E-9) && value - energy <= max * (1 + 1E-9));
+    *last_before = before;
+    *last_after = after;
+    return value;
+}
+
+int main(void)
+{
+    x86_energy_architecture_node_t* arch = x86_energy_init_architecture_nodes();
+    if (arch == NULL)
+    {
+        fprintf(stderr, "could not read the architecture: %s\n", x86_energy_error_string());
+        return 1;
+    }
+    collect(arch, false);
+    x86_energy_free_architecture_nodes(arch);
+    if (nr_cus == 0 || setup_dir() != 0)
+    {
+        fprintf(stderr, "could not create the register files in %s\n", dir);
+        remove_dir();
+        return 1;
+    }
+    setenv("X86_ENERGY_MSR_DIR", dir, 1);
+    /* the overflow thread would read between the updates of the registers */
+    x86_energy_set_internal_update_thread_rate(0);
+
+    if (msr_fam15_source.init() != 0)
+    {
+        fprintf(stderr, "could not initialize msr-Fam15: %s\n", x86_energy_error_string());
+        remove_dir();
+        return 1;
+    }
+    uint64_t before = x86_energy_overflow_now();
+    x86_energy_single_counter_t counter = msr_fam15_source.setup(X86_ENERGY_COUNTER_PCKG, 0);
+    uint64_t after = x86_energy_overflow_now();
+    if (counter == NULL)
+    {
+        fprintf(stderr, "could not set up msr-Fam15: %s\n", x86_energy_error_string());
+        msr_fam15_source.fini();
+        remove_dir();
+        return 1;
+    }
+    uint64_t max_accumulator = read_msr(MSR_F15H_CU_MAX_PWR_ACCUMULATOR);
+
+    /* 10 W per compute unit */
+    double energy = check_interval(counter, 626000, 1001000, hwmon_power(625000, 1000), 0.0,
+                                   &before, &after);
+    /* the accumulator wraps at its maximum, 10 W again */
+    uint64_t delta = max_accumulator - 626000 + 1000;
+    uint64_t ptsc = 1001000 + delta / 625;
+    energy = check_interval(counter, 1000, ptsc, hwmon_power(delta, delta / 625), energy, &before,
+                            &after);
+    /* without a new timestamp, no power is added */
+    check_interval(counter, 2000, ptsc, 0.0, energy, &before, &after);
+
+    msr_fam15_source.close(counter);
+    msr_fam15_source.fini();
+    remove_dir();
+    free(cpus);
+    if (failed)
+        fprintf(stderr, "%d checks failed\n", failed);
+    return failed != 0;
+}
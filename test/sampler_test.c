@@ -0,0 +1,115 @@
+/*
+ * sampler_test.c
+ *
+ * Checks that sampling can be stopped from the sample and trigger callbacks
+ *
+ *  Created on: 19.10.2026
+ */
+
+#include <stdio.h>
+#include <time.h>
+
+#include <x86_energy.h>
+
+#include "fake_source.h"
+
+static int failed;
+
+#define CHECK(condition)                                                                           \
+    do                                                                                             \
+    {                                                                                              \
+        if (!(condition))                                                                          \
+        {                                                                                          \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition);          \
+            failed++;                                                                              \
+        }                                                                                          \
+    } while (0)
+
+struct state
+{
+    x86_energy_session_t* session;
+    int nr_samples; /* accessed atomically */
+    int stop_result;
+    int nr_events; /* accessed atomically */
+};
+
+static void stop_from_callback(uint64_t time_ns, size_t nr, const double* values, void* arg)
+{
+    (void)time_ns;
+    (void)nr;
+    (void)values;
+    struct state* state = arg;
+    if (__atomic_add_fetch(&state->nr_samples, 1, __ATOMIC_RELAXED) == 1)
+        state->stop_result = x86_energy_session_stop_sampling(state->session);
+}
+
+static void count_samples(uint64_t time_ns, size_t nr, const double* values, void* arg)
+{
+    (void)time_ns;
+    (void)nr;
+    (void)values;
+    struct state* state = arg;
+    __atomic_add_fetch(&state->nr_samples, 1, __ATOMIC_RELAXED);
+}
+
+static void stop_from_trigger(const x86_energy_trigger_event_t* event, void* arg)
+{
+    (void)event;
+    struct state* state = arg;
+    if (__atomic_add_fetch(&state->nr_events, 1, __ATOMIC_RELAXED) == 1)
+        state->stop_result = x86_energy_session_stop_sampling(state->session);
+}
+
+static void sleep_ms(long ms)
+{
+    nanosleep(&(struct timespec){ .tv_sec = ms / 1000, .tv_nsec = ms % 1000 * 1000000 }, NULL);
+}
+
+int main(void)
+{
+    struct state state = { .session = x86_energy_session_create() };
+    if (state.session == NULL)
+    {
+        fprintf(stderr, "could not create a session: %s\n", x86_energy_error_string());
+        return 1;
+    }
+
+    /* sampling every ms, without counters the callback is still called */
+    CHECK(x86_energy_session_start_sampling(state.session, 1000, stop_from_callback, &state) == 0);
+    sleep_ms(50);
+    CHECK(__atomic_load_n(&state.nr_samples, __ATOMIC_RELAXED) == 1);
+    CHECK(state.stop_result == 0);
+    CHECK(x86_energy_session_stop_sampling(state.session) != 0);
+
+    /* the session can sample again */
+    __atomic_store_n(&state.nr_samples, 0, __ATOMIC_RELAXED);
+    CHECK(x86_energy_session_start_sampling(state.session, 1000, stop_from_callback, &state) == 0);
+    sleep_ms(50);
+    CHECK(__atomic_load_n(&state.nr_samples, __ATOMIC_RELAXED) == 1);
+
+    /* a budget of 0 J fires on the first sample, whose sample callback is then skipped */
+    x86_energy_access_source_t* source = fake_source_add(state.session);
+    CHECK(source != NULL);
+    if (source != NULL &&
+        x86_energy_session_add_counter(state.session, source, X86_ENERGY_COUNTER_PCKG, 0) == 0)
+    {
+        __atomic_store_n(&state.nr_samples, 0, __ATOMIC_RELAXED);
+        state.stop_result = 1;
+        CHECK(x86_energy_session_add_trigger(state.session, X86_ENERGY_TRIGGER_ENERGY_BUDGET, 0,
+                                             0.0, 0, stop_from_trigger, &state) >= 0);
+        CHECK(x86_energy_session_start_sampling(state.session, 1000, count_samples, &state) ==
+              0);
+        sleep_ms(50);
+        CHECK(__atomic_load_n(&state.nr_events, __ATOMIC_RELAXED) == 1);
+        CHECK(state.stop_result == 0);
+        CHECK(__atomic_load_n(&state.nr_samples, __ATOMIC_RELAXED) == 0);
+        CHECK(x86_energy_session_stop_sampling(state.session) != 0);
+    }
+    else
+        CHECK(!"could not add a counter of the fake source");
+
+    x86_energy_session_destroy(state.session);
+    if (failed)
+        fprintf(stderr, "%d checks failed\n", failed);
+    return failed != 0;
+}
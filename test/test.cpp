@@ -2,7 +2,7 @@
 
 #include <chrono>
 #include <iostream>
-#include <thread>
+#include <vector>
 
 int main()
 {
@@ -48,25 +48,20 @@ int main()
 
                 try
                 {
-                    auto source_counter = source.get(counter, package);
+                    std::vector<x86_energy::SourceCounter> counters;
+                    counters.push_back(source.get(counter, package));
 
-                    double value = source_counter.read();
-                    std::cout << "Read value: " << value << std::endl;
-
-                    std::this_thread::sleep_for(std::chrono::seconds(1));
-
-                    double value2 = source_counter.read();
-                    std::cout << "Read value: " << value2 - value << std::endl;
+                    x86_energy::AsyncSampler sampler(std::move(counters), std::chrono::seconds(1));
 
-                    std::this_thread::sleep_for(std::chrono::seconds(1));
-
-                    value = source_counter.read();
-                    std::cout << "Read value: " << value - value2 << std::endl;
-
-                    std::this_thread::sleep_for(std::chrono::seconds(1));
+                    double value = sampler.next().get().values[0];
+                    std::cout << "Read value: " << value << std::endl;
 
-                    value2 = source_counter.read();
-                    std::cout << "Read value: " << value2 - value << std::endl;
+                    for (int i = 0; i < 3; i++)
+                    {
+                        double value2 = sampler.next().get().values[0];
+                        std::cout << "Read value: " << value2 - value << std::endl;
+                        value = value2;
+                    }
                 }
                 catch (std::exception& e)
                 {
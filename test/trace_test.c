@@ -0,0 +1,269 @@
+/*
+ * trace_test.c
+ *
+ * Writes a trace with several counters and chunks, reads it back and checks that truncated and
+ * corrupt files are rejected
+ *
+ *  Created on: 19.10.2026
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <x86_energy_trace.h>
+
+#include "../src/include/trace_format.h"
+
+#define NR_COUNTERS 3
+#define NR_SAMPLES 30
+#define SAMPLES_PER_CHUNK 8
+#define NR_CHUNKS ((NR_SAMPLES + SAMPLES_PER_CHUNK - 1) / SAMPLES_PER_CHUNK)
+
+static const struct x86_energy_trace_counter counters[NR_COUNTERS] = {
+    { X86_ENERGY_COUNTER_PCKG, 0, 1.0 / 16384.0, 32, "msr-rapl" },
+    { X86_ENERGY_COUNTER_DRAM, 1, 1e-6, 32, "sysfs-rapl" },
+    { X86_ENERGY_COUNTER_CORES, 0, 1e-3, 64, "perf-rapl" },
+};
+
+static uint64_t times[NR_SAMPLES];
+static double values[NR_SAMPLES][NR_COUNTERS];
+
+static int failed;
+
+#define CHECK(condition)                                                                           \
+    do                                                                                             \
+    {                                                                                              \
+        if (!(condition))                                                                          \
+        {                                                                                          \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition);          \
+            failed++;                                                                              \
+        }                                                                                          \
+    } while (0)
+
+/* energy rises with varying steps, some samples are invalid and the last counter is reset */
+static void fill_samples(void)
+{
+    for (size_t i = 0; i < NR_SAMPLES; i++)
+    {
+        times[i] = 1000000000ULL + i * 10000000ULL + (i % 3) * 1234;
+        values[i][0] = i * 0.25 + (i % 4) / 16384.0;
+        values[i][1] = i % 7 == 3 ? -1.0 : i * 1.5e-3;
+        values[i][2] = i < 20 ? 100.0 + i * 2.0 : (i - 20) * 2.0;
+    }
+}
+
+static int write_trace(const char* file, const x86_energy_architecture_node_t* arch)
+{
+    x86_energy_trace_writer_t* writer =
+        x86_energy_trace_writer_create(file, arch, NR_COUNTERS, counters, SAMPLES_PER_CHUNK);
+    if (writer == NULL)
+        return 1;
+    /* all chunks fit into the buffers of the writer, so none are dropped */
+    for (size_t i = 0; i < NR_SAMPLES; i++)
+        CHECK(x86_energy_trace_writer_append(writer, times[i], values[i]) == 0);
+    CHECK(x86_energy_trace_writer_dropped(writer) == 0);
+    /* a sample of a session with other counters is not written */
+    x86_energy_trace_writer_sample_callback(times[NR_SAMPLES - 1] + 1, NR_COUNTERS - 1,
+                                            values[0], writer);
+    CHECK(x86_energy_trace_writer_dropped(writer) == 1);
+    return x86_energy_trace_writer_close(writer);
+}
+
+static int same_tree(const x86_energy_architecture_node_t* a,
+                     const x86_energy_architecture_node_t* b)
+{
+    if (a->granularity != b->granularity || a->id != b->id || strcmp(a->name, b->name) != 0 ||
+        a->nr_children != b->nr_children)
+        return 0;
+    for (size_t i = 0; i < a->nr_children; i++)
+        if (!same_tree(&a->children[i], &b->children[i]))
+            return 0;
+    return 1;
+}
+
+static void check_trace(const char* file, const x86_energy_architecture_node_t* arch)
+{
+    x86_energy_trace_reader_t* reader = x86_energy_trace_open(file);
+    CHECK(reader != NULL);
+    if (reader == NULL)
+        return;
+
+    CHECK(x86_energy_trace_nr_counters(reader) == NR_COUNTERS);
+    for (size_t c = 0; c < NR_COUNTERS; c++)
+    {
+        const struct x86_energy_trace_counter* counter = x86_energy_trace_get_counter(reader, c);
+        CHECK(counter->counter == counters[c].counter && counter->index == counters[c].index &&
+              counter->unit == counters[c].unit && counter->width == counters[c].width &&
+              strcmp(counter->source, counters[c].source) == 0);
+    }
+    CHECK(x86_energy_trace_get_counter(reader, NR_COUNTERS) == NULL);
+    x86_energy_architecture_node_t* read_arch = x86_energy_trace_get_architecture(reader);
+    CHECK(arch == NULL ? read_arch == NULL : read_arch != NULL && same_tree(arch, read_arch));
+
+    CHECK(x86_energy_trace_nr_chunks(reader) == NR_CHUNKS);
+    size_t sample = 0;
+    for (size_t chunk = 0; chunk < x86_energy_trace_nr_chunks(reader); chunk++)
+    {
+        struct x86_energy_trace_chunk_info info;
+        CHECK(x86_energy_trace_get_chunk_info(reader, chunk, &info) == 0);
+        size_t expected = NR_SAMPLES - sample < SAMPLES_PER_CHUNK ? NR_SAMPLES - sample :
+                                                                     SAMPLES_PER_CHUNK;
+        CHECK(info.nr_samples == expected);
+        CHECK(info.first_time_ns == times[sample] &&
+              info.last_time_ns == times[sample + expected - 1]);
+        CHECK(x86_energy_trace_find_chunk(reader, info.first_time_ns) == chunk);
+
+        uint64_t chunk_times[SAMPLES_PER_CHUNK];
+        double chunk_values[SAMPLES_PER_CHUNK];
+        int64_t ticks[SAMPLES_PER_CHUNK];
+        CHECK(x86_energy_trace_read_times(reader, chunk, chunk_times) == 0);
+        for (size_t i = 0; i < expected; i++)
+            CHECK(chunk_times[i] == times[sample + i]);
+        for (size_t c = 0; c < NR_COUNTERS; c++)
+        {
+            CHECK(x86_energy_trace_read_values(reader, chunk, c, chunk_values) == 0);
+            CHECK(x86_energy_trace_read_ticks(reader, chunk, c, ticks) == 0);
+            for (size_t i = 0; i < expected; i++)
+            {
+                double value = values[sample + i][c];
+                if (value < 0.0)
+                {
+                    CHECK(chunk_values[i] < 0.0 && ticks[i] == INT64_MIN);
+                    continue;
+                }
+                /* values are rounded to the unit */
+                double error = chunk_values[i] - value;
+                CHECK(error <= counters[c].unit / 2 && error >= -counters[c].unit / 2);
+                CHECK(chunk_values[i] == ticks[i] * counters[c].unit);
+            }
+        }
+        sample += expected;
+    }
+    CHECK(x86_energy_trace_find_chunk(reader, times[NR_SAMPLES - 1] + 1) == NR_CHUNKS);
+    CHECK(x86_energy_trace_read_times(reader, NR_CHUNKS, NULL) != 0);
+    x86_energy_trace_close(reader);
+}
+
+static char* read_file(const char* file, size_t* size)
+{
+    FILE* f = fopen(file, "rb");
+    if (f == NULL)
+        return NULL;
+    struct stat st;
+    char* data = NULL;
+    if (fstat(fileno(f), &st) == 0 && (data = malloc(st.st_size)) != NULL)
+    {
+        *size = fread(data, 1, st.st_size, f);
+        if (*size != (size_t)st.st_size)
+        {
+            free(data);
+            data = NULL;
+        }
+    }
+    fclose(f);
+    return data;
+}
+
+static int write_file(const char* file, const char* data, size_t size)
+{
+    FILE* f = fopen(file, "wb");
+    if (f == NULL)
+        return 1;
+    int ret = fwrite(data, 1, size, f) != size;
+    return fclose(f) != 0 || ret;
+}
+
+/* a trace that was not closed, e.g. after a crash, has no index and must be rejected */
+static void check_truncated(const char* file, const char* copy)
+{
+    size_t size;
+    char* data = read_file(file, &size);
+    CHECK(data != NULL);
+    if (data == NULL)
+        return;
+    for (size_t length = 0; length < size; length++)
+    {
+        if (write_file(copy, data, length) != 0)
+        {
+            CHECK(!"could not write the truncated trace");
+            break;
+        }
+        x86_energy_trace_reader_t* reader = x86_energy_trace_open(copy);
+        CHECK(reader == NULL);
+        x86_energy_trace_close(reader);
+    }
+    free(data);
+}
+
+/* a chunk whose columns end behind the file is detected when it is decoded */
+static void check_corrupt_chunk(const char* file, const char* copy)
+{
+    size_t size;
+    char* data = read_file(file, &size);
+    CHECK(data != NULL);
+    if (data == NULL)
+        return;
+    const struct trace_header* header = (const struct trace_header*)data;
+    size_t column_end = header->header_size + sizeof(struct trace_chunk_header) +
+                        NR_COUNTERS * sizeof(int64_t) + NR_COUNTERS * sizeof(uint32_t);
+    uint32_t end = size;
+    memcpy(data + column_end, &end, sizeof(end));
+    CHECK(write_file(copy, data, size) == 0);
+    free(data);
+
+    x86_energy_trace_reader_t* reader = x86_energy_trace_open(copy);
+    CHECK(reader != NULL);
+    if (reader == NULL)
+        return;
+    double chunk_values[SAMPLES_PER_CHUNK];
+    uint64_t chunk_times[SAMPLES_PER_CHUNK];
+    CHECK(x86_energy_trace_read_values(reader, 0, 0, chunk_values) != 0);
+    CHECK(x86_energy_trace_read_times(reader, 0, chunk_times) != 0);
+    CHECK(x86_energy_trace_read_times(reader, 1, chunk_times) == 0);
+    x86_energy_trace_close(reader);
+}
+
+int main(void)
+{
+    char file[] = "/tmp/x86_energy_trace_XXXXXX";
+    int fd = mkstemp(file);
+    if (fd < 0)
+    {
+        fprintf(stderr, "could not create a temporary file\n");
+        return 1;
+    }
+    close(fd);
+    char copy[sizeof(file) + 5];
+    snprintf(copy, sizeof(copy), "%s.copy", file);
+
+    fill_samples();
+    x86_energy_architecture_node_t* arch = x86_energy_init_architecture_nodes();
+    if (write_trace(file, arch) != 0)
+    {
+        fprintf(stderr, "could not write the trace: %s\n", x86_energy_error_string());
+        failed++;
+    }
+    else
+    {
+        check_trace(file, arch);
+        check_truncated(file, copy);
+        check_corrupt_chunk(file, copy);
+    }
+    /* without an architecture */
+    if (write_trace(file, NULL) != 0)
+        failed++;
+    else
+        check_trace(file, NULL);
+
+    if (arch != NULL)
+        x86_energy_free_architecture_nodes(arch);
+    unlink(file);
+    unlink(copy);
+    if (failed)
+        fprintf(stderr, "%d checks failed\n", failed);
+    return failed != 0;
+}
@@ -0,0 +1,188 @@
+/*
+ * trigger_test.c
+ *
+ * Checks power, energy and slope triggers, the event queue of triggers without callback and its
+ * eventfd. Samples are passed to the triggers directly, so the times are exact.
+ *
+ *  Created on: 19.10.2026
+ */
+
+#include <poll.h>
+#include <stdio.h>
+
+#include <x86_energy.h>
+
+#include "../src/include/session.h"
+#include "fake_source.h"
+
+#define MS 1000000ULL
+
+static int failed;
+
+#define CHECK(condition)                                                                           \
+    do                                                                                             \
+    {                                                                                              \
+        if (!(condition))                                                                          \
+        {                                                                                          \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition);          \
+            failed++;                                                                              \
+        }                                                                                          \
+    } while (0)
+
+#define MAX_EVENTS 8
+
+struct events
+{
+    size_t nr;
+    x86_energy_trigger_event_t events[MAX_EVENTS];
+};
+
+static void record(const x86_energy_trigger_event_t* event, void* arg)
+{
+    struct events* events = arg;
+    if (events->nr < MAX_EVENTS)
+        events->events[events->nr] = *event;
+    events->nr++;
+}
+
+static bool readable(int fd)
+{
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    return poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLIN);
+}
+
+/* passes samples every 10 ms from start to end at a constant power */
+static double feed(x86_energy_session_t* session, uint64_t start, uint64_t end, double power,
+                   double energy)
+{
+    for (uint64_t time = start; time < end; time += 10 * MS)
+    {
+        x86_energy_triggers_evaluate(session->triggers, time, 1, &energy);
+        energy += power * 0.01;
+    }
+    return energy;
+}
+
+/* 10 W, 100 W, 10 W and 100 W for 300 ms each */
+static void test_conditions(x86_energy_session_t* session)
+{
+    struct events above = { 0 }, below = { 0 }, slope = { 0 }, budget = { 0 };
+    int ids[4] = {
+        x86_energy_session_add_trigger(session, X86_ENERGY_TRIGGER_POWER_ABOVE, 0, 50.0, 100000,
+                                       record, &above),
+        x86_energy_session_add_trigger(session, X86_ENERGY_TRIGGER_POWER_BELOW, 0, 50.0, 100000,
+                                       record, &below),
+        x86_energy_session_add_trigger(session, X86_ENERGY_TRIGGER_POWER_SLOPE, 0, 300.0, 100000,
+                                       record, &slope),
+        x86_energy_session_add_trigger(session, X86_ENERGY_TRIGGER_ENERGY_BUDGET, 0, 4.5, 0,
+                                       record, &budget),
+    };
+    for (int i = 0; i < 4; i++)
+        CHECK(ids[i] >= 0);
+
+    double energy = feed(session, 1000 * MS, 1300 * MS, 10.0, 100.0);
+    energy = feed(session, 1300 * MS, 1600 * MS, 100.0, energy);
+    energy = feed(session, 1600 * MS, 1900 * MS, 10.0, energy);
+    feed(session, 1900 * MS, 2200 * MS, 100.0, energy);
+
+    /* edge-triggered: once per phase in which the condition holds */
+    CHECK(above.nr == 2);
+    for (size_t i = 0; i < above.nr && i < MAX_EVENTS; i++)
+        CHECK(above.events[i].id == ids[0] && above.events[i].value > 50.0);
+    CHECK(above.nr == 2 && above.events[0].time_ns > 1300 * MS &&
+          above.events[0].time_ns < 1400 * MS && above.events[1].time_ns > 1900 * MS);
+    CHECK(below.nr == 2);
+    for (size_t i = 0; i < below.nr && i < MAX_EVENTS; i++)
+        CHECK(below.events[i].id == ids[1] && below.events[i].value < 50.0);
+    /* the first window is covered after 100 ms */
+    CHECK(below.nr == 2 && below.events[0].time_ns == 1100 * MS);
+    /* rising, falling, rising */
+    CHECK(slope.nr == 3);
+    CHECK(slope.nr == 3 && slope.events[0].value > 300.0 && slope.events[1].value < -300.0 &&
+          slope.events[2].value > 300.0);
+    /* 3 J in the first phase, 1.5 J more after 20 ms at 100 W (samples are 1 J apart), once */
+    CHECK(budget.nr == 1);
+    CHECK(budget.nr == 1 && budget.events[0].time_ns == 1320 * MS &&
+          budget.events[0].value > 4.9 && budget.events[0].value < 5.1);
+
+    for (int i = 0; i < 4; i++)
+        CHECK(x86_energy_session_remove_trigger(session, ids[i]) == 0);
+    CHECK(x86_energy_session_remove_trigger(session, ids[0]) != 0);
+    feed(session, 2200 * MS, 2500 * MS, 10.0, energy);
+    CHECK(above.nr == 2 && below.nr == 2 && slope.nr == 3 && budget.nr == 1);
+}
+
+/* fires every second sample, more often than the queue is polled */
+static void test_queue(x86_energy_session_t* session)
+{
+    int fd = x86_energy_session_trigger_fd(session);
+    CHECK(fd >= 0);
+    int id = x86_energy_session_add_trigger(session, X86_ENERGY_TRIGGER_POWER_ABOVE, 0, 50.0,
+                                            10000, NULL, NULL);
+    CHECK(id >= 0);
+    CHECK(!readable(fd));
+
+    /* windows of one sample, alternating between 0 W and 100 W */
+    size_t nr_fired = 300;
+    double energy = 0.0;
+    uint64_t time = 3000 * MS;
+    x86_energy_triggers_evaluate(session->triggers, time, 1, &energy);
+    for (size_t i = 0; i < nr_fired; i++)
+    {
+        time += 10 * MS;
+        x86_energy_triggers_evaluate(session->triggers, time, 1, &energy);
+        energy += 1.0;
+        time += 10 * MS;
+        x86_energy_triggers_evaluate(session->triggers, time, 1, &energy);
+    }
+    CHECK(readable(fd));
+
+    /* the queue holds 256 events, the newer ones are dropped */
+    size_t queued = 0;
+    uint64_t last_time = 0;
+    x86_energy_trigger_event_t events[100];
+    size_t nr;
+    while ((nr = x86_energy_session_poll_triggers(session, events, 100)) > 0)
+    {
+        for (size_t i = 0; i < nr; i++)
+        {
+            CHECK(events[i].id == id && events[i].time_ns > last_time);
+            last_time = events[i].time_ns;
+        }
+        queued += nr;
+        /* the events that are left keep the eventfd readable */
+        CHECK(readable(fd) == (queued < 256));
+    }
+    CHECK(queued == 256);
+    CHECK(x86_energy_session_dropped_trigger_events(session) == nr_fired - 256);
+    CHECK(x86_energy_session_remove_trigger(session, id) == 0);
+}
+
+int main(void)
+{
+    x86_energy_session_t* session = x86_energy_session_create();
+    if (session == NULL)
+    {
+        fprintf(stderr, "could not create a session: %s\n", x86_energy_error_string());
+        return 1;
+    }
+    x86_energy_access_source_t* source = fake_source_add(session);
+    if (source == NULL ||
+        x86_energy_session_add_counter(session, source, X86_ENERGY_COUNTER_PCKG, 0) != 0)
+    {
+        fprintf(stderr, "could not add a counter of the fake source: %s\n",
+                x86_energy_error_string());
+        x86_energy_session_destroy(session);
+        return 1;
+    }
+    CHECK(x86_energy_session_add_trigger(session, X86_ENERGY_TRIGGER_POWER_ABOVE, 1, 1.0, 1000,
+                                         record, NULL) < 0);
+
+    test_conditions(session);
+    test_queue(session);
+
+    x86_energy_session_destroy(session);
+    if (failed)
+        fprintf(stderr, "%d checks failed\n", failed);
+    return failed != 0;
+}
@@ -0,0 +1,103 @@
+/*
+ * unwrap_test.c
+ *
+ * Checks the wrap handling and glitch validation of the shared unwrap stage
+ *
+ *  Created on: 19.10.2026
+ */
+
+#include <stdio.h>
+
+#include "../src/include/overflow_thread.h"
+#include "../src/include/unwrap.h"
+
+#define RANGE_32 (1ULL << 32)
+#define UNIT (1.0 / 16384.0) /* 61 uJ, the usual RAPL energy unit */
+#define MS 1000000ULL
+
+static int failed;
+
+#define CHECK(condition)                                                                           \
+    do                                                                                             \
+    {                                                                                              \
+        if (!(condition))                                                                          \
+        {                                                                                          \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition);          \
+            failed++;                                                                              \
+        }                                                                                          \
+    } while (0)
+
+/* without a bound, every reading below the last one is a wrap */
+static void test_wrap(void)
+{
+    struct x86_energy_unwrap unwrap;
+    x86_energy_unwrap_init(&unwrap, X86_ENERGY_COUNTER_CORES, RANGE_32, UNIT, 0xFFFFFF00ULL);
+    uint64_t now = x86_energy_overflow_now();
+    CHECK(x86_energy_unwrap(&unwrap, 0xFFFFFF80ULL, now + MS) == 0xFFFFFF80ULL);
+    CHECK(x86_energy_unwrap(&unwrap, 0x100ULL, now + 2 * MS) == RANGE_32 + 0x100ULL);
+    CHECK(x86_energy_unwrap(&unwrap, 0x200ULL, now + 3 * MS) == RANGE_32 + 0x200ULL);
+    CHECK(unwrap.stats.wraps == 1);
+    CHECK(unwrap.stats.false_wraps == 0 && unwrap.stats.spikes == 0);
+}
+
+/* counters narrower than 32 bit wrap at their own range */
+static void test_width(void)
+{
+    struct x86_energy_unwrap unwrap;
+    x86_energy_unwrap_init(&unwrap, X86_ENERGY_COUNTER_CORES, 1ULL << 16, UNIT, 0xFFF0ULL);
+    uint64_t now = x86_energy_overflow_now();
+    CHECK(x86_energy_unwrap(&unwrap, 0x10ULL, now + MS) == 0xFFF0ULL + 0x20ULL);
+    CHECK(unwrap.stats.wraps == 1);
+}
+
+/* an older reading that is unwrapped after a newer one must not count as a wrap */
+static void test_out_of_order(void)
+{
+    struct x86_energy_unwrap unwrap;
+    x86_energy_unwrap_init(&unwrap, X86_ENERGY_COUNTER_PCKG, RANGE_32, UNIT, 1000000ULL);
+    uint64_t now = x86_energy_overflow_now();
+    /* 100 W are 16384 ticks per 10 ms */
+    uint64_t total = x86_energy_unwrap(&unwrap, 1016384ULL, now + 10 * MS);
+    CHECK(total == 1016384ULL);
+    CHECK(x86_energy_unwrap(&unwrap, 1008000ULL, now + 10 * MS) == total);
+    CHECK(unwrap.stats.false_wraps == 1 && unwrap.stats.wraps == 0);
+    CHECK(x86_energy_unwrap(&unwrap, 1032768ULL, now + 20 * MS) == 1032768ULL);
+    CHECK(unwrap.stats.resyncs == 0);
+}
+
+/* a single reading above the bound is dropped, a counter that continues from a jump follows it */
+static void test_max_power(void)
+{
+    struct x86_energy_unwrap unwrap;
+    x86_energy_unwrap_init(&unwrap, X86_ENERGY_COUNTER_PCKG, RANGE_32, UNIT, 0ULL);
+    uint64_t now = x86_energy_overflow_now();
+    CHECK(x86_energy_unwrap(&unwrap, 16384ULL, now + 10 * MS) == 16384ULL);
+    /* 1000 W */
+    CHECK(x86_energy_unwrap(&unwrap, 180224ULL, now + 20 * MS) == 16384ULL);
+    CHECK(unwrap.stats.spikes == 1);
+    CHECK(x86_energy_unwrap(&unwrap, 32768ULL, now + 30 * MS) == 32768ULL);
+
+    /* the counter jumps and continues at 100 W from there */
+    CHECK(x86_energy_unwrap(&unwrap, 10032768ULL, now + 40 * MS) == 32768ULL);
+    CHECK(unwrap.stats.spikes == 2);
+    uint64_t total = x86_energy_unwrap(&unwrap, 10049152ULL, now + 50 * MS);
+    CHECK(unwrap.stats.resyncs == 1);
+    /* the jump interval is estimated with the power after it */
+    CHECK(total == 32768ULL + 2 * 16384ULL);
+}
+
+int main(void)
+{
+    test_wrap();
+    test_width();
+    if (x86_energy_set_max_power(X86_ENERGY_COUNTER_PCKG, 110.0) != 0)
+    {
+        fprintf(stderr, "could not set the maximal power\n");
+        return 1;
+    }
+    test_out_of_order();
+    test_max_power();
+    if (failed)
+        fprintf(stderr, "%d checks failed\n", failed);
+    return failed != 0;
+}
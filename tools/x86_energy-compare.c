@@ -0,0 +1,120 @@
+/*
+ * x86_energy-compare.c
+ *
+ * Reads the same domains through every available source and compares them
+ *
+ *  Created on: 19.10.2026
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <strings.h>
+
+#include <x86_energy.h>
+
+#define DEFAULT_DURATION_MS 2000
+
+static void usage(const char* name)
+{
+    fprintf(stderr,
+            "Usage: %s [-c COUNTER] [-i INDEX] [-d MS]\n"
+            "\n"
+            "Reads each domain through every available source interleaved and reports their\n"
+            "offset and drift to the first source, read latency and update period.\n"
+            "  -c COUNTER  compare only COUNTER (e.g. PCKG, DRAM, SINGLE_CORE)\n"
+            "  -i INDEX    index of the socket or core (default 0)\n"
+            "  -d MS       duration per domain in milliseconds (default %d)\n",
+            name, DEFAULT_DURATION_MS);
+}
+
+static int parse_counter(const char* name)
+{
+    for (int i = 0; i < X86_ENERGY_COUNTER_SIZE; i++)
+        if (strcasecmp(name, x86_energy_counter_name(i)) == 0)
+            return i;
+    return -1;
+}
+
+static int compare(enum x86_energy_counter counter, size_t index, long duration_ms)
+{
+    x86_energy_source_comparison_t* results;
+    int nr = x86_energy_compare_sources(counter, index, 1000LL * duration_ms, &results);
+    if (nr < 0)
+    {
+        fprintf(stderr, "Could not compare %s %zu: %s\n", x86_energy_counter_name(counter),
+                index, x86_energy_error_string());
+        return 1;
+    }
+    printf("%s %zu\n", x86_energy_counter_name(counter), index);
+    printf("  %-24s %9s %12s %9s %11s %10s %10s %10s %10s\n", "source", "reads", "energy[J]",
+           "power[W]", "offset[J]", "drift[W]", "read[us]", "max[us]", "update[ms]");
+    int reference = -1;
+    for (int i = 0; i < nr; i++)
+    {
+        x86_energy_source_comparison_t* result = &results[i];
+        if (result->status != 0)
+        {
+            printf("  %-24s %9s\n", result->source, "n/a");
+            continue;
+        }
+        if (reference < 0)
+            reference = i;
+        printf("  %-24s %9zu %12.6f %9.3f %11.6f %10.4f %10.2f %10.2f %10.3f%s\n", result->source,
+               result->nr_reads, result->energy, result->power, result->offset, result->drift,
+               1E6 * result->mean_read_latency, 1E6 * result->max_read_latency,
+               1E3 * result->update_period, reference == i ? "  (reference)" : "");
+    }
+    free(results);
+    return reference < 0;
+}
+
+int main(int argc, char** argv)
+{
+    int counter = -1;
+    size_t index = 0;
+    long duration_ms = DEFAULT_DURATION_MS;
+    int opt;
+    while ((opt = getopt(argc, argv, "c:i:d:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'c':
+            counter = parse_counter(optarg);
+            if (counter < 0)
+            {
+                fprintf(stderr, "Unknown counter %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'i':
+            index = strtoul(optarg, NULL, 10);
+            break;
+        case 'd':
+            duration_ms = strtol(optarg, NULL, 10);
+            if (duration_ms <= 0)
+                duration_ms = DEFAULT_DURATION_MS;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (counter >= 0)
+        return compare(counter, index, duration_ms);
+
+    x86_energy_mechanisms_t* mechanism = x86_energy_get_avail_mechanism();
+    if (mechanism == NULL)
+    {
+        fprintf(stderr, "No mechanism available: %s\n", x86_energy_error_string());
+        return 1;
+    }
+    int failed = 0;
+    for (int i = 0; i < X86_ENERGY_COUNTER_SIZE; i++)
+        if (mechanism->source_granularities[i] < X86_ENERGY_GRANULARITY_SIZE &&
+            x86_energy_counter_is_energy(i))
+            failed += compare(i, index, duration_ms);
+    x86_energy_free_mechanism(mechanism);
+    return failed != 0;
+}
@@ -0,0 +1,526 @@
+/*
+ * x86_energy-exporter.c
+ *
+ * Serves energy and power in the OpenMetrics text format
+ *
+ *  Created on: 19.10.2026
+ */
+
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <x86_energy.h>
+
+#define DEFAULT_PORT 9477
+#define DEFAULT_INTERVAL_MS 1000
+
+/* values are written zero-padded into fields of fixed width, so the response never changes size */
+#define ENERGY_WIDTH 20
+#define POWER_WIDTH 13
+
+/* timeout for sending and receiving on a connection */
+#define CONNECTION_TIMEOUT_MS 1000
+
+#define REQUEST_SIZE 2048
+
+/* signals might be delivered to the sampling thread, so the flag is checked regularly */
+#define POLL_TIMEOUT_MS 500
+
+static const char not_found[] = "HTTP/1.1 404 Not Found\r\n"
+                                "Content-Type: text/plain\r\n"
+                                "Content-Length: 10\r\n"
+                                "Connection: close\r\n"
+                                "\r\n"
+                                "not found\n";
+
+struct exporter
+{
+    size_t nr_counters;
+
+    /* the complete HTTP response, values are patched in place by the sampling thread */
+    char* response;
+    size_t response_size;
+    size_t* energy_offsets;
+    size_t* power_offsets;
+    uint64_t generation;
+    pthread_mutex_t mutex;
+
+    /* owned by the sampling thread */
+    double* start;
+    double* previous;
+    uint64_t previous_time;
+};
+
+static volatile sig_atomic_t stop;
+
+static void usage(const char* name)
+{
+    fprintf(stderr,
+            "Usage: %s [-p PORT | -u PATH] [-i MS] [-s SOURCE]\n"
+            "\n"
+            "Serves the energy and power of all domains in the OpenMetrics text format.\n"
+            "  -p PORT    listen for HTTP on 127.0.0.1:PORT (default %d)\n"
+            "  -u PATH    listen for HTTP on the UNIX domain socket PATH instead\n"
+            "  -i MS      sample every MS milliseconds (default %d)\n"
+            "  -s SOURCE  use SOURCE instead of the first available source\n",
+            name, DEFAULT_PORT, DEFAULT_INTERVAL_MS);
+}
+
+static void on_signal(int signal)
+{
+    (void)signal;
+    stop = 1;
+}
+
+/* string builder for the preformatted response */
+struct buffer
+{
+    char* data;
+    size_t size;
+    size_t capacity;
+    bool failed;
+};
+
+static void append(struct buffer* buffer, const char* format, ...)
+{
+    va_list args;
+    while (!buffer->failed)
+    {
+        va_start(args, format);
+        int len = vsnprintf(buffer->data + buffer->size, buffer->capacity - buffer->size, format,
+                            args);
+        va_end(args);
+        if (len < 0)
+        {
+            buffer->failed = true;
+            return;
+        }
+        if (buffer->size + len < buffer->capacity)
+        {
+            buffer->size += len;
+            return;
+        }
+        size_t capacity = 2 * (buffer->capacity + len);
+        char* data = realloc(buffer->data, capacity);
+        if (data == NULL)
+        {
+            buffer->failed = true;
+            return;
+        }
+        buffer->data = data;
+        buffer->capacity = capacity;
+    }
+}
+
+/* appends a label value, escaped as required by OpenMetrics */
+static void append_label(struct buffer* buffer, const char* value)
+{
+    for (; *value != '\0'; value++)
+    {
+        if (*value == '"' || *value == '\\')
+            append(buffer, "\\%c", *value);
+        else if (*value == '\n')
+            append(buffer, "\\n");
+        else
+            append(buffer, "%c", *value);
+    }
+}
+
+static void append_lower(struct buffer* buffer, const char* value)
+{
+    for (; *value != '\0'; value++)
+        append(buffer, "%c", tolower((unsigned char)*value));
+}
+
+static void append_labels(struct buffer* buffer, enum x86_energy_counter counter,
+                          const x86_energy_architecture_node_t* node)
+{
+    append(buffer, "{domain=\"");
+    append_lower(buffer, x86_energy_counter_name(counter));
+    append(buffer, "\",granularity=\"");
+    append_lower(buffer, x86_energy_granularity_name(node->granularity));
+    append(buffer, "\",id=\"%" PRId32 "\",node=\"", node->id);
+    append_label(buffer, node->name);
+    append(buffer, "\"}");
+}
+
+static void find_nodes(x86_energy_architecture_node_t* node,
+                       enum x86_energy_granularity granularity,
+                       x86_energy_architecture_node_t*** nodes, size_t* nr)
+{
+    if (node->granularity == granularity)
+    {
+        x86_energy_architecture_node_t** new_nodes = realloc(*nodes, (*nr + 1) * sizeof(*nodes));
+        if (new_nodes != NULL)
+        {
+            *nodes = new_nodes;
+            (*nodes)[(*nr)++] = node;
+        }
+        return;
+    }
+    for (size_t i = 0; i < node->nr_children; i++)
+        find_nodes(&node->children[i], granularity, nodes, nr);
+}
+
+/*
+ * adds every supported counter of every node to the session and builds the response around them,
+ * returns 0 on success
+ */
+static int setup(struct exporter* exporter, x86_energy_session_t* session,
+                 x86_energy_access_source_t* source)
+{
+    x86_energy_mechanisms_t* mechanism = x86_energy_session_get_mechanism(session);
+    x86_energy_architecture_node_t* arch = x86_energy_session_get_architecture(session);
+
+    enum x86_energy_counter* counters = NULL;
+    x86_energy_architecture_node_t** nodes = NULL;
+    for (int counter = 0; counter < X86_ENERGY_COUNTER_SIZE; counter++)
+    {
+        enum x86_energy_granularity granularity = mechanism->source_granularities[counter];
+        if (granularity >= X86_ENERGY_GRANULARITY_SIZE || !x86_energy_counter_is_energy(counter))
+            continue;
+        size_t first = exporter->nr_counters;
+        find_nodes(arch, granularity, &nodes, &exporter->nr_counters);
+        for (size_t i = first; i < exporter->nr_counters;)
+        {
+            /* core ids repeat per socket and sources read the first core with an id */
+            bool repeated = false;
+            for (size_t j = first; j < i; j++)
+                repeated |= nodes[j]->id == nodes[i]->id;
+            if (repeated ||
+                x86_energy_session_add_counter(session, source, counter, nodes[i]->id) < 0)
+            {
+                memmove(&nodes[i], &nodes[i + 1],
+                        (--exporter->nr_counters - i) * sizeof(*nodes));
+                continue;
+            }
+            enum x86_energy_counter* new_counters =
+                realloc(counters, (i + 1) * sizeof(*counters));
+            if (new_counters == NULL)
+                break;
+            counters = new_counters;
+            counters[i++] = counter;
+        }
+    }
+
+    struct buffer body = { 0 };
+    exporter->energy_offsets = malloc((exporter->nr_counters + 1) * sizeof(size_t));
+    exporter->power_offsets = malloc((exporter->nr_counters + 1) * sizeof(size_t));
+    if (exporter->nr_counters == 0 || counters == NULL || exporter->energy_offsets == NULL ||
+        exporter->power_offsets == NULL)
+    {
+        free(counters);
+        free(nodes);
+        return 1;
+    }
+
+    append(&body, "# TYPE x86_energy_joules counter\n"
+                  "# UNIT x86_energy_joules joules\n"
+                  "# HELP x86_energy_joules Energy consumed since the exporter started.\n");
+    for (size_t i = 0; i < exporter->nr_counters; i++)
+    {
+        append(&body, "x86_energy_joules_total");
+        append_labels(&body, counters[i], nodes[i]);
+        append(&body, " ");
+        exporter->energy_offsets[i] = body.size;
+        append(&body, "%0*.6f\n", ENERGY_WIDTH, 0.0);
+    }
+    append(&body, "# TYPE x86_energy_watts gauge\n"
+                  "# UNIT x86_energy_watts watts\n"
+                  "# HELP x86_energy_watts Average power during the last sampling interval.\n");
+    for (size_t i = 0; i < exporter->nr_counters; i++)
+    {
+        append(&body, "x86_energy_watts");
+        append_labels(&body, counters[i], nodes[i]);
+        append(&body, " ");
+        exporter->power_offsets[i] = body.size;
+        append(&body, "%0*.6f\n", POWER_WIDTH, 0.0);
+    }
+    append(&body, "# EOF\n");
+    free(counters);
+    free(nodes);
+
+    struct buffer response = { 0 };
+    append(&response,
+           "HTTP/1.1 200 OK\r\n"
+           "Content-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n"
+           "Content-Length: %zu\r\n"
+           "Connection: close\r\n"
+           "\r\n",
+           body.size);
+    size_t header_size = response.size;
+    append(&response, "%.*s", (int)body.size, body.data);
+    free(body.data);
+    if (body.failed || response.failed)
+    {
+        free(response.data);
+        return 1;
+    }
+    for (size_t i = 0; i < exporter->nr_counters; i++)
+    {
+        exporter->energy_offsets[i] += header_size;
+        exporter->power_offsets[i] += header_size;
+    }
+    exporter->response = response.data;
+    exporter->response_size = response.size;
+
+    exporter->start = malloc(exporter->nr_counters * sizeof(double));
+    exporter->previous = malloc(exporter->nr_counters * sizeof(double));
+    return exporter->start == NULL || exporter->previous == NULL;
+}
+
+static void patch(char* field, int width, double value)
+{
+    char text[32];
+    if (value < 0.0)
+        value = 0.0;
+    if (snprintf(text, sizeof(text), "%0*.6f", width, value) == width)
+        memcpy(field, text, width);
+}
+
+/* called by the sampling thread of the session */
+static void on_sample(uint64_t time_ns, size_t nr, const double* values, void* arg)
+{
+    struct exporter* exporter = arg;
+    if (exporter->previous_time == 0)
+    {
+        memcpy(exporter->start, values, nr * sizeof(double));
+        memcpy(exporter->previous, values, nr * sizeof(double));
+        exporter->previous_time = time_ns;
+        return;
+    }
+    double seconds = (time_ns - exporter->previous_time) / 1e9;
+
+    pthread_mutex_lock(&exporter->mutex);
+    for (size_t i = 0; i < nr; i++)
+    {
+        /* keep the last values of counters that failed */
+        if (values[i] < 0.0)
+            continue;
+        if (exporter->start[i] < 0.0)
+            exporter->start[i] = values[i];
+        patch(exporter->response + exporter->energy_offsets[i], ENERGY_WIDTH,
+              values[i] - exporter->start[i]);
+        if (exporter->previous[i] >= 0.0)
+            patch(exporter->response + exporter->power_offsets[i], POWER_WIDTH,
+                  (values[i] - exporter->previous[i]) / seconds);
+    }
+    exporter->generation++;
+    pthread_mutex_unlock(&exporter->mutex);
+
+    memcpy(exporter->previous, values, nr * sizeof(double));
+    exporter->previous_time = time_ns;
+}
+
+static int listen_tcp(int port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in address = { .sin_family = AF_INET,
+                                   .sin_port = htons(port),
+                                   .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    if (bind(fd, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(fd, 16) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int listen_unix(const char* path)
+{
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(address.sun_path))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(address.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    /* replace a stale socket of a previous run, but nothing else */
+    struct stat st;
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(path);
+    if (bind(fd, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(fd, 16) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void send_all(int fd, const char* data, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t written = send(fd, data, size, MSG_NOSIGNAL);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return;
+        data += written;
+        size -= written;
+    }
+}
+
+/* answers a single request, responses are only copied when the sampler updated them */
+static void serve(struct exporter* exporter, int fd, char* response, uint64_t* generation)
+{
+    struct timeval timeout = { .tv_sec = CONNECTION_TIMEOUT_MS / 1000,
+                               .tv_usec = (CONNECTION_TIMEOUT_MS % 1000) * 1000 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    char request[REQUEST_SIZE];
+    size_t size = 0;
+    while (size < sizeof(request) - 1)
+    {
+        ssize_t got = recv(fd, request + size, sizeof(request) - 1 - size, 0);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            return;
+        size += got;
+        request[size] = '\0';
+        if (strstr(request, "\r\n\r\n") != NULL || strstr(request, "\n\n") != NULL)
+            break;
+    }
+    request[size] = '\0';
+
+    if (strncmp(request, "GET /metrics ", 13) != 0 && strncmp(request, "GET / ", 6) != 0)
+    {
+        send_all(fd, not_found, sizeof(not_found) - 1);
+        return;
+    }
+    pthread_mutex_lock(&exporter->mutex);
+    if (*generation != exporter->generation)
+    {
+        memcpy(response, exporter->response, exporter->response_size);
+        *generation = exporter->generation;
+    }
+    pthread_mutex_unlock(&exporter->mutex);
+    send_all(fd, response, exporter->response_size);
+}
+
+int main(int argc, char** argv)
+{
+    int port = DEFAULT_PORT;
+    const char* path = NULL;
+    long interval_ms = DEFAULT_INTERVAL_MS;
+    const char* source_name = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "p:u:i:s:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 'u':
+            path = optarg;
+            break;
+        case 'i':
+            interval_ms = strtol(optarg, NULL, 10);
+            break;
+        case 's':
+            source_name = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (interval_ms <= 0 || port <= 0 || port > 65535)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    struct exporter exporter = { .nr_counters = 0 };
+    pthread_mutex_init(&exporter.mutex, NULL);
+    x86_energy_session_t* session = x86_energy_session_create();
+    x86_energy_access_source_t* source = NULL;
+    if (session != NULL)
+        source = x86_energy_session_init_source(session, source_name);
+    if (source == NULL || setup(&exporter, session, source) != 0)
+    {
+        fprintf(stderr, "x86_energy-exporter: energy cannot be measured: %s\n",
+                x86_energy_error_string());
+        x86_energy_session_destroy(session);
+        return 1;
+    }
+
+    int fd = path != NULL ? listen_unix(path) : listen_tcp(port);
+    if (fd < 0)
+    {
+        fprintf(stderr, "x86_energy-exporter: cannot listen: %s\n", strerror(errno));
+        x86_energy_session_destroy(session);
+        return 1;
+    }
+    char* response = malloc(exporter.response_size);
+    if (response == NULL ||
+        x86_energy_session_start_sampling(session, interval_ms * 1000, on_sample, &exporter) != 0)
+    {
+        fprintf(stderr, "x86_energy-exporter: cannot start sampling: %s\n",
+                x86_energy_error_string());
+        close(fd);
+        x86_energy_session_destroy(session);
+        return 1;
+    }
+    /* the first copy is always made */
+    uint64_t generation = UINT64_MAX;
+
+    struct sigaction action = { .sa_handler = on_signal };
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    while (!stop)
+    {
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        if (poll(&pfd, 1, POLL_TIMEOUT_MS) <= 0)
+            continue;
+        int client = accept4(fd, NULL, NULL, SOCK_CLOEXEC);
+        if (client < 0)
+            continue;
+        serve(&exporter, client, response, &generation);
+        close(client);
+    }
+
+    close(fd);
+    if (path != NULL)
+        unlink(path);
+    x86_energy_session_stop_sampling(session);
+    x86_energy_session_destroy(session);
+    pthread_mutex_destroy(&exporter.mutex);
+    free(response);
+    free(exporter.response);
+    free(exporter.energy_offsets);
+    free(exporter.power_offsets);
+    free(exporter.start);
+    free(exporter.previous);
+    return 0;
+}
@@ -0,0 +1,405 @@
+/*
+ * x86_energy-stat.c
+ *
+ * Measures the energy consumption of a command
+ *
+ *  Created on: 19.10.2026
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <x86_energy.h>
+
+/* sampling period used for peak power if no interval is given */
+#define DEFAULT_PERIOD_MS 100
+
+/* number of reads used to find the cheapest source */
+#define PROBE_READS 32
+
+struct domain
+{
+    enum x86_energy_counter counter;
+    enum x86_energy_granularity granularity;
+    size_t index; /* id of the node */
+};
+
+struct stat_state
+{
+    FILE* out;
+    bool print_intervals;
+    size_t nr_domains;
+    struct domain* domains;
+
+    /* shorter intervals are skipped, their power would be imprecise */
+    uint64_t min_interval_ns;
+
+    uint64_t start_time;
+    double* start;
+    uint64_t previous_time;
+    double* previous;
+    double* peak;
+};
+
+static pid_t child = -1;
+
+static void usage(const char* name)
+{
+    fprintf(stderr,
+            "Usage: %s [-I MS] [-s SOURCE] [-o FILE] -- COMMAND [ARGS...]\n"
+            "\n"
+            "Runs COMMAND and reports the energy consumed during its lifetime.\n"
+            "  -I MS      print the power of every interval of MS milliseconds\n"
+            "  -s SOURCE  use SOURCE instead of the cheapest available source\n"
+            "  -o FILE    write the report to FILE instead of stderr\n",
+            name);
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static double cpu_time(void)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+           (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+/* returns the cost of reading the package counter of a source in ns, < 0 if it is not usable */
+static double probe_source(const char* name, enum x86_energy_counter counter)
+{
+    x86_energy_session_t* session = x86_energy_session_create();
+    if (session == NULL)
+        return -1.0;
+    double cost = -1.0;
+    x86_energy_access_source_t* source = x86_energy_session_init_source(session, name);
+    if (source != NULL && x86_energy_session_add_counter(session, source, counter, 0) >= 0)
+    {
+        double value;
+        uint64_t start = now_ns();
+        int failed = 0;
+        for (int i = 0; i < PROBE_READS; i++)
+            failed += x86_energy_session_read(session, &value);
+        if (failed == 0)
+            cost = (double)(now_ns() - start) / PROBE_READS;
+    }
+    x86_energy_session_destroy(session);
+    return cost;
+}
+
+static const char* cheapest_source(x86_energy_mechanisms_t* mechanism)
+{
+    enum x86_energy_counter counter = X86_ENERGY_COUNTER_SIZE;
+    for (int i = 0; i < X86_ENERGY_COUNTER_SIZE && counter == X86_ENERGY_COUNTER_SIZE; i++)
+        if (mechanism->source_granularities[i] < X86_ENERGY_GRANULARITY_SIZE)
+            counter = i;
+    if (counter == X86_ENERGY_COUNTER_SIZE)
+        return NULL;
+
+    const char* best = NULL;
+    double best_cost = 0.0;
+    for (size_t i = 0; i < mechanism->nr_avail_sources; i++)
+    {
+        double cost = probe_source(mechanism->avail_sources[i].name, counter);
+        if (cost >= 0.0 && (best == NULL || cost < best_cost))
+        {
+            best = mechanism->avail_sources[i].name;
+            best_cost = cost;
+        }
+    }
+    return best;
+}
+
+/*
+ * adds the counter for every node of its granularity below node, passing the node id as index.
+ * Core ids repeat per socket and sources read the first core with an id, so repeated ids are
+ * skipped instead of reading that core twice.
+ */
+static void add_node_domains(x86_energy_session_t* session, x86_energy_access_source_t* source,
+                             enum x86_energy_counter counter, x86_energy_architecture_node_t* node,
+                             struct domain** domains, size_t* nr)
+{
+    enum x86_energy_granularity granularity =
+        x86_energy_session_get_mechanism(session)->source_granularities[counter];
+    if (node->granularity != granularity)
+    {
+        for (size_t i = 0; i < node->nr_children; i++)
+            add_node_domains(session, source, counter, &node->children[i], domains, nr);
+        return;
+    }
+    for (size_t i = 0; i < *nr; i++)
+        if ((*domains)[i].counter == counter && (*domains)[i].index == (size_t)node->id)
+            return;
+    struct domain* new_domains = realloc(*domains, (*nr + 1) * sizeof(struct domain));
+    if (new_domains == NULL)
+        return;
+    *domains = new_domains;
+    if (x86_energy_session_add_counter(session, source, counter, node->id) < 0)
+        return;
+    (*domains)[*nr].counter = counter;
+    (*domains)[*nr].granularity = granularity;
+    (*domains)[*nr].index = node->id;
+    (*nr)++;
+}
+
+/* adds all supported counters per socket (or core, ...), returns the number of domains */
+static size_t add_domains(x86_energy_session_t* session, x86_energy_access_source_t* source,
+                          struct domain** domains)
+{
+    x86_energy_mechanisms_t* mechanism = x86_energy_session_get_mechanism(session);
+    x86_energy_architecture_node_t* arch = x86_energy_session_get_architecture(session);
+    size_t nr = 0;
+    for (int counter = 0; counter < X86_ENERGY_COUNTER_SIZE; counter++)
+    {
+        if (mechanism->source_granularities[counter] >= X86_ENERGY_GRANULARITY_SIZE)
+            continue;
+        add_node_domains(session, source, counter, arch, domains, &nr);
+    }
+    return nr;
+}
+
+static void print_interval(struct stat_state* state, uint64_t time_ns, const double* values)
+{
+    double seconds = (time_ns - state->previous_time) / 1e9;
+    for (size_t i = 0; i < state->nr_domains; i++)
+    {
+        if (values[i] < 0.0 || state->previous[i] < 0.0)
+            continue;
+        /* throttle counters count seconds, their rate is the throttled share of the interval */
+        bool energy = x86_energy_counter_is_energy(state->domains[i].counter);
+        double rate = (values[i] - state->previous[i]) / seconds;
+        fprintf(state->out, "%12.3f %-14s %-8s %4zu %12.3f %s\n",
+                (time_ns - state->start_time) / 1e9,
+                x86_energy_counter_name(state->domains[i].counter),
+                x86_energy_granularity_name(state->domains[i].granularity),
+                state->domains[i].index, energy ? rate : 100.0 * rate, energy ? "W" : "%");
+    }
+}
+
+/* called by the sampling thread of the session and for the final sample */
+static void on_sample(uint64_t time_ns, size_t nr, const double* values, void* arg)
+{
+    struct stat_state* state = arg;
+    if (time_ns <= state->previous_time || time_ns - state->previous_time < state->min_interval_ns)
+        return;
+    double seconds = (time_ns - state->previous_time) / 1e9;
+    for (size_t i = 0; i < nr && i < state->nr_domains; i++)
+    {
+        if (values[i] < 0.0 || state->previous[i] < 0.0)
+            continue;
+        double power = (values[i] - state->previous[i]) / seconds;
+        if (power > state->peak[i])
+            state->peak[i] = power;
+    }
+    if (state->print_intervals)
+        print_interval(state, time_ns, values);
+    memcpy(state->previous, values, state->nr_domains * sizeof(double));
+    state->previous_time = time_ns;
+}
+
+static void print_report(struct stat_state* state, char** command, const char* source,
+                         uint64_t end_time, const double* end, double overhead)
+{
+    double seconds = (end_time - state->start_time) / 1e9;
+    fprintf(state->out, "\n Energy counter stats for '");
+    for (char** arg = command; *arg != NULL; arg++)
+        fprintf(state->out, "%s%s", arg == command ? "" : " ", *arg);
+    fprintf(state->out, "':\n\n");
+    for (size_t i = 0; i < state->nr_domains; i++)
+    {
+        const char* counter = x86_energy_counter_name(state->domains[i].counter);
+        const char* granularity = x86_energy_granularity_name(state->domains[i].granularity);
+        if (end[i] < 0.0 || state->start[i] < 0.0)
+        {
+            fprintf(state->out, "  %16s    %-14s %-8s %4zu  (could not be read)\n", "-", counter,
+                    granularity, state->domains[i].index);
+            continue;
+        }
+        double delta = end[i] - state->start[i];
+        if (x86_energy_counter_is_energy(state->domains[i].counter))
+            fprintf(state->out, "  %16.3f J  %-14s %-8s %4zu  avg %10.3f W  peak %10.3f W\n",
+                    delta, counter, granularity, state->domains[i].index, delta / seconds,
+                    state->peak[i]);
+        else
+            fprintf(state->out, "  %16.3f s  %-14s %-8s %4zu  avg %10.3f %%  peak %10.3f %%\n",
+                    delta, counter, granularity, state->domains[i].index,
+                    100.0 * delta / seconds, 100.0 * state->peak[i]);
+    }
+    fprintf(state->out, "\n  %16.6f seconds time elapsed\n", seconds);
+    fprintf(state->out, "  source %s, measurement overhead %.3f ms CPU time (%.3f %%)\n\n", source,
+            overhead * 1e3, seconds > 0.0 ? overhead / seconds * 100.0 : 0.0);
+}
+
+static void forward_signal(int signal)
+{
+    if (child > 0)
+        kill(child, signal);
+}
+
+static int wait_for_child(void)
+{
+    int status;
+    while (waitpid(child, &status, 0) < 0)
+    {
+        if (errno != EINTR)
+            return 127;
+    }
+    if (WIFEXITED(status))
+        return WEXITSTATUS(status);
+    if (WIFSIGNALED(status))
+        return 128 + WTERMSIG(status);
+    return 1;
+}
+
+static int run_command(char** command)
+{
+    /* terminal signals reach the child directly, others are forwarded */
+    struct sigaction action = { .sa_handler = forward_signal };
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGTERM, &action, NULL);
+    sigaction(SIGHUP, &action, NULL);
+    sigaction(SIGUSR1, &action, NULL);
+    sigaction(SIGUSR2, &action, NULL);
+    signal(SIGINT, SIG_IGN);
+    signal(SIGQUIT, SIG_IGN);
+
+    child = fork();
+    if (child < 0)
+    {
+        perror("fork");
+        return 127;
+    }
+    if (child == 0)
+    {
+        signal(SIGINT, SIG_DFL);
+        signal(SIGQUIT, SIG_DFL);
+        execvp(command[0], command);
+        fprintf(stderr, "%s: %s\n", command[0], strerror(errno));
+        _exit(127);
+    }
+    return wait_for_child();
+}
+
+int main(int argc, char** argv)
+{
+    long interval_ms = 0;
+    const char* source_name = NULL;
+    const char* output = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "+I:s:o:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'I':
+            interval_ms = strtol(optarg, NULL, 10);
+            if (interval_ms <= 0)
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 's':
+            source_name = optarg;
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind >= argc)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    char** command = &argv[optind];
+
+    FILE* out = stderr;
+    if (output != NULL && (out = fopen(output, "w")) == NULL)
+    {
+        perror(output);
+        return 1;
+    }
+
+    /* the command is run even if energy cannot be measured */
+    double cpu_start = cpu_time();
+    struct stat_state state = { .out = out, .print_intervals = interval_ms > 0 };
+    x86_energy_session_t* session = x86_energy_session_create();
+    x86_energy_access_source_t* source = NULL;
+    if (session != NULL)
+    {
+        if (source_name == NULL)
+            source_name = cheapest_source(x86_energy_session_get_mechanism(session));
+        if (source_name != NULL)
+            source = x86_energy_session_init_source(session, source_name);
+    }
+    if (source != NULL)
+        state.nr_domains = add_domains(session, source, &state.domains);
+    if (state.nr_domains > 0)
+    {
+        state.start = malloc(state.nr_domains * sizeof(double));
+        state.previous = malloc(state.nr_domains * sizeof(double));
+        state.peak = calloc(state.nr_domains, sizeof(double));
+        if (state.start == NULL || state.previous == NULL || state.peak == NULL)
+            state.nr_domains = 0;
+    }
+    if (state.nr_domains > 0)
+    {
+        state.start_time = state.previous_time = now_ns();
+        x86_energy_session_read(session, state.start);
+        memcpy(state.previous, state.start, state.nr_domains * sizeof(double));
+        long long period_us = (interval_ms ? interval_ms : DEFAULT_PERIOD_MS) * 1000LL;
+        state.min_interval_ns = period_us * 500;
+        if (x86_energy_session_start_sampling(session, period_us, on_sample, &state) != 0)
+            fprintf(stderr, "x86_energy-stat: no peak power: %s\n", x86_energy_error_string());
+    }
+    else
+    {
+        fprintf(stderr, "x86_energy-stat: energy cannot be measured: %s\n",
+                x86_energy_error_string());
+    }
+
+    int ret = run_command(command);
+
+    if (state.nr_domains > 0)
+    {
+        x86_energy_session_stop_sampling(session);
+        double* end = malloc(state.nr_domains * sizeof(double));
+        if (end != NULL)
+        {
+            uint64_t end_time = now_ns();
+            x86_energy_session_read(session, end);
+            state.min_interval_ns = 0;
+            on_sample(end_time, state.nr_domains, end, &state);
+            /* the CPU time of this process is spent on setup, sampling and overflow threads */
+            print_report(&state, command, source_name, end_time, end, cpu_time() - cpu_start);
+            free(end);
+        }
+    }
+    x86_energy_session_destroy(session);
+    free(state.domains);
+    free(state.start);
+    free(state.previous);
+    free(state.peak);
+    if (out != stderr)
+        fclose(out);
+    return ret;
+}
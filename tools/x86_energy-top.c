@@ -0,0 +1,493 @@
+/*
+ * x86_energy-top.c
+ *
+ * Shows the power of all nodes of the architecture tree live
+ *
+ *  Created on: 19.10.2026
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <x86_energy.h>
+
+#define MIN_INTERVAL_MS 50
+#define DEFAULT_INTERVAL_MS 1000
+
+#define LABEL_WIDTH 32
+#define CELL_WIDTH 12
+
+/* a line of the display, for each shown node of the architecture */
+struct row
+{
+    x86_energy_architecture_node_t* node;
+    int depth;
+    /* for each column, the counter slots that are summed up */
+    size_t* nr_slots;
+    size_t** slots;
+};
+
+struct top
+{
+    x86_energy_session_t* session;
+    const char* source;
+    long interval_ms;
+    bool ansi;
+
+    size_t nr_columns;
+    enum x86_energy_counter columns[X86_ENERGY_COUNTER_SIZE];
+
+    size_t nr_rows;
+    struct row* rows;
+
+    /* counter slots */
+    size_t nr_counters;
+    x86_energy_architecture_node_t** counter_nodes;
+    enum x86_energy_counter* counter_types;
+    double* previous;
+    double* current;
+    double* power;
+
+    /* what is on the screen, for incremental redraws */
+    char (*cells)[CELL_WIDTH + 1];
+    int screen_rows;
+    bool redraw;
+
+    /* output is collected and written at once */
+    char* out;
+    size_t out_size;
+    size_t out_capacity;
+};
+
+static volatile sig_atomic_t stop;
+static volatile sig_atomic_t resized;
+static struct termios saved_termios;
+static bool termios_saved;
+
+static void usage(const char* name)
+{
+    fprintf(stderr,
+            "Usage: %s [-d MS] [-n ITERATIONS] [-s SOURCE]\n"
+            "\n"
+            "Shows the power of each socket, die, module and core, press q to quit.\n"
+            "  -d MS          refresh every MS milliseconds (default %d, at least %d)\n"
+            "  -n ITERATIONS  stop after ITERATIONS refreshes\n"
+            "  -s SOURCE      use SOURCE instead of the first available source\n",
+            name, DEFAULT_INTERVAL_MS, MIN_INTERVAL_MS);
+}
+
+static void on_signal(int signal)
+{
+    if (signal == SIGWINCH)
+        resized = 1;
+    else
+        stop = 1;
+}
+
+static void restore_terminal(void)
+{
+    if (termios_saved)
+        tcsetattr(STDIN_FILENO, TCSANOW, &saved_termios);
+}
+
+static void setup_terminal(void)
+{
+    if (!isatty(STDIN_FILENO) || tcgetattr(STDIN_FILENO, &saved_termios) != 0)
+        return;
+    termios_saved = true;
+    atexit(restore_terminal);
+    struct termios raw = saved_termios;
+    raw.c_lflag &= ~(ICANON | ECHO);
+    raw.c_cc[VMIN] = 0;
+    raw.c_cc[VTIME] = 0;
+    tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void append(struct top* top, const char* format, ...)
+{
+    va_list args;
+    while (true)
+    {
+        va_start(args, format);
+        int len = vsnprintf(top->out + top->out_size, top->out_capacity - top->out_size, format,
+                            args);
+        va_end(args);
+        if (len < 0)
+            return;
+        if (top->out_size + len < top->out_capacity)
+        {
+            top->out_size += len;
+            return;
+        }
+        size_t capacity = 2 * (top->out_capacity + len);
+        char* out = realloc(top->out, capacity);
+        if (out == NULL)
+            return;
+        top->out = out;
+        top->out_capacity = capacity;
+    }
+}
+
+static void flush_output(struct top* top)
+{
+    const char* pos = top->out;
+    while (top->out_size > 0)
+    {
+        ssize_t written = write(STDOUT_FILENO, pos, top->out_size);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            break;
+        pos += written;
+        top->out_size -= written;
+    }
+    top->out_size = 0;
+}
+
+static int add_slot(struct row* row, size_t column, size_t slot)
+{
+    size_t* slots = realloc(row->slots[column], (row->nr_slots[column] + 1) * sizeof(size_t));
+    if (slots == NULL)
+        return 1;
+    slots[row->nr_slots[column]++] = slot;
+    row->slots[column] = slots;
+    return 0;
+}
+
+static bool is_descendant(x86_energy_architecture_node_t* ancestor,
+                          x86_energy_architecture_node_t* node)
+{
+    if (ancestor == node)
+        return true;
+    for (size_t i = 0; i < ancestor->nr_children; i++)
+        if (is_descendant(&ancestor->children[i], node))
+            return true;
+    return false;
+}
+
+static int add_rows(struct top* top, x86_energy_architecture_node_t* node, int depth)
+{
+    if (node->granularity >= X86_ENERGY_GRANULARITY_THREAD)
+        return 0;
+    struct row* rows = realloc(top->rows, (top->nr_rows + 1) * sizeof(struct row));
+    if (rows == NULL)
+        return 1;
+    top->rows = rows;
+    struct row* row = &top->rows[top->nr_rows++];
+    row->node = node;
+    row->depth = depth;
+    row->nr_slots = calloc(top->nr_columns, sizeof(size_t));
+    row->slots = calloc(top->nr_columns, sizeof(size_t*));
+    if (row->nr_slots == NULL || row->slots == NULL)
+        return 1;
+    for (size_t i = 0; i < node->nr_children; i++)
+        if (add_rows(top, &node->children[i], depth + 1) != 0)
+            return 1;
+    return 0;
+}
+
+/*
+ * returns whether a counter of the current column was added for id since first_slot. Core ids
+ * repeat per socket and sources read the first core with an id, so the cores of other sockets
+ * with that id are left empty instead of showing the same core twice.
+ */
+static bool is_added(struct top* top, size_t first_slot, int32_t id)
+{
+    for (size_t slot = first_slot; slot < top->nr_counters; slot++)
+        if (top->counter_nodes[slot]->id == id)
+            return true;
+    return false;
+}
+
+/* adds all counters and the rows they are shown in */
+static int setup_counters(struct top* top, x86_energy_access_source_t* source)
+{
+    x86_energy_mechanisms_t* mechanism = x86_energy_session_get_mechanism(top->session);
+    x86_energy_architecture_node_t* arch = x86_energy_session_get_architecture(top->session);
+
+    /* columns show power, throttle counters are left out */
+    for (int counter = 0; counter < X86_ENERGY_COUNTER_SIZE; counter++)
+        if (mechanism->source_granularities[counter] < X86_ENERGY_GRANULARITY_THREAD &&
+            x86_energy_counter_is_energy(counter))
+            top->columns[top->nr_columns++] = counter;
+    if (add_rows(top, arch, 0) != 0)
+        return 1;
+
+    for (size_t column = 0; column < top->nr_columns; column++)
+    {
+        enum x86_energy_counter counter = top->columns[column];
+        enum x86_energy_granularity granularity = mechanism->source_granularities[counter];
+        size_t first_slot = top->nr_counters;
+        for (size_t r = 0; r < top->nr_rows; r++)
+        {
+            x86_energy_architecture_node_t* node = top->rows[r].node;
+            if (node->granularity != granularity || is_added(top, first_slot, node->id))
+                continue;
+            if (x86_energy_session_add_counter(top->session, source, counter, node->id) < 0)
+                continue;
+            size_t slot = top->nr_counters++;
+            x86_energy_architecture_node_t** nodes =
+                realloc(top->counter_nodes, top->nr_counters * sizeof(*nodes));
+            if (nodes == NULL)
+                return 1;
+            top->counter_nodes = nodes;
+            top->counter_nodes[slot] = node;
+
+            /* shown in the row of the node and summed up in all coarser rows above it */
+            for (size_t above = 0; above < top->nr_rows; above++)
+                if (top->rows[above].node->granularity <= granularity &&
+                    is_descendant(top->rows[above].node, node) &&
+                    add_slot(&top->rows[above], column, slot) != 0)
+                    return 1;
+        }
+    }
+    if (top->nr_counters == 0)
+        return 1;
+
+    top->previous = malloc(top->nr_counters * sizeof(double));
+    top->current = malloc(top->nr_counters * sizeof(double));
+    top->power = malloc(top->nr_counters * sizeof(double));
+    top->cells = calloc(top->nr_rows * top->nr_columns, sizeof(*top->cells));
+    return top->previous == NULL || top->current == NULL || top->power == NULL ||
+           top->cells == NULL;
+}
+
+static int terminal_rows(void)
+{
+    struct winsize size;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) != 0 || size.ws_row == 0)
+        return 24;
+    return size.ws_row;
+}
+
+static void format_cell(struct top* top, const struct row* row, size_t column, char* cell)
+{
+    if (row->nr_slots[column] == 0)
+    {
+        snprintf(cell, CELL_WIDTH + 1, "%*s", CELL_WIDTH, "");
+        return;
+    }
+    double sum = 0.0;
+    for (size_t i = 0; i < row->nr_slots[column]; i++)
+    {
+        double power = top->power[row->slots[column][i]];
+        if (power < 0.0)
+        {
+            snprintf(cell, CELL_WIDTH + 1, "%*s", CELL_WIDTH, "-");
+            return;
+        }
+        sum += power;
+    }
+    snprintf(cell, CELL_WIDTH + 1, "%*.2f", CELL_WIDTH, sum);
+}
+
+static void draw_static(struct top* top)
+{
+    x86_energy_mechanisms_t* mechanism = x86_energy_session_get_mechanism(top->session);
+    top->screen_rows = terminal_rows();
+    if (top->ansi)
+        append(top, "\033[H\033[2J");
+    append(top, "x86_energy-top - %s via %s, every %ld ms%s\n", mechanism->name, top->source,
+           top->interval_ms, top->ansi ? ", q to quit" : "");
+    append(top, "%-*s", LABEL_WIDTH, "Node");
+    for (size_t column = 0; column < top->nr_columns; column++)
+        append(top, "%*s", CELL_WIDTH, x86_energy_counter_name(top->columns[column]));
+    append(top, "\n");
+    for (size_t r = 0; r < top->nr_rows; r++)
+    {
+        /* title and header take two lines, keep the last line free */
+        if (top->ansi && (int)r + 3 >= top->screen_rows)
+            break;
+        const struct row* row = &top->rows[r];
+        char label[LABEL_WIDTH + 1];
+        snprintf(label, sizeof(label), "%*s%s %s", 2 * row->depth, "",
+                 x86_energy_granularity_name(row->node->granularity), row->node->name);
+        append(top, "%-*s", LABEL_WIDTH, label);
+        if (!top->ansi)
+        {
+            char cell[CELL_WIDTH + 1];
+            for (size_t column = 0; column < top->nr_columns; column++)
+            {
+                format_cell(top, row, column, cell);
+                append(top, "%s", cell);
+            }
+        }
+        append(top, "\n");
+    }
+    /* all cells have to be drawn again */
+    memset(top->cells, 0, top->nr_rows * top->nr_columns * sizeof(*top->cells));
+}
+
+/* only writes the cells whose text changed */
+static void draw_values(struct top* top)
+{
+    char cell[CELL_WIDTH + 1];
+    for (size_t r = 0; r < top->nr_rows && (int)r + 3 < top->screen_rows; r++)
+    {
+        for (size_t column = 0; column < top->nr_columns; column++)
+        {
+            format_cell(top, &top->rows[r], column, cell);
+            char* shown = top->cells[r * top->nr_columns + column];
+            if (strcmp(cell, shown) == 0)
+                continue;
+            append(top, "\033[%zu;%zuH%s", r + 3, LABEL_WIDTH + column * CELL_WIDTH + 1, cell);
+            memcpy(shown, cell, sizeof(cell));
+        }
+    }
+    append(top, "\033[%d;1H", top->screen_rows);
+}
+
+/* waits until deadline, returns false if the user wants to quit */
+static bool wait_until(uint64_t deadline)
+{
+    while (!stop && !resized)
+    {
+        uint64_t now = now_ns();
+        if (now >= deadline)
+            return true;
+        struct pollfd fd = { .fd = STDIN_FILENO, .events = POLLIN };
+        int timeout = (deadline - now + 999999) / 1000000;
+        if (poll(&fd, termios_saved ? 1 : 0, timeout) > 0)
+        {
+            char c;
+            if (read(STDIN_FILENO, &c, 1) == 1 && (c == 'q' || c == 'Q'))
+                return false;
+        }
+    }
+    return !stop;
+}
+
+int main(int argc, char** argv)
+{
+    struct top top = { .interval_ms = DEFAULT_INTERVAL_MS };
+    long iterations = -1;
+    const char* source_name = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "d:n:s:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'd':
+            top.interval_ms = strtol(optarg, NULL, 10);
+            if (top.interval_ms < MIN_INTERVAL_MS)
+                top.interval_ms = MIN_INTERVAL_MS;
+            break;
+        case 'n':
+            iterations = strtol(optarg, NULL, 10);
+            break;
+        case 's':
+            source_name = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    top.session = x86_energy_session_create();
+    x86_energy_access_source_t* source = NULL;
+    if (top.session != NULL)
+        source = x86_energy_session_init_source(top.session, source_name);
+    if (source == NULL || setup_counters(&top, source) != 0)
+    {
+        fprintf(stderr, "x86_energy-top: energy cannot be measured: %s\n",
+                x86_energy_error_string());
+        x86_energy_session_destroy(top.session);
+        return 1;
+    }
+    top.source = source->name;
+    top.ansi = isatty(STDOUT_FILENO);
+
+    struct sigaction action = { .sa_handler = on_signal };
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    sigaction(SIGWINCH, &action, NULL);
+    if (top.ansi)
+    {
+        setup_terminal();
+        /* hide the cursor */
+        append(&top, "\033[?25l");
+    }
+
+    uint64_t previous_time = now_ns();
+    x86_energy_session_read(top.session, top.previous);
+    uint64_t deadline = previous_time;
+    top.redraw = true;
+    for (long i = 0; iterations < 0 || i < iterations; i++)
+    {
+        deadline += top.interval_ms * 1000000ULL;
+        if (!wait_until(deadline))
+            break;
+        if (resized)
+        {
+            resized = 0;
+            top.redraw = true;
+            deadline = now_ns();
+        }
+
+        uint64_t time = now_ns();
+        x86_energy_session_read(top.session, top.current);
+        double seconds = (time - previous_time) / 1e9;
+        for (size_t c = 0; c < top.nr_counters; c++)
+            top.power[c] = top.current[c] < 0.0 || top.previous[c] < 0.0 ?
+                               -1.0 :
+                               (top.current[c] - top.previous[c]) / seconds;
+        double* swap = top.previous;
+        top.previous = top.current;
+        top.current = swap;
+        previous_time = time;
+
+        if (!top.ansi || top.redraw)
+            draw_static(&top);
+        if (top.ansi)
+            draw_values(&top);
+        top.redraw = false;
+        flush_output(&top);
+    }
+
+    if (top.ansi)
+    {
+        append(&top, "\033[?25h\n");
+        flush_output(&top);
+    }
+    restore_terminal();
+    termios_saved = false;
+
+    x86_energy_session_destroy(top.session);
+    for (size_t r = 0; r < top.nr_rows; r++)
+    {
+        for (size_t column = 0; column < top.nr_columns; column++)
+            free(top.rows[r].slots[column]);
+        free(top.rows[r].slots);
+        free(top.rows[r].nr_slots);
+    }
+    free(top.rows);
+    free(top.counter_nodes);
+    free(top.previous);
+    free(top.current);
+    free(top.power);
+    free(top.cells);
+    free(top.out);
+    return 0;
+}
@@ -0,0 +1,288 @@
+/*
+ * x86_energy-trace.c
+ *
+ * Converts energy traces to and from CSV
+ *
+ *  Created on: 19.10.2026
+ */
+
+#define _GNU_SOURCE
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <x86_energy.h>
+#include <x86_energy_trace.h>
+
+static void usage(const char* name)
+{
+    fprintf(stderr,
+            "Usage: %s info TRACE\n"
+            "       %s to-csv TRACE\n"
+            "       %s from-csv [-u UNIT] CSV TRACE\n"
+            "\n"
+            "CSV files have a header line \"time_ns,SOURCE/COUNTER/INDEX,...\" and one line per "
+            "sample,\nwith values in Joules. Empty values mark samples that could not be read.\n"
+            "UNIT is the resolution in Joules used when converting to a trace (default 1e-6).\n",
+            name, name, name);
+}
+
+static const char* counter_name(enum x86_energy_counter counter)
+{
+    const char* name = x86_energy_counter_name(counter);
+    return name != NULL ? name : "INVALID";
+}
+
+static int parse_counter(const char* name, enum x86_energy_counter* counter)
+{
+    for (int i = 0; i < X86_ENERGY_COUNTER_SIZE; i++)
+    {
+        if (strcmp(name, x86_energy_counter_name(i)) == 0)
+        {
+            *counter = i;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int info(const char* file)
+{
+    x86_energy_trace_reader_t* reader = x86_energy_trace_open(file);
+    if (reader == NULL)
+    {
+        fprintf(stderr, "%s\n", x86_energy_error_string());
+        return 1;
+    }
+    size_t nr_counters = x86_energy_trace_nr_counters(reader);
+    printf("Counters: %zu\n", nr_counters);
+    for (size_t i = 0; i < nr_counters; i++)
+    {
+        const struct x86_energy_trace_counter* counter = x86_energy_trace_get_counter(reader, i);
+        printf("  %s/%s/%" PRIu32 " unit %g J width %" PRIu32 "\n", counter->source,
+               counter_name(counter->counter), counter->index, counter->unit,
+               counter->width);
+    }
+
+    size_t nr_chunks = x86_energy_trace_nr_chunks(reader);
+    size_t nr_samples = 0;
+    struct x86_energy_trace_chunk_info first, last, chunk;
+    for (size_t i = 0; i < nr_chunks; i++)
+    {
+        x86_energy_trace_get_chunk_info(reader, i, &chunk);
+        nr_samples += chunk.nr_samples;
+    }
+    printf("Chunks: %zu\nSamples: %zu\n", nr_chunks, nr_samples);
+    if (nr_chunks > 0)
+    {
+        x86_energy_trace_get_chunk_info(reader, 0, &first);
+        x86_energy_trace_get_chunk_info(reader, nr_chunks - 1, &last);
+        printf("Time: %" PRIu64 " - %" PRIu64 " ns\n", first.first_time_ns, last.last_time_ns);
+    }
+
+    x86_energy_architecture_node_t* arch = x86_energy_trace_get_architecture(reader);
+    if (arch != NULL)
+    {
+        printf("Architecture:\n");
+        x86_energy_print(arch, 1);
+    }
+    x86_energy_trace_close(reader);
+    return 0;
+}
+
+static int to_csv(const char* file)
+{
+    x86_energy_trace_reader_t* reader = x86_energy_trace_open(file);
+    if (reader == NULL)
+    {
+        fprintf(stderr, "%s\n", x86_energy_error_string());
+        return 1;
+    }
+    size_t nr_counters = x86_energy_trace_nr_counters(reader);
+    printf("time_ns");
+    for (size_t i = 0; i < nr_counters; i++)
+    {
+        const struct x86_energy_trace_counter* counter = x86_energy_trace_get_counter(reader, i);
+        printf(",%s/%s/%" PRIu32, counter->source, counter_name(counter->counter),
+               counter->index);
+    }
+    printf("\n");
+
+    int ret = 0;
+    uint64_t* times = NULL;
+    double* values = NULL;
+    size_t capacity = 0;
+    for (size_t chunk = 0; chunk < x86_energy_trace_nr_chunks(reader) && ret == 0; chunk++)
+    {
+        struct x86_energy_trace_chunk_info info;
+        x86_energy_trace_get_chunk_info(reader, chunk, &info);
+        if (info.nr_samples > capacity)
+        {
+            capacity = info.nr_samples;
+            free(times);
+            free(values);
+            times = malloc(capacity * sizeof(uint64_t));
+            values = malloc(capacity * (nr_counters ? nr_counters : 1) * sizeof(double));
+            if (times == NULL || values == NULL)
+            {
+                fprintf(stderr, "Could not allocate memory\n");
+                ret = 1;
+                break;
+            }
+        }
+        ret = x86_energy_trace_read_times(reader, chunk, times);
+        for (size_t i = 0; i < nr_counters && ret == 0; i++)
+            ret = x86_energy_trace_read_values(reader, chunk, i, &values[i * info.nr_samples]);
+        if (ret != 0)
+        {
+            fprintf(stderr, "%s\n", x86_energy_error_string());
+            break;
+        }
+        for (size_t sample = 0; sample < info.nr_samples; sample++)
+        {
+            printf("%" PRIu64, times[sample]);
+            for (size_t i = 0; i < nr_counters; i++)
+            {
+                double value = values[i * info.nr_samples + sample];
+                if (value >= 0.0)
+                    printf(",%.15g", value);
+                else
+                    printf(",");
+            }
+            printf("\n");
+        }
+    }
+    free(times);
+    free(values);
+    x86_energy_trace_close(reader);
+    return ret;
+}
+
+static int from_csv(const char* csv_file, const char* trace_file, double unit)
+{
+    FILE* csv = fopen(csv_file, "r");
+    if (csv == NULL)
+    {
+        perror(csv_file);
+        return 1;
+    }
+
+    char* line = NULL;
+    size_t line_size = 0;
+    if (getline(&line, &line_size, csv) < 0 || strncmp(line, "time_ns", 7) != 0)
+    {
+        fprintf(stderr, "%s: missing header line\n", csv_file);
+        free(line);
+        fclose(csv);
+        return 1;
+    }
+
+    /* the header: time_ns,SOURCE/COUNTER/INDEX,... */
+    size_t nr_counters = 0;
+    struct x86_energy_trace_counter* counters = NULL;
+    line[strcspn(line, "\r\n")] = '\0';
+    char* save = NULL;
+    strtok_r(line, ",", &save);
+    for (char* column = strtok_r(NULL, ",", &save); column != NULL;
+         column = strtok_r(NULL, ",", &save))
+    {
+        char* index = strrchr(column, '/');
+        char* counter_name = NULL;
+        if (index != NULL)
+        {
+            *index++ = '\0';
+            counter_name = strrchr(column, '/');
+        }
+        struct x86_energy_trace_counter* new_counters =
+            realloc(counters, (nr_counters + 1) * sizeof(struct x86_energy_trace_counter));
+        if (counter_name == NULL || new_counters == NULL)
+        {
+            fprintf(stderr, "%s: invalid column %s\n", csv_file, column);
+            free(new_counters ? new_counters : counters);
+            free(line);
+            fclose(csv);
+            return 1;
+        }
+        counters = new_counters;
+        *counter_name++ = '\0';
+        struct x86_energy_trace_counter* counter = &counters[nr_counters++];
+        memset(counter, 0, sizeof(*counter));
+        if (parse_counter(counter_name, &counter->counter) != 0)
+            counter->counter = X86_ENERGY_COUNTER_SIZE;
+        counter->index = strtoul(index, NULL, 10);
+        counter->unit = unit;
+        counter->width = 64;
+        counter->source = strdup(column);
+    }
+
+    x86_energy_trace_writer_t* writer =
+        x86_energy_trace_writer_create(trace_file, NULL, nr_counters, counters, 0);
+    int ret = writer == NULL;
+    if (writer == NULL)
+        fprintf(stderr, "%s\n", x86_energy_error_string());
+
+    double* values = malloc((nr_counters ? nr_counters : 1) * sizeof(double));
+    for (size_t line_nr = 2; writer != NULL && getline(&line, &line_size, csv) >= 0; line_nr++)
+    {
+        char* pos = line;
+        char* end;
+        uint64_t time = strtoull(pos, &end, 10);
+        if (end == pos)
+        {
+            fprintf(stderr, "%s:%zu: invalid time\n", csv_file, line_nr);
+            ret = 1;
+            break;
+        }
+        pos = end;
+        for (size_t i = 0; i < nr_counters; i++)
+        {
+            if (*pos == ',')
+                pos++;
+            values[i] = strtod(pos, &end);
+            if (end == pos)
+                values[i] = -1.0;
+            pos = end;
+        }
+        /* the writer drops samples if it cannot keep up, so wait for it */
+        while (x86_energy_trace_writer_append(writer, time, values) != 0)
+            usleep(1000);
+    }
+    if (writer != NULL && x86_energy_trace_writer_close(writer) != 0)
+    {
+        fprintf(stderr, "%s\n", x86_energy_error_string());
+        ret = 1;
+    }
+
+    for (size_t i = 0; i < nr_counters; i++)
+        free((char*)counters[i].source);
+    free(counters);
+    free(values);
+    free(line);
+    fclose(csv);
+    return ret;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc == 3 && strcmp(argv[1], "info") == 0)
+        return info(argv[2]);
+    if (argc == 3 && strcmp(argv[1], "to-csv") == 0)
+        return to_csv(argv[2]);
+    if (argc >= 4 && strcmp(argv[1], "from-csv") == 0)
+    {
+        double unit = 1e-6;
+        int arg = 2;
+        if (strcmp(argv[arg], "-u") == 0 && argc == 6)
+        {
+            unit = strtod(argv[arg + 1], NULL);
+            arg += 2;
+        }
+        if (argc == arg + 2)
+            return from_csv(argv[arg], argv[arg + 1], unit);
+    }
+    usage(argv[0]);
+    return 1;
+}